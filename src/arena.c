@@ -0,0 +1,208 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdalign.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "context.h"
+#include "defines.h"
+
+#define ARENA_ALIGNMENT      alignof(max_align_t)
+#define ARENA_MAX_BLOCK_SIZE ((size_t)64 * 1024 * 1024)
+
+struct arena_block {
+    struct arena_block *prev;
+    size_t size; /* Capacity of data. */
+    size_t used; /* Bytes handed out from data. */
+    alignas(max_align_t) unsigned char data[];
+};
+
+struct arena {
+    const struct cegse_ctx *ctx;
+    struct arena_block *head; /* The block allocations are made from. */
+    size_t next_block_size;
+};
+
+static struct arena_block *arena_block_alloc(const struct cegse_ctx *ctx,
+                                             size_t size)
+{
+    struct arena_block *block;
+
+    if (size > SIZE_MAX - sizeof(*block)) {
+        return NULL;
+    }
+
+    block = cegse_malloc(ctx, sizeof(*block) + size);
+    if (block) {
+        block->prev = NULL;
+        block->size = size;
+        block->used = 0;
+    }
+
+    return block;
+}
+
+struct arena *arena_create(const struct cegse_ctx *ctx, size_t block_size)
+{
+    struct arena *arena;
+
+    ctx = cegse_ctx_or_default(ctx);
+
+    arena = cegse_malloc(ctx, sizeof(*arena));
+    if (!arena) {
+        return NULL;
+    }
+
+    arena->ctx = ctx;
+    arena->head = arena_block_alloc(ctx, block_size);
+    if (!arena->head) {
+        cegse_free(ctx, arena);
+        return NULL;
+    }
+
+    arena->next_block_size = MIN(block_size * 2, ARENA_MAX_BLOCK_SIZE);
+
+    return arena;
+}
+
+void arena_destroy(struct arena *arena)
+{
+    struct arena_block *block;
+
+    if (!arena) {
+        return;
+    }
+
+    while ((block = arena->head) != NULL) {
+        arena->head = block->prev;
+        cegse_free(arena->ctx, block);
+    }
+
+    cegse_free(arena->ctx, arena);
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_block *head = arena->head;
+    struct arena_block *block;
+    size_t aligned_size;
+
+    if (size > SIZE_MAX - ARENA_ALIGNMENT) {
+        return NULL;
+    }
+
+    aligned_size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+    if (aligned_size <= head->size - head->used) {
+        void *ptr = head->data + head->used;
+        head->used += aligned_size;
+        return ptr;
+    }
+
+    if (aligned_size > arena->next_block_size / 4) {
+        /*
+         * Too large to share a block. Give it a block of its own behind
+         * the head so that the space left in the head is not wasted.
+         */
+        block = arena_block_alloc(arena->ctx, aligned_size);
+        if (!block) {
+            return NULL;
+        }
+
+        block->used = aligned_size;
+        block->prev = head->prev;
+        head->prev = block;
+        return block->data;
+    }
+
+    block = arena_block_alloc(arena->ctx, arena->next_block_size);
+    if (!block) {
+        return NULL;
+    }
+
+    block->used = aligned_size;
+    block->prev = head;
+    arena->head = block;
+    arena->next_block_size =
+        MIN(arena->next_block_size * 2, ARENA_MAX_BLOCK_SIZE);
+
+    return block->data;
+}
+
+#ifdef COMPILE_WITH_UNIT_TESTS
+
+#define TEST_SUITE(TEST_CASE)                                                  \
+    TEST_CASE(arena_allocations)                                               \
+    TEST_CASE(arena_large_allocations)
+
+#include "unit_tests.h"
+
+UNIT_TEST(arena_allocations)
+{
+    struct arena *arena;
+    unsigned char *prev = NULL;
+
+    ASSERT_NOT_NULL(arena = arena_create(NULL, 256));
+
+    /* Zero sized allocations succeed too. */
+    ASSERT_NOT_NULL(arena_alloc(arena, 0));
+
+    for (int i = 0; i < 1000; ++i) {
+        unsigned char *ptr = arena_alloc(arena, (i % 37) + 1);
+
+        ASSERT_NOT_NULL(ptr);
+        ASSERT_EQ((uintptr_t)ptr % ARENA_ALIGNMENT, 0u);
+        ASSERT_NE_PTR(ptr, prev);
+
+        /* Memory is writable and not shared with earlier allocations. */
+        memset(ptr, i & 0xff, (i % 37) + 1);
+        if (prev) {
+            ASSERT_EQ(prev[0], (unsigned char)((i - 1) & 0xff));
+        }
+
+        prev = ptr;
+    }
+
+    arena_destroy(arena);
+}
+
+UNIT_TEST(arena_large_allocations)
+{
+    struct arena *arena;
+    unsigned char *small;
+    unsigned char *large;
+
+    ASSERT_NOT_NULL(arena = arena_create(NULL, 1024));
+
+    small = arena_alloc(arena, 16);
+    ASSERT_NOT_NULL(small);
+
+    /* Gets a block of its own, the head block keeps serving. */
+    large = arena_alloc(arena, 1024 * 1024);
+    ASSERT_NOT_NULL(large);
+    memset(large, 0xab, 1024 * 1024);
+
+    ASSERT_EQ_PTR(arena_alloc(arena, 16), small + ARENA_ALIGNMENT);
+
+    ASSERT_EQ_PTR(arena_alloc(arena, SIZE_MAX), NULL);
+
+    arena_destroy(arena);
+}
+
+#endif /* COMPILE_WITH_UNIT_TESTS */
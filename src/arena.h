@@ -0,0 +1,50 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef CEGSE_ARENA_H
+#define CEGSE_ARENA_H
+
+#include <stddef.h>
+
+struct cegse_ctx;
+
+/*
+ * A bump allocator. Memory is handed out from large blocks and is only
+ * released when the whole arena is destroyed.
+ */
+struct arena;
+
+/*
+ * Create an arena whose first block is block_size bytes. Later blocks
+ * grow in size. The arena and its blocks are allocated with the allocator
+ * of ctx, which must outlive the arena. Return NULL on failure.
+ */
+struct arena *arena_create(const struct cegse_ctx *ctx, size_t block_size);
+
+/*
+ * Destroy the arena and release all memory allocated from it.
+ */
+void arena_destroy(struct arena *arena);
+
+/*
+ * Allocate size bytes, suitably aligned for any type. The memory is not
+ * initialized. Return NULL on failure.
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+#endif /* CEGSE_ARENA_H */
@@ -0,0 +1,358 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * Batch mode of cegse: read many save files at once, each on one of a
+ * fixed number of worker threads.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "context.h"
+#include "defines.h"
+#include "savefile.h"
+
+struct file_list {
+    char **names;
+    size_t count;
+    size_t capacity;
+};
+
+struct batch {
+    const struct batch_options *options;
+    struct file_list files;
+    atomic_size_t next;   /* Index of the next file to take */
+    pthread_mutex_t lock; /* Guards the totals and the output. */
+    size_t n_failed;
+    size_t total_bytes;
+};
+
+static double seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int add_file(struct file_list *list, const char *name)
+{
+    char **names;
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? 2 * list->capacity : 64;
+
+        names = realloc(list->names, capacity * sizeof(*names));
+        if (!names) {
+            return -1;
+        }
+
+        list->names = names;
+        list->capacity = capacity;
+    }
+
+    if (!(list->names[list->count] = strdup(name))) {
+        return -1;
+    }
+
+    list->count++;
+    return 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Add the regular files in a directory in the order of their names.
+ */
+static int add_directory(struct file_list *list, const char *dirname)
+{
+    struct dirent *dirent;
+    size_t first = list->count;
+    int rc = 0;
+    DIR *dir;
+
+    dir = opendir(dirname);
+    if (!dir) {
+        perror(dirname);
+        return -1;
+    }
+
+    while (rc == 0 && (dirent = readdir(dir)) != NULL) {
+        char filename[4096];
+        struct stat statbuf;
+
+        snprintf(filename, sizeof(filename), "%s/%s", dirname, dirent->d_name);
+        if (stat(filename, &statbuf) == 0 && S_ISREG(statbuf.st_mode)) {
+            rc = add_file(list, filename);
+        }
+    }
+
+    closedir(dir);
+
+    qsort(list->names + first, list->count - first, sizeof(*list->names),
+          compare_names);
+    return rc;
+}
+
+static int add_path(struct file_list *list, const char *path)
+{
+    struct stat statbuf;
+
+    if (stat(path, &statbuf) == 0 && S_ISDIR(statbuf.st_mode)) {
+        return add_directory(list, path);
+    }
+
+    /* Anything else fails when it is read. */
+    return add_file(list, path);
+}
+
+static int add_listed_paths(struct file_list *list, const char *list_filename)
+{
+    char line[4096];
+    FILE *stream;
+    int rc = 0;
+
+    if (strcmp(list_filename, "-") == 0) {
+        stream = stdin;
+    }
+    else if (!(stream = fopen(list_filename, "r"))) {
+        perror(list_filename);
+        return -1;
+    }
+
+    while (rc == 0 && fgets(line, sizeof(line), stream)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0') {
+            rc = add_path(list, line);
+        }
+    }
+
+    if (stream != stdin) {
+        fclose(stream);
+    }
+
+    return rc;
+}
+
+/*
+ * Read a save file and optionally write it back. On failure, return a
+ * description of what failed and set *errnum to errno if a system call
+ * failed. strerror() is not thread-safe, so the caller formats errnum.
+ */
+static const char *process_file(const struct cegse_ctx *ctx,
+                                const struct batch_options *options,
+                                const char *filename, size_t *file_size,
+                                int *errnum)
+{
+    const char *failure = NULL;
+    struct savegame *save;
+    unsigned char *written;
+    size_t written_size;
+    struct stat statbuf;
+    void *file;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        *errnum = errno;
+        return "cannot open file";
+    }
+
+    if (fstat(fd, &statbuf) == -1 || statbuf.st_size == 0) {
+        close(fd);
+        return "cannot map file";
+    }
+
+    *file_size = statbuf.st_size;
+    file = mmap(NULL, *file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        return "cannot map file";
+    }
+
+    if (options->scan_only) {
+        struct savefile_scan scan;
+
+        if (cengine_savefile_scan(ctx, file, *file_size, &scan) == -1) {
+            failure = "scan failed";
+        }
+        else {
+            savefile_scan_free(&scan);
+        }
+
+        goto out;
+    }
+
+    save = cengine_savefile_read_mem(ctx, file, *file_size, NULL);
+    if (!save) {
+        failure = "read failed";
+        goto out;
+    }
+
+    if (options->write_back) {
+        written = cengine_savefile_write_mem(save, NULL, &written_size);
+        if (!written) {
+            failure = "write failed";
+        }
+        else if (written_size != *file_size ||
+                 memcmp(written, file, written_size) != 0) {
+            failure = "written file differs";
+        }
+
+        cegse_free(ctx, written);
+    }
+
+    savegame_free(save);
+
+out:
+    munmap(file, *file_size);
+    return failure;
+}
+
+static void *worker(void *arg)
+{
+    struct batch *batch = arg;
+    struct cegse_ctx ctx = {
+        .logger.error = cegse_log_to_file,
+        /* Written back saves must compare equal to the files. */
+        .read_options.flags = batch->options->write_back
+                                  ? SAVEFILE_KEEP_COMPRESSED_BODY
+                                  : SAVEFILE_VIEW_CHANGE_FORMS |
+                                        SAVEFILE_VIEW_GLOBAL_DATA,
+    };
+    size_t i;
+
+    while ((i = atomic_fetch_add(&batch->next, 1)) < batch->files.count) {
+        const char *filename = batch->files.names[i];
+        size_t file_size = 0;
+        const char *failure;
+        double start = seconds();
+        double time;
+        int errnum = 0;
+
+        failure = process_file(&ctx, batch->options, filename, &file_size,
+                               &errnum);
+        time = seconds() - start;
+
+        /* The lock also guards the buffer that strerror() returns. */
+        pthread_mutex_lock(&batch->lock);
+        if (failure) {
+            batch->n_failed++;
+            printf("FAIL %9.2f ms %11zu B  %s: %s%s%s\n", time * 1e3,
+                   file_size, filename, failure, errnum ? ": " : "",
+                   errnum ? strerror(errnum) : "");
+        }
+        else {
+            batch->total_bytes += file_size;
+            printf("ok   %9.2f ms %11zu B  %s\n", time * 1e3, file_size,
+                   filename);
+        }
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    return NULL;
+}
+
+int batch_run(const struct batch_options *options, char **paths,
+              size_t n_paths)
+{
+    struct batch batch = { .options = options };
+    pthread_t *threads = NULL;
+    unsigned n_threads = options->threads;
+    unsigned started = 0;
+    double start;
+    double time;
+    int rc = -1;
+
+    for (size_t i = 0; i < n_paths; ++i) {
+        if (add_path(&batch.files, paths[i]) == -1) {
+            goto out;
+        }
+    }
+
+    if (options->list_filename &&
+        add_listed_paths(&batch.files, options->list_filename) == -1) {
+        goto out;
+    }
+
+    if (n_threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = cpus > 0 ? cpus : 1;
+    }
+
+    n_threads = MIN(n_threads, MAX(batch.files.count, 1));
+    threads = malloc(n_threads * sizeof(*threads));
+    if (!threads) {
+        eprintf("Failed to allocate memory.\n");
+        goto out;
+    }
+
+    atomic_init(&batch.next, 0);
+    pthread_mutex_init(&batch.lock, NULL);
+
+    start = seconds();
+    for (; started < n_threads; ++started) {
+        if (pthread_create(&threads[started], NULL, worker, &batch) != 0) {
+            break;
+        }
+    }
+
+    if (started == 0) {
+        /* Do the work on this thread instead. */
+        worker(&batch);
+    }
+
+    for (unsigned i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    time = MAX(seconds() - start, 1e-9);
+
+    pthread_mutex_destroy(&batch.lock);
+
+    printf("%zu files, %zu failed, %u threads, %.2f s, %.1f MB/s, "
+           "%.1f files/s\n",
+           batch.files.count, batch.n_failed, MAX(started, 1), time,
+           batch.total_bytes / 1e6 / time,
+           (batch.files.count - batch.n_failed) / time);
+
+    rc = batch.n_failed == 0 ? 0 : -1;
+
+out:
+    for (size_t i = 0; i < batch.files.count; ++i) {
+        free(batch.files.names[i]);
+    }
+
+    free(batch.files.names);
+    free(threads);
+    return rc;
+}
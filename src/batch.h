@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef CEGSE_BATCH_H
+#define CEGSE_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct batch_options {
+    unsigned threads; /* Number of worker threads, or 0 for one per CPU. */
+
+    /*
+     * Write each save back to memory and check that it is identical to
+     * the file.
+     */
+    bool write_back;
+
+    /*
+     * Only scan each save into an index of its blocks instead of reading
+     * it. Takes precedence over write_back.
+     */
+    bool scan_only;
+
+    /*
+     * If not NULL, file names are also read from this file, one per line.
+     * "-" is the standard input.
+     */
+    const char *list_filename;
+};
+
+/*
+ * Read every save file in paths on a pool of worker threads. A path that
+ * is a directory stands for the regular files in it. Print the result of
+ * each file as it completes and the total throughput at the end. Return 0
+ * if every file was read (and written back) successfully and -1 otherwise.
+ */
+int batch_run(const struct batch_options *options, char **paths,
+              size_t n_paths);
+
+#endif /* CEGSE_BATCH_H */
@@ -22,96 +22,129 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "defines.h"
 #include "endianness.h"
 
-#define FOR_PRIMITIVE_TYPES(ITEM)                                              \
-    ITEM(u8, uint8_t, 1)                                                       \
-    ITEM(le16, uint16_t, 2)                                                    \
-    ITEM(le32, uint32_t, 4)                                                    \
-    ITEM(le64, uint64_t, 8)                                                    \
-    ITEM(lef32, float, 4)
-
-#define FOR_ALL_TYPES(ITEM)                                                    \
-    FOR_PRIMITIVE_TYPES(ITEM)                                                  \
-    ITEM(be24, uint32_t, 3)
-
-#define DEFINE_POINTER_TO_BUF_API(id, type, size)                              \
-    void store_##id(unsigned char *dest, type value)                           \
-    {                                                                          \
-        value = hto##id(value);                                                \
-        memcpy(dest, &value, size);                                            \
-    }                                                                          \
-                                                                               \
-    type load_##id(const unsigned char *src)                                   \
-    {                                                                          \
-        type value;                                                            \
-        memcpy(&value, src, size);                                             \
-        return id##toh(value);                                                 \
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+void store_le32_array(unsigned char *dest, const uint32_t *src, size_t n)
+{
+#if BYTE_ORDER == LITTLE_ENDIAN
+    memcpy(dest, src, 4 * n);
+#else
+    for (size_t i = 0; i < n; ++i) {
+        store_le32(dest + 4 * i, src[i]);
     }
+#endif
+}
 
-void store_be24(unsigned char *dest, uint32_t value)
+void load_le32_array(uint32_t *dest, const unsigned char *src, size_t n)
 {
-    dest[0] = (value >> 16) & 0xff;
-    dest[1] = (value >> 8) & 0xff;
-    dest[2] = value & 0xff;
+#if BYTE_ORDER == LITTLE_ENDIAN
+    memcpy(dest, src, 4 * n);
+#else
+    for (size_t i = 0; i < n; ++i) {
+        dest[i] = load_le32(src + 4 * i);
+    }
+#endif
 }
 
-uint32_t load_be24(const unsigned char *src)
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * Convert between 24-bit big-endian values and 32-bit little-endian ones
+ * four at a time with byte shuffles. Every step reads and writes 16 bytes
+ * of which only 12 are packed values, so the loops stop while a step would
+ * still stay within bounds.
+ */
+__attribute__((target("ssse3"))) static size_t
+load_be24_array_ssse3(uint32_t *dest, const unsigned char *src, size_t n)
 {
-    return (uint32_t)src[0] << 16 | (uint32_t)src[1] << 8 | (uint32_t)src[2];
+    const __m128i widen = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1,
+                                        11, 10, 9, -1);
+    size_t i = 0;
+
+    for (; i + 6 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 3 * i));
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_shuffle_epi8(v, widen));
+    }
+
+    return i;
 }
 
-void c_store_bytes(struct cursor *cursor, const void *bytes, size_t n)
+__attribute__((target("ssse3"))) static size_t
+store_be24_array_ssse3(unsigned char *dest, const uint32_t *src, size_t n)
 {
-    cursor->n -= n;
-    if (cursor->n >= 0) {
-        memcpy(cursor->pos, bytes, n);
-        cursor->pos += n;
+    const __m128i narrow = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13,
+                                         12, -1, -1, -1, -1);
+    size_t i = 0;
+
+    for (; i + 6 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dest + 3 * i),
+                         _mm_shuffle_epi8(v, narrow));
     }
+
+    return i;
 }
 
-int c_load_bytes(struct cursor *cursor, void *dest, size_t n)
+#endif /* HAVE_X86_KERNELS */
+
+void store_be24_array(unsigned char *dest, const uint32_t *src, size_t n)
 {
-    cursor->n -= n;
-    if (cursor->n >= 0) {
-        memcpy(dest, cursor->pos, n);
-        cursor->pos += n;
-        return 1;
+    size_t i = 0;
+
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("ssse3")) {
+        i = store_be24_array_ssse3(dest, src, n);
+    }
+#endif
+
+    for (; i < n; ++i) {
+        store_be24(dest + 3 * i, src[i]);
     }
-    return 0;
 }
 
-void c_advance2(struct cursor *to, const struct cursor *from, long long n)
+void load_be24_array(uint32_t *dest, const unsigned char *src, size_t n)
 {
-    to->pos = from->pos + n;
-    to->n = from->n - n;
+    size_t i = 0;
+
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("ssse3")) {
+        i = load_be24_array_ssse3(dest, src, n);
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dest[i] = load_be24(src + 3 * i);
+    }
 }
 
-#define DEFINE_CURSOR_API(id, type, size)                                      \
-    void c_store_##id(struct cursor *c, type value)                            \
+#define DEFINE_CURSOR_ARRAY_API(id, size)                                      \
+    void c_store_##id##_array(struct cursor *c, const uint32_t *src,           \
+                              size_t n)                                        \
     {                                                                          \
-        c->n -= size;                                                          \
+        c->n -= (long long)(size * n);                                         \
         if (c->n >= 0) {                                                       \
-            store_##id(c->pos, value);                                         \
-            c->pos += size;                                                    \
+            store_##id##_array(c->pos, src, n);                                \
+            c->pos += size * n;                                                \
         }                                                                      \
     }                                                                          \
                                                                                \
-    int c_load_##id(struct cursor *c, type *dest)                              \
+    int c_load_##id##_array(struct cursor *c, uint32_t *dest, size_t n)       \
     {                                                                          \
-        c->n -= size;                                                          \
+        c->n -= (long long)(size * n);                                         \
         if (c->n >= 0) {                                                       \
-            *dest = load_##id(c->pos);                                         \
-            c->pos += size;                                                    \
+            load_##id##_array(dest, c->pos, n);                                \
+            c->pos += size * n;                                                \
             return 1;                                                          \
         }                                                                      \
         return 0;                                                              \
-    }                                                                          \
-                                                                               \
-    type c_load_##id##_or0(struct cursor *c)                                   \
-    {                                                                          \
-        type value;                                                            \
-        return c_load_##id(c, &value) ? value : 0;                             \
     }
 
+DEFINE_CURSOR_ARRAY_API(le32, 4)
+DEFINE_CURSOR_ARRAY_API(be24, 3)
+
 #define DEFINE_FILE_API(id, type, size)                                        \
     size_t put_##id(FILE *stream, type value)                                  \
     {                                                                          \
@@ -143,23 +176,15 @@ void c_advance2(struct cursor *to, const struct cursor *from, long long n)
         }                                                                      \
     }
 
-/*
- * These defines are just by-product of reusing lists and function
- * definition templates for types that don't need byte swapping.
- */
-#define htolef32(x) x
-#define lef32toh(x) x
-#define u8toh(x)    x
-#define htou8(x)    x
-FOR_PRIMITIVE_TYPES(DEFINE_POINTER_TO_BUF_API)
-FOR_ALL_TYPES(DEFINE_CURSOR_API)
 FOR_ALL_TYPES(DEFINE_FILE_API)
 
 #ifdef COMPILE_WITH_UNIT_TESTS
 
 #define TEST_SUITE(TEST_CASE)                                                  \
     TEST_CASE(store_load_functions)                                            \
-    TEST_CASE(cursor_advance)
+    TEST_CASE(cursor_advance)                                                  \
+    TEST_CASE(array_functions_match_single_values)                             \
+    TEST_CASE(reserved_fields)
 
 #include "unit_tests.h"
 
@@ -217,4 +242,97 @@ UNIT_TEST(cursor_advance)
     ASSERT_EQ_PTR(cursor2_buf.pos, buffer + 4);
 }
 
+UNIT_TEST(array_functions_match_single_values)
+{
+    enum {
+        MAX_VALUES = 100
+    };
+    unsigned char expected[4 * MAX_VALUES];
+    unsigned char buffer[4 * MAX_VALUES];
+    uint32_t values[MAX_VALUES];
+    uint32_t loaded[MAX_VALUES];
+
+    for (unsigned i = 0; i < MAX_VALUES; ++i) {
+        values[i] = (0x9e3779b9u * (i + 1)) >> 8;
+    }
+
+    /* Every count, to cover the shuffles and what is left over. */
+    for (unsigned n = 0; n <= MAX_VALUES; ++n) {
+        struct cursor cursor = { buffer, 3 * n };
+
+        for (unsigned i = 0; i < n; ++i) {
+            store_be24(expected + 3 * i, values[i]);
+        }
+
+        c_store_be24_array(&cursor, values, n);
+        ASSERT_EQ(cursor.n, 0);
+        ASSERT_EQ_MEM(buffer, 3 * n, expected, 3 * n);
+
+        cursor = (struct cursor){ buffer, 3 * n };
+        memset(loaded, 0, sizeof(loaded));
+        ASSERT_TRUE(c_load_be24_array(&cursor, loaded, n));
+        ASSERT_EQ_MEM(loaded, 4 * n, values, 4 * n);
+
+        for (unsigned i = 0; i < n; ++i) {
+            store_le32(expected + 4 * i, values[i]);
+        }
+
+        cursor = (struct cursor){ buffer, 4 * n };
+        c_store_le32_array(&cursor, values, n);
+        ASSERT_EQ(cursor.n, 0);
+        ASSERT_EQ_MEM(buffer, 4 * n, expected, 4 * n);
+
+        cursor = (struct cursor){ buffer, 4 * n };
+        memset(loaded, 0, sizeof(loaded));
+        ASSERT_TRUE(c_load_le32_array(&cursor, loaded, n));
+        ASSERT_EQ_MEM(loaded, 4 * n, values, 4 * n);
+    }
+
+    /* An array that does not fit is not touched. */
+    {
+        struct cursor cursor = { buffer, 3 * MAX_VALUES - 1 };
+
+        memset(loaded, 0, sizeof(loaded));
+        ASSERT_FALSE(c_load_be24_array(&cursor, loaded, MAX_VALUES));
+        ASSERT_EQ(cursor.n, -1);
+        ASSERT_EQ_PTR(cursor.pos, buffer);
+        ASSERT_EQ(loaded[0], 0);
+
+        memset(buffer, 0xab, sizeof(buffer));
+        cursor = (struct cursor){ buffer, 4 * MAX_VALUES - 4 };
+        c_store_le32_array(&cursor, values, MAX_VALUES);
+        ASSERT_EQ(cursor.n, -4);
+        ASSERT_EQ(buffer[0], 0xab);
+    }
+}
+
+UNIT_TEST(reserved_fields)
+{
+    unsigned char buffer[16];
+    struct cursor cursor = { buffer, sizeof(buffer) };
+    struct ucursor fields;
+
+    ASSERT_TRUE(c_reserve(&cursor, &fields, 11));
+    ASSERT_EQ_PTR(fields.pos, buffer);
+    ASSERT_EQ_PTR(cursor.pos, buffer + 11);
+    ASSERT_EQ(cursor.n, 5);
+
+    uc_store_le32(&fields, 0x12345678);
+    uc_store_be24(&fields, 0xabcdef);
+    uc_store_lef32(&fields, 1.5f);
+    ASSERT_EQ_PTR(fields.pos, buffer + 11);
+
+    fields.pos = buffer;
+    ASSERT_EQ(uc_load_le32(&fields), 0x12345678);
+    ASSERT_EQ(uc_load_be24(&fields), 0xabcdef);
+    ASSERT_TRUE(uc_load_lef32(&fields) == 1.5f);
+
+    /* Reserving too much only moves the cursor out of bounds. */
+    fields.pos = NULL;
+    ASSERT_FALSE(c_reserve(&cursor, &fields, 8));
+    ASSERT_EQ(cursor.n, -3);
+    ASSERT_EQ_PTR(cursor.pos, buffer + 11);
+    ASSERT_EQ_PTR(fields.pos, NULL);
+}
+
 #endif /* COMPILE_WITH_UNIT_TESTS */
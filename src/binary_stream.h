@@ -20,6 +20,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+
+#include "endianness.h"
 
 struct cursor {
     unsigned char *pos;
@@ -40,20 +43,73 @@ struct cursor {
     long long n;
 };
 
-/* Pointer to buffer API */
-void store_u8(unsigned char *dest, uint8_t value);
-void store_le16(unsigned char *dest, uint16_t value);
-void store_be24(unsigned char *dest, uint32_t value);
-void store_le32(unsigned char *dest, uint32_t value);
-void store_le64(unsigned char *dest, uint64_t value);
-void store_lef32(unsigned char *dest, float value);
-
-uint8_t load_u8(const unsigned char *src);
-uint16_t load_le16(const unsigned char *src);
-uint32_t load_be24(const unsigned char *src);
-uint32_t load_le32(const unsigned char *src);
-uint64_t load_le64(const unsigned char *src);
-float load_lef32(const unsigned char *src);
+/*
+ * Types of the pointer to buffer and cursor APIs. be24 is assembled byte by
+ * byte instead of byte swapped, so it is not a primitive type.
+ */
+#define FOR_PRIMITIVE_TYPES(ITEM)                                              \
+    ITEM(u8, uint8_t, 1)                                                       \
+    ITEM(le16, uint16_t, 2)                                                    \
+    ITEM(le32, uint32_t, 4)                                                    \
+    ITEM(le64, uint64_t, 8)                                                    \
+    ITEM(lef32, float, 4)
+
+#define FOR_ALL_TYPES(ITEM)                                                    \
+    FOR_PRIMITIVE_TYPES(ITEM)                                                  \
+    ITEM(be24, uint32_t, 3)
+
+/*
+ * These defines are just by-product of reusing lists and function
+ * definition templates for types that don't need byte swapping.
+ */
+#define htolef32(x) x
+#define lef32toh(x) x
+#define u8toh(x)    x
+#define htou8(x)    x
+
+/*
+ * Pointer to buffer API
+ *
+ * The functions are inline so that the byte order conversions, which are
+ * no-ops on little-endian hosts, disappear and the accesses of adjacent
+ * fields can be merged.
+ *
+ * void store_u8(unsigned char *dest, uint8_t value);
+ * uint8_t load_u8(const unsigned char *src);
+ * ...and the same for le16, be24, le32, le64 and lef32.
+ */
+#define DEFINE_POINTER_TO_BUF_API(id, type, size)                              \
+    static inline void store_##id(unsigned char *dest, type value)             \
+    {                                                                          \
+        value = hto##id(value);                                                \
+        memcpy(dest, &value, size);                                            \
+    }                                                                          \
+                                                                               \
+    static inline type load_##id(const unsigned char *src)                     \
+    {                                                                          \
+        type value;                                                            \
+        memcpy(&value, src, size);                                             \
+        return id##toh(value);                                                 \
+    }
+
+FOR_PRIMITIVE_TYPES(DEFINE_POINTER_TO_BUF_API)
+
+static inline void store_be24(unsigned char *dest, uint32_t value)
+{
+    dest[0] = (value >> 16) & 0xff;
+    dest[1] = (value >> 8) & 0xff;
+    dest[2] = value & 0xff;
+}
+
+static inline uint32_t load_be24(const unsigned char *src)
+{
+    return (uint32_t)src[0] << 16 | (uint32_t)src[1] << 8 | (uint32_t)src[2];
+}
+
+void store_le32_array(unsigned char *dest, const uint32_t *src, size_t n);
+void store_be24_array(unsigned char *dest, const uint32_t *src, size_t n);
+void load_le32_array(uint32_t *dest, const unsigned char *src, size_t n);
+void load_be24_array(uint32_t *dest, const unsigned char *src, size_t n);
 
 /* Cursor API */
 /*
@@ -68,42 +124,148 @@ static inline void c_advance(struct cursor *c, long long n)
 /*
  * Advance 'from' cursor by n bytes, storing the result to the 'to' cursor.
  */
-void c_advance2(struct cursor *to, const struct cursor *from, long long n);
+static inline void c_advance2(struct cursor *to, const struct cursor *from,
+                              long long n)
+{
+    to->pos = from->pos + n;
+    to->n = from->n - n;
+}
 
 /*
  * These functions store a value at the current position and advance the
  * position. The operation fails if cursor goes out of bounds.
+ *
+ * void c_store_bytes(struct cursor *cursor, const void *bytes, size_t n);
+ * void c_store_u8(struct cursor *c, uint8_t value);
+ * ...and the same for le16, be24, le32, le64 and lef32.
+ *
+ * These functions load a value from the current position to dest.
+ * On success, return nonzero value.
+ *
+ * int c_load_bytes(struct cursor *cursor, void *dest, size_t n);
+ * int c_load_u8(struct cursor *c, uint8_t *dest);
+ * ...
+ *
+ * These functions load a value from the current position and return it.
+ * On out of bounds error, return 0.
+ *
+ * uint8_t c_load_u8_or0(struct cursor *c);
+ * ...
  */
-void c_store_bytes(struct cursor *cursor, const void *bytes, size_t n);
-void c_store_u8(struct cursor *c, uint8_t value);
-void c_store_le16(struct cursor *c, uint16_t value);
-void c_store_be24(struct cursor *c, uint32_t value);
-void c_store_le32(struct cursor *c, uint32_t value);
-void c_store_le64(struct cursor *c, uint64_t value);
-void c_store_lef32(struct cursor *c, float value);
+static inline void c_store_bytes(struct cursor *cursor, const void *bytes,
+                                 size_t n)
+{
+    cursor->n -= n;
+    if (cursor->n >= 0 && n > 0) {
+        memcpy(cursor->pos, bytes, n);
+        cursor->pos += n;
+    }
+}
+
+static inline int c_load_bytes(struct cursor *cursor, void *dest, size_t n)
+{
+    cursor->n -= n;
+    if (cursor->n >= 0) {
+        memcpy(dest, cursor->pos, n);
+        cursor->pos += n;
+        return 1;
+    }
+    return 0;
+}
+
+#define DEFINE_CURSOR_API(id, type, size)                                      \
+    static inline void c_store_##id(struct cursor *c, type value)              \
+    {                                                                          \
+        c->n -= size;                                                          \
+        if (c->n >= 0) {                                                       \
+            store_##id(c->pos, value);                                         \
+            c->pos += size;                                                    \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    static inline int c_load_##id(struct cursor *c, type *dest)                \
+    {                                                                          \
+        c->n -= size;                                                          \
+        if (c->n >= 0) {                                                       \
+            *dest = load_##id(c->pos);                                         \
+            c->pos += size;                                                    \
+            return 1;                                                          \
+        }                                                                      \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    static inline type c_load_##id##_or0(struct cursor *c)                     \
+    {                                                                          \
+        type value;                                                            \
+        return c_load_##id(c, &value) ? value : 0;                             \
+    }
+
+FOR_ALL_TYPES(DEFINE_CURSOR_API)
 
 /*
- * These functions load a value from the current position to dest.
- * On success, return nonzero value.
+ * A cursor without bounds. It points into bytes that c_reserve() has
+ * checked to be within the bounds of a cursor, so the functions that use
+ * it need no checks of their own.
  */
-int c_load_bytes(struct cursor *cursor, void *dest, size_t n);
-int c_load_u8(struct cursor *cursor, uint8_t *dest);
-int c_load_le16(struct cursor *cursor, uint16_t *dest);
-int c_load_be24(struct cursor *cursor, uint32_t *dest);
-int c_load_le32(struct cursor *cursor, uint32_t *dest);
-int c_load_le64(struct cursor *cursor, uint64_t *dest);
-int c_load_lef32(struct cursor *cursor, float *dest);
+struct ucursor {
+    unsigned char *pos;
+};
 
 /*
- * These functions load a value from the current position and return it.
- * On out of bounds error, return 0.
+ * Reserve n bytes at the current position of cursor for a fixed layout
+ * and advance past them. On success, return nonzero and set reserved to
+ * the start of the bytes. Otherwise the cursor goes out of bounds like when
+ * storing or loading too much, and reserved is not set.
+ */
+static inline int c_reserve(struct cursor *cursor, struct ucursor *reserved,
+                            size_t n)
+{
+    cursor->n -= n;
+    if (cursor->n >= 0) {
+        reserved->pos = cursor->pos;
+        cursor->pos += n;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * These functions store or load a value at the position of an unchecked
+ * cursor and advance it. The caller must not go past the reserved bytes.
+ *
+ * void uc_store_u8(struct ucursor *c, uint8_t value);
+ * uint8_t uc_load_u8(struct ucursor *c);
+ * ...and the same for le16, be24, le32, le64 and lef32.
+ */
+#define DEFINE_UNCHECKED_CURSOR_API(id, type, size)                            \
+    static inline void uc_store_##id(struct ucursor *c, type value)            \
+    {                                                                          \
+        store_##id(c->pos, value);                                             \
+        c->pos += size;                                                        \
+    }                                                                          \
+                                                                               \
+    static inline type uc_load_##id(struct ucursor *c)                         \
+    {                                                                          \
+        type value = load_##id(c->pos);                                        \
+        c->pos += size;                                                        \
+        return value;                                                          \
+    }
+
+FOR_ALL_TYPES(DEFINE_UNCHECKED_CURSOR_API)
+
+#undef DEFINE_POINTER_TO_BUF_API
+#undef DEFINE_CURSOR_API
+#undef DEFINE_UNCHECKED_CURSOR_API
+
+/*
+ * These functions store or load n values at once. Bounds are checked once
+ * for the whole array: if it does not fit, nothing is stored or loaded,
+ * but the cursor goes out of bounds like with the functions above.
  */
-uint8_t c_load_u8_or0(struct cursor *cursor);
-uint16_t c_load_le16_or0(struct cursor *cursor);
-uint32_t c_load_be24_or0(struct cursor *cursor);
-uint32_t c_load_le32_or0(struct cursor *cursor);
-uint64_t c_load_le64_or0(struct cursor *cursor);
-float c_load_lef32_or0(struct cursor *cursor);
+void c_store_le32_array(struct cursor *cursor, const uint32_t *src, size_t n);
+void c_store_be24_array(struct cursor *cursor, const uint32_t *src, size_t n);
+int c_load_le32_array(struct cursor *cursor, uint32_t *dest, size_t n);
+int c_load_be24_array(struct cursor *cursor, uint32_t *dest, size_t n);
 
 static inline size_t write_bytes(FILE *restrict stream,
                                  const void *restrict bytes, size_t n)
@@ -0,0 +1,367 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "change_form_query.h"
+#include "defines.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+/* Rows of the bitmap buffer that indices are extracted from. */
+#define INDEX_BLOCK_WORDS 64
+
+/*
+ * A kernel fills words 64-row words of the bitmap. The rows that do not
+ * fill a whole word are left to match_rows().
+ */
+typedef void query_kernel_fn(const struct change_form_query *query,
+                             const uint8_t *type, const uint32_t *flags,
+                             size_t words, uint64_t *bitmap);
+
+static uint64_t match_rows(const struct change_form_query *query,
+                           const uint8_t *type, const uint32_t *flags,
+                           size_t n)
+{
+    uint64_t word = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t match = (query->types >> type[i]) & 1;
+
+        match &= (flags[i] & query->flags_mask) == query->flags_value;
+        word |= match << i;
+    }
+
+    return word;
+}
+
+static void query_scalar(const struct change_form_query *query,
+                         const uint8_t *type, const uint32_t *flags,
+                         size_t words, uint64_t *bitmap)
+{
+    for (size_t w = 0; w < words; ++w) {
+        bitmap[w] = match_rows(query, type + 64 * w, flags + 64 * w, 64);
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * SSE2 has no byte shuffle to look the types up with, so a type set of up
+ * to 8 types is compared type by type. Larger sets are looked up one row
+ * at a time, only for the rows whose flags match.
+ */
+__attribute__((target("sse2"))) static void
+query_sse2(const struct change_form_query *query, const uint8_t *type,
+           const uint32_t *flags, size_t words, uint64_t *bitmap)
+{
+    const __m128i mask = _mm_set1_epi32(query->flags_mask);
+    const __m128i value = _mm_set1_epi32(query->flags_value);
+    bool any_type = query->types == CHANGE_FORM_ALL_TYPES;
+    __m128i set[8];
+    unsigned n_set = 0;
+
+    for (unsigned t = 0; t < 64 && n_set <= ARRAY_LEN(set); ++t) {
+        if ((query->types >> t) & 1) {
+            if (n_set < ARRAY_LEN(set)) {
+                set[n_set] = _mm_set1_epi8((char)t);
+            }
+            n_set++;
+        }
+    }
+
+    for (size_t w = 0; w < words; ++w) {
+        uint64_t word = 0;
+
+        for (unsigned j = 0; j < 64; j += 16) {
+            const uint8_t *t = type + 64 * w + j;
+            const uint32_t *f = flags + 64 * w + j;
+            unsigned bits = 0;
+
+            for (unsigned k = 0; k < 4; ++k) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(f + 4 * k));
+
+                v = _mm_cmpeq_epi32(_mm_and_si128(v, mask), value);
+                bits |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(v))
+                        << (4 * k);
+            }
+
+            if (!bits || any_type) {
+                word |= (uint64_t)bits << j;
+                continue;
+            }
+
+            if (n_set <= ARRAY_LEN(set)) {
+                __m128i tv = _mm_loadu_si128((const __m128i *)t);
+                __m128i eq = _mm_setzero_si128();
+
+                for (unsigned k = 0; k < n_set; ++k) {
+                    eq = _mm_or_si128(eq, _mm_cmpeq_epi8(tv, set[k]));
+                }
+
+                bits &= (unsigned)_mm_movemask_epi8(eq);
+            }
+            else {
+                for (unsigned i = 0; i < 16; ++i) {
+                    if (!((query->types >> t[i]) & 1)) {
+                        bits &= ~(1u << i);
+                    }
+                }
+            }
+
+            word |= (uint64_t)bits << j;
+        }
+
+        bitmap[w] = word;
+    }
+}
+
+/*
+ * The type set is looked up with byte shuffles: the upper three bits of a
+ * type select a byte of the set and the lower three bits a bit in it.
+ */
+__attribute__((target("avx2"))) static void
+query_avx2(const struct change_form_query *query, const uint8_t *type,
+           const uint32_t *flags, size_t words, uint64_t *bitmap)
+{
+    const __m256i mask = _mm256_set1_epi32(query->flags_mask);
+    const __m256i value = _mm256_set1_epi32(query->flags_value);
+    const __m256i set_bytes = _mm256_broadcastsi128_si256(
+        _mm_set_epi64x(0, (long long)query->types));
+    const __m256i bit_of = _mm256_broadcastsi128_si256(
+        _mm_set_epi64x(0, (long long)UINT64_C(0x8040201008040201)));
+    const __m256i low3 = _mm256_set1_epi8(7);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (size_t w = 0; w < words; ++w) {
+        uint64_t word = 0;
+
+        for (unsigned j = 0; j < 64; j += 32) {
+            const uint8_t *t = type + 64 * w + j;
+            const uint32_t *f = flags + 64 * w + j;
+            __m256i tv, byte, bit;
+            uint32_t bits = 0;
+
+            for (unsigned k = 0; k < 4; ++k) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(f + 8 * k));
+
+                v = _mm256_cmpeq_epi32(_mm256_and_si256(v, mask), value);
+                bits |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(v))
+                        << (8 * k);
+            }
+
+            tv = _mm256_loadu_si256((const __m256i *)t);
+            byte = _mm256_shuffle_epi8(
+                set_bytes, _mm256_and_si256(_mm256_srli_epi16(tv, 3), low3));
+            bit = _mm256_shuffle_epi8(bit_of, _mm256_and_si256(tv, low3));
+            bits &= ~(uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_and_si256(byte, bit), zero));
+
+            word |= (uint64_t)bits << j;
+        }
+
+        bitmap[w] = word;
+    }
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+static query_kernel_fn *select_kernel(void)
+{
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        return query_avx2;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return query_sse2;
+    }
+#endif
+
+    return query_scalar;
+}
+
+static size_t query_with(query_kernel_fn *kernel,
+                         const struct change_form_query *query,
+                         const uint8_t *type, const uint32_t *flags,
+                         size_t count, uint64_t *bitmap)
+{
+    size_t words = count / 64;
+    size_t matches = 0;
+
+    kernel(query, type, flags, words, bitmap);
+
+    if (count % 64) {
+        bitmap[words] = match_rows(query, type + 64 * words,
+                                   flags + 64 * words, count % 64);
+        words++;
+    }
+
+    for (size_t w = 0; w < words; ++w) {
+        matches += __builtin_popcountll(bitmap[w]);
+    }
+
+    return matches;
+}
+
+size_t change_form_query_bitmap(const struct change_form_query *query,
+                                const uint8_t *type, const uint32_t *flags,
+                                size_t count, uint64_t *bitmap)
+{
+    return query_with(select_kernel(), query, type, flags, count, bitmap);
+}
+
+size_t change_form_query_indices(const struct change_form_query *query,
+                                 const uint8_t *type, const uint32_t *flags,
+                                 size_t count, uint32_t *indices)
+{
+    query_kernel_fn *kernel = select_kernel();
+    uint64_t bitmap[INDEX_BLOCK_WORDS];
+    size_t n = 0;
+
+    for (size_t start = 0; start < count; start += 64 * INDEX_BLOCK_WORDS) {
+        size_t rows = MIN(count - start, 64 * INDEX_BLOCK_WORDS);
+
+        query_with(kernel, query, type + start, flags + start, rows, bitmap);
+
+        for (size_t w = 0; w < (rows + 63) / 64; ++w) {
+            for (uint64_t word = bitmap[w]; word; word &= word - 1) {
+                indices[n++] = start + 64 * w + __builtin_ctzll(word);
+            }
+        }
+    }
+
+    return n;
+}
+
+#ifdef COMPILE_WITH_UNIT_TESTS
+
+#define TEST_SUITE(TEST_CASE)                                                  \
+    TEST_CASE(query_kernels_match_scalar)                                      \
+    TEST_CASE(query_indices_match_bitmap)
+
+#include <stdlib.h>
+#include "savefile.h"
+#include "unit_tests.h"
+
+#define TEST_ROWS 5000
+
+static const struct change_form_query test_queries[] = {
+    { CHANGE_FORM_ALL_TYPES, 0, 0 },
+    { CHANGE_FORM_TYPE(CHANGE_ACHR), 0, 0 },
+    { CHANGE_FORM_TYPE(CHANGE_ACHR), CHANGE_ACTOR_LIFESTATE,
+      CHANGE_ACTOR_LIFESTATE },
+    { CHANGE_FORM_TYPE(CHANGE_TACT), CHANGE_TALKING_ACTIVATOR_SPEAKER,
+      CHANGE_TALKING_ACTIVATOR_SPEAKER },
+    { CHANGE_FORM_TYPE(CHANGE_REFR) | CHANGE_FORM_TYPE(CHANGE_ACHR) |
+          CHANGE_FORM_TYPE(63),
+      CHANGE_FORM_FLAGS | CHANGE_REFR_MOVE, CHANGE_FORM_FLAGS },
+    { 0x00ff00ff00ff00ffull, 0x10, 0 },
+    { CHANGE_FORM_ALL_TYPES, 0xffffffff, 0x12345678 },
+    { 0, 0, 0 },
+    /* A value outside the mask matches nothing. */
+    { CHANGE_FORM_TYPE(CHANGE_PMIS), 0x1, 0x2 },
+};
+
+static void make_columns(uint8_t *type, uint32_t *flags, size_t count)
+{
+    srand(1234);
+    for (size_t i = 0; i < count; ++i) {
+        type[i] = rand() % 64;
+        flags[i] = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+        if (i % 7 == 0) {
+            flags[i] = 0x12345678;
+        }
+    }
+}
+
+static void check_kernel(query_kernel_fn *kernel)
+{
+    static uint8_t type[TEST_ROWS];
+    static uint32_t flags[TEST_ROWS];
+    static uint64_t expected[(TEST_ROWS + 63) / 64];
+    static uint64_t bitmap[(TEST_ROWS + 63) / 64];
+
+    make_columns(type, flags, TEST_ROWS);
+
+    for (size_t q = 0; q < ARRAY_LEN(test_queries); ++q) {
+        const struct change_form_query *query = &test_queries[q];
+
+        /* Row counts around word boundaries. */
+        for (size_t count = 0; count < 200; count += 13) {
+            ASSERT_EQ(query_with(kernel, query, type, flags, count, bitmap),
+                      query_with(query_scalar, query, type, flags, count,
+                                 expected));
+            ASSERT_EQ_MEM(bitmap, (count + 63) / 64 * 8, expected,
+                          (count + 63) / 64 * 8);
+        }
+
+        ASSERT_EQ(query_with(kernel, query, type, flags, TEST_ROWS, bitmap),
+                  query_with(query_scalar, query, type, flags, TEST_ROWS,
+                             expected));
+        ASSERT_EQ_MEM(bitmap, sizeof(bitmap), expected, sizeof(expected));
+    }
+}
+
+UNIT_TEST(query_kernels_match_scalar)
+{
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("sse2")) {
+        check_kernel(query_sse2);
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        check_kernel(query_avx2);
+    }
+#endif
+
+    check_kernel(query_scalar);
+}
+
+UNIT_TEST(query_indices_match_bitmap)
+{
+    static uint8_t type[TEST_ROWS * 2];
+    static uint32_t flags[TEST_ROWS * 2];
+    static uint64_t bitmap[(TEST_ROWS * 2 + 63) / 64];
+    static uint32_t indices[TEST_ROWS * 2];
+
+    make_columns(type, flags, TEST_ROWS * 2);
+
+    for (size_t q = 0; q < ARRAY_LEN(test_queries); ++q) {
+        const struct change_form_query *query = &test_queries[q];
+        size_t matches;
+        size_t n;
+
+        matches = change_form_query_bitmap(query, type, flags, TEST_ROWS * 2,
+                                           bitmap);
+        n = change_form_query_indices(query, type, flags, TEST_ROWS * 2,
+                                      indices);
+        ASSERT_EQ(n, matches);
+
+        for (size_t i = 0; i < n; ++i) {
+            ASSERT_TRUE(i == 0 || indices[i - 1] < indices[i]);
+            ASSERT_TRUE((bitmap[indices[i] / 64] >> (indices[i] % 64)) & 1);
+        }
+    }
+}
+
+#endif /* COMPILE_WITH_UNIT_TESTS */
@@ -0,0 +1,61 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef CEGSE_CHANGE_FORM_QUERY_H
+#define CEGSE_CHANGE_FORM_QUERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHANGE_FORM_TYPE(type)  ((uint64_t)1 << (type))
+#define CHANGE_FORM_ALL_TYPES   (~(uint64_t)0)
+
+/*
+ * A change form matches if its form type is in types and its flags masked
+ * with flags_mask equal flags_value. Types and flags are named by enum
+ * change_form_type and enum change_flags in savefile.h, e.g. the actors
+ * whose life state changed are
+ * { CHANGE_FORM_TYPE(CHANGE_ACHR), CHANGE_ACTOR_LIFESTATE,
+ *   CHANGE_ACTOR_LIFESTATE }.
+ */
+struct change_form_query {
+    uint64_t types; /* Bitwise OR of CHANGE_FORM_TYPE() */
+    uint32_t flags_mask;
+    uint32_t flags_value;
+};
+
+/*
+ * Evaluate the query on count rows of the form type and flags columns.
+ * Form types must be less than 64. Bit i % 64 of bitmap[i / 64] is set if
+ * row i matches and cleared otherwise. Return the number of matches.
+ *
+ * SSE2 or AVX2 is used if the processor has it.
+ */
+size_t change_form_query_bitmap(const struct change_form_query *query,
+                                const uint8_t *type, const uint32_t *flags,
+                                size_t count, uint64_t *bitmap);
+
+/*
+ * Like change_form_query_bitmap() but store the indices of the matching
+ * rows in ascending order. indices must have room for count indices.
+ */
+size_t change_form_query_indices(const struct change_form_query *query,
+                                 const uint8_t *type, const uint32_t *flags,
+                                 size_t count, uint32_t *indices);
+
+#endif /* CEGSE_CHANGE_FORM_QUERY_H */
@@ -17,17 +17,27 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
-#include <errno.h>
+#include <unistd.h>
 
 #include <lz4.h>
+#include <lz4hc.h>
 #include <zlib.h>
 
 #include "compression.h"
 #include "defines.h"
 
-ssize_t lz4_compress(struct cregion src, struct region dest)
+ssize_t lz4_compress(struct cregion src, struct region dest,
+                     const struct compress_options *options)
 {
+    int acceleration = options ? options->acceleration : 0;
+    int level = options ? options->level : 0;
     int result;
 
     /* Check limits. */
@@ -39,22 +49,414 @@ ssize_t lz4_compress(struct cregion src, struct region dest)
         dest.size = INT_MAX;
     }
 
-    result = LZ4_compress_default(src.data, dest.data, src.size, dest.size);
+    if (level > 0) {
+        result = LZ4_compress_HC(src.data, dest.data, src.size, dest.size,
+                                 level);
+    }
+    else if (acceleration > 1) {
+        result = LZ4_compress_fast(src.data, dest.data, src.size, dest.size,
+                                   acceleration);
+    }
+    else {
+        result = LZ4_compress_default(src.data, dest.data, src.size,
+                                      dest.size);
+    }
 
     if (result <= 0) {
-        eprintf("lz4_compress: compression failed\n");
         return -1;
     }
 
     return result;
 }
 
-ssize_t zlib_compress(struct cregion src, struct region dest)
+ssize_t lz4_decompress_partial(struct cregion src, struct region dest)
+{
+    int result;
+
+    if (src.size > INT_MAX) {
+        src.size = INT_MAX;
+    }
+
+    if (dest.size > INT_MAX) {
+        dest.size = INT_MAX;
+    }
+
+    result = LZ4_decompress_safe_partial(src.data, dest.data, src.size,
+                                         dest.size, dest.size);
+
+    if (result < 0) {
+        return -1;
+    }
+
+    return result;
+}
+
+ssize_t zlib_decompress_partial(struct cregion src, struct region dest)
+{
+    z_stream stream = { 0 };
+    int result;
+
+    if (inflateInit(&stream) != Z_OK) {
+        return -1;
+    }
+
+    stream.next_in = (Bytef *)src.data;
+    stream.avail_in = MIN(src.size, UINT_MAX);
+    stream.next_out = dest.data;
+    stream.avail_out = MIN(dest.size, UINT_MAX);
+
+    result = inflate(&stream, Z_SYNC_FLUSH);
+    inflateEnd(&stream);
+
+    if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+        return -1;
+    }
+
+    return stream.total_out;
+}
+
+size_t lz4_compress_bound(size_t size)
+{
+    if (size > LZ4_MAX_INPUT_SIZE) {
+        return 0;
+    }
+
+    return LZ4_compressBound(size);
+}
+
+size_t zlib_compress_bound(size_t size)
+{
+    if (size > ULONG_MAX - (ULONG_MAX >> 10) - 13) {
+        return 0;
+    }
+
+    return compressBound(size);
+}
+
+ssize_t zlib_compress_level(struct cregion src, struct region dest, int level)
+{
+    z_stream stream = { 0 };
+    int result;
+
+    if (deflateInit(&stream, level) != Z_OK) {
+        return -1;
+    }
+
+    stream.next_in = (Bytef *)src.data;
+    stream.next_out = dest.data;
+
+    /* avail_in and avail_out are only 32 bits wide. Feed in pieces. */
+    do {
+        size_t in_done = stream.next_in - (const Bytef *)src.data;
+        size_t out_done = stream.next_out - (Bytef *)dest.data;
+        int flush;
+
+        if (stream.avail_in == 0) {
+            stream.avail_in = MIN(src.size - in_done, UINT_MAX);
+        }
+
+        if (stream.avail_out == 0) {
+            stream.avail_out = MIN(dest.size - out_done, UINT_MAX);
+        }
+
+        flush = in_done + stream.avail_in == src.size ? Z_FINISH : Z_NO_FLUSH;
+        result = deflate(&stream, flush);
+    } while (result == Z_OK);
+
+    deflateEnd(&stream);
+
+    if (result != Z_STREAM_END) {
+        return -1;
+    }
+
+    return stream.next_out - (Bytef *)dest.data;
+}
+
+ssize_t zlib_compress(struct cregion src, struct region dest,
+                      const struct compress_options *options)
+{
+    int level = Z_DEFAULT_COMPRESSION;
+
+    if (options && options->level) {
+        level = options->level;
+    }
+
+    if (options && options->threads) {
+        return zlib_compress_parallel(src, dest, level, options->threads);
+    }
+
+    return zlib_compress_level(src, dest, level);
+}
+
+/*
+ * Parallel zlib compression in the manner of pigz: the input is cut into
+ * segments that are deflated independently as raw deflate streams. Every
+ * segment but the last ends with a full flush, which leaves it on a byte
+ * boundary without marking the end of the stream, so the segments can be
+ * concatenated. Each segment is primed with the window that precedes it,
+ * which keeps the ratio close to that of a single stream.
+ */
+
+/* Size of the pieces of input deflated in parallel. */
+#define ZLIB_SEGMENT_SIZE ((size_t)128 * 1024)
+
+/* How far back deflate can refer to. */
+#define ZLIB_WINDOW_SIZE ((size_t)32 * 1024)
+
+struct zlib_segment {
+    size_t offset;         /* Offset of the segment in the input. */
+    size_t size;           /* Size of the segment. */
+    unsigned char *out;    /* Deflated segment. */
+    size_t out_size;       /* Size of the deflated segment. */
+    uLong adler;           /* Adler-32 of the segment. */
+};
+
+struct zlib_job {
+    struct cregion src;
+    struct zlib_segment *segments;
+    size_t n_segments;
+    int level;
+    atomic_size_t next_segment;
+    atomic_bool failed;
+};
+
+/*
+ * Return the maximum size of a deflated segment: the compressBound()
+ * of the data plus the full flush marker, which the zlib wrapper
+ * included in compressBound() more than covers.
+ */
+static size_t zlib_segment_bound(size_t size)
+{
+    return compressBound(size) + 5;
+}
+
+static bool zlib_deflate_segment(const struct zlib_job *job,
+                                 struct zlib_segment *segment)
+{
+    const unsigned char *data = (const unsigned char *)job->src.data;
+    bool last = segment->offset + segment->size == job->src.size;
+    z_stream stream = { 0 };
+    int result;
+
+    if (deflateInit2(&stream, job->level, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    if (segment->offset > 0) {
+        size_t dict_size = MIN(segment->offset, ZLIB_WINDOW_SIZE);
+
+        deflateSetDictionary(&stream, data + segment->offset - dict_size,
+                             dict_size);
+    }
+
+    stream.next_in = (Bytef *)data + segment->offset;
+    stream.avail_in = segment->size;
+    stream.next_out = segment->out;
+    stream.avail_out = zlib_segment_bound(segment->size);
+
+    result = deflate(&stream, last ? Z_FINISH : Z_FULL_FLUSH);
+    deflateEnd(&stream);
+
+    if (result != (last ? Z_STREAM_END : Z_OK) || stream.avail_in != 0 ||
+        stream.avail_out == 0) {
+        return false;
+    }
+
+    segment->out_size = stream.next_out - segment->out;
+    segment->adler = adler32(adler32(0, NULL, 0), data + segment->offset,
+                             segment->size);
+
+    return true;
+}
+
+static void *zlib_worker(void *arg)
+{
+    struct zlib_job *job = arg;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&job->next_segment, 1)) < job->n_segments) {
+        if (atomic_load(&job->failed)) {
+            break;
+        }
+
+        if (!zlib_deflate_segment(job, &job->segments[i])) {
+            atomic_store(&job->failed, true);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * The zlib header zlib writes for a level, so that the output matches a
+ * single stream's header.
+ */
+static unsigned zlib_header(int level)
 {
-    (void)src;
-    (void)dest;
+    unsigned level_flags;
+    unsigned header;
 
-    eprintf("zlib_compress: %s\n", strerror(ENOSYS));
+    if (level == Z_DEFAULT_COMPRESSION) {
+        level = 6;
+    }
+
+    if (level < 2) {
+        level_flags = 0;
+    }
+    else if (level < 6) {
+        level_flags = 1;
+    }
+    else if (level == 6) {
+        level_flags = 2;
+    }
+    else {
+        level_flags = 3;
+    }
+
+    header = (0x78 << 8) | (level_flags << 6);
+    header += 31 - header % 31;
+
+    return header;
+}
+
+size_t zlib_compress_parallel_bound(size_t size)
+{
+    size_t n_segments = size / ZLIB_SEGMENT_SIZE;
+    size_t last_size = size % ZLIB_SEGMENT_SIZE;
+    size_t bound;
+
+    if (size > ULONG_MAX / 2) {
+        return 0;
+    }
+
+    /* zlib header and Adler-32 trailer. */
+    bound = 2 + 4;
+    bound += n_segments * zlib_segment_bound(ZLIB_SEGMENT_SIZE);
+    if (last_size > 0 || n_segments == 0) {
+        bound += zlib_segment_bound(last_size);
+    }
+
+    return MAX(bound, zlib_compress_bound(size));
+}
+
+size_t zlib_compress_options_bound(size_t size,
+                                   const struct compress_options *options)
+{
+    if (options && options->threads) {
+        return zlib_compress_parallel_bound(size);
+    }
+
+    return zlib_compress_bound(size);
+}
+
+ssize_t zlib_compress_parallel(struct cregion src, struct region dest,
+                               int level, unsigned threads)
+{
+    struct zlib_job job = { .src = src, .level = level };
+    unsigned char *out_buffer = NULL;
+    pthread_t *workers = NULL;
+    unsigned n_workers = 0;
+    unsigned char *out;
+    unsigned header;
+    uLong adler;
+    size_t i;
+
+    if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+        return -1;
+    }
+
+    job.n_segments = (src.size + ZLIB_SEGMENT_SIZE - 1) / ZLIB_SEGMENT_SIZE;
+    if (job.n_segments <= 1) {
+        return zlib_compress_level(src, dest, level);
+    }
+
+    if (threads == 0) {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n_cpus > 0 ? n_cpus : 1;
+    }
+
+    threads = MIN(threads, job.n_segments);
+
+    job.segments = calloc(job.n_segments, sizeof(*job.segments));
+    out_buffer = malloc(job.n_segments * zlib_segment_bound(ZLIB_SEGMENT_SIZE));
+    if (threads > 1) {
+        workers = malloc((threads - 1) * sizeof(*workers));
+    }
+
+    if (!job.segments || !out_buffer || (threads > 1 && !workers)) {
+        goto out_error;
+    }
+
+    for (i = 0; i < job.n_segments; ++i) {
+        struct zlib_segment *segment = &job.segments[i];
+
+        segment->offset = i * ZLIB_SEGMENT_SIZE;
+        segment->size = MIN(ZLIB_SEGMENT_SIZE, src.size - segment->offset);
+        segment->out = out_buffer + i * zlib_segment_bound(ZLIB_SEGMENT_SIZE);
+    }
+
+    atomic_init(&job.next_segment, 0);
+    atomic_init(&job.failed, false);
+
+    /* The calling thread is one of the workers. */
+    for (; n_workers < threads - 1; ++n_workers) {
+        if (pthread_create(&workers[n_workers], NULL, zlib_worker, &job)) {
+            break;
+        }
+    }
+
+    zlib_worker(&job);
+
+    for (unsigned j = 0; j < n_workers; ++j) {
+        pthread_join(workers[j], NULL);
+    }
+
+    if (atomic_load(&job.failed)) {
+        goto out_error;
+    }
+
+    /*
+     * Stitch the segments together.
+     */
+    if (dest.size < 2 + 4) {
+        goto out_error;
+    }
+
+    out = dest.data;
+    header = zlib_header(level);
+    *out++ = header >> 8;
+    *out++ = header & 0xff;
+
+    adler = adler32(0, NULL, 0);
+    for (i = 0; i < job.n_segments; ++i) {
+        struct zlib_segment *segment = &job.segments[i];
+
+        if ((size_t)(out - (unsigned char *)dest.data) + segment->out_size + 4 >
+            dest.size) {
+            goto out_error;
+        }
+
+        memcpy(out, segment->out, segment->out_size);
+        out += segment->out_size;
+        adler = adler32_combine(adler, segment->adler, segment->size);
+    }
+
+    /* Adler-32 of all the data, most significant byte first. */
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        *out++ = (adler >> shift) & 0xff;
+    }
+
+    free(workers);
+    free(out_buffer);
+    free(job.segments);
+
+    return out - (unsigned char *)dest.data;
+
+out_error:
+    free(workers);
+    free(out_buffer);
+    free(job.segments);
 
     return -1;
 }
@@ -66,7 +468,6 @@ ssize_t lz4_decompress(struct cregion src, struct region dest)
     result = LZ4_decompress_safe(src.data, dest.data, src.size, dest.size);
 
     if (result < 0) {
-        eprintf("lz4_decompress: data malformed\n");
         return -1;
     }
 
@@ -80,9 +481,624 @@ ssize_t zlib_decompress(struct cregion src, struct region dest)
     zdest_len = dest.size;
 
     if (uncompress(dest.data, &zdest_len, src.data, src.size) != Z_OK) {
-        eprintf("zlib_decompress: decompression failed\n");
         return -1;
     }
 
     return zdest_len;
 }
+
+/*
+ * Decompression of a whole LZ4 block or zlib stream on a background
+ * thread. The thread publishes its progress a window at a time, so that
+ * the output can be read while the rest is being decompressed.
+ */
+struct decompress_stream {
+    /*
+     * Decompress at least size more bytes unless the data ends first.
+     * Return the number of bytes decompressed in total or -1 on failure.
+     * Set finished when the data has ended.
+     */
+    ssize_t (*step)(struct decompress_stream *stream, size_t size);
+    bool finished;
+
+    const unsigned char *src;
+    const unsigned char *src_end;
+    unsigned char *dest;
+    unsigned char *out;
+    unsigned char *dest_end;
+    z_stream zstream;
+    bool zstream_initialized;
+
+    size_t window;
+    pthread_t thread;
+    bool threaded;
+    atomic_bool stop;
+
+    /* Protected by lock. */
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+    size_t decompressed;
+    bool done;
+    bool failed;
+};
+
+/*
+ * Read the extra length bytes of an LZ4 literal or match length.
+ */
+static bool lz4_read_length(struct decompress_stream *stream, size_t *length)
+{
+    unsigned byte;
+
+    do {
+        if (stream->src == stream->src_end) {
+            return false;
+        }
+
+        byte = *stream->src++;
+        *length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+/*
+ * Decode LZ4 sequences. Each sequence is a run of literals followed by a
+ * match: a copy of earlier output. The last sequence has no match.
+ */
+static ssize_t lz4_step(struct decompress_stream *stream, size_t size)
+{
+    size_t target = stream->out - stream->dest;
+
+    target += MIN(size, (size_t)(stream->dest_end - stream->out));
+
+    /* A full dest must still be followed by the end of the data. */
+    while (!stream->finished &&
+           ((size_t)(stream->out - stream->dest) < target ||
+            stream->out == stream->dest_end)) {
+        size_t literal_length;
+        size_t match_length;
+        size_t offset;
+        unsigned token;
+
+        if (stream->src == stream->src_end) {
+            return -1;
+        }
+
+        token = *stream->src++;
+
+        literal_length = token >> 4;
+        if (literal_length == 15 &&
+            !lz4_read_length(stream, &literal_length)) {
+            return -1;
+        }
+
+        if (literal_length > (size_t)(stream->src_end - stream->src) ||
+            literal_length > (size_t)(stream->dest_end - stream->out)) {
+            return -1;
+        }
+
+        memcpy(stream->out, stream->src, literal_length);
+        stream->out += literal_length;
+        stream->src += literal_length;
+
+        if (stream->src == stream->src_end) {
+            stream->finished = true;
+            break;
+        }
+
+        if (stream->src_end - stream->src < 2) {
+            return -1;
+        }
+
+        offset = stream->src[0] | (stream->src[1] << 8);
+        stream->src += 2;
+
+        match_length = token & 15;
+        if (match_length == 15 && !lz4_read_length(stream, &match_length)) {
+            return -1;
+        }
+
+        match_length += 4;
+
+        if (offset == 0 || offset > (size_t)(stream->out - stream->dest) ||
+            match_length > (size_t)(stream->dest_end - stream->out)) {
+            return -1;
+        }
+
+        if (offset >= match_length) {
+            memcpy(stream->out, stream->out - offset, match_length);
+            stream->out += match_length;
+        }
+        else {
+            /* The match overlaps itself: copy it a period at a time. */
+            const unsigned char *match = stream->out - offset;
+
+            while (match_length > 0) {
+                size_t n = MIN(offset, match_length);
+
+                memcpy(stream->out, match, n);
+                stream->out += n;
+                match_length -= n;
+                offset += n;
+            }
+        }
+    }
+
+    return stream->out - stream->dest;
+}
+
+static ssize_t zlib_step(struct decompress_stream *stream, size_t size)
+{
+    size_t target = stream->out - stream->dest;
+
+    target += MIN(size, (size_t)(stream->dest_end - stream->out));
+
+    do {
+        int result;
+
+        stream->zstream.next_out = stream->out;
+        stream->zstream.avail_out =
+            MIN(target - (stream->out - stream->dest), UINT_MAX);
+
+        result = inflate(&stream->zstream, Z_NO_FLUSH);
+        stream->out = stream->zstream.next_out;
+
+        if (result == Z_STREAM_END) {
+            stream->finished = true;
+        }
+        else if (result != Z_OK) {
+            /* Malformed, or more data than fits in dest. */
+            return -1;
+        }
+    } while (!stream->finished && (size_t)(stream->out - stream->dest) < target);
+
+    return stream->out - stream->dest;
+}
+
+static void *decompress_thread(void *arg)
+{
+    struct decompress_stream *stream = arg;
+    bool done;
+
+    do {
+        ssize_t total = stream->step(stream, stream->window);
+
+        pthread_mutex_lock(&stream->lock);
+        if (total == -1) {
+            stream->failed = true;
+        }
+        else {
+            stream->decompressed = total;
+        }
+
+        done = stream->done = total == -1 || stream->finished;
+        pthread_cond_broadcast(&stream->progress);
+        pthread_mutex_unlock(&stream->lock);
+    } while (!done && !atomic_load(&stream->stop));
+
+    return NULL;
+}
+
+static struct decompress_stream *
+decompress_start(struct decompress_stream *stream, size_t window)
+{
+    stream->window = MAX(window, 1);
+    stream->out = stream->dest;
+    atomic_init(&stream->stop, false);
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->progress, NULL);
+
+    stream->threaded =
+        pthread_create(&stream->thread, NULL, decompress_thread, stream) == 0;
+    if (!stream->threaded) {
+        /* Decompress everything now instead. */
+        stream->window = SIZE_MAX;
+        decompress_thread(stream);
+    }
+
+    return stream;
+}
+
+struct decompress_stream *lz4_decompress_start(struct cregion src,
+                                               struct region dest,
+                                               size_t window)
+{
+    struct decompress_stream *stream = calloc(1, sizeof(*stream));
+
+    if (!stream) {
+        return NULL;
+    }
+
+    stream->step = lz4_step;
+    stream->src = src.data;
+    stream->src_end = stream->src + src.size;
+    stream->dest = dest.data;
+    stream->dest_end = stream->dest + dest.size;
+
+    return decompress_start(stream, window);
+}
+
+struct decompress_stream *zlib_decompress_start(struct cregion src,
+                                                struct region dest,
+                                                size_t window)
+{
+    struct decompress_stream *stream = calloc(1, sizeof(*stream));
+
+    if (!stream) {
+        return NULL;
+    }
+
+    if (src.size > UINT_MAX || inflateInit(&stream->zstream) != Z_OK) {
+        free(stream);
+        return NULL;
+    }
+
+    stream->step = zlib_step;
+    stream->zstream_initialized = true;
+    stream->zstream.next_in = (Bytef *)src.data;
+    stream->zstream.avail_in = src.size;
+    stream->dest = dest.data;
+    stream->dest_end = stream->dest + dest.size;
+
+    return decompress_start(stream, window);
+}
+
+ssize_t decompress_stream_wait(struct decompress_stream *stream, size_t have)
+{
+    ssize_t result;
+
+    pthread_mutex_lock(&stream->lock);
+    while (!stream->done && stream->decompressed <= have) {
+        pthread_cond_wait(&stream->progress, &stream->lock);
+    }
+
+    result = stream->failed ? -1 : (ssize_t)stream->decompressed;
+    pthread_mutex_unlock(&stream->lock);
+
+    return result;
+}
+
+ssize_t decompress_stream_end(struct decompress_stream *stream)
+{
+    ssize_t result;
+
+    atomic_store(&stream->stop, true);
+    if (stream->threaded) {
+        pthread_join(stream->thread, NULL);
+    }
+
+    result = stream->failed ? -1 : (ssize_t)stream->decompressed;
+    if (stream->zstream_initialized) {
+        inflateEnd(&stream->zstream);
+    }
+
+    pthread_cond_destroy(&stream->progress);
+    pthread_mutex_destroy(&stream->lock);
+    free(stream);
+
+    return result;
+}
+
+#ifdef COMPILE_WITH_UNIT_TESTS
+
+#define TEST_SUITE(TEST_CASE)                                                  \
+    TEST_CASE(zlib_compress_round_trip)                                        \
+    TEST_CASE(zlib_compress_within_bound)                                      \
+    TEST_CASE(zlib_compress_fails_when_dest_is_small)                          \
+    TEST_CASE(zlib_compress_parallel_round_trip)                               \
+    TEST_CASE(compress_options_round_trip)                                     \
+    TEST_CASE(decompress_stream_round_trip)                                    \
+    TEST_CASE(decompress_stream_malformed)
+
+#include "unit_tests.h"
+
+#define TEST_DATA_SIZE (256u * 1024u)
+
+/* Half text-like, half random. */
+static unsigned char *make_test_data(size_t size)
+{
+    unsigned char *data = malloc(size);
+
+    ASSERT_NOT_NULL(data);
+
+    for (size_t i = 0; i < size / 2; ++i) {
+        data[i] = "change form "[i % 12];
+    }
+
+    srand(1);
+    for (size_t i = size / 2; i < size; ++i) {
+        data[i] = rand();
+    }
+
+    return data;
+}
+
+UNIT_TEST(zlib_compress_round_trip)
+{
+    static const int levels[] = { Z_DEFAULT_COMPRESSION, 0, 1, 6, 9 };
+    size_t bound = zlib_compress_bound(TEST_DATA_SIZE);
+    unsigned char *data = make_test_data(TEST_DATA_SIZE);
+    unsigned char *compressed = malloc(bound);
+    unsigned char *decompressed = malloc(TEST_DATA_SIZE);
+
+    ASSERT_NOT_NULL(compressed);
+    ASSERT_NOT_NULL(decompressed);
+
+    for (size_t i = 0; i < ARRAY_LEN(levels); ++i) {
+        ssize_t compress_size;
+
+        compress_size =
+            zlib_compress_level(make_cregion(data, TEST_DATA_SIZE),
+                                make_region(compressed, bound), levels[i]);
+        ASSERT_NE(compress_size, -1);
+
+        ASSERT_EQ(zlib_decompress(make_cregion(compressed, compress_size),
+                                  make_region(decompressed, TEST_DATA_SIZE)),
+                  TEST_DATA_SIZE);
+        ASSERT_EQ_MEM(decompressed, TEST_DATA_SIZE, data, TEST_DATA_SIZE);
+    }
+
+    ASSERT_EQ(zlib_compress_level(make_cregion(data, TEST_DATA_SIZE),
+                                  make_region(compressed, bound), 10),
+              -1);
+
+    free(decompressed);
+    free(compressed);
+    free(data);
+}
+
+UNIT_TEST(zlib_compress_within_bound)
+{
+    size_t bound = zlib_compress_bound(TEST_DATA_SIZE);
+    unsigned char *data = make_test_data(TEST_DATA_SIZE);
+    unsigned char *compressed = malloc(bound);
+
+    ASSERT_NOT_NULL(compressed);
+
+    /* Random data does not compress, but still fits. */
+    bound = zlib_compress_bound(TEST_DATA_SIZE / 2);
+    ASSERT_NE(zlib_compress(make_cregion(data + TEST_DATA_SIZE / 2,
+                                         TEST_DATA_SIZE / 2),
+                            make_region(compressed, bound), NULL),
+              -1);
+
+    /* So does nothing. */
+    bound = zlib_compress_bound(0);
+    ASSERT_NE(zlib_compress(make_cregion(data, 0),
+                            make_region(compressed, bound), NULL),
+              -1);
+
+    free(compressed);
+    free(data);
+}
+
+UNIT_TEST(zlib_compress_fails_when_dest_is_small)
+{
+    unsigned char *data = make_test_data(TEST_DATA_SIZE);
+    unsigned char compressed[64];
+
+    ASSERT_EQ(zlib_compress(make_cregion(data, TEST_DATA_SIZE),
+                            make_region(compressed, sizeof(compressed)), NULL),
+              -1);
+
+    free(data);
+}
+
+UNIT_TEST(zlib_compress_parallel_round_trip)
+{
+    static const unsigned thread_counts[] = { 1, 2, 4, 0 };
+    size_t size = 5 * TEST_DATA_SIZE + 1000;
+    size_t bound = zlib_compress_parallel_bound(size);
+    unsigned char *data = make_test_data(size);
+    unsigned char *first = malloc(bound);
+    unsigned char *compressed = malloc(bound);
+    unsigned char *decompressed = malloc(size);
+    ssize_t first_size;
+
+    ASSERT_NOT_NULL(first);
+    ASSERT_NOT_NULL(compressed);
+    ASSERT_NOT_NULL(decompressed);
+
+    first_size = zlib_compress_parallel(make_cregion(data, size),
+                                        make_region(first, bound), 6, 1);
+    ASSERT_NE(first_size, -1);
+
+    /* Output does not depend on the number of threads. */
+    for (size_t i = 0; i < ARRAY_LEN(thread_counts); ++i) {
+        ssize_t compress_size;
+
+        compress_size =
+            zlib_compress_parallel(make_cregion(data, size),
+                                   make_region(compressed, bound), 6,
+                                   thread_counts[i]);
+        ASSERT_EQ_MEM(compressed, compress_size, first, first_size);
+    }
+
+    /* It is one valid zlib stream. */
+    ASSERT_EQ(zlib_decompress(make_cregion(first, first_size),
+                              make_region(decompressed, size)),
+              size);
+    ASSERT_EQ_MEM(decompressed, size, data, size);
+
+    /* Same header as a single stream. */
+    ASSERT_NE(zlib_compress(make_cregion(data, size),
+                            make_region(compressed, bound), NULL),
+              -1);
+    ASSERT_EQ_MEM(first, 2, compressed, 2);
+
+    /* Incompressible input still fits in the bound. */
+    ASSERT_NE(zlib_compress_parallel(make_cregion(data + size / 2, size / 2),
+                                     make_region(compressed,
+                                                 zlib_compress_parallel_bound(
+                                                     size / 2)),
+                                     9, 0),
+              -1);
+
+    ASSERT_EQ(zlib_compress_parallel(make_cregion(data, size),
+                                     make_region(compressed, first_size - 1),
+                                     6, 2),
+              -1);
+
+    free(decompressed);
+    free(compressed);
+    free(first);
+    free(data);
+}
+
+static void check_round_trip(compress_fn_t compress,
+                             decompress_fn_t decompress,
+                             const struct compress_options *options)
+{
+    size_t bound = MAX(lz4_compress_bound(TEST_DATA_SIZE),
+                       zlib_compress_parallel_bound(TEST_DATA_SIZE));
+    unsigned char *data = make_test_data(TEST_DATA_SIZE);
+    unsigned char *compressed = malloc(bound);
+    unsigned char *decompressed = malloc(TEST_DATA_SIZE);
+    ssize_t compress_size;
+
+    ASSERT_NOT_NULL(compressed);
+    ASSERT_NOT_NULL(decompressed);
+
+    compress_size = compress(make_cregion(data, TEST_DATA_SIZE),
+                             make_region(compressed, bound), options);
+    ASSERT_NE(compress_size, -1);
+    ASSERT_EQ(decompress(make_cregion(compressed, compress_size),
+                         make_region(decompressed, TEST_DATA_SIZE)),
+              TEST_DATA_SIZE);
+    ASSERT_EQ_MEM(decompressed, TEST_DATA_SIZE, data, TEST_DATA_SIZE);
+
+    free(decompressed);
+    free(compressed);
+    free(data);
+}
+
+UNIT_TEST(compress_options_round_trip)
+{
+    static const struct compress_options lz4_option_sets[] = {
+        { 0 },
+        { .acceleration = 8 },
+        { .level = LZ4HC_CLEVEL_MIN },
+        { .level = LZ4HC_CLEVEL_MAX },
+    };
+    static const struct compress_options zlib_option_sets[] = {
+        { 0 },
+        { .level = 1 },
+        { .level = 9, .threads = 2 },
+    };
+
+    check_round_trip(lz4_compress, lz4_decompress, NULL);
+    for (size_t i = 0; i < ARRAY_LEN(lz4_option_sets); ++i) {
+        check_round_trip(lz4_compress, lz4_decompress, &lz4_option_sets[i]);
+    }
+
+    check_round_trip(zlib_compress, zlib_decompress, NULL);
+    for (size_t i = 0; i < ARRAY_LEN(zlib_option_sets); ++i) {
+        check_round_trip(zlib_compress, zlib_decompress, &zlib_option_sets[i]);
+    }
+}
+
+/*
+ * Compress test data with the given compressor and decompress it as a
+ * stream, reading the output as it becomes available.
+ */
+static void check_stream(compress_fn_t compress,
+                         struct decompress_stream *(*start)(struct cregion,
+                                                            struct region,
+                                                            size_t),
+                         size_t window)
+{
+    size_t size = 3 * TEST_DATA_SIZE + 123;
+    size_t bound = MAX(lz4_compress_bound(size), zlib_compress_bound(size));
+    unsigned char *data = make_test_data(size);
+    unsigned char *compressed = malloc(bound);
+    unsigned char *decompressed = malloc(size);
+    struct decompress_stream *stream;
+    ssize_t compress_size;
+    size_t have = 0;
+    ssize_t available;
+
+    ASSERT_NOT_NULL(compressed);
+    ASSERT_NOT_NULL(decompressed);
+
+    compress_size = compress(make_cregion(data, size),
+                             make_region(compressed, bound), NULL);
+    ASSERT_NE(compress_size, -1);
+
+    stream = start(make_cregion(compressed, compress_size),
+                   make_region(decompressed, size), window);
+    ASSERT_NOT_NULL(stream);
+
+    while ((available = decompress_stream_wait(stream, have)) > (ssize_t)have) {
+        /* What is available is final. */
+        ASSERT_EQ_MEM(decompressed + have, available - have, data + have,
+                      available - have);
+        have = available;
+    }
+
+    ASSERT_EQ(available, size);
+    ASSERT_EQ(decompress_stream_end(stream), size);
+
+    free(decompressed);
+    free(compressed);
+    free(data);
+}
+
+UNIT_TEST(decompress_stream_round_trip)
+{
+    static const size_t windows[] = { 1, 1000, 64 * 1024, SIZE_MAX };
+
+    for (size_t i = 0; i < ARRAY_LEN(windows); ++i) {
+        check_stream(lz4_compress, lz4_decompress_start, windows[i]);
+        check_stream(zlib_compress, zlib_decompress_start, windows[i]);
+    }
+}
+
+UNIT_TEST(decompress_stream_malformed)
+{
+    unsigned char *data = make_test_data(TEST_DATA_SIZE);
+    size_t bound = lz4_compress_bound(TEST_DATA_SIZE);
+    unsigned char *compressed = malloc(bound);
+    unsigned char *decompressed = malloc(TEST_DATA_SIZE);
+    struct decompress_stream *stream;
+    ssize_t compress_size;
+
+    ASSERT_NOT_NULL(compressed);
+    ASSERT_NOT_NULL(decompressed);
+
+    compress_size = lz4_compress(make_cregion(data, TEST_DATA_SIZE),
+                                 make_region(compressed, bound), NULL);
+    ASSERT_NE(compress_size, -1);
+
+    /* Truncated data. */
+    stream = lz4_decompress_start(make_cregion(compressed, compress_size / 2),
+                                  make_region(decompressed, TEST_DATA_SIZE),
+                                  4096);
+    ASSERT_NOT_NULL(stream);
+    ASSERT_EQ(decompress_stream_wait(stream, TEST_DATA_SIZE), -1);
+    ASSERT_EQ(decompress_stream_end(stream), -1);
+
+    /* More data than fits. */
+    stream = lz4_decompress_start(make_cregion(compressed, compress_size),
+                                  make_region(decompressed, TEST_DATA_SIZE - 1),
+                                  4096);
+    ASSERT_NOT_NULL(stream);
+    ASSERT_EQ(decompress_stream_wait(stream, TEST_DATA_SIZE), -1);
+    ASSERT_EQ(decompress_stream_end(stream), -1);
+
+    compress_size = zlib_compress(make_cregion(data, TEST_DATA_SIZE),
+                                  make_region(compressed, bound), NULL);
+    ASSERT_NE(compress_size, -1);
+
+    stream = zlib_decompress_start(make_cregion(compressed, compress_size / 2),
+                                   make_region(decompressed, TEST_DATA_SIZE),
+                                   4096);
+    ASSERT_NOT_NULL(stream);
+    ASSERT_EQ(decompress_stream_wait(stream, TEST_DATA_SIZE), -1);
+    ASSERT_EQ(decompress_stream_end(stream), -1);
+
+    free(decompressed);
+    free(compressed);
+    free(data);
+}
+
+#endif /* COMPILE_WITH_UNIT_TESTS */
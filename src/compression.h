@@ -22,14 +22,65 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <sys/types.h>
 #include "mem_types.h"
 
-typedef ssize_t (*compress_fn_t)(struct cregion src, struct region dest);
+/*
+ * Nothing here prints anything. Failures are only returned, and it is up to
+ * the caller to report them.
+ */
+
+/*
+ * Tuning of the compressors. Zero initialized options, like NULL options,
+ * select the defaults.
+ */
+struct compress_options {
+    /*
+     * Compression level or 0 for the default. For LZ4, a level selects
+     * LZ4_compress_HC() at that level, from LZ4HC_CLEVEL_MIN (3) to
+     * LZ4HC_CLEVEL_MAX (12). For zlib, it is the deflate level from 1
+     * to 9.
+     */
+    int level;
+
+    /*
+     * LZ4 acceleration when level is 0. Values above 1 compress faster
+     * and less with LZ4_compress_fast().
+     */
+    int acceleration;
+
+    /*
+     * If not 0, zlib compresses on this many threads with
+     * zlib_compress_parallel(). The default is a single stream.
+     */
+    unsigned threads;
+};
+
+typedef ssize_t (*compress_fn_t)(struct cregion src, struct region dest,
+                                 const struct compress_options *options);
 typedef ssize_t (*decompress_fn_t)(struct cregion src, struct region dest);
 
 /*
  * Return compressed size on success or -1 on failure.
  */
-ssize_t lz4_compress(struct cregion src, struct region dest);
-ssize_t zlib_compress(struct cregion src, struct region dest);
+ssize_t lz4_compress(struct cregion src, struct region dest,
+                     const struct compress_options *options);
+ssize_t zlib_compress(struct cregion src, struct region dest,
+                      const struct compress_options *options);
+
+/*
+ * Compress at the given zlib level, from Z_NO_COMPRESSION (0) for speed to
+ * Z_BEST_COMPRESSION (9) for size.
+ * Return compressed size on success or -1 on failure.
+ */
+ssize_t zlib_compress_level(struct cregion src, struct region dest, int level);
+
+/*
+ * Compress into a single zlib stream on the given number of threads, or on
+ * as many threads as there are processors if threads is 0. The input is
+ * deflated in independent segments, so the result differs slightly from
+ * that of zlib_compress_level() but does not depend on the number of
+ * threads. Return compressed size on success or -1 on failure.
+ */
+ssize_t zlib_compress_parallel(struct cregion src, struct region dest,
+                               int level, unsigned threads);
 
 /*
  * Return uncompressed size on success or -1 on failure.
@@ -37,4 +88,51 @@ ssize_t zlib_compress(struct cregion src, struct region dest);
 ssize_t lz4_decompress(struct cregion src, struct region dest);
 ssize_t zlib_decompress(struct cregion src, struct region dest);
 
+/*
+ * Decompress only the first dest.size bytes, or less if the data ends
+ * sooner. Return the decompressed size on success or -1 on failure.
+ */
+ssize_t lz4_decompress_partial(struct cregion src, struct region dest);
+ssize_t zlib_decompress_partial(struct cregion src, struct region dest);
+
+/*
+ * Decompress an LZ4 block or a zlib stream on a background thread so that
+ * the output can be read while it is being produced. Progress is published
+ * window bytes at a time. Return NULL on failure.
+ */
+struct decompress_stream;
+struct decompress_stream *lz4_decompress_start(struct cregion src,
+                                               struct region dest,
+                                               size_t window);
+struct decompress_stream *zlib_decompress_start(struct cregion src,
+                                                struct region dest,
+                                                size_t window);
+
+/*
+ * Wait until more than have bytes of dest are decompressed. Return the
+ * number of bytes decompressed so far, which is have only if the data has
+ * ended, or -1 if the data is malformed.
+ */
+ssize_t decompress_stream_wait(struct decompress_stream *stream, size_t have);
+
+/*
+ * Stop decompressing if not done and free the stream. Return the number of
+ * bytes decompressed or -1 if the data is malformed.
+ */
+ssize_t decompress_stream_end(struct decompress_stream *stream);
+
+/*
+ * Return the maximum compressed size of size bytes of input or 0 if the
+ * input is too large to be compressed.
+ */
+size_t lz4_compress_bound(size_t size);
+size_t zlib_compress_bound(size_t size);
+size_t zlib_compress_parallel_bound(size_t size);
+
+/*
+ * Like the above but for zlib_compress() with the given options.
+ */
+size_t zlib_compress_options_bound(size_t size,
+                                   const struct compress_options *options);
+
 #endif /* CEGSE_COMPRESSION_H */
@@ -0,0 +1,236 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * Measure the speed and ratio of each compression setting on the save data
+ * of the compressed save files in a directory.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compression.h"
+#include "defines.h"
+#include "mem_types.h"
+#include "savefile.h"
+
+/* Each setting is timed this many times and the fastest run counts. */
+#define BENCH_RUNS 3
+
+static const struct setting {
+    const char *name;
+    compress_fn_t compress;
+    struct compress_options options;
+} settings[] = {
+    { "lz4", lz4_compress, { 0 } },
+    { "lz4 acceleration 4", lz4_compress, { .acceleration = 4 } },
+    { "lz4 acceleration 16", lz4_compress, { .acceleration = 16 } },
+    { "lz4hc level 3", lz4_compress, { .level = 3 } },
+    { "lz4hc level 9", lz4_compress, { .level = 9 } },
+    { "lz4hc level 12", lz4_compress, { .level = 12 } },
+    { "zlib level 1", zlib_compress, { .level = 1 } },
+    { "zlib level 6", zlib_compress, { .level = 6 } },
+    { "zlib level 9", zlib_compress, { .level = 9 } },
+    { "zlib level 6, 4 threads", zlib_compress, { .level = 6, .threads = 4 } },
+};
+
+struct body {
+    unsigned char *data;
+    size_t size;
+};
+
+static double seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned char *read_entire_file(const char *filename, size_t *size)
+{
+    unsigned char *data = NULL;
+    FILE *stream;
+    long length;
+
+    stream = fopen(filename, "rb");
+    if (!stream) {
+        return NULL;
+    }
+
+    if (fseek(stream, 0, SEEK_END) == 0 && (length = ftell(stream)) > 0 &&
+        fseek(stream, 0, SEEK_SET) == 0 && (data = malloc(length)) &&
+        fread(data, 1, length, stream) == (size_t)length) {
+        *size = length;
+    }
+    else {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(stream);
+    return data;
+}
+
+/*
+ * Decompress the save data of a save file. Return false if the file has no
+ * compressed save data.
+ */
+static bool load_body(const char *filename, struct body *body)
+{
+    struct savefile_scan scan;
+    unsigned char *file;
+    size_t file_size;
+    bool ok = false;
+
+    file = read_entire_file(filename, &file_size);
+    if (!file) {
+        return false;
+    }
+
+    if (cengine_savefile_scan(NULL, file, file_size, &scan) == -1) {
+        goto out;
+    }
+
+    if (scan.compressed && (body->data = malloc(scan.body_size))) {
+        memcpy(body->data, scan.body, scan.body_size);
+        body->size = scan.body_size;
+        ok = true;
+    }
+
+    savefile_scan_free(&scan);
+
+out:
+    free(file);
+    return ok;
+}
+
+static void bench_setting(const struct setting *setting,
+                          const struct body *bodies, size_t n_bodies,
+                          struct region buffer)
+{
+    double best_time = 0.0;
+    size_t total_in = 0;
+    size_t total_out = 0;
+
+    for (int run = 0; run < BENCH_RUNS; ++run) {
+        double start = seconds();
+        double time;
+
+        total_in = 0;
+        total_out = 0;
+
+        for (size_t i = 0; i < n_bodies; ++i) {
+            ssize_t size;
+
+            size = setting->compress(
+                make_cregion(bodies[i].data, bodies[i].size), buffer,
+                &setting->options);
+            if (size == -1) {
+                eprintf("%s: compression failed\n", setting->name);
+                return;
+            }
+
+            total_in += bodies[i].size;
+            total_out += size;
+        }
+
+        time = seconds() - start;
+        if (run == 0 || time < best_time) {
+            best_time = time;
+        }
+    }
+
+    printf("%-28s %10.1f MB/s %8.3f\n", setting->name,
+           total_in / 1e6 / MAX(best_time, 1e-9),
+           (double)total_in / MAX(total_out, 1));
+}
+
+int main(int argc, char **argv)
+{
+    const char *dirname = argc > 1 ? argv[1] : "samples";
+    struct body *bodies = NULL;
+    struct dirent *dirent;
+    size_t n_bodies = 0;
+    size_t max_size = 0;
+    struct region buffer;
+    DIR *dir;
+
+    dir = opendir(dirname);
+    if (!dir) {
+        eprintf("usage: %s [path/to/samples]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    while ((dirent = readdir(dir)) != NULL) {
+        char filename[512];
+        struct body *tmp;
+
+        if (dirent->d_type != DT_REG) {
+            continue;
+        }
+
+        snprintf(filename, sizeof(filename), "%s/%s", dirname, dirent->d_name);
+
+        tmp = realloc(bodies, (n_bodies + 1) * sizeof(*bodies));
+        if (!tmp) {
+            break;
+        }
+
+        bodies = tmp;
+        if (load_body(filename, &bodies[n_bodies])) {
+            max_size = MAX(max_size, bodies[n_bodies].size);
+            n_bodies++;
+        }
+    }
+
+    closedir(dir);
+
+    if (n_bodies == 0) {
+        eprintf("No compressed save files in %s\n", dirname);
+        free(bodies);
+        return EXIT_FAILURE;
+    }
+
+    buffer.size = MAX(lz4_compress_bound(max_size),
+                      zlib_compress_parallel_bound(max_size));
+    buffer.data = malloc(buffer.size);
+    if (!buffer.data) {
+        eprintf("Failed to allocate memory.\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu save files\n", n_bodies);
+    printf("%-28s %15s %8s\n", "setting", "speed", "ratio");
+
+    for (size_t i = 0; i < ARRAY_LEN(settings); ++i) {
+        bench_setting(&settings[i], bodies, n_bodies, buffer);
+    }
+
+    for (size_t i = 0; i < n_bodies; ++i) {
+        free(bodies[i].data);
+    }
+
+    free(bodies);
+    free(buffer.data);
+
+    return EXIT_SUCCESS;
+}
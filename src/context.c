@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "context.h"
+
+/* Errors go to stderr unless a context says otherwise. */
+static const struct cegse_ctx default_ctx = {
+    .logger.error = cegse_log_to_file,
+};
+
+const struct cegse_ctx *cegse_ctx_or_default(const struct cegse_ctx *ctx)
+{
+    return ctx ? ctx : &default_ctx;
+}
+
+void *cegse_malloc(const struct cegse_ctx *ctx, size_t size)
+{
+    const struct cegse_allocator *allocator = &ctx->allocator;
+
+    if (allocator->malloc) {
+        return allocator->malloc(allocator->opaque, size);
+    }
+
+    return malloc(size);
+}
+
+void *cegse_calloc(const struct cegse_ctx *ctx, size_t n, size_t size)
+{
+    void *ptr;
+
+    if (!ctx->allocator.malloc) {
+        return calloc(n, size);
+    }
+
+    if (size != 0 && n > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    ptr = cegse_malloc(ctx, n * size);
+    if (ptr) {
+        memset(ptr, 0, n * size);
+    }
+
+    return ptr;
+}
+
+void *cegse_realloc(const struct cegse_ctx *ctx, void *ptr, size_t size)
+{
+    const struct cegse_allocator *allocator = &ctx->allocator;
+
+    if (allocator->realloc) {
+        return allocator->realloc(allocator->opaque, ptr, size);
+    }
+
+    return realloc(ptr, size);
+}
+
+void cegse_free(const struct cegse_ctx *ctx, void *ptr)
+{
+    const struct cegse_allocator *allocator = &ctx->allocator;
+
+    if (allocator->free) {
+        allocator->free(allocator->opaque, ptr);
+    }
+    else {
+        free(ptr);
+    }
+}
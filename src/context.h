@@ -0,0 +1,84 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef CEGSE_CONTEXT_H
+#define CEGSE_CONTEXT_H
+
+#include <stddef.h>
+
+#include "log.h"
+#include "savefile.h"
+
+/*
+ * Allocator of a context. The functions behave like malloc(), realloc()
+ * and free(). Either all or none of them are set; none means the functions
+ * of the C library.
+ */
+struct cegse_allocator {
+    void *(*malloc)(void *opaque, size_t size);
+    void *(*realloc)(void *opaque, void *ptr, size_t size);
+    void (*free)(void *opaque, void *ptr);
+    void *opaque;
+};
+
+/*
+ * Everything that reading and writing save files depends on besides the
+ * arguments. A zeroed context logs nothing, allocates with malloc() and
+ * uses the default options. A NULL context is the same except that it
+ * logs errors to stderr.
+ *
+ * A savegame keeps the context it was read with and uses it until it is
+ * freed: its memory comes from the allocator, and reading, writing and
+ * freeing it are logged to the logger. The context must outlive it.
+ *
+ * The library has no global mutable state. Savegames read with distinct
+ * contexts can be read, written and freed on different threads at the
+ * same time. A context and the savegames read with it must be used by one
+ * thread at a time, unless the logger and the allocator of the context
+ * are thread-safe; the default ones are. The internal buffers of the
+ * compressors are allocated with malloc().
+ */
+struct cegse_ctx {
+    struct cegse_logger logger;
+    struct cegse_allocator allocator;
+
+    /* Used when NULL options are passed to a read or write function. */
+    struct savefile_read_options read_options;
+    struct savefile_write_options write_options;
+
+    /*
+     * If not NULL, the decompressed save data of every save file read is
+     * written to a file of this name for debugging.
+     */
+    const char *dump_filename;
+};
+
+/*
+ * Return the context or the default context if ctx is NULL.
+ */
+const struct cegse_ctx *cegse_ctx_or_default(const struct cegse_ctx *ctx);
+
+/*
+ * Allocate and free with the allocator of a context.
+ */
+void *cegse_malloc(const struct cegse_ctx *ctx, size_t size);
+void *cegse_calloc(const struct cegse_ctx *ctx, size_t n, size_t size);
+void *cegse_realloc(const struct cegse_ctx *ctx, void *ptr, size_t size);
+void cegse_free(const struct cegse_ctx *ctx, void *ptr);
+
+#endif /* CEGSE_CONTEXT_H */
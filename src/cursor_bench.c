@@ -0,0 +1,336 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * Compare the inline cursor API with calling a function for every field,
+ * on the field layouts of the file header, the weather and the player
+ * location objects.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "binary_stream.h"
+#include "defines.h"
+
+/* Objects serialized back to back per run. */
+#define BENCH_OBJECTS 100000
+
+/* Each variant is timed this many times and the fastest run counts. */
+#define BENCH_RUNS 5
+
+/* What every cursor API call cost before the API was inline. */
+#define DEFINE_CALLED_API(id, type, size)                                      \
+    __attribute__((noinline)) static void called_store_##id(struct cursor *c,  \
+                                                            type value)        \
+    {                                                                          \
+        c_store_##id(c, value);                                                \
+    }                                                                          \
+                                                                               \
+    __attribute__((noinline)) static type called_load_##id##_or0(              \
+        struct cursor *c)                                                      \
+    {                                                                          \
+        return c_load_##id##_or0(c);                                           \
+    }
+
+FOR_ALL_TYPES(DEFINE_CALLED_API)
+
+__attribute__((noinline)) static void called_store_bytes(struct cursor *c,
+                                                         const void *bytes,
+                                                         size_t n)
+{
+    c_store_bytes(c, bytes, n);
+}
+
+__attribute__((noinline)) static int called_load_bytes(struct cursor *c,
+                                                       void *dest, size_t n)
+{
+    return c_load_bytes(c, dest, n);
+}
+
+#define INLINE_STORE(id) c_store_##id
+#define INLINE_LOAD(id)  c_load_##id##_or0
+#define CALLED_STORE(id) called_store_##id
+#define CALLED_LOAD(id)  called_load_##id##_or0
+
+struct header {
+    uint32_t file_version;
+    uint32_t save_num;
+    char player_name[16];
+    uint32_t level;
+    char location[16];
+    char game_time[16];
+    char race_id[16];
+    uint16_t sex;
+    float current_xp;
+    float target_xp;
+    uint64_t filetime;
+    uint32_t snapshot_width;
+    uint32_t snapshot_height;
+    uint16_t compressor;
+};
+
+struct weather {
+    uint32_t refs[6];
+    float current_time;
+    float begin_time;
+    float weather_pct;
+    uint32_t data1[6];
+    float data2;
+    uint32_t data3;
+    uint8_t flags;
+    unsigned char data4[30];
+};
+
+struct player_location {
+    uint32_t next_object_id;
+    uint32_t world_space1;
+    int32_t coord_x;
+    int32_t coord_y;
+    uint32_t world_space2;
+    float pos_x;
+    float pos_y;
+    float pos_z;
+    uint8_t unknown;
+};
+
+/*
+ * Define functions that store and load the objects like the serializer and
+ * the deserializer do, with the given variant of the cursor API.
+ */
+#define DEFINE_OBJECT_API(variant, STORE, LOAD, store_bytes, load_bytes)       \
+    static void variant##_store_string(struct cursor *c, const char *s)        \
+    {                                                                          \
+        uint16_t length = strlen(s);                                           \
+        STORE(le16)(c, length);                                                \
+        store_bytes(c, s, length);                                             \
+    }                                                                          \
+                                                                               \
+    static void variant##_load_string(struct cursor *c, char *s, size_t size)  \
+    {                                                                          \
+        uint16_t length = LOAD(le16)(c);                                       \
+        if (length < size && load_bytes(c, s, length)) {                       \
+            s[length] = '\0';                                                  \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    static void variant##_store_header(struct cursor *c,                       \
+                                       const struct header *h)                 \
+    {                                                                          \
+        STORE(le32)(c, h->file_version);                                       \
+        STORE(le32)(c, h->save_num);                                           \
+        variant##_store_string(c, h->player_name);                             \
+        STORE(le32)(c, h->level);                                              \
+        variant##_store_string(c, h->location);                                \
+        variant##_store_string(c, h->game_time);                               \
+        variant##_store_string(c, h->race_id);                                 \
+        STORE(le16)(c, h->sex);                                                \
+        STORE(lef32)(c, h->current_xp);                                        \
+        STORE(lef32)(c, h->target_xp);                                         \
+        STORE(le64)(c, h->filetime);                                           \
+        STORE(le32)(c, h->snapshot_width);                                     \
+        STORE(le32)(c, h->snapshot_height);                                    \
+        STORE(le16)(c, h->compressor);                                         \
+    }                                                                          \
+                                                                               \
+    static void variant##_load_header(struct cursor *c, struct header *h)      \
+    {                                                                          \
+        h->file_version = LOAD(le32)(c);                                       \
+        h->save_num = LOAD(le32)(c);                                           \
+        variant##_load_string(c, h->player_name, sizeof(h->player_name));      \
+        h->level = LOAD(le32)(c);                                              \
+        variant##_load_string(c, h->location, sizeof(h->location));            \
+        variant##_load_string(c, h->game_time, sizeof(h->game_time));          \
+        variant##_load_string(c, h->race_id, sizeof(h->race_id));              \
+        h->sex = LOAD(le16)(c);                                                \
+        h->current_xp = LOAD(lef32)(c);                                        \
+        h->target_xp = LOAD(lef32)(c);                                         \
+        h->filetime = LOAD(le64)(c);                                           \
+        h->snapshot_width = LOAD(le32)(c);                                     \
+        h->snapshot_height = LOAD(le32)(c);                                    \
+        h->compressor = LOAD(le16)(c);                                         \
+    }                                                                          \
+                                                                               \
+    static void variant##_store_weather(struct cursor *c,                      \
+                                        const struct weather *w)               \
+    {                                                                          \
+        for (int i = 0; i < 6; ++i)                                            \
+            STORE(be24)(c, w->refs[i]);                                        \
+        STORE(lef32)(c, w->current_time);                                      \
+        STORE(lef32)(c, w->begin_time);                                        \
+        STORE(lef32)(c, w->weather_pct);                                       \
+        for (int i = 0; i < 6; ++i)                                            \
+            STORE(le32)(c, w->data1[i]);                                       \
+        STORE(lef32)(c, w->data2);                                             \
+        STORE(le32)(c, w->data3);                                              \
+        STORE(u8)(c, w->flags);                                                \
+        store_bytes(c, w->data4, sizeof(w->data4));                            \
+    }                                                                          \
+                                                                               \
+    static void variant##_load_weather(struct cursor *c, struct weather *w)    \
+    {                                                                          \
+        for (int i = 0; i < 6; ++i)                                            \
+            w->refs[i] = LOAD(be24)(c);                                        \
+        w->current_time = LOAD(lef32)(c);                                      \
+        w->begin_time = LOAD(lef32)(c);                                        \
+        w->weather_pct = LOAD(lef32)(c);                                       \
+        for (int i = 0; i < 6; ++i)                                            \
+            w->data1[i] = LOAD(le32)(c);                                       \
+        w->data2 = LOAD(lef32)(c);                                             \
+        w->data3 = LOAD(le32)(c);                                              \
+        w->flags = LOAD(u8)(c);                                                \
+        load_bytes(c, w->data4, sizeof(w->data4));                             \
+    }                                                                          \
+                                                                               \
+    static void variant##_store_player_location(                               \
+        struct cursor *c, const struct player_location *p)                     \
+    {                                                                          \
+        STORE(le32)(c, p->next_object_id);                                     \
+        STORE(be24)(c, p->world_space1);                                       \
+        STORE(le32)(c, p->coord_x);                                            \
+        STORE(le32)(c, p->coord_y);                                            \
+        STORE(be24)(c, p->world_space2);                                       \
+        STORE(lef32)(c, p->pos_x);                                             \
+        STORE(lef32)(c, p->pos_y);                                             \
+        STORE(lef32)(c, p->pos_z);                                             \
+        STORE(u8)(c, p->unknown);                                              \
+    }                                                                          \
+                                                                               \
+    static void variant##_load_player_location(struct cursor *c,               \
+                                               struct player_location *p)      \
+    {                                                                          \
+        p->next_object_id = LOAD(le32)(c);                                     \
+        p->world_space1 = LOAD(be24)(c);                                       \
+        p->coord_x = LOAD(le32)(c);                                            \
+        p->coord_y = LOAD(le32)(c);                                            \
+        p->world_space2 = LOAD(be24)(c);                                       \
+        p->pos_x = LOAD(lef32)(c);                                             \
+        p->pos_y = LOAD(lef32)(c);                                             \
+        p->pos_z = LOAD(lef32)(c);                                             \
+        p->unknown = LOAD(u8)(c);                                              \
+    }
+
+DEFINE_OBJECT_API(inline, INLINE_STORE, INLINE_LOAD, c_store_bytes,
+                  c_load_bytes)
+DEFINE_OBJECT_API(called, CALLED_STORE, CALLED_LOAD, called_store_bytes,
+                  called_load_bytes)
+
+static const struct header header = {
+    12, 7, "Prisoner", 12, "Whiterun", "000.01.02", "NordRace", 1, 1.5f,
+    100.0f, 133000000000000000ull, 320, 192, 2,
+};
+
+static const struct weather weather = {
+    { 0x400010, 0x400011, 0x400012, 0x400013, 0x400014, 0x400015 },
+    12.0f, 10.0f, 0.5f, { 0, 1, 2, 3, 4, 5 }, 1.0f, 2, 1,
+    "unknown data of the weather",
+};
+
+static const struct player_location player_location = {
+    0x1234, 0x40003c, 5, -3, 0x40003c, 1.0f, 2.0f, 3.0f, 1,
+};
+
+static double seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Time storing and loading BENCH_OBJECTS copies of an object with both
+ * variants and print the time per object.
+ */
+#define BENCH_OBJECT(name, object)                                             \
+    do {                                                                       \
+        double store_time[2] = { 0 };                                          \
+        double load_time[2] = { 0 };                                           \
+        struct name loaded;                                                    \
+                                                                               \
+        memset(&loaded, 0, sizeof(loaded));                                    \
+        for (int run = 0; run < BENCH_RUNS; ++run) {                           \
+            for (int v = 0; v < 2; ++v) {                                      \
+                struct cursor c = { buffer, buffer_size };                     \
+                double start = seconds();                                      \
+                double time;                                                   \
+                                                                               \
+                for (int i = 0; i < BENCH_OBJECTS; ++i) {                      \
+                    if (v == 0)                                                \
+                        inline_store_##name(&c, &object);                      \
+                    else                                                       \
+                        called_store_##name(&c, &object);                      \
+                }                                                              \
+                                                                               \
+                time = seconds() - start;                                      \
+                if (run == 0 || time < store_time[v])                          \
+                    store_time[v] = time;                                      \
+                                                                               \
+                c = (struct cursor){ buffer, buffer_size };                    \
+                start = seconds();                                             \
+                for (int i = 0; i < BENCH_OBJECTS; ++i) {                      \
+                    if (v == 0)                                                \
+                        inline_load_##name(&c, &loaded);                       \
+                    else                                                       \
+                        called_load_##name(&c, &loaded);                       \
+                }                                                              \
+                                                                               \
+                time = seconds() - start;                                      \
+                if (run == 0 || time < load_time[v])                           \
+                    load_time[v] = time;                                       \
+                                                                               \
+                if (memcmp(&loaded, &object, sizeof(object)) != 0) {           \
+                    eprintf("%s: loaded object differs\n", #name);             \
+                    return EXIT_FAILURE;                                       \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
+                                                                               \
+        printf("%-16s %-6s %10.1f %10.1f %7.2fx\n", #name, "store",          \
+               store_time[0] * 1e9 / BENCH_OBJECTS,                            \
+               store_time[1] * 1e9 / BENCH_OBJECTS,                            \
+               store_time[1] / MAX(store_time[0], 1e-12));                     \
+        printf("%-16s %-6s %10.1f %10.1f %7.2fx\n", #name, "load",           \
+               load_time[0] * 1e9 / BENCH_OBJECTS,                             \
+               load_time[1] * 1e9 / BENCH_OBJECTS,                             \
+               load_time[1] / MAX(load_time[0], 1e-12));                       \
+    } while (0)
+
+int main(void)
+{
+    size_t buffer_size = 256 * BENCH_OBJECTS;
+    unsigned char *buffer;
+
+    buffer = malloc(buffer_size);
+    if (!buffer) {
+        eprintf("Failed to allocate memory.\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-16s %-6s %10s %10s %8s\n", "object", "", "inline ns",
+           "called ns", "speedup");
+
+    BENCH_OBJECT(header, header);
+    BENCH_OBJECT(weather, weather);
+    BENCH_OBJECT(player_location, player_location);
+
+    free(buffer);
+    return EXIT_SUCCESS;
+}
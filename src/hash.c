@@ -0,0 +1,161 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ull
+#define PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define PRIME64_3 0x165667B19E3779F9ull
+#define PRIME64_4 0x85EBCA77C2B2AE63ull
+#define PRIME64_5 0x27D4EB2F165667C5ull
+
+static inline uint64_t rotl64(uint64_t x, unsigned r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* Reads are little-endian so that hashes match across hosts. */
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v = 0;
+
+    for (int i = 7; i >= 0; --i) {
+        v = (v << 8) | p[i];
+    }
+
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t merge_round64(uint64_t acc, uint64_t val)
+{
+    acc ^= round64(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        const unsigned char *limit = end - 32;
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        do {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = merge_round64(h, v1);
+        h = merge_round64(h, v2);
+        h = merge_round64(h, v3);
+        h = merge_round64(h, v4);
+    }
+    else {
+        h = seed + PRIME64_5;
+    }
+
+    h += size;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= round64(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+
+    if (p + 4 <= end) {
+        h ^= read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+
+    for (; p < end; ++p) {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+#ifdef COMPILE_WITH_UNIT_TESTS
+
+#define TEST_SUITE(TEST_CASE)                                                  \
+    TEST_CASE(hash64_known_values)                                             \
+    TEST_CASE(hash64_detects_changes)
+
+#include "unit_tests.h"
+
+UNIT_TEST(hash64_known_values)
+{
+    ASSERT_EQ(hash64("", 0, 0), 0xEF46DB3751D8E999ull);
+    ASSERT_EQ(hash64("a", 1, 0), 0xD24EC4F1A98C6E5Bull);
+    ASSERT_EQ(hash64("abc", 3, 0), 0x44BC2CF5AD770999ull);
+}
+
+UNIT_TEST(hash64_detects_changes)
+{
+    unsigned char data[1000];
+    uint64_t hash;
+
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = i * 7;
+    }
+
+    hash = hash64(data, sizeof(data), 0);
+    ASSERT_EQ(hash64(data, sizeof(data), 0), hash);
+    ASSERT_NE(hash64(data, sizeof(data) - 1, 0), hash);
+    ASSERT_NE(hash64(data, sizeof(data), 1), hash);
+
+    /* Every byte counts, in the bulk loop and in the tail alike. */
+    for (size_t i = 0; i < sizeof(data); i += 37) {
+        data[i] ^= 1;
+        ASSERT_NE(hash64(data, sizeof(data), 0), hash);
+        data[i] ^= 1;
+    }
+}
+
+#endif /* COMPILE_WITH_UNIT_TESTS */
@@ -0,0 +1,31 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef CEGSE_HASH_H
+#define CEGSE_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Return the 64-bit xxHash (XXH64) of size bytes of data. Fast enough to
+ * tell whether megabytes of data changed, but not a cryptographic hash.
+ */
+uint64_t hash64(const void *data, size_t size, uint64_t seed);
+
+#endif /* CEGSE_HASH_H */
@@ -15,13 +15,92 @@ You should have received a copy of the GNU General Public License
 along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "context.h"
 #include "log.h"
 
-FILE *debug_log_file;
+/* Messages shorter than this are formatted without allocating. */
+#define LOG_MESSAGE_SIZE 256
+
+void cegse_log_to_file(void *opaque, const char *message)
+{
+    fputs(message, opaque ? opaque : stderr);
+}
+
+/*
+ * Format a message prefixed with func and pass it to log.
+ */
+static void log_message(const struct cegse_ctx *ctx,
+                        void (*log)(void *opaque, const char *message),
+                        const char *func, const char *fmt, va_list args)
+{
+    char buffer[LOG_MESSAGE_SIZE];
+    char *message = buffer;
+    va_list retry;
+    int prefix;
+    int length;
+
+    prefix = snprintf(buffer, sizeof(buffer), "%s: ", func);
+    if (prefix < 0 || (size_t)prefix >= sizeof(buffer)) {
+        return;
+    }
+
+    va_copy(retry, args);
+    length = vsnprintf(buffer + prefix, sizeof(buffer) - prefix, fmt, args);
+
+    if (length < 0) {
+        va_end(retry);
+        return;
+    }
+
+    if ((size_t)(prefix + length) >= sizeof(buffer)) {
+        /* Too long for the buffer. Format it again to a large enough one. */
+        message = cegse_malloc(ctx, prefix + length + 1);
+        if (!message) {
+            va_end(retry);
+            return;
+        }
+
+        memcpy(message, buffer, prefix);
+        vsnprintf(message + prefix, length + 1, fmt, retry);
+    }
+
+    va_end(retry);
+
+    log(ctx->logger.opaque, message);
+
+    if (message != buffer) {
+        cegse_free(ctx, message);
+    }
+}
+
+void debug_log(const struct cegse_ctx *ctx, const char *func, const char *fmt,
+               ...)
+{
+    va_list args;
+
+    if (!ctx || !ctx->logger.log) {
+        return;
+    }
 
-void logging(void)
+    va_start(args, fmt);
+    log_message(ctx, ctx->logger.log, func, fmt, args);
+    va_end(args);
+}
+
+void error_log(const struct cegse_ctx *ctx, const char *func, const char *fmt,
+               ...)
 {
-    if (!debug_log_file) {
-        debug_log_file = fopen("/tmp/cegse_debug.log", "w");
+    va_list args;
+
+    if (!ctx || !ctx->logger.error) {
+        return;
     }
+
+    va_start(args, fmt);
+    log_message(ctx, ctx->logger.error, func, fmt, args);
+    va_end(args);
 }
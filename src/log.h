@@ -21,17 +21,46 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include <stdio.h>
 
-extern FILE *debug_log_file;
+struct cegse_ctx;
 
-void logging(void);
+struct cegse_logger {
+    /*
+     * Called with every debug log message, which ends in a newline.
+     * NULL disables the debug log.
+     */
+    void (*log)(void *opaque, const char *message);
+
+    /*
+     * Called with every error message, which ends in a newline. Errors are
+     * logged even if the debug log is disabled. NULL discards them.
+     */
+    void (*error)(void *opaque, const char *message);
+    void *opaque;
+};
+
+/*
+ * A logger function that writes the messages to the FILE * in opaque, or
+ * to stderr if opaque is NULL.
+ */
+void cegse_log_to_file(void *opaque, const char *message);
+
+/*
+ * Format a message prefixed with the name of the function and pass it to
+ * the logger of the context.
+ */
+void debug_log(const struct cegse_ctx *ctx, const char *func, const char *fmt,
+               ...) __attribute__((format(printf, 3, 4)));
+
+/*
+ * Like debug_log() but pass the message to the error logger of the context.
+ */
+void error_log(const struct cegse_ctx *ctx, const char *func, const char *fmt,
+               ...) __attribute__((format(printf, 3, 4)));
+
+#define ERROR_LOG(ctx, fmt, ...) error_log(ctx, __func__, fmt, ##__VA_ARGS__)
 
 #if !defined(DISABLE_DEBUG_LOG)
-#define DEBUG_LOG(fmt, ...)                                                    \
-    do {                                                                       \
-        if (debug_log_file) {                                                  \
-            fprintf(debug_log_file, "%s: " fmt, __func__, ##__VA_ARGS__);      \
-        }                                                                      \
-    } while (0)
+#define DEBUG_LOG(ctx, fmt, ...) debug_log(ctx, __func__, fmt, ##__VA_ARGS__)
 #else
 #define DEBUG_LOG(...) (void)0
 #endif /* !defined(DISABLE_DEBUG_LOG) */
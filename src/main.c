@@ -16,38 +16,149 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "batch.h"
+#include "context.h"
 #include "savefile.h"
 #include "defines.h"
 #include "log.h"
 
+static void print_usage(const char *program)
+{
+    eprintf("usage: %s path/to/savefile\n"
+            "       %s -b [-j threads] [-w | -s] [-l list] [path...]\n"
+            "\n"
+            "  -b         read many save files at once; a directory path\n"
+            "             stands for the files in it\n"
+            "  -j threads number of worker threads (default: one per CPU)\n"
+            "  -w         also write each save back and compare to the file\n"
+            "  -s         only scan each save into an index of its blocks\n"
+            "  -l list    read more paths from a file, one per line\n"
+            "             (- is the standard input)\n",
+            program, program);
+}
+
+/*
+ * Parse a positive number of threads. Return 0 if arg is not one.
+ */
+static unsigned parse_threads(const char *arg)
+{
+    unsigned long value;
+    char *end;
+
+    /* strtoul() accepts a sign and negates the number if it is '-'. */
+    if (*arg < '0' || *arg > '9') {
+        return 0;
+    }
+
+    errno = 0;
+    value = strtoul(arg, &end, 10);
+    if (errno != 0 || *end != '\0' || value > UINT_MAX) {
+        return 0;
+    }
+
+    return value;
+}
+
+static int run_batch(int argc, char **argv)
+{
+    struct batch_options options = { 0 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bj:wsl:")) != -1) {
+        switch (opt) {
+        case 'b':
+            break;
+        case 'j':
+            options.threads = parse_threads(optarg);
+            if (options.threads == 0) {
+                eprintf("%s: invalid number of threads: %s\n", argv[0],
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'w':
+            options.write_back = true;
+            break;
+        case 's':
+            options.scan_only = true;
+            break;
+        case 'l':
+            options.list_filename = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind == argc && !options.list_filename) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    return batch_run(&options, argv + optind, argc - optind) == -1
+               ? EXIT_FAILURE
+               : EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv)
 {
+    struct cegse_ctx ctx = {
+        /* Errors go to the debug log if there is one. */
+        .logger.error = cegse_log_to_file,
+        .read_options.flags = SAVEFILE_VIEW_CHANGE_FORMS |
+                              SAVEFILE_VIEW_GLOBAL_DATA | SAVEFILE_STREAM_BODY,
+        .dump_filename = "decompressed_save_data",
+    };
+    const char *log_filename = getenv("CEGSE_DEBUG_LOG");
+    FILE *log_file = NULL;
     struct savegame *save;
     int rc;
 
-    logging();
-
     if (argc < 2) {
-        eprintf("usage: %s path/to/savefile\n", argv[0]);
+        print_usage(argv[0]);
         return EXIT_FAILURE;
     }
 
-    save = cengine_savefile_read(argv[1]);
+    if (strcmp(argv[1], "-b") == 0) {
+        return run_batch(argc, argv);
+    }
+
+    /* Log only if asked to. */
+    if (log_filename) {
+        log_file = fopen(log_filename, "w");
+        if (!log_file) {
+            perror(log_filename);
+        }
+
+        ctx.logger.log = log_file ? cegse_log_to_file : NULL;
+        ctx.logger.opaque = log_file;
+    }
+
+    save = cengine_savefile_read(&ctx, argv[1], NULL);
     if (!save) {
         eprintf("fail\n");
-        return EXIT_FAILURE;
+        rc = -1;
+        goto out;
     }
 
-    rc = cengine_savefile_write("written_savefile", save);
+    rc = cengine_savefile_write("written_savefile", save, NULL);
     if (rc == -1) {
         eprintf("failed to write file\n");
-        savegame_free(save);
-        return EXIT_FAILURE;
     }
 
     savegame_free(save);
 
-    return EXIT_SUCCESS;
+out:
+    if (log_file) {
+        fclose(log_file);
+    }
+
+    return rc == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
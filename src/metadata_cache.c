@@ -0,0 +1,1108 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "binary_stream.h"
+#include "context.h"
+#include "defines.h"
+#include "hash.h"
+#include "log.h"
+#include "metadata_cache.h"
+
+/*
+ * Cache file format, all little-endian:
+ *
+ * header {
+ *     u8[8] magic
+ *     le32 version
+ *     le32 count
+ *     le64 strings_size
+ * }
+ * record[count]
+ * u8[strings_size] strings
+ *
+ * Records are fixed-width and sorted by the hash of the path and then by
+ * the path, so a lookup is a binary search in the mapped file. A string
+ * field of a record is the offset of a null-terminated string in strings,
+ * or NO_STRING. The plugin names are an array of le32 string offsets in
+ * strings, of which the plugins come before the light plugins. strings
+ * ends with a null byte, so every offset in it starts a terminated string.
+ */
+#define CACHE_MAGIC       "CEGSEMDC"
+#define CACHE_VERSION     1
+#define CACHE_HEADER_SIZE 24
+
+/*
+ * le64 path_hash, le32 path, le64 file_size, le64 mtime_sec, le32
+ * mtime_nsec, le64 content_hash, u8 game, le32 save_num, le32 level, le32
+ * sex, lef32 current_xp, lef32 target_xp, le64 filetime, le32
+ * player_name, le32 player_location_name, le32 game_time, le32 race_id,
+ * le32 game_version, le32 snapshot_width, le32 snapshot_height, u8
+ * snapshot_bytes_per_pixel, le32 snapshot_size, le64 snapshot_offset, u8
+ * num_plugins, le16 num_light_plugins, le32 plugins
+ */
+#define CACHE_RECORD_SIZE 117
+
+#define NO_STRING UINT32_MAX
+
+/* An entry of a save looked up since the cache was opened. */
+struct entry {
+    uint64_t path_hash;
+    const unsigned char *record;
+    const char *strings;
+    size_t strings_size;
+
+    /*
+     * If not NULL, the record and the strings of a save that was read,
+     * which the entry owns. Otherwise they are in the mapped cache file.
+     */
+    unsigned char *owned;
+};
+
+struct metadata_cache {
+    const struct cegse_ctx *ctx;
+    char *filename;
+
+    /* The mapped cache file, if it was valid. */
+    unsigned char *map;
+    size_t map_size;
+    uint32_t n_records;
+    const unsigned char *records;
+    const char *strings;
+    size_t strings_size;
+
+    /* Entries looked up, found by path through slots. */
+    struct entry *entries;
+    size_t n_entries;
+    size_t capacity;
+
+    /* Open addressing table of entry indices plus one, or 0 if empty. */
+    uint32_t *slots;
+    size_t n_slots;
+};
+
+/* Strings and string offset arrays of records being built. */
+struct strings {
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+static uint64_t hash_path(const char *path)
+{
+    return hash64(path, strlen(path), 0);
+}
+
+static const char *string_at(const char *strings, size_t strings_size,
+                             uint32_t offset, bool *ok)
+{
+    if (offset == NO_STRING) {
+        return NULL;
+    }
+
+    if (offset >= strings_size) {
+        *ok = false;
+        return NULL;
+    }
+
+    return strings + offset;
+}
+
+static const char *record_path(const struct entry *entry)
+{
+    bool ok = true;
+    const char *path;
+
+    path = string_at(entry->strings, entry->strings_size,
+                     load_le32(entry->record + 8), &ok);
+    return path ? path : "";
+}
+
+/*
+ * Decode a record. Return -1 if it points outside of the strings.
+ */
+static int decode_record(const unsigned char *record, const char *strings,
+                         size_t strings_size, struct save_metadata *metadata)
+{
+    struct ucursor fields = { (unsigned char *)record + 12 };
+    uint32_t plugins;
+    size_t n_plugins;
+    bool ok = true;
+
+#define STRING() string_at(strings, strings_size, uc_load_le32(&fields), &ok)
+
+    metadata->file_size = uc_load_le64(&fields);
+    metadata->mtime.tv_sec = uc_load_le64(&fields);
+    metadata->mtime.tv_nsec = uc_load_le32(&fields);
+    metadata->content_hash = uc_load_le64(&fields);
+    metadata->game = uc_load_u8(&fields);
+    metadata->save_num = uc_load_le32(&fields);
+    metadata->level = uc_load_le32(&fields);
+    metadata->sex = uc_load_le32(&fields);
+    metadata->current_xp = uc_load_lef32(&fields);
+    metadata->target_xp = uc_load_lef32(&fields);
+    metadata->filetime = uc_load_le64(&fields);
+    metadata->player_name = STRING();
+    metadata->player_location_name = STRING();
+    metadata->game_time = STRING();
+    metadata->race_id = STRING();
+    metadata->game_version = STRING();
+    metadata->snapshot_width = uc_load_le32(&fields);
+    metadata->snapshot_height = uc_load_le32(&fields);
+    metadata->snapshot_bytes_per_pixel = uc_load_u8(&fields);
+    metadata->snapshot_size = uc_load_le32(&fields);
+    metadata->snapshot_offset = uc_load_le64(&fields);
+    metadata->num_plugins = uc_load_u8(&fields);
+    metadata->num_light_plugins = uc_load_le16(&fields);
+    plugins = uc_load_le32(&fields);
+
+#undef STRING
+
+    n_plugins = (size_t)metadata->num_plugins + metadata->num_light_plugins;
+    metadata->plugin_offsets = (const unsigned char *)strings + plugins;
+    metadata->strings = strings;
+
+    if (n_plugins > 0) {
+        if (plugins > strings_size || 4 * n_plugins > strings_size - plugins) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < n_plugins; ++i) {
+            string_at(strings, strings_size,
+                      load_le32(metadata->plugin_offsets + 4 * i), &ok);
+        }
+    }
+
+    return ok ? 0 : -1;
+}
+
+static int strings_reserve(const struct cegse_ctx *ctx,
+                           struct strings *strings, size_t size)
+{
+    char *data;
+
+    if (size <= strings->capacity - strings->size) {
+        return 0;
+    }
+
+    size = MAX(strings->size + size, 2 * strings->capacity);
+    if (size >= NO_STRING) {
+        return -1;
+    }
+
+    data = cegse_realloc(ctx, strings->data, size);
+    if (!data) {
+        return -1;
+    }
+
+    strings->data = data;
+    strings->capacity = size;
+    return 0;
+}
+
+/*
+ * Append a string and return its offset, NO_STRING for NULL or -1 if out
+ * of memory.
+ */
+static int64_t strings_add(const struct cegse_ctx *ctx,
+                           struct strings *strings, const char *string)
+{
+    size_t offset = strings->size;
+    size_t length;
+
+    if (!string) {
+        return NO_STRING;
+    }
+
+    length = strlen(string) + 1;
+    if (strings_reserve(ctx, strings, length) == -1) {
+        return -1;
+    }
+
+    memcpy(strings->data + offset, string, length);
+    strings->size += length;
+    return offset;
+}
+
+/*
+ * Return the name of plugin i, counting the light plugins after the
+ * plugins, from the savegame if it is not NULL or else from the metadata.
+ */
+static const char *plugin_name(const struct save_metadata *metadata,
+                               const struct savegame *save, size_t i)
+{
+    if (!save) {
+        return save_metadata_plugin(metadata, i);
+    }
+
+    return i < save->num_plugins ? save->plugins[i]
+                                 : save->light_plugins[i - save->num_plugins];
+}
+
+/*
+ * Encode the metadata of the save at path into a record and append its
+ * strings. The plugin names come from save if the metadata was made from
+ * it. Return -1 if out of memory.
+ */
+static int encode_record(const struct cegse_ctx *ctx, unsigned char *record,
+                         struct strings *strings, const char *path,
+                         const struct save_metadata *metadata,
+                         const struct savegame *save)
+{
+    size_t n_plugins = (size_t)metadata->num_plugins +
+                       metadata->num_light_plugins;
+    struct ucursor fields = { record };
+    uint32_t offsets[7];
+    size_t plugins;
+    int64_t offset;
+
+    const char *fixed[] = {
+        path,
+        metadata->player_name,
+        metadata->player_location_name,
+        metadata->game_time,
+        metadata->race_id,
+        metadata->game_version,
+    };
+
+    for (size_t i = 0; i < ARRAY_LEN(fixed); ++i) {
+        if ((offset = strings_add(ctx, strings, fixed[i])) == -1) {
+            return -1;
+        }
+        offsets[i] = offset;
+    }
+
+    /* The names first and then the array of their offsets. */
+    plugins = strings->size;
+    for (size_t i = 0; i < n_plugins; ++i) {
+        if (strings_add(ctx, strings, plugin_name(metadata, save, i)) == -1) {
+            return -1;
+        }
+    }
+
+    if (strings_reserve(ctx, strings, 4 * n_plugins) == -1) {
+        return -1;
+    }
+
+    offsets[6] = strings->size;
+    for (size_t i = 0; i < n_plugins; ++i) {
+        store_le32((unsigned char *)strings->data + strings->size, plugins);
+        strings->size += 4;
+        plugins += strlen(strings->data + plugins) + 1;
+    }
+
+    uc_store_le64(&fields, hash_path(path));
+    uc_store_le32(&fields, offsets[0]);
+    uc_store_le64(&fields, metadata->file_size);
+    uc_store_le64(&fields, metadata->mtime.tv_sec);
+    uc_store_le32(&fields, metadata->mtime.tv_nsec);
+    uc_store_le64(&fields, metadata->content_hash);
+    uc_store_u8(&fields, metadata->game);
+    uc_store_le32(&fields, metadata->save_num);
+    uc_store_le32(&fields, metadata->level);
+    uc_store_le32(&fields, metadata->sex);
+    uc_store_lef32(&fields, metadata->current_xp);
+    uc_store_lef32(&fields, metadata->target_xp);
+    uc_store_le64(&fields, metadata->filetime);
+    for (int i = 1; i <= 5; ++i) {
+        uc_store_le32(&fields, offsets[i]);
+    }
+    uc_store_le32(&fields, metadata->snapshot_width);
+    uc_store_le32(&fields, metadata->snapshot_height);
+    uc_store_u8(&fields, metadata->snapshot_bytes_per_pixel);
+    uc_store_le32(&fields, metadata->snapshot_size);
+    uc_store_le64(&fields, metadata->snapshot_offset);
+    uc_store_u8(&fields, metadata->num_plugins);
+    uc_store_le16(&fields, metadata->num_light_plugins);
+    uc_store_le32(&fields, n_plugins > 0 ? offsets[6] : 0);
+
+    return 0;
+}
+
+const char *save_metadata_plugin(const struct save_metadata *metadata,
+                                 unsigned i)
+{
+    return metadata->strings + load_le32(metadata->plugin_offsets + 4 * i);
+}
+
+const char *save_metadata_light_plugin(const struct save_metadata *metadata,
+                                       unsigned i)
+{
+    return save_metadata_plugin(metadata, metadata->num_plugins + i);
+}
+
+/*
+ * Map the cache file if it is valid.
+ */
+static void map_cache_file(struct metadata_cache *cache)
+{
+    unsigned char *map;
+    uint64_t strings_size;
+    struct stat statbuf;
+    uint64_t size;
+    uint32_t count;
+    int fd;
+
+    fd = open(cache->filename, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+
+    if (fstat(fd, &statbuf) == -1 || statbuf.st_size < CACHE_HEADER_SIZE) {
+        close(fd);
+        return;
+    }
+
+    map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    count = load_le32(map + 12);
+    strings_size = load_le64(map + 16);
+    size = statbuf.st_size - CACHE_HEADER_SIZE;
+
+    /* The sizes are checked one at a time so that they cannot wrap around. */
+    if (memcmp(map, CACHE_MAGIC, 8) != 0 ||
+        load_le32(map + 8) != CACHE_VERSION || strings_size == 0 ||
+        strings_size > size ||
+        count > (size - strings_size) / CACHE_RECORD_SIZE ||
+        size != (uint64_t)count * CACHE_RECORD_SIZE + strings_size ||
+        map[statbuf.st_size - 1] != '\0') {
+        DEBUG_LOG(cache->ctx, "%s is not a valid metadata cache\n",
+                  cache->filename);
+        munmap(map, statbuf.st_size);
+        return;
+    }
+
+    cache->map = map;
+    cache->map_size = statbuf.st_size;
+    cache->n_records = count;
+    cache->records = map + CACHE_HEADER_SIZE;
+    cache->strings = (const char *)cache->records +
+                     (size_t)count * CACHE_RECORD_SIZE;
+    cache->strings_size = strings_size;
+}
+
+struct metadata_cache *metadata_cache_open(const struct cegse_ctx *ctx,
+                                           const char *filename)
+{
+    struct metadata_cache *cache;
+
+    ctx = cegse_ctx_or_default(ctx);
+
+    cache = cegse_calloc(ctx, 1, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+
+    cache->ctx = ctx;
+    cache->filename = cegse_malloc(ctx, strlen(filename) + 1);
+    if (!cache->filename) {
+        cegse_free(ctx, cache);
+        return NULL;
+    }
+
+    strcpy(cache->filename, filename);
+    map_cache_file(cache);
+
+    DEBUG_LOG(ctx, "Opened metadata cache %s with %u entries\n", filename,
+              cache->n_records);
+    return cache;
+}
+
+void metadata_cache_close(struct metadata_cache *cache)
+{
+    if (!cache) {
+        return;
+    }
+
+    for (size_t i = 0; i < cache->n_entries; ++i) {
+        cegse_free(cache->ctx, cache->entries[i].owned);
+    }
+
+    if (cache->map) {
+        munmap(cache->map, cache->map_size);
+    }
+
+    cegse_free(cache->ctx, cache->entries);
+    cegse_free(cache->ctx, cache->slots);
+    cegse_free(cache->ctx, cache->filename);
+    cegse_free(cache->ctx, cache);
+}
+
+/*
+ * Return the record of the path in the mapped cache file or NULL.
+ */
+static const unsigned char *find_record(const struct metadata_cache *cache,
+                                        uint64_t path_hash, const char *path)
+{
+    size_t low = 0;
+    size_t high = cache->n_records;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (load_le64(cache->records + middle * CACHE_RECORD_SIZE) <
+            path_hash) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    for (; low < cache->n_records; ++low) {
+        const unsigned char *record = cache->records + low * CACHE_RECORD_SIZE;
+        struct entry entry = { path_hash, record, cache->strings,
+                               cache->strings_size, NULL };
+
+        if (load_le64(record) != path_hash) {
+            break;
+        }
+
+        if (strcmp(record_path(&entry), path) == 0) {
+            return record;
+        }
+    }
+
+    return NULL;
+}
+
+static uint32_t *find_slot(const struct metadata_cache *cache,
+                           uint64_t path_hash, const char *path)
+{
+    size_t mask = cache->n_slots - 1;
+
+    for (size_t i = path_hash & mask;; i = (i + 1) & mask) {
+        uint32_t *slot = &cache->slots[i];
+        const struct entry *entry;
+
+        if (*slot == 0) {
+            return slot;
+        }
+
+        entry = &cache->entries[*slot - 1];
+        if (entry->path_hash == path_hash &&
+            strcmp(record_path(entry), path) == 0) {
+            return slot;
+        }
+    }
+}
+
+/*
+ * Add an entry, which must not be in the cache yet. Return NULL if out of
+ * memory.
+ */
+static struct entry *add_entry(struct metadata_cache *cache,
+                               const struct entry *entry, const char *path)
+{
+    if (cache->n_entries == cache->capacity) {
+        size_t capacity = cache->capacity ? 2 * cache->capacity : 64;
+        struct entry *entries;
+
+        entries = cegse_realloc(cache->ctx, cache->entries,
+                                capacity * sizeof(*entries));
+        if (!entries) {
+            return NULL;
+        }
+
+        cache->entries = entries;
+        cache->capacity = capacity;
+    }
+
+    /* Keep the table at most half full. */
+    if (2 * (cache->n_entries + 1) > cache->n_slots) {
+        size_t n_slots = cache->n_slots ? 2 * cache->n_slots : 128;
+        uint32_t *old_slots = cache->slots;
+        size_t old_n_slots = cache->n_slots;
+
+        cache->slots = cegse_calloc(cache->ctx, n_slots, sizeof(uint32_t));
+        if (!cache->slots) {
+            cache->slots = old_slots;
+            return NULL;
+        }
+
+        cache->n_slots = n_slots;
+        for (size_t i = 0; i < old_n_slots; ++i) {
+            if (old_slots[i] != 0) {
+                const struct entry *old = &cache->entries[old_slots[i] - 1];
+                *find_slot(cache, old->path_hash, record_path(old)) =
+                    old_slots[i];
+            }
+        }
+
+        cegse_free(cache->ctx, old_slots);
+    }
+
+    cache->entries[cache->n_entries] = *entry;
+    *find_slot(cache, entry->path_hash, path) = ++cache->n_entries;
+    return &cache->entries[cache->n_entries - 1];
+}
+
+/*
+ * Read the metadata of a save file into an owned entry. Return -1 on
+ * error.
+ */
+static int read_entry(const struct cegse_ctx *ctx, const char *path,
+                      struct entry *entry)
+{
+    struct strings strings = { 0 };
+    unsigned char record[CACHE_RECORD_SIZE];
+    struct save_metadata metadata = { 0 };
+    struct savegame *save = NULL;
+    void *file = MAP_FAILED;
+    struct stat statbuf;
+    int rc = -1;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (fstat(fd, &statbuf) == -1 || statbuf.st_size == 0) {
+        goto out;
+    }
+
+    file = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file == MAP_FAILED) {
+        goto out;
+    }
+
+    save = cengine_savefile_read_header_mem(ctx, file, statbuf.st_size, true);
+    if (!save) {
+        goto out;
+    }
+
+    metadata = (struct save_metadata){
+        .file_size = statbuf.st_size,
+        .mtime = statbuf.st_mtim,
+        .content_hash = hash64(file, statbuf.st_size, 0),
+        .game = save->game,
+        .save_num = save->save_num,
+        .player_name = save->player_name,
+        .level = save->level,
+        .player_location_name = save->player_location_name,
+        .game_time = save->game_time,
+        .race_id = save->race_id,
+        .sex = save->sex,
+        .current_xp = save->current_xp,
+        .target_xp = save->target_xp,
+        .filetime = save->filetime,
+        .snapshot_width = save->snapshot_width,
+        .snapshot_height = save->snapshot_height,
+        .snapshot_size = save->snapshot_size,
+        .snapshot_bytes_per_pixel = save->snapshot_bytes_per_pixel,
+        .snapshot_offset = savegame_snapshot_offset(save),
+        .game_version = save->game_version,
+        .num_plugins = save->num_plugins,
+        .num_light_plugins = save->num_light_plugins,
+    };
+
+    /* The strings of an entry end with a null byte like in the file. */
+    if (encode_record(ctx, record, &strings, path, &metadata, save) == -1 ||
+        strings_reserve(ctx, &strings, 1) == -1) {
+        goto out;
+    }
+
+    strings.data[strings.size++] = '\0';
+
+    entry->owned = cegse_malloc(ctx, CACHE_RECORD_SIZE + strings.size);
+    if (!entry->owned) {
+        goto out;
+    }
+
+    memcpy(entry->owned, record, CACHE_RECORD_SIZE);
+    memcpy(entry->owned + CACHE_RECORD_SIZE, strings.data, strings.size);
+    entry->path_hash = load_le64(record);
+    entry->record = entry->owned;
+    entry->strings = (const char *)entry->owned + CACHE_RECORD_SIZE;
+    entry->strings_size = strings.size;
+    rc = 0;
+
+out:
+    cegse_free(ctx, strings.data);
+    savegame_free(save);
+    if (file != MAP_FAILED) {
+        munmap(file, statbuf.st_size);
+    }
+    close(fd);
+    return rc;
+}
+
+static bool entry_is_valid(const struct entry *entry,
+                           const struct stat *statbuf)
+{
+    const unsigned char *record = entry->record;
+
+    return load_le64(record + 12) == (uint64_t)statbuf->st_size &&
+           (int64_t)load_le64(record + 20) == statbuf->st_mtim.tv_sec &&
+           load_le32(record + 28) == (uint32_t)statbuf->st_mtim.tv_nsec;
+}
+
+int metadata_cache_lookup(struct metadata_cache *cache,
+                          const char *save_filename,
+                          struct save_metadata *metadata)
+{
+    uint64_t path_hash = hash_path(save_filename);
+    struct entry *entry = NULL;
+    struct entry fresh;
+    struct stat statbuf;
+    int cached = 1;
+
+    if (stat(save_filename, &statbuf) == -1) {
+        return -1;
+    }
+
+    if (cache->n_slots > 0) {
+        uint32_t slot = *find_slot(cache, path_hash, save_filename);
+
+        if (slot != 0) {
+            entry = &cache->entries[slot - 1];
+        }
+    }
+
+    if (!entry) {
+        const unsigned char *record;
+
+        record = find_record(cache, path_hash, save_filename);
+        if (record) {
+            entry = add_entry(cache,
+                              &(struct entry){ path_hash, record,
+                                               cache->strings,
+                                               cache->strings_size, NULL },
+                              save_filename);
+            if (!entry) {
+                return -1;
+            }
+        }
+    }
+
+    if (!entry || !entry_is_valid(entry, &statbuf)) {
+        DEBUG_LOG(cache->ctx, "Reading metadata of %s\n", save_filename);
+
+        if (read_entry(cache->ctx, save_filename, &fresh) == -1) {
+            return -1;
+        }
+
+        if (entry) {
+            cegse_free(cache->ctx, entry->owned);
+            *entry = fresh;
+        }
+        else if (!(entry = add_entry(cache, &fresh, save_filename))) {
+            cegse_free(cache->ctx, fresh.owned);
+            return -1;
+        }
+
+        cached = 0;
+    }
+
+    if (decode_record(entry->record, entry->strings, entry->strings_size,
+                      metadata) == -1) {
+        DEBUG_LOG(cache->ctx, "Corrupt metadata cache entry of %s\n",
+                  save_filename);
+        return -1;
+    }
+
+    return cached;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct entry *entry_a = a;
+    const struct entry *entry_b = b;
+
+    if (entry_a->path_hash != entry_b->path_hash) {
+        return entry_a->path_hash < entry_b->path_hash ? -1 : 1;
+    }
+
+    return strcmp(record_path(entry_a), record_path(entry_b));
+}
+
+static int write_all(FILE *stream, const void *data, size_t size)
+{
+    return write_bytes(stream, data, size) == size ? 0 : -1;
+}
+
+int metadata_cache_save(struct metadata_cache *cache)
+{
+    const struct cegse_ctx *ctx = cache->ctx;
+    unsigned char header[CACHE_HEADER_SIZE];
+    struct strings strings = { 0 };
+    unsigned char *records = NULL;
+    struct entry *sorted = NULL;
+    char *tmp_filename = NULL;
+    bool created = false;
+    FILE *stream = NULL;
+    int rc = -1;
+
+    sorted = cegse_malloc(ctx, (cache->n_entries + 1) * sizeof(*sorted));
+    records = cegse_malloc(ctx, cache->n_entries * CACHE_RECORD_SIZE + 1);
+    tmp_filename = cegse_malloc(ctx, strlen(cache->filename) + 5);
+    if (!sorted || !records || !tmp_filename) {
+        goto out;
+    }
+
+    memcpy(sorted, cache->entries, cache->n_entries * sizeof(*sorted));
+    qsort(sorted, cache->n_entries, sizeof(*sorted), compare_entries);
+
+    /* Records point into the strings of the new file. */
+    for (size_t i = 0; i < cache->n_entries; ++i) {
+        struct save_metadata metadata;
+
+        if (decode_record(sorted[i].record, sorted[i].strings,
+                          sorted[i].strings_size, &metadata) == -1 ||
+            encode_record(ctx, records + i * CACHE_RECORD_SIZE, &strings,
+                          record_path(&sorted[i]), &metadata, NULL) == -1) {
+            goto out;
+        }
+    }
+
+    if (strings_reserve(ctx, &strings, 1) == -1) {
+        goto out;
+    }
+
+    strings.data[strings.size++] = '\0';
+
+    memcpy(header, CACHE_MAGIC, 8);
+    store_le32(header + 8, CACHE_VERSION);
+    store_le32(header + 12, cache->n_entries);
+    store_le64(header + 16, strings.size);
+
+    /*
+     * Write a new file and rename it over the old one so that the mapped
+     * old file stays intact and readers never see a partial file.
+     */
+    sprintf(tmp_filename, "%s.tmp", cache->filename);
+    stream = fopen(tmp_filename, "wb");
+    if (!stream) {
+        goto out;
+    }
+
+    created = true;
+
+    if (write_all(stream, header, sizeof(header)) == -1 ||
+        write_all(stream, records, cache->n_entries * CACHE_RECORD_SIZE) ==
+            -1 ||
+        write_all(stream, strings.data, strings.size) == -1) {
+        goto out;
+    }
+
+    if (fclose(stream) != 0) {
+        stream = NULL;
+        goto out;
+    }
+
+    stream = NULL;
+    if (rename(tmp_filename, cache->filename) == -1) {
+        goto out;
+    }
+
+    DEBUG_LOG(ctx, "Saved %zu entries to metadata cache %s\n",
+              cache->n_entries, cache->filename);
+    rc = 0;
+
+out:
+    if (stream) {
+        fclose(stream);
+    }
+
+    if (rc == -1 && created) {
+        remove(tmp_filename);
+    }
+
+    cegse_free(ctx, strings.data);
+    cegse_free(ctx, tmp_filename);
+    cegse_free(ctx, records);
+    cegse_free(ctx, sorted);
+    return rc;
+}
+
+#ifdef COMPILE_WITH_UNIT_TESTS
+
+#define TEST_SUITE(TEST_CASE)                                                  \
+    TEST_CASE(cached_metadata_matches_header_read)                             \
+    TEST_CASE(changed_files_are_read_again)                                    \
+    TEST_CASE(invalid_cache_files_open_empty)
+
+#include <dirent.h>
+#include "unit_tests.h"
+
+#define TEST_CACHE_FILENAME "test_metadata_cache"
+#define TEST_SAVE_FILENAME  "test_metadata_cache_save"
+
+static const struct cegse_ctx test_ctx = {
+    .logger = { .log = cegse_log_to_file, .error = cegse_log_to_file },
+};
+
+static void assert_strings_eq(const char *a, const char *b)
+{
+    if (!a || !b) {
+        ASSERT_EQ_PTR(a, b);
+    }
+    else {
+        ASSERT_EQ(strcmp(a, b), 0);
+    }
+}
+
+static void assert_matches_file(const struct save_metadata *metadata,
+                                const char *filename)
+{
+    struct savegame *save;
+    unsigned char *file;
+    struct stat statbuf;
+    int fd;
+
+    ASSERT_NE(fd = open(filename, O_RDONLY), -1);
+    ASSERT_NE(fstat(fd, &statbuf), -1);
+    file = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ASSERT_NE_PTR(file, MAP_FAILED);
+    close(fd);
+
+    save = cengine_savefile_read_header(&test_ctx, filename, true);
+    ASSERT_NOT_NULL(save);
+
+    ASSERT_EQ(metadata->file_size, statbuf.st_size);
+    ASSERT_EQ(metadata->mtime.tv_sec, statbuf.st_mtim.tv_sec);
+    ASSERT_EQ(metadata->mtime.tv_nsec, statbuf.st_mtim.tv_nsec);
+    ASSERT_EQ(metadata->content_hash, hash64(file, statbuf.st_size, 0));
+    ASSERT_EQ(metadata->game, save->game);
+    ASSERT_EQ(metadata->save_num, save->save_num);
+    assert_strings_eq(metadata->player_name, save->player_name);
+    ASSERT_EQ(metadata->level, save->level);
+    assert_strings_eq(metadata->player_location_name,
+                      save->player_location_name);
+    assert_strings_eq(metadata->game_time, save->game_time);
+    assert_strings_eq(metadata->race_id, save->race_id);
+    ASSERT_EQ(metadata->sex, save->sex);
+    ASSERT_EQ(metadata->current_xp, save->current_xp);
+    ASSERT_EQ(metadata->target_xp, save->target_xp);
+    ASSERT_EQ(metadata->filetime, save->filetime);
+    ASSERT_EQ(metadata->snapshot_width, save->snapshot_width);
+    ASSERT_EQ(metadata->snapshot_height, save->snapshot_height);
+    ASSERT_EQ(metadata->snapshot_size, save->snapshot_size);
+    ASSERT_EQ(metadata->snapshot_bytes_per_pixel,
+              save->snapshot_bytes_per_pixel);
+    ASSERT_EQ(metadata->snapshot_offset, savegame_snapshot_offset(save));
+    assert_strings_eq(metadata->game_version, save->game_version);
+
+    ASSERT_EQ(metadata->num_plugins, save->num_plugins);
+    for (unsigned i = 0; i < save->num_plugins; ++i) {
+        assert_strings_eq(save_metadata_plugin(metadata, i), save->plugins[i]);
+    }
+
+    ASSERT_EQ(metadata->num_light_plugins, save->num_light_plugins);
+    for (unsigned i = 0; i < save->num_light_plugins; ++i) {
+        assert_strings_eq(save_metadata_light_plugin(metadata, i),
+                          save->light_plugins[i]);
+    }
+
+    savegame_free(save);
+    munmap(file, statbuf.st_size);
+}
+
+/*
+ * Look up every sample file and check that each lookup returns expected.
+ */
+static void lookup_samples(struct metadata_cache *cache, int expected)
+{
+    struct dirent *dirent;
+    DIR *samples;
+
+    ASSERT_NOT_NULL(samples = opendir("../samples"));
+
+    while ((dirent = readdir(samples)) != NULL) {
+        struct save_metadata metadata;
+        char sample_filename[512];
+
+        if (dirent->d_type != DT_REG) {
+            continue;
+        }
+
+        sprintf(sample_filename, "../samples/%s", dirent->d_name);
+        ASSERT_EQ(metadata_cache_lookup(cache, sample_filename, &metadata),
+                  expected);
+        assert_matches_file(&metadata, sample_filename);
+    }
+
+    closedir(samples);
+}
+
+UNIT_TEST(cached_metadata_matches_header_read)
+{
+    struct metadata_cache *cache;
+
+    remove(TEST_CACHE_FILENAME);
+
+    ASSERT_NOT_NULL(cache = metadata_cache_open(&test_ctx,
+                                                TEST_CACHE_FILENAME));
+    lookup_samples(cache, 0);
+    lookup_samples(cache, 1);
+    ASSERT_EQ(metadata_cache_save(cache), 0);
+
+    /* The entries stay valid after the cache file is replaced. */
+    lookup_samples(cache, 1);
+    metadata_cache_close(cache);
+
+    /* Reopened, nothing is read again. */
+    ASSERT_NOT_NULL(cache = metadata_cache_open(&test_ctx,
+                                                TEST_CACHE_FILENAME));
+    lookup_samples(cache, 1);
+
+    /* Saving the entries from the mapped file keeps them. */
+    ASSERT_EQ(metadata_cache_save(cache), 0);
+    metadata_cache_close(cache);
+
+    ASSERT_NOT_NULL(cache = metadata_cache_open(&test_ctx,
+                                                TEST_CACHE_FILENAME));
+    lookup_samples(cache, 1);
+    metadata_cache_close(cache);
+
+    remove(TEST_CACHE_FILENAME);
+}
+
+/*
+ * Copy the first sample file to TEST_SAVE_FILENAME.
+ */
+static void copy_a_sample(void)
+{
+    unsigned char buffer[65536];
+    struct dirent *dirent;
+    FILE *src = NULL;
+    FILE *dest;
+    DIR *samples;
+    size_t n;
+
+    ASSERT_NOT_NULL(samples = opendir("../samples"));
+    while (!src && (dirent = readdir(samples)) != NULL) {
+        char sample_filename[512];
+
+        if (dirent->d_type == DT_REG) {
+            sprintf(sample_filename, "../samples/%s", dirent->d_name);
+            src = fopen(sample_filename, "rb");
+        }
+    }
+    closedir(samples);
+
+    ASSERT_NOT_NULL(src);
+    ASSERT_NOT_NULL(dest = fopen(TEST_SAVE_FILENAME, "wb"));
+    while ((n = fread(buffer, 1, sizeof(buffer), src)) > 0) {
+        ASSERT_EQ(fwrite(buffer, 1, n, dest), n);
+    }
+
+    fclose(src);
+    ASSERT_EQ(fclose(dest), 0);
+}
+
+UNIT_TEST(changed_files_are_read_again)
+{
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { 1000000000, 5 } };
+    struct save_metadata metadata;
+    struct metadata_cache *cache;
+
+    remove(TEST_CACHE_FILENAME);
+    copy_a_sample();
+
+    ASSERT_NOT_NULL(cache = metadata_cache_open(&test_ctx,
+                                                TEST_CACHE_FILENAME));
+    ASSERT_EQ(metadata_cache_lookup(cache, TEST_SAVE_FILENAME, &metadata), 0);
+    ASSERT_EQ(metadata_cache_lookup(cache, TEST_SAVE_FILENAME, &metadata), 1);
+    ASSERT_EQ(metadata_cache_save(cache), 0);
+    metadata_cache_close(cache);
+
+    /* A new modification time invalidates the entry. */
+    ASSERT_EQ(utimensat(AT_FDCWD, TEST_SAVE_FILENAME, times, 0), 0);
+
+    ASSERT_NOT_NULL(cache = metadata_cache_open(&test_ctx,
+                                                TEST_CACHE_FILENAME));
+    ASSERT_EQ(metadata_cache_lookup(cache, TEST_SAVE_FILENAME, &metadata), 0);
+    ASSERT_EQ(metadata.mtime.tv_sec, 1000000000);
+    ASSERT_EQ(metadata.mtime.tv_nsec, 5);
+    assert_matches_file(&metadata, TEST_SAVE_FILENAME);
+    ASSERT_EQ(metadata_cache_lookup(cache, TEST_SAVE_FILENAME, &metadata), 1);
+
+    /* Files that are gone are errors. */
+    remove(TEST_SAVE_FILENAME);
+    ASSERT_EQ(metadata_cache_lookup(cache, TEST_SAVE_FILENAME, &metadata), -1);
+    metadata_cache_close(cache);
+
+    remove(TEST_CACHE_FILENAME);
+}
+
+UNIT_TEST(invalid_cache_files_open_empty)
+{
+    /*
+     * A header whose sizes add up to the file size only when they wrap
+     * around.
+     */
+    static unsigned char wrapped[4096];
+    /*
+     * Empty, truncated, not a cache, a header claiming five records and the
+     * wrapped header.
+     */
+    static const struct {
+        const void *data;
+        size_t size;
+    } contents[] = {
+        { "", 0 },
+        { "CEGSEMDC", 8 },
+        { "not a metadata cache file at all", 32 },
+        { "CEGSEMDC\x01\0\0\0\x05\0\0\0\x01\0\0\0\0\0\0\0\0", 25 },
+        { wrapped, sizeof(wrapped) },
+    };
+    uint32_t wrapped_count = 0x100000;
+    struct save_metadata metadata;
+    struct metadata_cache *cache;
+    FILE *stream;
+
+    copy_a_sample();
+
+    memcpy(wrapped, CACHE_MAGIC, 8);
+    store_le32(wrapped + 8, CACHE_VERSION);
+    store_le32(wrapped + 12, wrapped_count);
+    store_le64(wrapped + 16, sizeof(wrapped) - CACHE_HEADER_SIZE -
+                                 (uint64_t)wrapped_count * CACHE_RECORD_SIZE);
+
+    for (size_t i = 0; i < ARRAY_LEN(contents); ++i) {
+        ASSERT_NOT_NULL(stream = fopen(TEST_CACHE_FILENAME, "wb"));
+        fwrite(contents[i].data, 1, contents[i].size, stream);
+        ASSERT_EQ(fclose(stream), 0);
+
+        ASSERT_NOT_NULL(cache = metadata_cache_open(&test_ctx,
+                                                    TEST_CACHE_FILENAME));
+        ASSERT_EQ(metadata_cache_lookup(cache, TEST_SAVE_FILENAME, &metadata),
+                  0);
+        metadata_cache_close(cache);
+    }
+
+    remove(TEST_CACHE_FILENAME);
+    remove(TEST_SAVE_FILENAME);
+}
+
+#endif /* COMPILE_WITH_UNIT_TESTS */
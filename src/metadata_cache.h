@@ -0,0 +1,115 @@
+/*
+Copyright (C) 2024  SSYSS000
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef CEGSE_METADATA_CACHE_H
+#define CEGSE_METADATA_CACHE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "savefile.h"
+
+/*
+ * A cache of the metadata of the save files of a library: the file header,
+ * the plugin lists, where the snapshot is and a hash of the file. An entry
+ * is valid as long as the size and the modification time of its file are
+ * unchanged, so looking up a cached save costs a stat() and nothing is
+ * read or parsed.
+ *
+ * The cache is kept in a single file that is mapped when the cache is
+ * opened and replaced when it is saved. A cache must be used by one thread
+ * at a time.
+ */
+struct metadata_cache;
+
+/*
+ * Metadata of a save file. The fields are those of struct savegame after
+ * cengine_savefile_read_header() with plugins. The strings are valid until
+ * the same save is looked up again or the cache is closed.
+ */
+struct save_metadata {
+    /* Size and modification time of the file when it was read. */
+    uint64_t file_size;
+    struct timespec mtime;
+
+    /* hash64() of the whole file with seed 0. */
+    uint64_t content_hash;
+
+    enum game game;
+    uint32_t save_num;
+    const char *player_name;
+    uint32_t level;
+    const char *player_location_name;
+    const char *game_time;
+    const char *race_id;
+    uint32_t sex;
+    float current_xp;
+    float target_xp;
+    uint64_t filetime;
+
+    uint32_t snapshot_width;
+    uint32_t snapshot_height;
+    uint32_t snapshot_size;
+    unsigned snapshot_bytes_per_pixel;
+    uint64_t snapshot_offset; /* Offset of the snapshot in the file */
+
+    const char *game_version; /* NULL if the save has none. */
+
+    uint8_t num_plugins;
+    uint16_t num_light_plugins;
+
+    /* Where the plugin names are. Use save_metadata_plugin(). */
+    const unsigned char *plugin_offsets;
+    const char *strings;
+};
+
+/*
+ * Open the cache in the file filename. A cache file that does not exist or
+ * is not a valid cache opens as an empty cache. Return NULL if out of
+ * memory.
+ */
+struct metadata_cache *metadata_cache_open(const struct cegse_ctx *ctx,
+                                           const char *filename);
+
+/*
+ * Get the metadata of a save file. If the cache has no valid entry for the
+ * file, the header of the file is read and the entry is updated. Return 1
+ * if the metadata was cached, 0 if the file was read or -1 on error.
+ */
+int metadata_cache_lookup(struct metadata_cache *cache,
+                          const char *save_filename,
+                          struct save_metadata *metadata);
+
+/*
+ * Replace the cache file with the entries of the saves looked up since the
+ * cache was opened. Entries of saves that were not looked up are dropped,
+ * so the cache follows the library as it was last listed. Return 0 on
+ * success or -1 on error.
+ */
+int metadata_cache_save(struct metadata_cache *cache);
+
+void metadata_cache_close(struct metadata_cache *cache);
+
+/*
+ * Return the name of the plugin or the light plugin at index i.
+ */
+const char *save_metadata_plugin(const struct save_metadata *metadata,
+                                 unsigned i);
+const char *save_metadata_light_plugin(const struct save_metadata *metadata,
+                                       unsigned i);
+
+#endif /* CEGSE_METADATA_CACHE_H */
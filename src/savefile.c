@@ -18,6 +18,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,9 +30,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#include "arena.h"
 #include "binary_stream.h"
 #include "compression.h"
+#include "context.h"
 #include "defines.h"
+#include "hash.h"
 #include "mem_types.h"
 #include "savefile.h"
 #include "log.h"
@@ -39,8 +45,16 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include "mem_type_casts.h"
 
-#define perror(str)                                                            \
-    eprintf("%s:%d: %s: %s\n", __FILE__, __LINE__, str, strerror(errno))
+/*
+ * Log that the call str failed and why. strerror() is not thread-safe but
+ * the GNU strerror_r() is.
+ */
+#define LOG_ERRNO(ctx, str)                                                    \
+    do {                                                                       \
+        char errno_buffer_[128];                                               \
+        ERROR_LOG(ctx, "%s: %s\n", str,                                        \
+                  strerror_r(errno, errno_buffer_, sizeof(errno_buffer_)));    \
+    } while (0)
 
 #define TESV_SIGNATURE "TESV_SAVEGAME"
 #define FO4_SIGNATURE  "FO4_SAVEGAME"
@@ -65,8 +79,54 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #define LOCATION_TABLE_SIZE 100u
 
+/*
+ * Sizes of the fixed layouts: the end of the file header from sex to the
+ * snapshot height, the player location without the Skyrim only byte, the
+ * weather up to the variable length data and a global variable.
+ */
+#define HEADER_TAIL_SIZE      26u
+#define PLAYER_LOCATION_SIZE  30u
+#define WEATHER_FIXED_SIZE    63u
+#define GLOBAL_VARIABLE_SIZE  7u
+
 #define VSVAL_MAX 4194303u
 
+/* Smallest buffer for reading a file descriptor that cannot be mapped. */
+#define READ_FD_MIN_BUFFER (64u * 1024u)
+
+/* Size of the first block of a savegame arena. */
+#define SAVEGAME_ARENA_BLOCK_SIZE (1024u * 1024u)
+
+/*
+ * Sidecar file format, all little-endian:
+ *
+ * header {
+ *     u8[8] magic
+ *     le32 version
+ *     le32 prefix_size        Bytes of the save file before the save data
+ *     le64 source_size        Size and modification time of the save file
+ *     le64 source_mtime_sec
+ *     le32 source_mtime_nsec
+ *     le32 body_size          Size of the decompressed save data
+ *     le32 num_globals12      struct savefile_block_index without the blocks
+ *     le32 num_change_forms
+ *     le32 num_globals3
+ *     le32 end_offset
+ *     le64 index_offset       Offset of the blocks in the sidecar file
+ * }
+ * u8[prefix_size] prefix      The save file up to the save data
+ * u8[body_size] body          The decompressed save data
+ * block[num_globals12 + num_change_forms + num_globals3] {
+ *     le32 offset, size, uncompressed_size, type, form_id, flags, version
+ * }
+ *
+ * The blocks start at the first multiple of 8 after the body.
+ */
+#define SIDECAR_MAGIC       "CEGSESDC"
+#define SIDECAR_VERSION     1u
+#define SIDECAR_HEADER_SIZE 64u
+#define SIDECAR_BLOCK_SIZE  28u
+
 typedef enum cg_err {
     CG_OK = 0,
     CG_UNSUPPORTED,
@@ -133,153 +193,10 @@ enum object_type {
     OBJECT_TYPE_COUNT
 };
 
-enum change_form_type {
-    CHANGE_REFR,
-    CHANGE_ACHR,
-    CHANGE_PMIS,
-    CHANGE_PGRE,
-    CHANGE_PBEA,
-    CHANGE_PFLA,
-    CHANGE_CELL,
-    CHANGE_INFO,
-    CHANGE_QUST,
-    CHANGE_NPC_,
-    CHANGE_ACTI,
-    CHANGE_TACT,
-    CHANGE_ARMO,
-    CHANGE_BOOK,
-    CHANGE_CONT,
-    CHANGE_DOOR,
-    CHANGE_INGR,
-    CHANGE_LIGH,
-    CHANGE_MISC,
-    CHANGE_APPA,
-    CHANGE_STAT,
-    CHANGE_MSTT,
-    CHANGE_FURN,
-    CHANGE_WEAP,
-    CHANGE_AMMO,
-    CHANGE_KEYM,
-    CHANGE_ALCH,
-    CHANGE_IDLM,
-    CHANGE_NOTE,
-    CHANGE_ECZN,
-    CHANGE_CLAS,
-    CHANGE_FACT,
-    CHANGE_PACK,
-    CHANGE_NAVM,
-    CHANGE_WOOP,
-    CHANGE_MGEF,
-    CHANGE_SMQN,
-    CHANGE_SCEN,
-    CHANGE_LCTN,
-    CHANGE_RELA,
-    CHANGE_PHZD,
-    CHANGE_PBAR,
-    CHANGE_PCON,
-    CHANGE_FLST,
-    CHANGE_LVLN,
-    CHANGE_LVLI,
-    CHANGE_LVSP,
-    CHANGE_PARW,
-    CHANGE_ENCH
-};
-
-enum change_flags {
-    CHANGE_FORM_FLAGS = 0x00000001,
-    CHANGE_CLASS_TAG_SKILLS = 0x00000002,
-    CHANGE_FACTION_FLAGS = 0x00000002,
-    CHANGE_FACTION_REACTIONS = 0x00000004,
-    CHANGE_FACTION_CRIME_COUNTS = 0x80000000,
-    CHANGE_TALKING_ACTIVATOR_SPEAKER = 0x00800000,
-    CHANGE_BOOK_TEACHES = 0x00000020,
-    CHANGE_BOOK_READ = 0x00000040,
-    CHANGE_DOOR_EXTRA_TELEPORT = 0x00020000,
-    CHANGE_INGREDIENT_USE = 0x80000000,
-    CHANGE_ACTOR_BASE_DATA = 0x00000002,
-    CHANGE_ACTOR_BASE_ATTRIBUTES = 0x00000004,
-    CHANGE_ACTOR_BASE_AIDATA = 0x00000008,
-    CHANGE_ACTOR_BASE_SPELLLIST = 0x00000010,
-    CHANGE_ACTOR_BASE_FULLNAME = 0x00000020,
-    CHANGE_ACTOR_BASE_FACTIONS = 0x00000040,
-    CHANGE_NPC_SKILLS = 0x00000200,
-    CHANGE_NPC_CLASS = 0x00000400,
-    CHANGE_NPC_FACE = 0x00000800,
-    CHANGE_NPC_DEFAULT_OUTFIT = 0x00001000,
-    CHANGE_NPC_SLEEP_OUTFIT = 0x00002000,
-    CHANGE_NPC_GENDER = 0x01000000,
-    CHANGE_NPC_RACE = 0x02000000,
-    CHANGE_LEVELED_LIST_ADDED_OBJECT = 0x80000000,
-    CHANGE_NOTE_READ = 0x80000000,
-    CHANGE_CELL_FLAGS = 0x00000002,
-    CHANGE_CELL_FULLNAME = 0x00000004,
-    CHANGE_CELL_OWNERSHIP = 0x00000008,
-    CHANGE_CELL_EXTERIOR_SHORT = 0x10000000,
-    CHANGE_CELL_EXTERIOR_CHAR = 0x20000000,
-    CHANGE_CELL_DETACHTIME = 0x40000000,
-    CHANGE_CELL_SEENDATA = 0x80000000,
-    CHANGE_REFR_MOVE = 0x00000002,
-    CHANGE_REFR_HAVOK_MOVE = 0x00000004,
-    CHANGE_REFR_CELL_CHANGED = 0x00000008,
-    CHANGE_REFR_SCALE = 0x00000010,
-    CHANGE_REFR_INVENTORY = 0x00000020,
-    CHANGE_REFR_EXTRA_OWNERSHIP = 0x00000040,
-    CHANGE_REFR_BASEOBJECT = 0x00000080,
-    CHANGE_REFR_PROMOTED = 0x02000000,
-    CHANGE_REFR_EXTRA_ACTIVATING_CHILDREN = 0x04000000,
-    CHANGE_REFR_LEVELED_INVENTORY = 0x08000000,
-    CHANGE_REFR_ANIMATION = 0x10000000,
-    CHANGE_REFR_EXTRA_ENCOUNTER_ZONE = 0x20000000,
-    CHANGE_REFR_EXTRA_CREATED_ONLY = 0x40000000,
-    CHANGE_REFR_EXTRA_GAME_ONLY = 0x80000000,
-    CHANGE_ACTOR_LIFESTATE = 0x00000400,
-    CHANGE_ACTOR_EXTRA_PACKAGE_DATA = 0x00000800,
-    CHANGE_ACTOR_EXTRA_MERCHANT_CONTAINER = 0x00001000,
-    CHANGE_ACTOR_EXTRA_DISMEMBERED_LIMBS = 0x00020000,
-    CHANGE_ACTOR_LEVELED_ACTOR = 0x00040000,
-    CHANGE_ACTOR_DISPOSITION_MODIFIERS = 0x00080000,
-    CHANGE_ACTOR_TEMP_MODIFIERS = 0x00100000,
-    CHANGE_ACTOR_DAMAGE_MODIFIERS = 0x00200000,
-    CHANGE_ACTOR_OVERRIDE_MODIFIERS = 0x00400000,
-    CHANGE_ACTOR_PERMANENT_MODIFIERS = 0x00800000,
-    CHANGE_OBJECT_EXTRA_ITEM_DATA = 0x00000400,
-    CHANGE_OBJECT_EXTRA_AMMO = 0x00000800,
-    CHANGE_OBJECT_EXTRA_LOCK = 0x00001000,
-    CHANGE_OBJECT_EMPTY = 0x00200000,
-    CHANGE_OBJECT_OPEN_DEFAULT_STATE = 0x00400000,
-    CHANGE_OBJECT_OPEN_STATE = 0x00800000,
-    CHANGE_TOPIC_SAIDONCE = 0x80000000,
-    CHANGE_QUEST_FLAGS = 0x00000002,
-    CHANGE_QUEST_SCRIPT_DELAY = 0x00000004,
-    CHANGE_QUEST_ALREADY_RUN = 0x04000000,
-    CHANGE_QUEST_INSTANCES = 0x08000000,
-    CHANGE_QUEST_RUNDATA = 0x10000000,
-    CHANGE_QUEST_OBJECTIVES = 0x20000000,
-    CHANGE_QUEST_SCRIPT = 0x40000000,
-    CHANGE_QUEST_STAGES = 0x80000000,
-    CHANGE_PACKAGE_WAITING = 0x40000000,
-    CHANGE_PACKAGE_NEVER_RUN = 0x80000000,
-    CHANGE_FORM_LIST_ADDED_FORM = 0x80000000,
-    CHANGE_ENCOUNTER_ZONE_FLAGS = 0x00000002,
-    CHANGE_ENCOUNTER_ZONE_GAME_DATA = 0x80000000,
-    CHANGE_LOCATION_KEYWORDDATA = 0x40000000,
-    CHANGE_LOCATION_CLEARED = 0x80000000,
-    CHANGE_QUEST_NODE_TIME_RUN = 0x80000000,
-    CHANGE_RELATIONSHIP_DATA = 0x00000002,
-    CHANGE_SCENE_ACTIVE = 0x80000000,
-    CHANGE_BASE_OBJECT_VALUE = 0x00000002,
-    CHANGE_BASE_OBJECT_FULLNAME = 0x00000004
-};
-
-struct change_form {
-    ref_t form_id;
-    uint32_t flags;
-    uint32_t type;
-    uint32_t version;
-    uint32_t length1; /* Length of data */
-    uint32_t length2; /* Non-zero value means data is compressed */
-    unsigned char *data;
-};
+/* The public section numbers follow object types. */
+_Static_assert((int)SECTION_PLUGIN_INFO == (int)OBJECT_PLUGIN_INFO &&
+                   (int)SECTION_GLDA_1007 == (int)OBJECT_GLDA_1007,
+               "enum savefile_section does not match enum object_type");
 
 enum compressor {
     NO_COMPRESSION = 0,
@@ -287,6 +204,13 @@ enum compressor {
     LZ4 = 2,
 };
 
+/* How the savegame releases the save file it retains. */
+enum file_owner {
+    FILE_BORROWED,  /* Owned by the caller */
+    FILE_MAPPED,    /* munmap() */
+    FILE_ALLOCATED, /* The allocator of the context */
+};
+
 struct psavegame {
     /*
      * Skyrim LE: 7,8,9
@@ -301,9 +225,58 @@ struct psavegame {
 
     unsigned n_change_forms;
 
-    struct chunk *globals[OBJECT_GLDA_TYPE_COUNT];
+    /*
+     * Global data that is not interpreted, indexed by object type. data is
+     * NULL if the global data was not read.
+     */
+    struct cregion globals[OBJECT_GLDA_TYPE_COUNT];
     struct change_form *change_forms;
-    struct chunk *unknown3; /* Data at the end of the savefile. */
+    struct cregion unknown3; /* Data at the end of the savefile. */
+
+    /*
+     * Buffers kept for the lifetime of the savegame so that data can
+     * point into them instead of being copied. body is the decompressed
+     * save data and file is the mapped save file.
+     */
+    struct chunk *body;
+    void *file;
+    size_t file_size;
+    enum file_owner file_owner;
+
+    /* True if global data may point into the retained buffers. */
+    bool view_global_data;
+
+    /* The context the savegame was read with. */
+    const struct cegse_ctx *ctx;
+
+    /* If not NULL, everything owned by the savegame is allocated here. */
+    struct arena *arena;
+
+    /*
+     * The compressed save data as read, and the size and hash of the
+     * save data it decompresses to. Kept only if requested.
+     */
+    struct chunk *compressed_body;
+    size_t body_size;
+    uint64_t body_hash;
+
+    /* Sections that were loaded. A save missing any is not written. */
+    uint64_t sections;
+
+    /* Offset of the snapshot in the file that was read. */
+    size_t snapshot_offset;
+
+    /*
+     * Lookup of change forms by form ID and the change form metadata as
+     * columns. Built on first use.
+     */
+    struct change_form_index *change_form_index;
+    struct change_form_table *change_form_table;
+
+#if defined(COMPILE_WITH_UNIT_TESTS)
+    /* Copies of the blocks that objects were deserialized from. */
+    struct chunk *file_objects[OBJECT_TYPE_COUNT];
+#endif
 };
 
 struct location_table {
@@ -387,7 +360,8 @@ struct block_change_form {
     uint32_t version;
 };
 
-static struct savegame *savegame_alloc(void);
+static struct savegame *savegame_alloc(const struct cegse_ctx *ctx,
+                                       unsigned flags);
 
 static inline struct region block_as_region(struct block *block)
 {
@@ -400,10 +374,26 @@ static inline struct cregion const_block_as_cregion(const struct block *block)
 }
 
 static cg_err_t file_writer(unsigned char *file, size_t *file_size_ptr,
-                            const struct savegame *save);
+                            const struct savegame *save, size_t body_size,
+                            const struct savefile_write_options *options);
 static cg_err_t file_reader(const unsigned char *file, size_t file_size,
-                            struct savegame *save);
+                            struct savegame *save,
+                            const struct savefile_read_options *options);
 
+static cg_err_t threaded_blocks_reader(
+    struct cursor *cursor, struct savegame *save,
+    const struct location_table *locations, uint64_t wanted,
+    const struct savefile_read_options *options);
+
+typedef cg_err_t (*file_reader_fn_t)(
+    const unsigned char *file, size_t file_size, struct savegame *save,
+    const struct savefile_read_options *options);
+
+/*
+ * Serialize an object to the block buffer. If the block buffer is NULL,
+ * nothing is written and only the serialized size of the object is stored
+ * to block->size.
+ */
 static cg_err_t serializer(struct block *block, const struct savegame *save,
                            enum object_type object_type);
 static cg_err_t deserializer(struct block *block, struct savegame *save,
@@ -427,9 +417,10 @@ static cg_err_t decompressor(struct block *block, void *buffer,
 static void assembler(const struct block *block, struct cursor *cursor);
 static cg_err_t disassembler(struct block *block, struct cursor *cursor);
 
-static void print_locations_table(const struct location_table *t)
+static void print_locations_table(const struct cegse_ctx *ctx,
+                                  const struct location_table *t)
 {
-    DEBUG_LOG("\n"
+    DEBUG_LOG(ctx, "\n"
               "+==============================================+\n"
               "|                Location table                |\n"
               "+==============================================+\n"
@@ -453,1116 +444,3403 @@ static void print_locations_table(const struct location_table *t)
     );
 }
 
-static bool supports_save_file_compression(const struct savegame *save)
+/*
+ * Return true if data points into a buffer retained by the savegame rather
+ * than to memory allocated for it separately.
+ */
+static bool savegame_retains(const struct psavegame *priv, const void *data)
 {
-    return save->game == SKYRIM && save->priv->file_version >= 12;
-}
+    const unsigned char *p = data;
 
-static bool supports_light_plugins(const struct savegame *save)
-{
-    switch (save->game) {
-    case SKYRIM:
-        return save->priv->file_version >= 12 && save->priv->form_version >= 78;
-    case FALLOUT4:
-        return save->priv->file_version >= 12;
+    if (priv->body && p >= priv->body->data &&
+        p <= priv->body->data + priv->body->size) {
+        return true;
     }
-    return false;
-}
 
-static unsigned snapshot_pixel_width(const struct savegame *save)
-{
-    return save->priv->file_version >= 11 ? 4 : 3;
+    if (priv->file && p >= (unsigned char *)priv->file &&
+        p <= (unsigned char *)priv->file + priv->file_size) {
+        return true;
+    }
+
+    return false;
 }
 
-#if 0
-/**
- * @brief Convert a FILETIME to a time_t.
- *
- * @note FILETIME is more accurate than time_t.
- * @param filetime Filetime.
- * @return Filetime converted to time_t.
+/*
+ * Allocators for memory owned by a savegame. If the savegame has an arena,
+ * the memory comes from the arena and save_free() does nothing.
  */
-static inline time_t filetime_to_time(FILETIME filetime)
+static void *save_malloc(struct savegame *save, size_t size)
 {
-    return (time_t)(filetime / 10000000) - 11644473600;
+    if (save->priv->arena) {
+        return arena_alloc(save->priv->arena, size);
+    }
+
+    return cegse_malloc(save->priv->ctx, size);
 }
 
-/**
- * @brief Convert a time_t to a FILETIME.
- *
- * @note FILETIME is more accurate than time_t.
- * @param t time_t value.
- * @return Filetime.
- */
-static inline FILETIME time_to_filetime(time_t t)
+static void *save_calloc(struct savegame *save, size_t n, size_t size)
 {
-    return (FILETIME)(t + 11644473600) * 10000000;
-}
-#endif
+    void *ptr;
 
-#define GLDA_TYPE_NUMBER_LIST                                                  \
-    X(0, OBJECT_GLDA_MISC_STATS)                                               \
-    X(1, OBJECT_GLDA_PLAYER_LOCATION)                                          \
-    X(2, OBJECT_GLDA_GAME)                                                     \
-    X(3, OBJECT_GLDA_GLOBAL_VARIABLES)                                         \
-    X(4, OBJECT_GLDA_CREATED_OBJECTS)                                          \
-    X(5, OBJECT_GLDA_EFFECTS)                                                  \
-    X(6, OBJECT_GLDA_WEATHER)                                                  \
-    X(7, OBJECT_GLDA_AUDIO)                                                    \
-    X(8, OBJECT_GLDA_SKY_CELLS)                                                \
-    X(9, OBJECT_GLDA_9)                                                        \
-    X(10, OBJECT_GLDA_10)                                                      \
-    X(11, OBJECT_GLDA_11)                                                      \
-    X(100, OBJECT_GLDA_PROCESS_LISTS)                                          \
-    X(101, OBJECT_GLDA_COMBAT)                                                 \
-    X(102, OBJECT_GLDA_INTERFACE)                                              \
-    X(103, OBJECT_GLDA_ACTOR_CAUSES)                                           \
-    X(104, OBJECT_GLDA_104)                                                    \
-    X(105, OBJECT_GLDA_DETECTION_MANAGER)                                      \
-    X(106, OBJECT_GLDA_LOCATION_METADATA)                                      \
-    X(107, OBJECT_GLDA_QUEST_STATIC_DATA)                                      \
-    X(108, OBJECT_GLDA_STORYTELLER)                                            \
-    X(109, OBJECT_GLDA_MAGIC_FAVORITES)                                        \
-    X(110, OBJECT_GLDA_PLAYER_CONTROLS)                                        \
-    X(111, OBJECT_GLDA_STORY_EVENT_MANAGER)                                    \
-    X(112, OBJECT_GLDA_INGREDIENT_SHARED)                                      \
-    X(113, OBJECT_GLDA_MENU_CONTROLS)                                          \
-    X(114, OBJECT_GLDA_MENU_TOPIC_MANAGER)                                     \
-    X(115, OBJECT_GLDA_115)                                                    \
-    X(116, OBJECT_GLDA_116)                                                    \
-    X(117, OBJECT_GLDA_117)                                                    \
-    X(1000, OBJECT_GLDA_TEMP_EFFECTS)                                          \
-    X(1001, OBJECT_GLDA_PAPYRUS)                                               \
-    X(1002, OBJECT_GLDA_ANIM_OBJECTS)                                          \
-    X(1003, OBJECT_GLDA_TIMER)                                                 \
-    X(1004, OBJECT_GLDA_SYNCHRONISED_ANIMS)                                    \
-    X(1005, OBJECT_GLDA_MAIN)                                                  \
-    X(1006, OBJECT_GLDA_1006)                                                  \
-    X(1007, OBJECT_GLDA_1007)
+    if (!save->priv->arena) {
+        return cegse_calloc(save->priv->ctx, n, size);
+    }
 
-static unsigned glda_type_number(enum object_type type)
-{
-    switch (type) {
-#define X(number, object_type)                                                 \
-    case object_type:                                                          \
-        return number;
-        GLDA_TYPE_NUMBER_LIST
-#undef X
-    default:
-        assert(0); /* Invalid object type argument. */
-        return 0;
+    if (size != 0 && n > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    ptr = arena_alloc(save->priv->arena, n * size);
+    if (ptr) {
+        memset(ptr, 0, n * size);
     }
+
+    return ptr;
 }
 
-static int object_type_from_glda_type_number(int type_number)
+static void save_free(struct savegame *save, void *ptr)
 {
-    switch (type_number) {
-#define X(number, object_type)                                                 \
-    case number:                                                               \
-        return object_type;
-        GLDA_TYPE_NUMBER_LIST
-#undef X
-    default:
-        /* No object type for type_number. */
-        return -1;
+    if (!save->priv->arena) {
+        cegse_free(save->priv->ctx, ptr);
     }
 }
 
 /*
- * Encode a variable size value. Caller decides whether it is an error
- * when the buffer overflows. Therefore, this returns CG_OK even if
- * the buffer is full. See cursor->n to check buffer overflow.
+ * Allocate a chunk with the allocator of a context.
  */
-static cg_err_t encode_vsval(struct cursor *cursor, uint32_t value)
+static struct chunk *ctx_chunk_alloc(const struct cegse_ctx *ctx, size_t size)
 {
-    int num_octets;
+    struct chunk *c;
 
-    if (value > VSVAL_MAX) {
-        assert(0);
-        return CG_INVAL;
+    if (size > SIZE_MAX - sizeof(*c)) {
+        return NULL;
     }
 
-    /*
-     * 2 least significant bits determine vsval size
-     *
-     *    2 LSB    | vsval size
-     * ------------+------------
-     *     00       |   1 octet
-     *     01       |   2 octets
-     *     10       |   3 octets
-     */
-    value <<= 2;        /* vsval size information takes 2 bits. */
-    value &= 0xffffffu; /* vsval max width is 24 bits. */
-    num_octets = ((value >= 0x100u) << (value >= 0x10000u)) + 1;
-    value |= num_octets - 1; /* add size information */
-    value = htole32(value);  /* vsval is little endian */
+    c = cegse_malloc(ctx, sizeof(*c) + size);
+    if (c) {
+        c->size = size;
+    }
 
-    c_store_bytes(cursor, &value, num_octets);
-    return CG_OK;
+    return c;
 }
 
-static cg_err_t decode_vsval(struct cursor *cursor, uint32_t *out)
+static struct chunk *save_chunk_alloc(struct savegame *save, size_t size)
 {
-    uint8_t b[3] = { 0 };
-    int i;
+    struct chunk *c;
 
-    /*
-     * Loop at least once. Break when all octets have been read
-     * or octet count is invalid.
-     */
-    for (i = 0; i < ((b[0] + 1) & 0x3); ++i) {
-        if (!c_load_u8(cursor, &b[i])) {
-            return CG_EOF;
-        }
+    if (!save->priv->arena) {
+        return ctx_chunk_alloc(save->priv->ctx, size);
     }
 
-    /* Check if octet count is invalid (> 3 octets). */
-    if ((b[0] & 0x3) == 3) {
-        /* Count not valid. Corrupt vsval. */
-        return CG_CORRUPT;
+    if (size > SIZE_MAX - sizeof(*c)) {
+        return NULL;
     }
 
-    *out = ((uint32_t)b[2] << 16 | (uint32_t)b[1] << 8 | b[0]) >> 2;
+    c = arena_alloc(save->priv->arena, sizeof(*c) + size);
+    if (c) {
+        c->size = size;
+    }
 
-    return CG_OK;
+    return c;
 }
 
-static cg_err_t c_load_le16_str(struct cursor *cursor, char **string_out)
+/*
+ * Read length bytes at the cursor to a view. The view points into the save
+ * data if global data is viewed and the save data is retained, and to a
+ * copy owned by the savegame otherwise. Even an empty view has non-NULL
+ * data.
+ */
+static cg_err_t read_view(struct cursor *cursor, struct savegame *save,
+                          struct cregion *view, size_t length)
 {
-    uint16_t string_length;
-    char *string;
+    struct ucursor bytes;
+    unsigned char *copy;
 
-    if (!c_load_le16(cursor, &string_length)) {
+    if (!c_reserve(cursor, &bytes, length)) {
         return CG_EOF;
     }
 
-    if (string_length >= 512) {
-        DEBUG_LOG("Reading a very long string (%u chars).\n", string_length);
+    if (save->priv->view_global_data &&
+        savegame_retains(save->priv, bytes.pos)) {
+        *view = make_cregion(bytes.pos, length);
+        return CG_OK;
     }
 
-    string = malloc((size_t)string_length + 1);
-    if (!string) {
+    copy = save_malloc(save, length ? length : 1);
+    if (!copy) {
         return CG_NO_MEM;
     }
 
-    if (!c_load_bytes(cursor, string, string_length)) {
-        free(string);
-        return CG_EOF;
-    }
-
-    string[string_length] = '\0';
+    memcpy(copy, bytes.pos, length);
+    *view = make_cregion(copy, length);
 
-    *string_out = string;
     return CG_OK;
 }
 
-static void c_store_le16_str(struct cursor *restrict cursor,
-                             const char *restrict string)
+/*
+ * Free the data of a view unless it points into a retained buffer.
+ */
+static void free_view(struct savegame *save, struct cregion view)
 {
-    size_t length = strlen(string);
-
-    assert(length <= UINT16_MAX);
-
-    c_store_le16(cursor, length);
-    c_store_bytes(cursor, string, length);
+    if (!savegame_retains(save->priv, view.data)) {
+        save_free(save, (void *)view.data);
+    }
 }
 
-static cg_err_t read_le16_str_array(struct cursor *cursor, char **array,
-                                    int length)
+int savegame_change_form_own_data(struct savegame *save,
+                                  struct change_form *cf)
 {
-    cg_err_t err = CG_OK;
-    int i;
+    unsigned char *data;
 
-    for (i = 0; i < length; ++i) {
-        err = c_load_le16_str(cursor, &array[i]);
-        if (err) {
-            break;
-        }
+    if (!savegame_retains(save->priv, cf->data)) {
+        return 0;
     }
 
-    if (err) {
-        while (i--) {
-            free(array[i]);
-            array[i] = NULL;
-        }
+    data = save_malloc(save, cf->length1 ? cf->length1 : 1);
+    if (!data) {
+        return -1;
     }
 
-    return err;
+    memcpy(data, cf->data, cf->length1);
+    cf->data = data;
+
+    return 0;
 }
 
-static cg_err_t alloc_and_read_chunk(struct cursor *cursor,
-                                     struct chunk **chunk_out, size_t length)
+static struct cregion *global_data_slot(struct savegame *save,
+                                        enum savefile_section section)
 {
-    struct chunk *chunk;
+    if (section < SECTION_GLDA_MISC_STATS || section > SECTION_GLDA_1007) {
+        return NULL;
+    }
+
+    return &save->priv->globals[(int)section - FIRST_OBJECT_GLDA];
+}
 
-    chunk = chunk_alloc(length);
+size_t savegame_snapshot_offset(const struct savegame *save)
+{
+    return save->priv->snapshot_offset;
+}
 
-    if (!chunk) {
-        return CG_NO_MEM;
+struct cregion savegame_global_data(const struct savegame *save,
+                                    enum savefile_section section)
+{
+    struct cregion *slot;
+
+    slot = global_data_slot((struct savegame *)save, section);
+    if (!slot) {
+        return make_cregion(NULL, 0);
     }
 
-    if (!c_load_bytes(cursor, chunk->data, length)) {
-        free(chunk);
-        return CG_EOF;
-    }
-
-    *chunk_out = chunk;
-
-    return CG_OK;
+    return *slot;
 }
 
-static void dump_to_file(const char *filename, const void *data, size_t size,
-                         long offset)
+int savegame_replace_global_data(struct savegame *save,
+                                 enum savefile_section section,
+                                 const void *data, size_t size)
 {
-    FILE *fp;
+    struct cregion *slot;
+    unsigned char *copy;
 
-    if ((fp = fopen(filename, "w")) == NULL) {
-        perror("fopen");
-        return;
+    slot = global_data_slot(save, section);
+    if (!slot || !slot->data) {
+        return -1;
     }
 
-    if (offset > 0) {
-        fseek(fp, offset, SEEK_SET);
+    copy = save_malloc(save, size ? size : 1);
+    if (!copy) {
+        return -1;
     }
 
-    write_bytes(fp, data, size);
-    fclose(fp);
-}
-
-static off_t get_file_size(int fd)
-{
-    struct stat statbuf;
+    memcpy(copy, data, size);
+    free_view(save, *slot);
+    *slot = make_cregion(copy, size);
 
-    if (fstat(fd, &statbuf) == 0) {
-        return statbuf.st_size;
-    }
-    else {
-        return (off_t)-1;
-    }
+    return 0;
 }
 
-static void *mmap_entire_file_r(const char *filename, size_t *pfsize)
+int savegame_replace_weather_data4(struct savegame *save, const void *data,
+                                   size_t size)
 {
-    void *fcontents;
-    int save_errno;
-    off_t fsize;
-    int fd;
+    unsigned char *copy;
 
-    fd = open(filename, O_RDONLY);
-    if (fd == -1) {
-        return MAP_FAILED;
+    if (!(save->priv->sections & SAVEFILE_SECTION(SECTION_GLDA_WEATHER))) {
+        return -1;
     }
 
-    fsize = get_file_size(fd);
-    if (fsize == -1) {
-        save_errno = errno;
-        close(fd);
-        errno = save_errno;
-        return MAP_FAILED;
+    copy = save_malloc(save, size ? size : 1);
+    if (!copy) {
+        return -1;
     }
 
-    fcontents = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (fcontents == MAP_FAILED) {
-        save_errno = errno;
-        close(fd);
-        errno = save_errno;
-        return MAP_FAILED;
-    }
+    memcpy(copy, data, size);
+    free_view(save, save->weather.data4);
+    save->weather.data4 = make_cregion(copy, size);
 
-    close(fd);
+    return 0;
+}
 
-    *pfsize = fsize;
-    return fcontents;
+/*
+ * Open addressing hash table from form ID to change form. A slot holds the
+ * index of a change form plus one, or 0 if the slot is empty. Change forms
+ * are inserted in file order, so a probe meets change forms with the same
+ * form ID in file order too.
+ *
+ * The index remembers the array it was built from so that replacing or
+ * resizing the array is noticed without being told.
+ */
+struct change_form_index {
+    const struct change_form *change_forms;
+    unsigned n_change_forms;
+    unsigned shift; /* 32 - log2 of the number of slots. */
+    uint32_t mask;
+    uint32_t slots[];
+};
+
+static uint32_t change_form_slot(const struct change_form_index *index,
+                                 ref_t form_id)
+{
+    /* Fibonacci hashing spreads the sequential form IDs of a save. */
+    return (uint32_t)(form_id * UINT32_C(0x9e3779b9)) >> index->shift;
 }
 
-struct savegame *cengine_savefile_read(const char *filename)
+static struct change_form_index *
+change_form_index_build(const struct psavegame *priv)
 {
-    struct savegame *save;
-    size_t file_size = 0;
-    unsigned char *file;
-    cg_err_t err;
+    struct change_form_index *index;
+    unsigned bits = 4;
 
-    file = mmap_entire_file_r(filename, &file_size);
-    if (!file) {
-        perror("mmap");
-        return NULL;
+    /* Keep the table at most half full. */
+    while (bits < 31 && (UINT32_C(1) << bits) / 2 < priv->n_change_forms) {
+        bits++;
     }
 
-    if ((save = savegame_alloc()) == NULL) {
-        munmap(file, file_size);
+    index = cegse_calloc(priv->ctx, 1,
+                         sizeof(*index) +
+                             ((size_t)1 << bits) * sizeof(index->slots[0]));
+    if (!index) {
         return NULL;
     }
 
-    DEBUG_LOG("Reading save file %s\n", filename);
+    index->change_forms = priv->change_forms;
+    index->n_change_forms = priv->n_change_forms;
+    index->shift = 32 - bits;
+    index->mask = (UINT32_C(1) << bits) - 1;
 
-    err = file_reader(file, file_size, save);
-    switch (err) {
-    case CG_UNSUPPORTED:
-        eprintf("File cannot be read because its format is unsupported.\n");
-        break;
-    case CG_EOF:
-        eprintf("File ended too soon. Is the save corrupt?\n");
-        break;
-    case CG_CORRUPT:
-        eprintf("File may be corrupt.\n");
-        break;
-    case CG_NO_MEM:
-        eprintf("Failed to allocate memory.\n");
-        break;
-    case CG_COMPRESS:
-        eprintf("Compression error.\n");
-        break;
-    case CG_INVAL:
-        eprintf("Invalid argument.\n");
-        break;
-    case CG_NOT_PRESENT:
-        /* bug */
-        break;
-    case CG_OK:
-        /* No error. */
-        break;
+    for (unsigned i = 0; i < priv->n_change_forms; ++i) {
+        uint32_t slot = change_form_slot(index, priv->change_forms[i].form_id);
+
+        while (index->slots[slot]) {
+            slot = (slot + 1) & index->mask;
+        }
+
+        index->slots[slot] = i + 1;
     }
 
-    munmap(file, file_size);
+    return index;
+}
+
+/*
+ * Find the first change form with the form ID and, unless type is -1, the
+ * type.
+ */
+static struct change_form *find_change_form(struct savegame *save,
+                                            ref_t form_id, int type)
+{
+    struct psavegame *priv = save->priv;
+    struct change_form_index *index = priv->change_form_index;
+    struct change_form *cf;
+
+    if (!index || index->change_forms != priv->change_forms ||
+        index->n_change_forms != priv->n_change_forms) {
+        savegame_change_forms_changed(save);
+        index = priv->change_form_index = change_form_index_build(priv);
+    }
+
+    if (!index) {
+        /* Out of memory. Scan instead. */
+        for (unsigned i = 0; i < priv->n_change_forms; ++i) {
+            cf = &priv->change_forms[i];
+            if (cf->form_id == form_id &&
+                (type == -1 || (int)(cf->type & 0x3f) == type)) {
+                return cf;
+            }
+        }
 
-    if (err) {
-        DEBUG_LOG("Error %d occurred while reading save file\n", err);
-        savegame_free(save);
         return NULL;
     }
 
-    return save;
+    for (uint32_t slot = change_form_slot(index, form_id); index->slots[slot];
+         slot = (slot + 1) & index->mask) {
+        cf = &priv->change_forms[index->slots[slot] - 1];
+        if (cf->form_id == form_id &&
+            (type == -1 || (int)(cf->type & 0x3f) == type)) {
+            return cf;
+        }
+    }
+
+    return NULL;
 }
 
-static cg_err_t file_reader(const unsigned char *file, size_t file_size,
-                            struct savegame *save)
+struct change_form *savegame_find_change_form(struct savegame *save,
+                                              ref_t form_id)
 {
-    struct location_table locations;
-    struct chunk *buffers[1] = { 0 };
-    struct cursor file_cursor;
-    struct cursor body_cursor;
-    struct cursor *cursor;
-    intptr_t offset_var = (intptr_t)file;
-    cg_err_t err = CG_OK;
+    return find_change_form(save, form_id, -1);
+}
 
-    union {
-        struct block simple;
-        struct block_change_form chfo;
-        struct block_global_data glda;
-    } block_buf = { 0 };
-    struct block *block = &block_buf.simple;
+struct change_form *savegame_find_change_form_of_type(struct savegame *save,
+                                                      uint32_t type,
+                                                      ref_t form_id)
+{
+    return find_change_form(save, form_id, type & 0x3f);
+}
 
-    if (file_size < 300) {
-        return CG_CORRUPT;
-    }
+void savegame_change_forms_changed(struct savegame *save)
+{
+    cegse_free(save->priv->ctx, save->priv->change_form_index);
+    cegse_free(save->priv->ctx, save->priv->change_form_table);
+    save->priv->change_form_index = NULL;
+    save->priv->change_form_table = NULL;
+}
 
-    file_cursor.pos = (unsigned char *)file;
-    file_cursor.n = file_size;
-    cursor = &file_cursor;
+/*
+ * Change form metadata as columns and the storage of the columns. Like the
+ * index, the table remembers the array it was built from.
+ */
+struct change_form_table {
+    const struct change_form *change_forms;
+    struct change_form_columns columns;
+};
 
-/* Calculates current file offset at cursor position. */
-#define OFFSET() ((unsigned long)((intptr_t)cursor->pos - offset_var))
+static bool change_form_table_is_stale(const struct change_form_table *table,
+                                       const struct psavegame *priv)
+{
+    return table->change_forms != priv->change_forms ||
+           table->columns.count != priv->n_change_forms;
+}
 
-    /*
-     * Check the file signature.
-     */
-    {
-        if (!memcmp(file, TESV_SIGNATURE, strlen(TESV_SIGNATURE))) {
-            DEBUG_LOG("TESV file signature detected\n");
-            save->game = SKYRIM;
-            c_advance(cursor, strlen(TESV_SIGNATURE));
-        }
-        else if (!memcmp(file, FO4_SIGNATURE, strlen(FO4_SIGNATURE))) {
-            DEBUG_LOG("Fallout 4 file signature detected\n");
-            save->game = FALLOUT4;
-            c_advance(cursor, strlen(FO4_SIGNATURE));
-            // return CG_UNSUPPORTED;
-        }
-        else {
-            DEBUG_LOG("File not recognized\n");
-            err = CG_UNSUPPORTED;
-            goto out_error;
-        }
+static struct change_form_table *
+change_form_table_build(const struct psavegame *priv)
+{
+    struct change_form_table *table;
+    uint32_t *form_id, *flags, *version, *length1, *length2;
+    size_t n = priv->n_change_forms;
+    uint8_t *type;
+
+    /* The columns of 32-bit values come first to keep them aligned. */
+    table = cegse_malloc(priv->ctx,
+                         sizeof(*table) + n * (5 * sizeof(uint32_t) + 1));
+    if (!table) {
+        return NULL;
     }
 
-    /*
-     * Read the file header.
-     */
-    DEBUG_LOG("0x%08lx: Reading file header\n", OFFSET());
-    block->block_type = BLOCK_SIMPLE;
-    err = disassembler(block, cursor);
-    if (err) {
-        goto out_error;
-    }
-    err = deserializer(block, save, OBJECT_FILE_HEADER);
-    if (err) {
-        goto out_error;
+    form_id = (uint32_t *)(table + 1);
+    flags = form_id + n;
+    version = flags + n;
+    length1 = version + n;
+    length2 = length1 + n;
+    type = (uint8_t *)(length2 + n);
+
+    for (size_t i = 0; i < n; ++i) {
+        const struct change_form *cf = &priv->change_forms[i];
+
+        form_id[i] = cf->form_id;
+        flags[i] = cf->flags;
+        length1[i] = cf->length1;
+        length2[i] = cf->length2;
+        type[i] = cf->type & 0x3f;
+        version[i] = cf->version;
     }
 
-    DEBUG_LOG("File version: %u\n", save->priv->file_version);
-    if (save->priv->file_version > 15) {
-        err = CG_UNSUPPORTED;
-        goto out_error;
+    table->change_forms = priv->change_forms;
+    table->columns = (struct change_form_columns){
+        .count = n,
+        .form_id = form_id,
+        .flags = flags,
+        .type = type,
+        .version = version,
+        .length1 = length1,
+        .length2 = length2,
+    };
+
+    return table;
+}
+
+const struct change_form_columns *
+savegame_change_form_columns(struct savegame *save)
+{
+    struct psavegame *priv = save->priv;
+
+    if (priv->change_form_table &&
+        change_form_table_is_stale(priv->change_form_table, priv)) {
+        savegame_change_forms_changed(save);
     }
 
-    /*
-     * Read the snapshot.
-     */
-    save->snapshot_bytes_per_pixel = snapshot_pixel_width(save);
-    save->snapshot_size = save->snapshot_width * save->snapshot_height *
-                          save->snapshot_bytes_per_pixel;
-    save->snapshot_data = malloc(save->snapshot_size);
-    if (!save->snapshot_data) {
-        err = CG_NO_MEM;
-        goto out_error;
+    if (!priv->change_form_table) {
+        priv->change_form_table = change_form_table_build(priv);
+        if (!priv->change_form_table) {
+            return NULL;
+        }
     }
 
-    DEBUG_LOG("0x%08lx: Reading %u bytes of snapshot data\n", OFFSET(),
-              save->snapshot_size);
+    return &priv->change_form_table->columns;
+}
 
-    c_load_bytes(cursor, save->snapshot_data, save->snapshot_size);
+struct change_form *savegame_change_form(struct savegame *save,
+                                         uint32_t index)
+{
+    if (index >= save->priv->n_change_forms) {
+        return NULL;
+    }
 
-    /* Initialize body cursor. */
-    if (supports_save_file_compression(save)) {
-        ssize_t uncompress_size;
-        ssize_t compress_size;
+    return &save->priv->change_forms[index];
+}
 
-        uncompress_size = c_load_le32_or0(cursor);
-        compress_size = c_load_le32_or0(cursor);
-        if (cursor->n < 0) {
-            err = CG_EOF;
-            goto out_error;
-        }
+ssize_t savegame_change_forms_of_type(struct savegame *save, unsigned type,
+                                      uint32_t *indices)
+{
+    struct change_form_query query = { 0 };
 
-        DEBUG_LOG("Save data uncompressed length: %zd\n", uncompress_size);
-        DEBUG_LOG("Save data compressed length:   %zd\n", compress_size);
+    /* Form types are six bits wide, so larger types match nothing. */
+    if (type < 64) {
+        query.types = CHANGE_FORM_TYPE(type);
+    }
 
-        if (save->priv->compressor != NO_COMPRESSION) {
-            decompress_fn_t decompress = NULL;
-            ssize_t decompress_size = 0;
+    return savegame_query_change_form_indices(save, &query, indices);
+}
 
-            /* Allocate space for decompression. */
-            buffers[0] = chunk_alloc(uncompress_size);
-            if (!buffers[0]) {
-                err = CG_NO_MEM;
-                goto out_error;
-            }
+ssize_t savegame_change_forms_with_flags(struct savegame *save,
+                                         uint32_t flags, uint32_t *indices)
+{
+    struct change_form_query query = {
+        .types = CHANGE_FORM_ALL_TYPES,
+        .flags_mask = flags,
+        .flags_value = flags,
+    };
 
-            /* Select decompress method. */
-            switch (save->priv->compressor) {
-            case LZ4:
-                decompress = lz4_decompress;
-                break;
-            case ZLIB:
-                decompress = zlib_decompress;
-                break;
-            case NO_COMPRESSION:
-                abort();
-                break;
-            }
+    return savegame_query_change_form_indices(save, &query, indices);
+}
 
-            /* Decompress. */
-            struct cregion src = make_cregion(cursor->pos, compress_size);
-            struct region dest =
-                make_region(buffers[0]->data, buffers[0]->size);
-            DEBUG_LOG("Decompressing save data\n");
-            decompress_size = decompress(src, dest);
-            if (decompress_size == -1) {
-                err = CG_COMPRESS;
-                goto out_error;
-            }
+/*
+ * Stores every index and advances only past the matching ones, so the loop
+ * has no branch on the flags.
+ */
+ssize_t savegame_keep_change_forms_with_flags(struct savegame *save,
+                                              uint32_t flags,
+                                              uint32_t *indices, size_t count)
+{
+    const struct change_form_columns *columns;
+    uint32_t n = 0;
 
-            DEBUG_LOG("Dumping decompressed save data\n");
-            dump_to_file("decompressed_save_data", dest.data, dest.size,
-                         OFFSET());
+    if ((columns = savegame_change_form_columns(save)) == NULL) {
+        return -1;
+    }
 
-            body_cursor.pos = dest.data;
-            body_cursor.n = decompress_size;
-            offset_var = (intptr_t)body_cursor.pos - (file_cursor.pos - file);
-        }
-        else {
-            /*
-             * No compression required. We will directly write to file, but
-             * need to leave 8 bytes of space to store size information.
-             */
-            c_advance2(&body_cursor, &file_cursor, 8);
-            offset_var += 8;
+    /* Check all indices first so that a failure leaves them unchanged. */
+    for (size_t i = 0; i < count; ++i) {
+        if (indices[i] >= columns->count) {
+            return -1;
         }
     }
-    else {
-        /*
-         * Game engine doesn't support compression for the save file.
-         * We will continue reading where we left off.
-         */
-        c_advance2(&body_cursor, &file_cursor, 0);
+
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t index = indices[i];
+
+        indices[n] = index;
+        n += (columns->flags[index] & flags) == flags;
     }
 
-    cursor = &body_cursor;
+    return n;
+}
 
-    DEBUG_LOG("0x%08lx: Save data begins\n", OFFSET());
+ssize_t savegame_query_change_forms(struct savegame *save,
+                                    const struct change_form_query *query,
+                                    uint64_t *bitmap)
+{
+    const struct change_form_columns *columns;
 
-    if (!c_load_u8(cursor, &save->priv->form_version)) {
-        err = CG_EOF;
-        goto out_error;
+    if ((columns = savegame_change_form_columns(save)) == NULL) {
+        return -1;
     }
 
-    DEBUG_LOG("Save data form version: %u\n", save->priv->form_version);
+    return change_form_query_bitmap(query, columns->type, columns->flags,
+                                    columns->count, bitmap);
+}
 
-    if (save->game == FALLOUT4) {
-        err = c_load_le16_str(cursor, &save->game_version);
-        if (err) {
-            goto out_error;
-        }
+ssize_t savegame_query_change_form_indices(
+    struct savegame *save, const struct change_form_query *query,
+    uint32_t *indices)
+{
+    const struct change_form_columns *columns;
+
+    if ((columns = savegame_change_form_columns(save)) == NULL) {
+        return -1;
     }
 
-    /*
-     * Read plugin information.
-     */
-    block->block_type = BLOCK_SIMPLE;
-    err = disassembler(block, cursor);
-    if (err) {
-        goto out_error;
+    return change_form_query_indices(query, columns->type, columns->flags,
+                                     columns->count, indices);
+}
+
+int savegame_count_change_form_types(struct savegame *save,
+                                     uint32_t counts[64])
+{
+    const struct change_form_columns *columns;
+
+    if ((columns = savegame_change_form_columns(save)) == NULL) {
+        return -1;
     }
-    err = deserializer(block, save, OBJECT_PLUGIN_INFO);
-    if (err) {
-        goto out_error;
+
+    memset(counts, 0, 64 * sizeof(counts[0]));
+    for (uint32_t i = 0; i < columns->count; ++i) {
+        counts[columns->type[i]]++;
     }
 
-    /*
-     * Read location table.
-     */
-    DEBUG_LOG("0x%08lx: Reading locations table\n", OFFSET());
-    locations.off_form_ids_count = c_load_le32_or0(cursor);
-    locations.off_unknown_table = c_load_le32_or0(cursor);
-    locations.off_globals1 = c_load_le32_or0(cursor);
-    locations.off_globals2 = c_load_le32_or0(cursor);
-    locations.off_change_forms = c_load_le32_or0(cursor);
-    locations.off_globals3 = c_load_le32_or0(cursor);
-    locations.num_globals1 = c_load_le32_or0(cursor);
-    locations.num_globals2 = c_load_le32_or0(cursor);
-    locations.num_globals3 = c_load_le32_or0(cursor);
-    locations.num_change_forms = c_load_le32_or0(cursor);
-    c_advance(cursor, 60); /* Skip junk. */
+    return 0;
+}
 
-    locations.num_globals3 += 1; /* Count is bugged and short by 1. */
-    print_locations_table(&locations);
+static bool supports_save_file_compression(const struct savegame *save)
+{
+    return save->game == SKYRIM && save->priv->file_version >= 12;
+}
 
-    save->priv->n_change_forms = locations.num_change_forms;
+static bool supports_light_plugins(const struct savegame *save)
+{
+    switch (save->game) {
+    case SKYRIM:
+        return save->priv->file_version >= 12 && save->priv->form_version >= 78;
+    case FALLOUT4:
+        return save->priv->file_version >= 12;
+    }
+    return false;
+}
 
-    /*
-     * Read global data table 1 and 2.
-     */
-    DEBUG_LOG("0x%08lx: Reading global data table 1 and 2\n", OFFSET());
+static unsigned snapshot_pixel_width(const struct savegame *save)
+{
+    return save->priv->file_version >= 11 ? 4 : 3;
+}
 
-    block->block_type = BLOCK_GLOBAL_DATA;
-    for (unsigned i = 0; i < locations.num_globals1 + locations.num_globals2;
-         ++i) {
-        struct block_global_data *glda = (struct block_global_data *)block;
-        int object_type;
+#if 0
+/**
+ * @brief Convert a FILETIME to a time_t.
+ *
+ * @note FILETIME is more accurate than time_t.
+ * @param filetime Filetime.
+ * @return Filetime converted to time_t.
+ */
+static inline time_t filetime_to_time(FILETIME filetime)
+{
+    return (time_t)(filetime / 10000000) - 11644473600;
+}
 
-        err = disassembler(block, cursor);
-        if (err) {
-            goto out_error;
-        }
+/**
+ * @brief Convert a time_t to a FILETIME.
+ *
+ * @note FILETIME is more accurate than time_t.
+ * @param t time_t value.
+ * @return Filetime.
+ */
+static inline FILETIME time_to_filetime(time_t t)
+{
+    return (FILETIME)(t + 11644473600) * 10000000;
+}
+#endif
 
-        object_type = object_type_from_glda_type_number(glda->type_num);
-        if (object_type == -1) {
-            /* Invalid type number. */
-            err = CG_CORRUPT;
-            goto out_error;
-        }
+#define GLDA_TYPE_NUMBER_LIST                                                  \
+    X(0, OBJECT_GLDA_MISC_STATS)                                               \
+    X(1, OBJECT_GLDA_PLAYER_LOCATION)                                          \
+    X(2, OBJECT_GLDA_GAME)                                                     \
+    X(3, OBJECT_GLDA_GLOBAL_VARIABLES)                                         \
+    X(4, OBJECT_GLDA_CREATED_OBJECTS)                                          \
+    X(5, OBJECT_GLDA_EFFECTS)                                                  \
+    X(6, OBJECT_GLDA_WEATHER)                                                  \
+    X(7, OBJECT_GLDA_AUDIO)                                                    \
+    X(8, OBJECT_GLDA_SKY_CELLS)                                                \
+    X(9, OBJECT_GLDA_9)                                                        \
+    X(10, OBJECT_GLDA_10)                                                      \
+    X(11, OBJECT_GLDA_11)                                                      \
+    X(100, OBJECT_GLDA_PROCESS_LISTS)                                          \
+    X(101, OBJECT_GLDA_COMBAT)                                                 \
+    X(102, OBJECT_GLDA_INTERFACE)                                              \
+    X(103, OBJECT_GLDA_ACTOR_CAUSES)                                           \
+    X(104, OBJECT_GLDA_104)                                                    \
+    X(105, OBJECT_GLDA_DETECTION_MANAGER)                                      \
+    X(106, OBJECT_GLDA_LOCATION_METADATA)                                      \
+    X(107, OBJECT_GLDA_QUEST_STATIC_DATA)                                      \
+    X(108, OBJECT_GLDA_STORYTELLER)                                            \
+    X(109, OBJECT_GLDA_MAGIC_FAVORITES)                                        \
+    X(110, OBJECT_GLDA_PLAYER_CONTROLS)                                        \
+    X(111, OBJECT_GLDA_STORY_EVENT_MANAGER)                                    \
+    X(112, OBJECT_GLDA_INGREDIENT_SHARED)                                      \
+    X(113, OBJECT_GLDA_MENU_CONTROLS)                                          \
+    X(114, OBJECT_GLDA_MENU_TOPIC_MANAGER)                                     \
+    X(115, OBJECT_GLDA_115)                                                    \
+    X(116, OBJECT_GLDA_116)                                                    \
+    X(117, OBJECT_GLDA_117)                                                    \
+    X(1000, OBJECT_GLDA_TEMP_EFFECTS)                                          \
+    X(1001, OBJECT_GLDA_PAPYRUS)                                               \
+    X(1002, OBJECT_GLDA_ANIM_OBJECTS)                                          \
+    X(1003, OBJECT_GLDA_TIMER)                                                 \
+    X(1004, OBJECT_GLDA_SYNCHRONISED_ANIMS)                                    \
+    X(1005, OBJECT_GLDA_MAIN)                                                  \
+    X(1006, OBJECT_GLDA_1006)                                                  \
+    X(1007, OBJECT_GLDA_1007)
 
-        err = deserializer(block, save, object_type);
-        if (err) {
-            goto out_error;
-        }
+static unsigned glda_type_number(enum object_type type)
+{
+    switch (type) {
+#define X(number, object_type)                                                 \
+    case object_type:                                                          \
+        return number;
+        GLDA_TYPE_NUMBER_LIST
+#undef X
+    default:
+        assert(0); /* Invalid object type argument. */
+        return 0;
     }
+}
 
-    /*
-     * Read change forms.
-     */
-    save->priv->change_forms =
-        calloc(locations.num_change_forms, sizeof(*save->priv->change_forms));
-    if (!save->priv->change_forms) {
-        err = CG_NO_MEM;
-        goto out_error;
+static int object_type_from_glda_type_number(int type_number)
+{
+    switch (type_number) {
+#define X(number, object_type)                                                 \
+    case number:                                                               \
+        return object_type;
+        GLDA_TYPE_NUMBER_LIST
+#undef X
+    default:
+        /* No object type for type_number. */
+        return -1;
     }
+}
 
-    DEBUG_LOG("0x%08lx: Reading %u change forms\n", OFFSET(),
-              locations.num_change_forms);
-
-    block->block_type = BLOCK_CHANGE_FORM;
-    for (unsigned i = 0; i < locations.num_change_forms; ++i) {
-        struct change_form *cf = &save->priv->change_forms[i];
-
-        err = disassembler(block, cursor);
-        if (err) {
-            goto out_error;
-        }
-
-        cf->flags = block_buf.chfo.flags;
-        cf->form_id = block_buf.chfo.form_id;
-        cf->version = block_buf.chfo.version;
-        cf->type = block_buf.chfo.type_num;
-        cf->length1 = block->size;
-        cf->length2 = block->uncompressed_size;
-        cf->data = malloc(block->size);
-        if (!cf->data) {
-            err = CG_NO_MEM;
-            goto out_error;
-        }
+/*
+ * Encode a variable size value. Caller decides whether it is an error
+ * when the buffer overflows. Therefore, this returns CG_OK even if
+ * the buffer is full. See cursor->n to check buffer overflow.
+ */
+static cg_err_t encode_vsval(struct cursor *cursor, uint32_t value)
+{
+    int num_octets;
 
-        memcpy(cf->data, block->buffer, block->size);
+    if (value > VSVAL_MAX) {
+        assert(0);
+        return CG_INVAL;
     }
 
     /*
-     * Read global data table 3.
+     * 2 least significant bits determine vsval size
+     *
+     *    2 LSB    | vsval size
+     * ------------+------------
+     *     00       |   1 octet
+     *     01       |   2 octets
+     *     10       |   3 octets
      */
-    DEBUG_LOG("0x%08lx: Reading global data table 3\n", OFFSET());
-
-    block->block_type = BLOCK_GLOBAL_DATA;
-    for (unsigned i = 0; i < locations.num_globals3; ++i) {
-        struct block_global_data *glda = (struct block_global_data *)block;
-        int object_type;
-
-        err = disassembler(block, cursor);
-        if (err) {
-            goto out_error;
-        }
+    value <<= 2;        /* vsval size information takes 2 bits. */
+    value &= 0xffffffu; /* vsval max width is 24 bits. */
+    num_octets = ((value >= 0x100u) << (value >= 0x10000u)) + 1;
+    value |= num_octets - 1; /* add size information */
+    value = htole32(value);  /* vsval is little endian */
 
-        object_type = object_type_from_glda_type_number(glda->type_num);
-        if (object_type == -1) {
-            /* Invalid type number. */
-            err = CG_CORRUPT;
-            goto out_error;
-        }
+    c_store_bytes(cursor, &value, num_octets);
+    return CG_OK;
+}
 
-        err = deserializer(block, save, object_type);
-        if (err) {
-            goto out_error;
-        }
-    }
+static cg_err_t decode_vsval(struct cursor *cursor, uint32_t *out)
+{
+    uint8_t b[3] = { 0 };
+    int i;
 
     /*
-     * Read form IDs.
+     * Loop at least once. Break when all octets have been read
+     * or octet count is invalid.
      */
-    DEBUG_LOG("0x%08lx: Reading %u form IDs\n", OFFSET(), save->num_form_ids);
-    if (!c_load_le32(cursor, &save->num_form_ids)) {
-        err = CG_EOF;
-        goto out_error;
+    for (i = 0; i < ((b[0] + 1) & 0x3); ++i) {
+        if (!c_load_u8(cursor, &b[i])) {
+            return CG_EOF;
+        }
     }
 
-    save->form_ids = calloc(save->num_form_ids, sizeof(*save->form_ids));
-    if (!save->form_ids) {
-        err = CG_NO_MEM;
-        goto out_error;
+    /* Check if octet count is invalid (> 3 octets). */
+    if ((b[0] & 0x3) == 3) {
+        /* Count not valid. Corrupt vsval. */
+        return CG_CORRUPT;
     }
 
-    for (uint32_t i = 0; i < save->num_form_ids; ++i)
-        c_load_le32(cursor, &save->form_ids[i]);
+    *out = ((uint32_t)b[2] << 16 | (uint32_t)b[1] << 8 | b[0]) >> 2;
 
-    /*
-     * Read world spaces.
-     */
-    DEBUG_LOG("0x%08lx: Reading %u world spaces\n", OFFSET(),
-              save->num_world_spaces);
-    if (!c_load_le32(cursor, &save->num_world_spaces)) {
+    return CG_OK;
+}
+
+static cg_err_t c_load_le16_str(struct cursor *cursor, struct savegame *save,
+                                char **string_out)
+{
+    uint16_t string_length;
+    char *string;
+
+    if (!c_load_le16(cursor, &string_length)) {
         return CG_EOF;
     }
 
-    save->world_spaces =
-        calloc(save->num_world_spaces, sizeof(*save->world_spaces));
-    if (!save->world_spaces) {
-        err = CG_NO_MEM;
-        goto out_error;
+    if (string_length >= 512) {
+        DEBUG_LOG(save->priv->ctx,
+                  "Reading a very long string (%u chars).\n", string_length);
     }
 
-    for (uint32_t i = 0; i < save->num_world_spaces; ++i)
-        c_load_le32(cursor, &save->world_spaces[i]);
-
-    /*
-     * Read the unknown chunk at the end of the savefile.
-     */
-    {
-        uint32_t size;
-
-        DEBUG_LOG("0x%08lx: Reading unknown table\n", OFFSET());
-
-        if (!c_load_le32(cursor, &size)) {
-            err = CG_EOF;
-            goto out_error;
-        }
-
-        err = alloc_and_read_chunk(cursor, &save->priv->unknown3, size);
-        if (err) {
-            goto out_error;
-        }
+    string = save_malloc(save, (size_t)string_length + 1);
+    if (!string) {
+        return CG_NO_MEM;
     }
 
-out_error:
-    for (size_t i = 0; i < ARRAY_LEN(buffers); ++i) {
-        free(buffers[i]);
+    if (!c_load_bytes(cursor, string, string_length)) {
+        save_free(save, string);
+        return CG_EOF;
     }
 
-    return err;
-#undef OFFSET
+    string[string_length] = '\0';
+
+    *string_out = string;
+    return CG_OK;
 }
 
-static unsigned block_header_size(const struct block *block)
+static void c_store_le16_str(struct cursor *restrict cursor,
+                             const char *restrict string)
 {
-    struct block_change_form *cf;
+    size_t length = strlen(string);
 
-    switch (block->block_type) {
-    case BLOCK_SIMPLE:
-        return 4;
-    case BLOCK_GLOBAL_DATA:
-        return 8;
-    case BLOCK_CHANGE_FORM:
-        cf = (struct block_change_form *)block;
-        return 9 + (2 << ((cf->type_num >> 6) & 0x3));
-    }
+    assert(length <= UINT16_MAX);
 
-    return 0;
+    c_store_le16(cursor, length);
+    c_store_bytes(cursor, string, length);
 }
 
-static cg_err_t disassembler(struct block *block, struct cursor *cursor)
+static cg_err_t read_le16_str_array(struct cursor *cursor,
+                                    struct savegame *save, char **array,
+                                    int length)
 {
-    struct block_change_form *cf;
-
-    switch (block->block_type) {
-    case BLOCK_GLOBAL_DATA:
-        ((struct block_global_data *)block)->type_num = c_load_le32_or0(cursor);
-        /* fallthrough */
-    case BLOCK_SIMPLE:
-        block->size = c_load_le32_or0(cursor);
-        break;
+    cg_err_t err = CG_OK;
+    int i;
 
-    case BLOCK_CHANGE_FORM:
-        cf = (struct block_change_form *)block;
-        cf->form_id = c_load_be24_or0(cursor);
-        cf->flags = c_load_le32_or0(cursor);
-        cf->type_num = c_load_u8_or0(cursor);
-        cf->version = c_load_u8_or0(cursor);
-        if (cursor->n < 0) {
+    for (i = 0; i < length; ++i) {
+        err = c_load_le16_str(cursor, save, &array[i]);
+        if (err) {
             break;
         }
+    }
 
-        /*
-         * Two upper bits of type determine the sizes of size information.
-         */
-        switch ((cf->type_num >> 6) & 0x3) {
-        case 0:
-            block->size = c_load_u8_or0(cursor);
-            block->uncompressed_size = c_load_u8_or0(cursor);
-            break;
-        case 1:
-            block->size = c_load_le16_or0(cursor);
-            block->uncompressed_size = c_load_le16_or0(cursor);
-            break;
-        case 2:
-            block->size = c_load_le32_or0(cursor);
-            block->uncompressed_size = c_load_le32_or0(cursor);
-            break;
-        default:
-            return CG_CORRUPT;
+    if (err) {
+        while (i--) {
+            save_free(save, array[i]);
+            array[i] = NULL;
         }
-        break;
     }
 
-    /* Unless readed header successfully and block is completely in buffer: */
-    if (cursor->n < (long)block->size) {
-        /* Bug or corrupt. */
+    return err;
+}
+
+static cg_err_t alloc_and_read_chunk(struct cursor *cursor,
+                                     struct savegame *save,
+                                     struct chunk **chunk_out, size_t length)
+{
+    struct chunk *chunk;
+
+    chunk = save_chunk_alloc(save, length);
+
+    if (!chunk) {
+        return CG_NO_MEM;
+    }
+
+    if (!c_load_bytes(cursor, chunk->data, length)) {
+        save_free(save, chunk);
         return CG_EOF;
     }
 
-    block->buffer = cursor->pos;
-    block->buffer_size = cursor->n;
-    c_advance(cursor, block->size);
+    *chunk_out = chunk;
 
     return CG_OK;
 }
 
-__attribute__((unused)) static cg_err_t decompressor(
-    struct block *block, void *buffer, size_t buffer_size,
-    enum compressor compressor_type)
+static void dump_to_file(const struct cegse_ctx *ctx, const char *filename,
+                         const void *data, size_t size, long offset)
 {
-    decompress_fn_t decompress;
-    ssize_t decompress_size;
+    FILE *fp;
 
-    switch (compressor_type) {
-    case LZ4:
-        decompress = lz4_decompress;
-        break;
-    case ZLIB:
-        decompress = zlib_decompress;
-        break;
-    default:
-        return CG_INVAL;
+    if ((fp = fopen(filename, "w")) == NULL) {
+        LOG_ERRNO(ctx, "fopen");
+        return;
     }
 
-    decompress_size =
-        decompress(as_cregion(block), make_region(buffer, buffer_size));
-    if (decompress_size == -1) {
-        /* Buffer too small? */
-        return CG_COMPRESS;
+    if (offset > 0) {
+        fseek(fp, offset, SEEK_SET);
     }
 
-    /* Update values. */
-    block->uncompressed_size = 0;
-    block->size = decompress_size;
-    block->buffer_size = buffer_size;
-    block->buffer = buffer;
-
-    return CG_OK;
+    write_bytes(fp, data, size);
+    fclose(fp);
 }
 
-#if defined(COMPILE_WITH_UNIT_TESTS)
-static struct chunk *unit_test_file_objects[OBJECT_TYPE_COUNT];
-#endif
+static off_t get_file_size(int fd)
+{
+    struct stat statbuf;
 
-static cg_err_t deserializer(struct block *block, struct savegame *save,
-                             enum object_type object_type)
+    if (fstat(fd, &statbuf) == 0) {
+        return statbuf.st_size;
+    }
+    else {
+        return (off_t)-1;
+    }
+}
+
+static void *mmap_entire_file_r(const char *filename, size_t *pfsize)
 {
-    struct cursor *cursor = &(struct cursor){ block->buffer, block->size };
-    cg_err_t err = CG_OK;
+    void *fcontents;
+    int save_errno;
+    off_t fsize;
+    int fd;
 
-#if defined(COMPILE_WITH_UNIT_TESTS)
-    if (unit_test_file_objects[object_type]) {
-        free(unit_test_file_objects[object_type]);
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return MAP_FAILED;
     }
 
-    /* Copy this block for unit testing. */
-    unit_test_file_objects[object_type] = chunk_alloc(block->size);
-    if (!unit_test_file_objects[object_type]) {
-        perror("chunk_alloc");
-        exit(1);
+    fsize = get_file_size(fd);
+    if (fsize == -1) {
+        save_errno = errno;
+        close(fd);
+        errno = save_errno;
+        return MAP_FAILED;
     }
 
-    memcpy(unit_test_file_objects[object_type]->data, block->buffer,
-           block->size);
-#endif
+    fcontents = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (fcontents == MAP_FAILED) {
+        save_errno = errno;
+        close(fd);
+        errno = save_errno;
+        return MAP_FAILED;
+    }
 
-    switch (object_type) {
-    case OBJECT_FILE_HEADER:
-        if (!c_load_le32(cursor, &save->priv->file_version)) {
-            err = CG_EOF;
-            break;
-        }
+    close(fd);
 
-        save->save_num = c_load_le32_or0(cursor);
-        err = c_load_le16_str(cursor, &save->player_name);
-        if (err)
-            break;
-        save->level = c_load_le32_or0(cursor);
-        err = c_load_le16_str(cursor, &save->player_location_name);
-        if (err)
-            break;
-        err = c_load_le16_str(cursor, &save->game_time);
-        if (err)
-            break;
-        err = c_load_le16_str(cursor, &save->race_id);
-        if (err)
-            break;
-        save->sex = c_load_le16_or0(cursor);
-        save->current_xp = c_load_lef32_or0(cursor);
-        save->target_xp = c_load_lef32_or0(cursor);
-        save->filetime = c_load_le64_or0(cursor);
-        save->snapshot_width = c_load_le32_or0(cursor);
-        save->snapshot_height = c_load_le32_or0(cursor);
+    *pfsize = fsize;
+    return fcontents;
+}
 
-        if (supports_save_file_compression(save)) {
-            /*
-             * Read compression type and validate it.
-             */
-            uint16_t compression_type;
+static void print_read_error(const struct cegse_ctx *ctx, cg_err_t err)
+{
+    switch (err) {
+    case CG_UNSUPPORTED:
+        ERROR_LOG(ctx, "File cannot be read because its format is "
+                       "unsupported.\n");
+        break;
+    case CG_EOF:
+        ERROR_LOG(ctx, "File ended too soon. Is the save corrupt?\n");
+        break;
+    case CG_CORRUPT:
+        ERROR_LOG(ctx, "File may be corrupt.\n");
+        break;
+    case CG_NO_MEM:
+        ERROR_LOG(ctx, "Failed to allocate memory.\n");
+        break;
+    case CG_COMPRESS:
+        ERROR_LOG(ctx, "Compression error.\n");
+        break;
+    case CG_INVAL:
+        ERROR_LOG(ctx, "Invalid argument.\n");
+        break;
+    case CG_NOT_PRESENT:
+        /* bug */
+        break;
+    case CG_OK:
+        /* No error. */
+        break;
+    }
+}
 
-            if (!c_load_le16(cursor, &compression_type)) {
-                err = CG_EOF;
-                break;
+static void release_file(const struct cegse_ctx *ctx, void *file,
+                         size_t file_size, enum file_owner owner)
+{
+    switch (owner) {
+    case FILE_BORROWED:
+        break;
+    case FILE_MAPPED: {
+        /* A file mapped from an offset may start within its first page. */
+        size_t slack = (uintptr_t)file % sysconf(_SC_PAGESIZE);
+
+        munmap((unsigned char *)file - slack, file_size + slack);
+        break;
+    }
+    case FILE_ALLOCATED:
+        cegse_free(ctx, file);
+        break;
+    }
+}
+
+/*
+ * Read everything from a file descriptor to a buffer that grows as needed.
+ * size_hint is the expected size, or 0 if unknown. Return NULL on error.
+ */
+static unsigned char *read_entire_fd(const struct cegse_ctx *ctx, int fd,
+                                     size_t size_hint, size_t *pfsize)
+{
+    size_t capacity = size_hint + 1;
+    unsigned char *buffer = NULL;
+    unsigned char *grown;
+    size_t size = 0;
+    ssize_t n;
+
+    if (capacity < READ_FD_MIN_BUFFER) {
+        capacity = READ_FD_MIN_BUFFER;
+    }
+
+    for (;;) {
+        if (!buffer || size == capacity) {
+            if (buffer) {
+                capacity *= 2;
             }
 
-            if (!(compression_type <= 2)) {
-                DEBUG_LOG("Read an invalid compression type: %u\n",
-                          compression_type);
-                err = CG_CORRUPT;
-                break;
+            grown = cegse_realloc(ctx, buffer, capacity);
+            if (!grown) {
+                cegse_free(ctx, buffer);
+                errno = ENOMEM;
+                return NULL;
             }
 
-            save->priv->compressor = compression_type;
+            buffer = grown;
+        }
 
-            DEBUG_LOG("Save file compression algorithm = %s.\n",
-                      compression_type == LZ4    ? "lz4"
-                      : compression_type == ZLIB ? "zlib"
-                                                 : "none");
+        n = read(fd, buffer + size, capacity - size);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            cegse_free(ctx, buffer);
+            return NULL;
         }
-        else {
-            DEBUG_LOG("No save file compression support\n");
+
+        if (n == 0) {
+            break;
         }
-        break;
 
-    case OBJECT_PLUGIN_INFO:
-        /* Regular plugins. */
-        if (!c_load_u8(cursor, &save->num_plugins)) {
-            err = CG_EOF;
-            break;
-        }
+        size += n;
+    }
 
-        save->plugins = calloc(save->num_plugins, sizeof(*save->plugins));
-        if (!save->plugins) {
-            err = CG_NO_MEM;
-            break;
+    *pfsize = size;
+    return buffer;
+}
+
+/*
+ * Read a save file from a buffer with a reader such as file_reader(). The
+ * savegame takes the ownership of the buffer according to owner, and
+ * releases it as soon as nothing points into it.
+ */
+static struct savegame *
+buffer_reader(const struct cegse_ctx *ctx, unsigned char *file,
+              size_t file_size, enum file_owner owner,
+              const struct savefile_read_options *options,
+              file_reader_fn_t reader)
+{
+    struct savegame *save;
+    cg_err_t err;
+
+    if (!options) {
+        options = &ctx->read_options;
+    }
+
+    if ((save = savegame_alloc(ctx, options->flags)) == NULL) {
+        release_file(ctx, file, file_size, owner);
+        return NULL;
+    }
+
+    if (options->flags &
+        (SAVEFILE_VIEW_CHANGE_FORMS | SAVEFILE_VIEW_GLOBAL_DATA)) {
+        /* Views into an uncompressed save point into the file. */
+        save->priv->file = file;
+        save->priv->file_size = file_size;
+        save->priv->file_owner = owner;
+    }
+
+    err = reader(file, file_size, save, options);
+    print_read_error(ctx, err);
+
+    if (save->priv->body) {
+        /* Change forms point into the decompressed body, not the file. */
+        save->priv->file = NULL;
+    }
+
+    if (!save->priv->file) {
+        release_file(ctx, file, file_size, owner);
+    }
+
+    if (err) {
+        DEBUG_LOG(ctx, "Error %d occurred while reading save file\n", err);
+        savegame_free(save);
+        return NULL;
+    }
+
+    return save;
+}
+
+struct savegame *cengine_savefile_read(
+    const struct cegse_ctx *ctx, const char *filename,
+    const struct savefile_read_options *options)
+{
+    size_t file_size = 0;
+    unsigned char *file;
+
+    ctx = cegse_ctx_or_default(ctx);
+
+    file = mmap_entire_file_r(filename, &file_size);
+    if (file == MAP_FAILED) {
+        LOG_ERRNO(ctx, "mmap");
+        return NULL;
+    }
+
+    DEBUG_LOG(ctx, "Reading save file %s\n", filename);
+
+    return buffer_reader(ctx, file, file_size, FILE_MAPPED, options,
+                         file_reader);
+}
+
+struct savegame *cengine_savefile_read_mem(
+    const struct cegse_ctx *ctx, const void *data, size_t size,
+    const struct savefile_read_options *options)
+{
+    ctx = cegse_ctx_or_default(ctx);
+
+    DEBUG_LOG(ctx, "Reading save file from memory\n");
+
+    /* The buffer is only read from. */
+    return buffer_reader(ctx, (unsigned char *)data, size, FILE_BORROWED,
+                         options, file_reader);
+}
+
+struct savegame *cengine_savefile_read_fd(
+    const struct cegse_ctx *ctx, int fd,
+    const struct savefile_read_options *options)
+{
+    struct stat statbuf;
+    size_t file_size = 0;
+    size_t size_hint = 0;
+    unsigned char *file;
+    off_t offset;
+
+    ctx = cegse_ctx_or_default(ctx);
+
+    if (fstat(fd, &statbuf) == -1) {
+        LOG_ERRNO(ctx, "fstat");
+        return NULL;
+    }
+
+    DEBUG_LOG(ctx, "Reading save file from file descriptor %d\n", fd);
+
+    offset = lseek(fd, 0, SEEK_CUR);
+    if (S_ISREG(statbuf.st_mode) && offset != -1 &&
+        statbuf.st_size > offset) {
+        /* Mappings start at a page boundary. */
+        off_t start = offset - offset % sysconf(_SC_PAGESIZE);
+
+        size_hint = statbuf.st_size - offset;
+        file = mmap(NULL, statbuf.st_size - start, PROT_READ, MAP_PRIVATE, fd,
+                    start);
+        if (file != MAP_FAILED) {
+            /* Leave the offset at the end as reading would. */
+            lseek(fd, 0, SEEK_END);
+            return buffer_reader(ctx, file + (offset - start), size_hint,
+                                 FILE_MAPPED, options, file_reader);
         }
+    }
+
+    /* Pipes, sockets and such cannot be mapped. */
+    file = read_entire_fd(ctx, fd, size_hint, &file_size);
+    if (!file) {
+        LOG_ERRNO(ctx, "read");
+        return NULL;
+    }
+
+    return buffer_reader(ctx, file, file_size, FILE_ALLOCATED, options,
+                         file_reader);
+}
+
+/*
+ * Read the file signature and the file header. On success, the cursor is
+ * left at the snapshot and the snapshot size is known.
+ */
+static cg_err_t header_reader(struct cursor *cursor, struct savegame *save)
+{
+    struct block block = { .block_type = BLOCK_SIMPLE };
+    const unsigned char *start = cursor->pos;
+    cg_err_t err;
+
+    if (cursor->n < 300) {
+        return CG_CORRUPT;
+    }
+
+    /*
+     * Check the file signature.
+     */
+    if (!memcmp(cursor->pos, TESV_SIGNATURE, strlen(TESV_SIGNATURE))) {
+        DEBUG_LOG(save->priv->ctx, "TESV file signature detected\n");
+        save->game = SKYRIM;
+        c_advance(cursor, strlen(TESV_SIGNATURE));
+    }
+    else if (!memcmp(cursor->pos, FO4_SIGNATURE, strlen(FO4_SIGNATURE))) {
+        DEBUG_LOG(save->priv->ctx, "Fallout 4 file signature detected\n");
+        save->game = FALLOUT4;
+        c_advance(cursor, strlen(FO4_SIGNATURE));
+    }
+    else {
+        DEBUG_LOG(save->priv->ctx, "File not recognized\n");
+        return CG_UNSUPPORTED;
+    }
+
+    /*
+     * Read the file header.
+     */
+    DEBUG_LOG(save->priv->ctx, "Reading file header\n");
+    err = disassembler(&block, cursor);
+    if (err) {
+        return err;
+    }
+    err = deserializer(&block, save, OBJECT_FILE_HEADER);
+    if (err) {
+        return err;
+    }
+
+    DEBUG_LOG(save->priv->ctx, "File version: %u\n", save->priv->file_version);
+    if (save->priv->file_version > 15) {
+        return CG_UNSUPPORTED;
+    }
+
+    save->snapshot_bytes_per_pixel = snapshot_pixel_width(save);
+    save->snapshot_size = save->snapshot_width * save->snapshot_height *
+                          save->snapshot_bytes_per_pixel;
+    save->priv->snapshot_offset = cursor->pos - start;
+
+    return CG_OK;
+}
+
+/*
+ * Read what precedes the location table in the body: the form version,
+ * the game version and, if with_plugins is true, the plugin information.
+ */
+static cg_err_t body_start_reader(struct cursor *cursor, struct savegame *save,
+                                  bool with_plugins)
+{
+    struct block block = { .block_type = BLOCK_SIMPLE };
+    cg_err_t err;
 
-        err = read_le16_str_array(cursor, save->plugins, save->num_plugins);
+    if (!c_load_u8(cursor, &save->priv->form_version)) {
+        return CG_EOF;
+    }
+
+    DEBUG_LOG(save->priv->ctx, "Save data form version: %u\n",
+              save->priv->form_version);
+
+    if (save->game == FALLOUT4) {
+        err = c_load_le16_str(cursor, save, &save->game_version);
         if (err) {
-            break;
+            return err;
         }
+    }
 
-        /* Light plugins. */
-        if (supports_light_plugins(save)) {
-            if (!c_load_le16(cursor, &save->num_light_plugins)) {
-                err = CG_EOF;
-                break;
-            }
+    /*
+     * Read plugin information.
+     */
+    err = disassembler(&block, cursor);
+    if (err || !with_plugins) {
+        return err;
+    }
 
-            save->light_plugins =
-                calloc(save->num_light_plugins, sizeof(*save->light_plugins));
-            if (!save->light_plugins) {
-                err = CG_NO_MEM;
-                break;
-            }
+    return deserializer(&block, save, OBJECT_PLUGIN_INFO);
+}
 
-            err = read_le16_str_array(cursor, save->light_plugins,
-                                      save->num_light_plugins);
-        }
-        break;
+/*
+ * Return how many bytes body_start_reader() needs at the start of the body.
+ * The result is exact only if the bytes available to probe are enough to
+ * see all the sizes it depends on. Otherwise it is a lower bound.
+ */
+static size_t body_start_size(struct cursor probe, const struct savegame *save)
+{
+    long long n = probe.n;
 
-    case OBJECT_GLDA_MISC_STATS:
-        save->num_misc_stats = c_load_le32_or0(cursor);
-        if (save->num_misc_stats == 0) {
-            break;
-        }
+    c_advance(&probe, 1);
+    if (save->game == FALLOUT4) {
+        c_advance(&probe, c_load_le16_or0(&probe));
+    }
+    c_advance(&probe, c_load_le32_or0(&probe));
 
-        save->misc_stats =
-            calloc(save->num_misc_stats, sizeof(*save->misc_stats));
-        if (!save->misc_stats) {
-            err = CG_NO_MEM;
-            break;
-        }
+    return n - probe.n;
+}
 
-        for (uint32_t i = 0u; i < save->num_misc_stats; ++i) {
-            err = c_load_le16_str(cursor, &save->misc_stats[i].name);
-            if (err) {
-                break;
-            }
+/* Number of bytes decompressed at a time when the body is streamed. */
+#define BODY_STREAM_WINDOW (256u * 1024u)
 
-            save->misc_stats[i].category = c_load_u8_or0(cursor);
-            save->misc_stats[i].value = c_load_le32_or0(cursor);
-        }
-        break;
+/*
+ * A body that is decompressed on another thread while it is being read.
+ * The body cursor only covers what has been decompressed so far.
+ */
+struct streamed_body {
+    struct decompress_stream *stream;
+    const unsigned char *data;
+    bool ended;
+};
 
-    case OBJECT_GLDA_PLAYER_LOCATION:
-        save->player_location.next_object_id = c_load_le32_or0(cursor);
-        save->player_location.world_space1 = c_load_be24_or0(cursor);
-        save->player_location.coord_x = (int32_t)c_load_le32_or0(cursor);
-        save->player_location.coord_y = (int32_t)c_load_le32_or0(cursor);
-        save->player_location.world_space2 = c_load_be24_or0(cursor);
-        save->player_location.pos_x = c_load_lef32_or0(cursor);
-        save->player_location.pos_y = c_load_lef32_or0(cursor);
-        save->player_location.pos_z = c_load_lef32_or0(cursor);
-        if (save->game == SKYRIM) {
-            save->player_location.unknown =
-                c_load_u8_or0(cursor); /* Skyrim only */
-        }
-        break;
+/*
+ * Wait until size bytes are available at the cursor or the body ends.
+ * Does nothing if body is NULL.
+ */
+static cg_err_t body_wait(struct streamed_body *body, struct cursor *cursor,
+                          size_t size)
+{
+    while (body && !body->ended && cursor->n < (long long)size) {
+        size_t offset = cursor->pos - body->data;
+        ssize_t available;
 
-    case OBJECT_GLDA_GLOBAL_VARIABLES:
-        err = decode_vsval(cursor, &save->num_global_vars);
-        if (err || save->num_global_vars == 0) {
-            break;
+        available = decompress_stream_wait(body->stream, offset + cursor->n);
+        if (available == -1) {
+            return CG_COMPRESS;
         }
 
-        save->global_vars =
-            calloc(save->num_global_vars, sizeof(*save->global_vars));
-        if (!save->global_vars) {
-            err = CG_NO_MEM;
-            break;
+        if ((size_t)available == offset + cursor->n) {
+            body->ended = true;
         }
 
-        for (uint32_t i = 0u; i < save->num_global_vars; ++i) {
-            save->global_vars[i].form_id = c_load_be24_or0(cursor);
-            save->global_vars[i].value = c_load_lef32_or0(cursor);
-        }
-        break;
+        cursor->n = available - offset;
+    }
 
-    case OBJECT_GLDA_WEATHER:
-        save->weather.climate = c_load_be24_or0(cursor);
-        save->weather.weather = c_load_be24_or0(cursor);
-        save->weather.prev_weather = c_load_be24_or0(cursor);
-        save->weather.unk_weather1 = c_load_be24_or0(cursor);
-        save->weather.unk_weather2 = c_load_be24_or0(cursor);
-        save->weather.regn_weather = c_load_be24_or0(cursor);
-        save->weather.current_time = c_load_lef32_or0(cursor);
-        save->weather.begin_time = c_load_lef32_or0(cursor);
-        save->weather.weather_pct = c_load_lef32_or0(cursor);
-        for (size_t i = 0u; i < 6; ++i)
-            save->weather.data1[i] = c_load_le32_or0(cursor);
-        save->weather.data2 = c_load_lef32_or0(cursor);
-        save->weather.data3 = c_load_le32_or0(cursor);
-        save->weather.flags = c_load_u8_or0(cursor);
+    return CG_OK;
+}
 
-        /* Read the remaining bytes. Don't know what they are. */
-        if (cursor->n > 0) {
-            save->weather.data4 = chunk_alloc(cursor->n);
-            if (!save->weather.data4) {
-                err = CG_NO_MEM;
-                break;
-            }
-            c_load_bytes(cursor, save->weather.data4->data,
-                         save->weather.data4->size);
+/*
+ * Like disassembler() but waits for more of a streamed body until the whole
+ * block is available.
+ */
+static cg_err_t body_disassembler(struct block *block, struct cursor *cursor,
+                                  struct streamed_body *body)
+{
+    struct cursor start = *cursor;
+    cg_err_t err;
+
+    for (;;) {
+        err = disassembler(block, cursor);
+        if (err != CG_EOF || !body || body->ended) {
+            return err;
         }
-        break;
 
-    case OBJECT_GLDA_MAGIC_FAVORITES:
-        err = decode_vsval(cursor, &save->num_favourites);
+        /* The block is cut off. Retry when there is more of it. */
+        *cursor = start;
+        err = body_wait(body, cursor, cursor->n + 1);
         if (err) {
-            break;
+            return err;
         }
 
-        save->favourites =
-            calloc(save->num_favourites, sizeof(*save->favourites));
-        if (!save->favourites) {
-            err = CG_NO_MEM;
-            break;
-        }
+        start = *cursor;
+    }
+}
+
+/*
+ * Size of the body prefix to decompress first when only the beginning of
+ * the body is needed.
+ */
+#define BODY_START_GUESS 4096u
+
+/*
+ * Read the file header and optionally the plugin information without
+ * reading the snapshot or decompressing more of the body than is needed.
+ */
+static cg_err_t header_only_reader(const unsigned char *file, size_t file_size,
+                                   struct savegame *save, bool with_plugins)
+{
+    struct cursor *cursor = &(struct cursor){ (unsigned char *)file, file_size };
+    decompress_fn_t decompress = NULL;
+    struct chunk *buffer = NULL;
+    struct cursor body_cursor;
+    uint32_t uncompress_size;
+    uint32_t compress_size;
+    size_t prefix_size;
+    cg_err_t err;
+
+    save->priv->sections = SAVEFILE_SECTION(SECTION_FILE_HEADER);
+    if (with_plugins) {
+        save->priv->sections |= SAVEFILE_SECTION(SECTION_PLUGIN_INFO);
+    }
+
+    err = header_reader(cursor, save);
+    if (err || !with_plugins) {
+        return err;
+    }
+
+    c_advance(cursor, save->snapshot_size);
+
+    if (!supports_save_file_compression(save)) {
+        return body_start_reader(cursor, save, true);
+    }
+
+    uncompress_size = c_load_le32_or0(cursor);
+    compress_size = c_load_le32_or0(cursor);
+    if (cursor->n < (long long)compress_size) {
+        return CG_EOF;
+    }
+
+    switch (save->priv->compressor) {
+    case LZ4:
+        decompress = lz4_decompress_partial;
+        break;
+    case ZLIB:
+        decompress = zlib_decompress_partial;
+        break;
+    case NO_COMPRESSION:
+        return body_start_reader(cursor, save, true);
+    }
 
-        for (uint32_t i = 0; i < save->num_favourites; ++i) {
-            save->favourites[i] = c_load_be24_or0(cursor);
+    /*
+     * Decompress a prefix of the body and grow it until the plugin
+     * information fits in it or the body ends.
+     */
+    prefix_size = MIN(BODY_START_GUESS, uncompress_size);
+    for (;;) {
+        struct cregion src = make_cregion(cursor->pos, compress_size);
+        ssize_t decompress_size;
+        size_t needed;
+
+        cegse_free(save->priv->ctx, buffer);
+        buffer = ctx_chunk_alloc(save->priv->ctx, prefix_size);
+        if (!buffer) {
+            return CG_NO_MEM;
         }
 
-        err = decode_vsval(cursor, &save->num_hotkeys);
-        if (err) {
-            break;
+        decompress_size = decompress(src, region_from_chunk(buffer));
+        if (decompress_size == -1) {
+            cegse_free(save->priv->ctx, buffer);
+            return CG_COMPRESS;
         }
 
-        save->hotkeys = calloc(save->num_hotkeys, sizeof(*save->hotkeys));
-        if (!save->hotkeys) {
-            err = CG_NO_MEM;
+        body_cursor.pos = buffer->data;
+        body_cursor.n = decompress_size;
+
+        needed = body_start_size(body_cursor, save);
+        if (needed <= (size_t)decompress_size ||
+            (size_t)decompress_size < prefix_size ||
+            prefix_size == uncompress_size) {
             break;
         }
 
-        for (uint32_t i = 0; i < save->num_hotkeys; ++i) {
-            save->hotkeys[i] = c_load_be24_or0(cursor);
-        }
-        break;
+        prefix_size = MIN(needed, uncompress_size);
+    }
 
-    case OBJECT_GLDA_GAME:
-    case OBJECT_GLDA_CREATED_OBJECTS:
-    case OBJECT_GLDA_EFFECTS:
-    case OBJECT_GLDA_AUDIO:
-    case OBJECT_GLDA_SKY_CELLS:
-    case OBJECT_GLDA_9:
-    case OBJECT_GLDA_10:
+    err = body_start_reader(&body_cursor, save, true);
+    cegse_free(save->priv->ctx, buffer);
+
+    return err;
+}
+
+struct savegame *cengine_savefile_read_header_mem(const struct cegse_ctx *ctx,
+                                                  const void *data, size_t size,
+                                                  bool with_plugins)
+{
+    struct savegame *save;
+    cg_err_t err;
+
+    ctx = cegse_ctx_or_default(ctx);
+
+    if ((save = savegame_alloc(ctx, 0)) == NULL) {
+        return NULL;
+    }
+
+    err = header_only_reader(data, size, save, with_plugins);
+    print_read_error(ctx, err);
+
+    if (err) {
+        DEBUG_LOG(ctx, "Error %d occurred while reading save file header\n",
+                  err);
+        savegame_free(save);
+        return NULL;
+    }
+
+    return save;
+}
+
+struct savegame *cengine_savefile_read_header(const struct cegse_ctx *ctx,
+                                              const char *filename,
+                                              bool with_plugins)
+{
+    struct savegame *save;
+    size_t file_size = 0;
+    unsigned char *file;
+
+    ctx = cegse_ctx_or_default(ctx);
+
+    file = mmap_entire_file_r(filename, &file_size);
+    if (file == MAP_FAILED) {
+        LOG_ERRNO(ctx, "mmap");
+        return NULL;
+    }
+
+    DEBUG_LOG(ctx, "Reading header of save file %s\n", filename);
+
+    save = cengine_savefile_read_header_mem(ctx, file, file_size, with_plugins);
+    munmap(file, file_size);
+
+    return save;
+}
+
+/*
+ * Mask of the sections from first to last.
+ */
+static uint64_t section_range(enum savefile_section first,
+                              enum savefile_section last)
+{
+    return SAVEFILE_SECTION(last + 1) - SAVEFILE_SECTION(first);
+}
+
+/*
+ * Read count global data blocks. Blocks of sections not in wanted are
+ * skipped without being deserialized. body is the streamed body that the
+ * cursor reads or NULL.
+ */
+static cg_err_t global_data_reader(struct cursor *cursor,
+                                   struct savegame *save, unsigned count,
+                                   uint64_t wanted, struct streamed_body *body)
+{
+    struct block_global_data glda = { .base.block_type = BLOCK_GLOBAL_DATA };
+    struct block *block = &glda.base;
+    cg_err_t err;
+
+    for (unsigned i = 0; i < count; ++i) {
+        int object_type;
+
+        err = body_disassembler(block, cursor, body);
+        if (err) {
+            return err;
+        }
+
+        object_type = object_type_from_glda_type_number(glda.type_num);
+        if (object_type == -1) {
+            /* Invalid type number. */
+            return CG_CORRUPT;
+        }
+
+        if (!(wanted & SAVEFILE_SECTION(object_type))) {
+            continue;
+        }
+
+        err = deserializer(block, save, object_type);
+        if (err) {
+            return err;
+        }
+    }
+
+    return CG_OK;
+}
+
+/*
+ * Read the location table at the cursor.
+ */
+static void location_table_reader(struct cursor *cursor,
+                                  struct location_table *locations)
+{
+    locations->off_form_ids_count = c_load_le32_or0(cursor);
+    locations->off_unknown_table = c_load_le32_or0(cursor);
+    locations->off_globals1 = c_load_le32_or0(cursor);
+    locations->off_globals2 = c_load_le32_or0(cursor);
+    locations->off_change_forms = c_load_le32_or0(cursor);
+    locations->off_globals3 = c_load_le32_or0(cursor);
+    locations->num_globals1 = c_load_le32_or0(cursor);
+    locations->num_globals2 = c_load_le32_or0(cursor);
+    locations->num_globals3 = c_load_le32_or0(cursor);
+    locations->num_change_forms = c_load_le32_or0(cursor);
+    c_advance(cursor, 60); /* Skip junk. */
+
+    locations->num_globals3 += 1; /* Count is bugged and short by 1. */
+}
+
+/*
+ * Read the form IDs, the world spaces and the unknown table at the end of
+ * the body. Sections not in wanted are skipped, and reading stops after
+ * the last wanted one. body is the streamed body that the cursor reads or
+ * NULL.
+ */
+static cg_err_t body_end_reader(struct cursor *cursor, struct savegame *save,
+                                uint64_t wanted, struct streamed_body *body)
+{
+    uint32_t size;
+    cg_err_t err;
+
+    /*
+     * Read form IDs.
+     */
+    err = body_wait(body, cursor, 4);
+    if (err) {
+        return err;
+    }
+
+    if (!c_load_le32(cursor, &save->num_form_ids)) {
+        return CG_EOF;
+    }
+
+    DEBUG_LOG(save->priv->ctx, "Reading %u form IDs\n", save->num_form_ids);
+
+    err = body_wait(body, cursor, 4ull * save->num_form_ids);
+    if (err) {
+        return err;
+    }
+
+    if (wanted & SAVEFILE_SECTION(SECTION_FORM_IDS)) {
+        save->form_ids =
+            save_calloc(save, save->num_form_ids, sizeof(*save->form_ids));
+        if (!save->form_ids) {
+            return CG_NO_MEM;
+        }
+
+        c_load_le32_array(cursor, save->form_ids, save->num_form_ids);
+    }
+    else {
+        c_advance(cursor, 4ll * save->num_form_ids);
+        save->num_form_ids = 0;
+    }
+
+    if (!(wanted & section_range(SECTION_WORLD_SPACES, SECTION_UNKNOWN3))) {
+        return CG_OK;
+    }
+
+    /*
+     * Read world spaces.
+     */
+    err = body_wait(body, cursor, 4);
+    if (err) {
+        return err;
+    }
+
+    if (!c_load_le32(cursor, &save->num_world_spaces)) {
+        return CG_EOF;
+    }
+
+    DEBUG_LOG(save->priv->ctx, "Reading %u world spaces\n",
+              save->num_world_spaces);
+
+    err = body_wait(body, cursor, 4ull * save->num_world_spaces);
+    if (err) {
+        return err;
+    }
+
+    if (wanted & SAVEFILE_SECTION(SECTION_WORLD_SPACES)) {
+        save->world_spaces = save_calloc(save, save->num_world_spaces,
+                                         sizeof(*save->world_spaces));
+        if (!save->world_spaces) {
+            return CG_NO_MEM;
+        }
+
+        c_load_le32_array(cursor, save->world_spaces, save->num_world_spaces);
+    }
+    else {
+        c_advance(cursor, 4ll * save->num_world_spaces);
+        save->num_world_spaces = 0;
+    }
+
+    if (!(wanted & SAVEFILE_SECTION(SECTION_UNKNOWN3))) {
+        return CG_OK;
+    }
+
+    /*
+     * Read the unknown chunk at the end of the savefile.
+     */
+    DEBUG_LOG(save->priv->ctx, "Reading unknown table\n");
+
+    err = body_wait(body, cursor, 4);
+    if (err) {
+        return err;
+    }
+
+    if (!c_load_le32(cursor, &size)) {
+        return CG_EOF;
+    }
+
+    err = body_wait(body, cursor, size);
+    if (err) {
+        return err;
+    }
+
+    return read_view(cursor, save, &save->priv->unknown3, size);
+}
+
+static cg_err_t file_reader(const unsigned char *file, size_t file_size,
+                            struct savegame *save,
+                            const struct savefile_read_options *options)
+{
+    const struct cegse_ctx *ctx = save->priv->ctx;
+    struct location_table locations;
+    struct chunk *buffers[1] = { 0 };
+    struct streamed_body streamed = { 0 };
+    struct streamed_body *body = NULL;
+    const unsigned char *body_data = NULL;
+    ssize_t body_size = 0;
+    struct cursor file_cursor;
+    struct cursor body_cursor;
+    struct cursor *cursor;
+    intptr_t offset_var = (intptr_t)file;
+    uint64_t wanted = SAVEFILE_ALL_SECTIONS;
+    uint64_t pending;
+    cg_err_t err = CG_OK;
+
+    union {
+        struct block simple;
+        struct block_change_form chfo;
+        struct block_global_data glda;
+    } block_buf = { 0 };
+    struct block *block = &block_buf.simple;
+
+    if (options->sections) {
+        wanted = options->sections & SAVEFILE_ALL_SECTIONS;
+        wanted |= SAVEFILE_SECTION(SECTION_FILE_HEADER);
+    }
+
+    /* Sections not read yet. Reading stops when none are wanted. */
+    pending = wanted;
+    save->priv->sections = wanted;
+
+    file_cursor.pos = (unsigned char *)file;
+    file_cursor.n = file_size;
+    cursor = &file_cursor;
+
+/* Calculates current file offset at cursor position. */
+#define OFFSET() ((unsigned long)((intptr_t)cursor->pos - offset_var))
+
+/* Marks sections as read and stops if no more are wanted. */
+#define SECTIONS_DONE(sections)                                                \
+    do {                                                                       \
+        pending &= ~(sections);                                                \
+        if (!pending) {                                                        \
+            goto out_error;                                                    \
+        }                                                                      \
+    } while (0)
+
+    err = header_reader(cursor, save);
+    if (err) {
+        goto out_error;
+    }
+
+    SECTIONS_DONE(SAVEFILE_SECTION(SECTION_FILE_HEADER));
+
+    /*
+     * Read the snapshot.
+     */
+    if (wanted & SAVEFILE_SECTION(SECTION_SNAPSHOT)) {
+        save->snapshot_data = save_malloc(save, save->snapshot_size);
+        if (!save->snapshot_data) {
+            err = CG_NO_MEM;
+            goto out_error;
+        }
+
+        DEBUG_LOG(ctx, "0x%08lx: Reading %u bytes of snapshot data\n",
+                  OFFSET(), save->snapshot_size);
+
+        c_load_bytes(cursor, save->snapshot_data, save->snapshot_size);
+    }
+    else {
+        c_advance(cursor, save->snapshot_size);
+    }
+
+    SECTIONS_DONE(SAVEFILE_SECTION(SECTION_SNAPSHOT));
+
+    /* Initialize body cursor. */
+    if (supports_save_file_compression(save)) {
+        ssize_t uncompress_size;
+        ssize_t compress_size;
+
+        uncompress_size = c_load_le32_or0(cursor);
+        compress_size = c_load_le32_or0(cursor);
+        if (cursor->n < 0) {
+            err = CG_EOF;
+            goto out_error;
+        }
+
+        DEBUG_LOG(ctx, "Save data uncompressed length: %zd\n", uncompress_size);
+        DEBUG_LOG(ctx, "Save data compressed length:   %zd\n", compress_size);
+
+        if (save->priv->compressor != NO_COMPRESSION) {
+            decompress_fn_t decompress = NULL;
+            ssize_t decompress_size = 0;
+
+            /* Allocate space for decompression. */
+            buffers[0] = ctx_chunk_alloc(ctx, uncompress_size);
+            if (!buffers[0]) {
+                err = CG_NO_MEM;
+                goto out_error;
+            }
+
+            /* Select decompress method. */
+            switch (save->priv->compressor) {
+            case LZ4:
+                decompress = lz4_decompress;
+                break;
+            case ZLIB:
+                decompress = zlib_decompress;
+                break;
+            case NO_COMPRESSION:
+                abort();
+                break;
+            }
+
+            struct cregion src = make_cregion(cursor->pos, compress_size);
+            struct region dest =
+                make_region(buffers[0]->data, buffers[0]->size);
+
+            if (options->flags & SAVEFILE_STREAM_BODY) {
+                /* Decompress while reading. */
+                DEBUG_LOG(ctx, "Streaming save data\n");
+                streamed.stream =
+                    decompress == lz4_decompress
+                        ? lz4_decompress_start(src, dest, BODY_STREAM_WINDOW)
+                        : zlib_decompress_start(src, dest, BODY_STREAM_WINDOW);
+                if (!streamed.stream) {
+                    err = CG_NO_MEM;
+                    goto out_error;
+                }
+
+                streamed.data = dest.data;
+                body = &streamed;
+            }
+            else {
+                DEBUG_LOG(ctx, "Decompressing save data\n");
+                decompress_size = decompress(src, dest);
+                if (decompress_size == -1) {
+                    err = CG_COMPRESS;
+                    goto out_error;
+                }
+            }
+
+            if ((options->flags & SAVEFILE_KEEP_COMPRESSED_BODY) &&
+                wanted == SAVEFILE_ALL_SECTIONS) {
+                struct cursor compressed = *cursor;
+
+                /* The body is hashed once all of it has been read. */
+                err = alloc_and_read_chunk(&compressed, save,
+                                           &save->priv->compressed_body,
+                                           compress_size);
+                if (err) {
+                    goto out_error;
+                }
+            }
+
+            if (options->flags &
+                (SAVEFILE_VIEW_CHANGE_FORMS | SAVEFILE_VIEW_GLOBAL_DATA)) {
+                /* Change forms or global data will point into the body. */
+                save->priv->body = buffers[0];
+                buffers[0] = NULL;
+            }
+
+            body_data = dest.data;
+            body_size = decompress_size;
+            body_cursor.pos = dest.data;
+            body_cursor.n = decompress_size;
+            offset_var = (intptr_t)body_cursor.pos - (file_cursor.pos - file);
+        }
+        else {
+            /*
+             * No compression required. We will directly write to file, but
+             * need to leave 8 bytes of space to store size information.
+             */
+            c_advance2(&body_cursor, &file_cursor, 8);
+            offset_var += 8;
+        }
+    }
+    else {
+        /*
+         * Game engine doesn't support compression for the save file.
+         * We will continue reading where we left off.
+         */
+        c_advance2(&body_cursor, &file_cursor, 0);
+    }
+
+    cursor = &body_cursor;
+
+    DEBUG_LOG(ctx, "0x%08lx: Save data begins\n", OFFSET());
+
+    for (;;) {
+        size_t needed = body_start_size(*cursor, save);
+
+        if ((long long)needed <= cursor->n || !body || body->ended) {
+            break;
+        }
+
+        err = body_wait(body, cursor, needed);
+        if (err) {
+            goto out_error;
+        }
+    }
+
+    err = body_start_reader(cursor, save,
+                            wanted & SAVEFILE_SECTION(SECTION_PLUGIN_INFO));
+    if (err) {
+        goto out_error;
+    }
+
+    SECTIONS_DONE(SAVEFILE_SECTION(SECTION_PLUGIN_INFO));
+
+    /*
+     * Read location table.
+     */
+    DEBUG_LOG(ctx, "0x%08lx: Reading locations table\n", OFFSET());
+    err = body_wait(body, cursor, LOCATION_TABLE_SIZE);
+    if (err) {
+        goto out_error;
+    }
+
+    location_table_reader(cursor, &locations);
+    print_locations_table(ctx, &locations);
+
+    /*
+     * Read the global data and the change forms on threads if they are all
+     * walked anyway.
+     */
+    if (options->threads > 1 && !body &&
+        (pending &
+         (section_range(SECTION_GLDA_TEMP_EFFECTS, SECTION_GLDA_1007) |
+          section_range(SECTION_FORM_IDS, SECTION_UNKNOWN3)))) {
+        DEBUG_LOG(ctx, "0x%08lx: Reading global data and change forms\n",
+                  OFFSET());
+
+        err = threaded_blocks_reader(cursor, save, &locations, wanted,
+                                     options);
+        if (err) {
+            goto out_error;
+        }
+
+        /* Global data table 1 and 2, the change forms and table 3. */
+        SECTIONS_DONE(
+            section_range(SECTION_GLDA_MISC_STATS, SECTION_GLDA_117) |
+            SAVEFILE_SECTION(SECTION_CHANGE_FORMS) |
+            section_range(SECTION_GLDA_TEMP_EFFECTS, SECTION_GLDA_1007));
+        goto blocks_done;
+    }
+
+    /*
+     * Read global data table 1 and 2.
+     */
+    DEBUG_LOG(ctx, "0x%08lx: Reading global data table 1 and 2\n", OFFSET());
+
+    err = global_data_reader(cursor, save,
+                             locations.num_globals1 + locations.num_globals2,
+                             wanted, body);
+    if (err) {
+        goto out_error;
+    }
+
+    SECTIONS_DONE(
+        section_range(SECTION_GLDA_MISC_STATS, SECTION_GLDA_117));
+
+    /*
+     * Read change forms.
+     */
+    if (!(wanted & SAVEFILE_SECTION(SECTION_CHANGE_FORMS))) {
+        DEBUG_LOG(ctx, "0x%08lx: Skipping %u change forms\n", OFFSET(),
+                  locations.num_change_forms);
+
+        block->block_type = BLOCK_CHANGE_FORM;
+        for (unsigned i = 0; i < locations.num_change_forms; ++i) {
+            err = body_disassembler(block, cursor, body);
+            if (err) {
+                goto out_error;
+            }
+        }
+
+        goto change_forms_done;
+    }
+
+    save->priv->n_change_forms = locations.num_change_forms;
+    save->priv->change_forms = save_calloc(save, locations.num_change_forms,
+                                           sizeof(*save->priv->change_forms));
+    if (!save->priv->change_forms) {
+        err = CG_NO_MEM;
+        goto out_error;
+    }
+
+    DEBUG_LOG(ctx, "0x%08lx: Reading %u change forms\n", OFFSET(),
+              locations.num_change_forms);
+
+    block->block_type = BLOCK_CHANGE_FORM;
+    for (unsigned i = 0; i < locations.num_change_forms; ++i) {
+        struct change_form *cf = &save->priv->change_forms[i];
+
+        err = body_disassembler(block, cursor, body);
+        if (err) {
+            goto out_error;
+        }
+
+        cf->flags = block_buf.chfo.flags;
+        cf->form_id = block_buf.chfo.form_id;
+        cf->version = block_buf.chfo.version;
+        cf->type = block_buf.chfo.type_num;
+        cf->length1 = block->size;
+        cf->length2 = block->uncompressed_size;
+
+        if (options->flags & SAVEFILE_VIEW_CHANGE_FORMS) {
+            cf->data = block->buffer;
+            continue;
+        }
+
+        cf->data = save_malloc(save, block->size);
+        if (!cf->data) {
+            err = CG_NO_MEM;
+            goto out_error;
+        }
+
+        memcpy(cf->data, block->buffer, block->size);
+    }
+
+change_forms_done:
+    SECTIONS_DONE(SAVEFILE_SECTION(SECTION_CHANGE_FORMS));
+
+    /*
+     * Read global data table 3.
+     */
+    DEBUG_LOG(ctx, "0x%08lx: Reading global data table 3\n", OFFSET());
+
+    err = global_data_reader(cursor, save, locations.num_globals3, wanted,
+                             body);
+    if (err) {
+        goto out_error;
+    }
+
+    SECTIONS_DONE(
+        section_range(SECTION_GLDA_TEMP_EFFECTS, SECTION_GLDA_1007));
+
+blocks_done:
+    /*
+     * Read form IDs, world spaces and the unknown table.
+     */
+    DEBUG_LOG(ctx, "0x%08lx: Reading the end of save data\n", OFFSET());
+
+    err = body_end_reader(cursor, save, wanted, body);
+    if (err) {
+        goto out_error;
+    }
+
+    if (streamed.stream) {
+        body_size = decompress_stream_end(streamed.stream);
+        streamed.stream = NULL;
+        if (body_size == -1) {
+            err = CG_COMPRESS;
+            goto out_error;
+        }
+    }
+
+    if (body_data) {
+        if (save->priv->compressed_body) {
+            save->priv->body_size = body_size;
+            save->priv->body_hash = hash64(body_data, body_size, 0);
+        }
+
+        if (ctx->dump_filename) {
+            DEBUG_LOG(ctx, "Dumping decompressed save data\n");
+            dump_to_file(ctx, ctx->dump_filename, body_data, body_size,
+                         file_cursor.pos - file);
+        }
+    }
+
+out_error:
+    if (streamed.stream && decompress_stream_end(streamed.stream) == -1 &&
+        !err) {
+        err = CG_COMPRESS;
+    }
+
+    for (size_t i = 0; i < ARRAY_LEN(buffers); ++i) {
+        cegse_free(ctx, buffers[i]);
+    }
+
+    return err;
+#undef SECTIONS_DONE
+#undef OFFSET
+}
+
+/*
+ * Walk the blocks that follow the location table without deserializing
+ * them and record them in a new index. body is the start of the save
+ * data. On success, the cursor is left at the form IDs.
+ */
+static cg_err_t block_index_builder(struct cursor *cursor,
+                                    const unsigned char *body,
+                                    const struct location_table *locations,
+                                    struct savefile_block_index *index,
+                                    const struct cegse_ctx *ctx)
+{
+    union {
+        struct block simple;
+        struct block_change_form chfo;
+        struct block_global_data glda;
+    } block_buf = { 0 };
+    struct block *block = &block_buf.simple;
+    uint64_t first_change_form;
+    uint64_t end_change_form;
+    uint64_t count;
+    cg_err_t err;
+
+    first_change_form = (uint64_t)locations->num_globals1 +
+                        locations->num_globals2;
+    end_change_form = first_change_form + locations->num_change_forms;
+    count = end_change_form + locations->num_globals3;
+
+    /* Every block has a header of 8 bytes or more. */
+    if (cursor->n < 0 || count > (uint64_t)cursor->n / 8) {
+        return CG_CORRUPT;
+    }
+
+    index->num_globals12 = first_change_form;
+    index->num_change_forms = locations->num_change_forms;
+    index->num_globals3 = locations->num_globals3;
+    index->blocks = cegse_malloc(ctx, count ? count * sizeof(*index->blocks)
+                                             : 1);
+    if (!index->blocks) {
+        return CG_NO_MEM;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        struct savefile_block *entry = &index->blocks[i];
+        bool change_form = i >= first_change_form && i < end_change_form;
+
+        block->block_type = change_form ? BLOCK_CHANGE_FORM : BLOCK_GLOBAL_DATA;
+        err = disassembler(block, cursor);
+        if (err) {
+            cegse_free(ctx, index->blocks);
+            index->blocks = NULL;
+            return err;
+        }
+
+        entry->offset = block->buffer - body;
+        entry->size = block->size;
+
+        if (change_form) {
+            entry->uncompressed_size = block->uncompressed_size;
+            entry->type = block_buf.chfo.type_num;
+            entry->form_id = block_buf.chfo.form_id;
+            entry->flags = block_buf.chfo.flags;
+            entry->version = block_buf.chfo.version;
+        }
+        else {
+            *entry = (struct savefile_block){
+                .offset = entry->offset,
+                .size = entry->size,
+                .type = block_buf.glda.type_num,
+            };
+        }
+    }
+
+    index->end_offset = cursor->pos - body;
+
+    return CG_OK;
+}
+
+/* Change forms in a task of a read on threads. */
+#define INDEXED_CHANGE_FORMS_PER_TASK 512
+
+/*
+ * A read of the blocks in an index of body_size bytes of save data at body.
+ * On threads, the blocks are split into tasks that the threads take in
+ * turn.
+ */
+struct indexed_read {
+    const unsigned char *body;
+    size_t body_size;
+    struct savegame *save;
+    const struct savefile_block_index *index;
+    uint64_t wanted;
+    unsigned flags;
+
+    struct indexed_task *tasks;
+    size_t n_tasks;
+    atomic_size_t next_task;
+};
+
+/* Blocks from first to end of an index and the result of reading them. */
+struct indexed_task {
+    size_t first;
+    size_t end;
+    cg_err_t err;
+};
+
+/*
+ * Deserialize the global data and set up the change forms of the blocks
+ * from first to end of an indexed read. Blocks of sections not wanted are
+ * skipped. The change forms must have been allocated if they are wanted.
+ */
+static cg_err_t indexed_range_reader(const struct indexed_read *read,
+                                     size_t first, size_t end)
+{
+    const struct savefile_block_index *index = read->index;
+    size_t first_change_form = index->num_globals12;
+    size_t end_change_form = first_change_form + index->num_change_forms;
+    struct savegame *save = read->save;
+    cg_err_t err;
+
+    for (size_t i = first; i < end; ++i) {
+        const struct savefile_block *entry = &index->blocks[i];
+        struct block_global_data glda = {
+            .base.block_type = BLOCK_GLOBAL_DATA,
+        };
+        struct change_form *cf;
+        int object_type;
+
+        if (entry->offset > read->body_size ||
+            entry->size > read->body_size - entry->offset) {
+            return CG_CORRUPT;
+        }
+
+        glda.base.buffer = (unsigned char *)read->body + entry->offset;
+        glda.base.buffer_size = entry->size;
+        glda.base.size = entry->size;
+        glda.type_num = entry->type;
+
+        if (i >= first_change_form && i < end_change_form) {
+            if (!(read->wanted & SAVEFILE_SECTION(SECTION_CHANGE_FORMS))) {
+                continue;
+            }
+
+            cf = &save->priv->change_forms[i - first_change_form];
+            cf->form_id = entry->form_id;
+            cf->flags = entry->flags;
+            cf->type = entry->type;
+            cf->version = entry->version;
+            cf->length1 = entry->size;
+            cf->length2 = entry->uncompressed_size;
+
+            if (read->flags & SAVEFILE_VIEW_CHANGE_FORMS) {
+                cf->data = glda.base.buffer;
+                continue;
+            }
+
+            cf->data = save_malloc(save, entry->size);
+            if (!cf->data) {
+                return CG_NO_MEM;
+            }
+
+            memcpy(cf->data, glda.base.buffer, entry->size);
+            continue;
+        }
+
+        object_type = object_type_from_glda_type_number(entry->type);
+        if (object_type == -1) {
+            /* Invalid type number. */
+            return CG_CORRUPT;
+        }
+
+        if (!(read->wanted & SAVEFILE_SECTION(object_type))) {
+            continue;
+        }
+
+        err = deserializer(&glda.base, save, object_type);
+        if (err) {
+            return err;
+        }
+    }
+
+    return CG_OK;
+}
+
+static void *indexed_read_worker(void *arg)
+{
+    struct indexed_read *read = arg;
+    size_t i;
+
+    /*
+     * Every task is read even after one fails, so that the error of the
+     * first failed task is the one that a read on one thread returns.
+     */
+    while ((i = atomic_fetch_add(&read->next_task, 1)) < read->n_tasks) {
+        struct indexed_task *task = &read->tasks[i];
+
+        task->err = indexed_range_reader(read, task->first, task->end);
+    }
+
+    return NULL;
+}
+
+/*
+ * Return true if the global data blocks of an index are of valid and
+ * distinct types, so that deserializing them at once writes no field of
+ * the savegame twice.
+ */
+static bool global_data_types_distinct(const struct savefile_block_index *index)
+{
+    size_t first_change_form = index->num_globals12;
+    size_t end_change_form = first_change_form + index->num_change_forms;
+    size_t count = end_change_form + index->num_globals3;
+    bool seen[OBJECT_TYPE_COUNT] = { 0 };
+
+    for (size_t i = 0; i < count; ++i) {
+        int object_type;
+
+        if (i >= first_change_form && i < end_change_form) {
+            continue;
+        }
+
+        object_type = object_type_from_glda_type_number(index->blocks[i].type);
+        if (object_type == -1 || seen[object_type]) {
+            return false;
+        }
+
+        seen[object_type] = true;
+    }
+
+    return true;
+}
+
+/*
+ * Read the blocks of an indexed read on threads. Each global data block is
+ * a task of its own and the change forms are split into tasks of
+ * INDEXED_CHANGE_FORMS_PER_TASK. The calling thread is one of the workers.
+ * Return the error of the first block that failed, as a read on one
+ * thread would.
+ */
+static cg_err_t parallel_indexed_reader(struct indexed_read *read,
+                                        unsigned threads)
+{
+    const struct savefile_block_index *index = read->index;
+    size_t first_change_form = index->num_globals12;
+    size_t end_change_form = first_change_form + index->num_change_forms;
+    size_t count = end_change_form + index->num_globals3;
+    const struct cegse_ctx *ctx = read->save->priv->ctx;
+    size_t max_tasks = count - index->num_change_forms +
+                       index->num_change_forms / INDEXED_CHANGE_FORMS_PER_TASK +
+                       1;
+    pthread_t *workers;
+    unsigned n_workers = 0;
+    size_t n_tasks = 0;
+    size_t failed;
+    cg_err_t err = CG_OK;
+
+    read->tasks = cegse_malloc(ctx, max_tasks * sizeof(*read->tasks));
+    workers = cegse_malloc(ctx, (threads - 1) * sizeof(*workers));
+    if (!read->tasks || !workers) {
+        err = CG_NO_MEM;
+        goto out;
+    }
+
+    /*
+     * Global data goes first so that its largest blocks, such as the
+     * Papyrus data, do not start last and keep the other threads waiting.
+     */
+    for (size_t i = 0; i < count; ++i) {
+        if (i < first_change_form || i >= end_change_form) {
+            read->tasks[n_tasks++] = (struct indexed_task){
+                .first = i,
+                .end = i + 1,
+            };
+        }
+    }
+
+    for (size_t i = first_change_form; i < end_change_form;
+         i += INDEXED_CHANGE_FORMS_PER_TASK) {
+        read->tasks[n_tasks++] = (struct indexed_task){
+            .first = i,
+            .end = MIN(i + INDEXED_CHANGE_FORMS_PER_TASK, end_change_form),
+        };
+    }
+
+    read->n_tasks = n_tasks;
+    atomic_init(&read->next_task, 0);
+
+    threads = MIN(threads, MAX(n_tasks, 1));
+    for (; n_workers + 1 < threads; ++n_workers) {
+        if (pthread_create(&workers[n_workers], NULL, indexed_read_worker,
+                           read)) {
+            break;
+        }
+    }
+
+    indexed_read_worker(read);
+
+    for (unsigned i = 0; i < n_workers; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    failed = n_tasks;
+    for (size_t i = 0; i < n_tasks; ++i) {
+        if (read->tasks[i].err &&
+            (failed == n_tasks ||
+             read->tasks[i].first < read->tasks[failed].first)) {
+            failed = i;
+        }
+    }
+
+    if (failed < n_tasks) {
+        err = read->tasks[failed].err;
+    }
+
+out:
+    cegse_free(ctx, workers);
+    cegse_free(ctx, read->tasks);
+    read->tasks = NULL;
+    return err;
+}
+
+/*
+ * Deserialize the global data and set up the change forms of the blocks in
+ * an index of body_size bytes of save data at body. Blocks of sections not
+ * in wanted are skipped. If threads is greater than 1, the blocks are read
+ * on that many threads, unless the savegame is allocated in an arena, which
+ * is not thread-safe, or the global data blocks are not of distinct types.
+ */
+static cg_err_t indexed_blocks_reader(const unsigned char *body,
+                                      size_t body_size, struct savegame *save,
+                                      const struct savefile_block_index *index,
+                                      uint64_t wanted, unsigned flags,
+                                      unsigned threads)
+{
+    struct indexed_read read = {
+        .body = body,
+        .body_size = body_size,
+        .save = save,
+        .index = index,
+        .wanted = wanted,
+        .flags = flags,
+    };
+
+    if (wanted & SAVEFILE_SECTION(SECTION_CHANGE_FORMS)) {
+        save->priv->n_change_forms = index->num_change_forms;
+        save->priv->change_forms =
+            save_calloc(save, index->num_change_forms,
+                        sizeof(*save->priv->change_forms));
+        if (!save->priv->change_forms) {
+            return CG_NO_MEM;
+        }
+    }
+
+    if (threads > 1 && !save->priv->arena &&
+        global_data_types_distinct(index)) {
+        DEBUG_LOG(save->priv->ctx, "Reading indexed blocks on %u threads\n",
+                  threads);
+        return parallel_indexed_reader(&read, threads);
+    }
+
+    return indexed_range_reader(&read, 0,
+                                (size_t)index->num_globals12 +
+                                    index->num_change_forms +
+                                    index->num_globals3);
+}
+
+/*
+ * Index the blocks that follow the location table and read them with
+ * options->threads threads. On success, the cursor is left at the form IDs.
+ */
+static cg_err_t threaded_blocks_reader(
+    struct cursor *cursor, struct savegame *save,
+    const struct location_table *locations, uint64_t wanted,
+    const struct savefile_read_options *options)
+{
+    const struct cegse_ctx *ctx = save->priv->ctx;
+    const unsigned char *blocks = cursor->pos;
+    struct savefile_block_index index = { 0 };
+    cg_err_t err;
+
+    err = block_index_builder(cursor, blocks, locations, &index, ctx);
+    if (err) {
+        return err;
+    }
+
+    err = indexed_blocks_reader(blocks, index.end_offset, save, &index,
+                                wanted, options->flags, options->threads);
+    cegse_free(ctx, index.blocks);
+
+    return err;
+}
+
+/*
+ * Decompress the save data of a save file and index its blocks. Only the
+ * file header is deserialized. Free the result with savefile_scan_free().
+ */
+static cg_err_t scan_reader(const unsigned char *file, size_t file_size,
+                            struct savegame *save, struct savefile_scan *out)
+{
+    struct cursor file_cursor = { (unsigned char *)file, file_size };
+    const struct cegse_ctx *ctx = save->priv->ctx;
+    struct cursor *cursor = &file_cursor;
+    decompress_fn_t decompress = NULL;
+    struct location_table locations;
+    struct cursor body_cursor;
+    cg_err_t err;
+
+    *out = (struct savefile_scan){ .ctx = ctx };
+
+    err = header_reader(cursor, save);
+    if (err) {
+        return err;
+    }
+
+    c_advance(cursor, save->snapshot_size);
+
+    if (supports_save_file_compression(save)) {
+        uint32_t uncompress_size = c_load_le32_or0(cursor);
+        uint32_t compress_size = c_load_le32_or0(cursor);
+
+        if (cursor->n < (long long)compress_size) {
+            return CG_EOF;
+        }
+
+        switch (save->priv->compressor) {
+        case LZ4:
+            decompress = lz4_decompress;
+            break;
+        case ZLIB:
+            decompress = zlib_decompress;
+            break;
+        case NO_COMPRESSION:
+            break;
+        }
+
+        if (decompress) {
+            struct chunk *buffer;
+            ssize_t decompress_size;
+
+            out->buffer = buffer = ctx_chunk_alloc(ctx, uncompress_size);
+            if (!buffer) {
+                return CG_NO_MEM;
+            }
+
+            decompress_size = decompress(make_cregion(cursor->pos,
+                                                      compress_size),
+                                         region_from_chunk(buffer));
+            if (decompress_size == -1) {
+                return CG_COMPRESS;
+            }
+
+            body_cursor.pos = buffer->data;
+            body_cursor.n = decompress_size;
+            out->compressed = true;
+        }
+        else {
+            body_cursor = *cursor;
+        }
+    }
+    else if (cursor->n < 0) {
+        return CG_EOF;
+    }
+    else {
+        body_cursor = *cursor;
+    }
+
+    out->prefix_size = cursor->pos - file;
+    out->body = body_cursor.pos;
+    out->body_size = body_cursor.n;
+
+    err = body_start_reader(&body_cursor, save, false);
+    if (err) {
+        return err;
+    }
+
+    if (body_cursor.n < LOCATION_TABLE_SIZE) {
+        return CG_EOF;
+    }
+
+    location_table_reader(&body_cursor, &locations);
+
+    return block_index_builder(&body_cursor, out->body, &locations,
+                               &out->index, ctx);
+}
+
+int cengine_savefile_scan(const struct cegse_ctx *ctx, const void *data,
+                          size_t size, struct savefile_scan *scan)
+{
+    struct savegame *save;
+    cg_err_t err;
+
+    ctx = cegse_ctx_or_default(ctx);
+    *scan = (struct savefile_scan){ .ctx = ctx };
+
+    if ((save = savegame_alloc(ctx, 0)) == NULL) {
+        return -1;
+    }
+
+    DEBUG_LOG(ctx, "Scanning save file\n");
+
+    err = scan_reader(data, size, save, scan);
+    print_read_error(ctx, err);
+    savegame_free(save);
+
+    if (err) {
+        DEBUG_LOG(ctx, "Error %d occurred while scanning save file\n", err);
+        savefile_scan_free(scan);
+        return -1;
+    }
+
+    return 0;
+}
+
+void savefile_scan_free(struct savefile_scan *scan)
+{
+    if (scan->ctx) {
+        cegse_free(scan->ctx, scan->index.blocks);
+        cegse_free(scan->ctx, scan->buffer);
+    }
+
+    *scan = (struct savefile_scan){ 0 };
+}
+
+static uint64_t sidecar_index_offset(size_t prefix_size, size_t body_size)
+{
+    return (SIDECAR_HEADER_SIZE + (uint64_t)prefix_size + body_size + 7) &
+           ~(uint64_t)7;
+}
+
+/*
+ * Write the sidecar of a save file. Return -1 on I/O error.
+ */
+static int sidecar_file_writer(FILE *stream, const unsigned char *file,
+                               const struct stat *source,
+                               const struct savefile_scan *scan)
+{
+    static const unsigned char padding[8];
+    const struct savefile_block_index *index = &scan->index;
+    uint64_t index_offset;
+    size_t count;
+
+    count = (size_t)index->num_globals12 + index->num_change_forms +
+            index->num_globals3;
+    index_offset = sidecar_index_offset(scan->prefix_size, scan->body_size);
+
+    write_bytes(stream, SIDECAR_MAGIC, 8);
+    put_le32(stream, SIDECAR_VERSION);
+    put_le32(stream, scan->prefix_size);
+    put_le64(stream, source->st_size);
+    put_le64(stream, source->st_mtim.tv_sec);
+    put_le32(stream, source->st_mtim.tv_nsec);
+    put_le32(stream, scan->body_size);
+    put_le32(stream, index->num_globals12);
+    put_le32(stream, index->num_change_forms);
+    put_le32(stream, index->num_globals3);
+    put_le32(stream, index->end_offset);
+    put_le64(stream, index_offset);
+    write_bytes(stream, file, scan->prefix_size);
+    write_bytes(stream, scan->body, scan->body_size);
+    write_bytes(stream, padding,
+                index_offset - SIDECAR_HEADER_SIZE - scan->prefix_size -
+                    scan->body_size);
+
+    for (size_t i = 0; i < count; ++i) {
+        const struct savefile_block *entry = &index->blocks[i];
+
+        put_le32(stream, entry->offset);
+        put_le32(stream, entry->size);
+        put_le32(stream, entry->uncompressed_size);
+        put_le32(stream, entry->type);
+        put_le32(stream, entry->form_id);
+        put_le32(stream, entry->flags);
+        put_le32(stream, entry->version);
+    }
+
+    return ferror(stream) ? -1 : 0;
+}
+
+int cengine_savefile_write_sidecar(const struct cegse_ctx *ctx,
+                                   const char *filename,
+                                   const char *sidecar_filename)
+{
+    struct savefile_scan scan = { 0 };
+    char *tmp_filename = NULL;
+    void *file = MAP_FAILED;
+    struct stat statbuf;
+    FILE *stream;
+    int rc = -1;
+    int fd;
+
+    ctx = cegse_ctx_or_default(ctx);
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        LOG_ERRNO(ctx, "open");
+        return -1;
+    }
+
+    if (fstat(fd, &statbuf) == -1) {
+        LOG_ERRNO(ctx, "fstat");
+        goto out;
+    }
+
+    file = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file == MAP_FAILED) {
+        LOG_ERRNO(ctx, "mmap");
+        goto out;
+    }
+
+    DEBUG_LOG(ctx, "Writing sidecar of save file %s\n", filename);
+
+    if (cengine_savefile_scan(ctx, file, statbuf.st_size, &scan) == -1) {
+        goto out;
+    }
+
+    /* Readers never see a partially written sidecar. */
+    tmp_filename = cegse_malloc(ctx, strlen(sidecar_filename) + 5);
+    if (!tmp_filename) {
+        goto out;
+    }
+
+    sprintf(tmp_filename, "%s.tmp", sidecar_filename);
+    stream = fopen(tmp_filename, "wb");
+    if (!stream) {
+        LOG_ERRNO(ctx, "fopen");
+        goto out;
+    }
+
+    rc = sidecar_file_writer(stream, file, &statbuf, &scan);
+    if (fclose(stream) != 0 || rc == -1 ||
+        rename(tmp_filename, sidecar_filename) == -1) {
+        LOG_ERRNO(ctx, "write");
+        remove(tmp_filename);
+        rc = -1;
+    }
+
+out:
+    cegse_free(ctx, tmp_filename);
+    savefile_scan_free(&scan);
+    if (file != MAP_FAILED) {
+        munmap(file, statbuf.st_size);
+    }
+    close(fd);
+    return rc;
+}
+
+/*
+ * Return true if a sidecar was made of the save file of the status.
+ */
+static bool sidecar_matches(const unsigned char *sidecar, size_t size,
+                            const struct stat *source)
+{
+    return size >= SIDECAR_HEADER_SIZE &&
+           memcmp(sidecar, SIDECAR_MAGIC, 8) == 0 &&
+           load_le32(sidecar + 8) == SIDECAR_VERSION &&
+           load_le64(sidecar + 16) == (uint64_t)source->st_size &&
+           (int64_t)load_le64(sidecar + 24) == source->st_mtim.tv_sec &&
+           load_le32(sidecar + 32) == (uint32_t)source->st_mtim.tv_nsec;
+}
+
+/*
+ * Read a save from a sidecar. The file header and the plugin information
+ * are read from the copy of the file, the other global data straight from
+ * the blocks in the index and the change forms from the index alone.
+ */
+static cg_err_t sidecar_reader(const unsigned char *sidecar, size_t size,
+                               struct savegame *save,
+                               const struct savefile_read_options *options)
+{
+    struct ucursor fields = { (unsigned char *)sidecar + 12 };
+    const struct cegse_ctx *ctx = save->priv->ctx;
+    uint64_t wanted = SAVEFILE_ALL_SECTIONS;
+    struct savefile_block_index index = { 0 };
+    const unsigned char *body_data;
+    const unsigned char *blocks;
+    struct cursor prefix;
+    struct cursor body;
+    uint32_t prefix_size;
+    uint32_t body_size;
+    uint64_t index_offset;
+    uint64_t count;
+    cg_err_t err;
+
+    if (size < SIDECAR_HEADER_SIZE) {
+        return CG_EOF;
+    }
+
+    prefix_size = uc_load_le32(&fields);
+    fields.pos += 20; /* The status of the save file was checked. */
+    body_size = uc_load_le32(&fields);
+    index.num_globals12 = uc_load_le32(&fields);
+    index.num_change_forms = uc_load_le32(&fields);
+    index.num_globals3 = uc_load_le32(&fields);
+    index.end_offset = uc_load_le32(&fields);
+    index_offset = uc_load_le64(&fields);
+
+    count = (uint64_t)index.num_globals12 + index.num_change_forms +
+            index.num_globals3;
+    if (index_offset != sidecar_index_offset(prefix_size, body_size) ||
+        index_offset + count * SIDECAR_BLOCK_SIZE != size ||
+        index.end_offset > body_size) {
+        return CG_CORRUPT;
+    }
+
+    if (options->sections) {
+        wanted = options->sections & SAVEFILE_ALL_SECTIONS;
+        wanted |= SAVEFILE_SECTION(SECTION_FILE_HEADER);
+    }
+
+    save->priv->sections = wanted;
+
+    prefix.pos = (unsigned char *)sidecar + SIDECAR_HEADER_SIZE;
+    prefix.n = prefix_size;
+    err = header_reader(&prefix, save);
+    if (err) {
+        return err;
+    }
+
+    if (wanted & SAVEFILE_SECTION(SECTION_SNAPSHOT)) {
+        save->snapshot_data = save_malloc(save, save->snapshot_size);
+        if (!save->snapshot_data) {
+            return CG_NO_MEM;
+        }
+
+        if (!c_load_bytes(&prefix, save->snapshot_data, save->snapshot_size)) {
+            return CG_EOF;
+        }
+    }
+
+    body_data = sidecar + SIDECAR_HEADER_SIZE + prefix_size;
+    body.pos = (unsigned char *)body_data;
+    body.n = body_size;
+    err = body_start_reader(&body, save,
+                            wanted & SAVEFILE_SECTION(SECTION_PLUGIN_INFO));
+    if (err) {
+        return err;
+    }
+
+    index.blocks = cegse_malloc(ctx, count ? count * sizeof(*index.blocks)
+                                            : 1);
+    if (!index.blocks) {
+        return CG_NO_MEM;
+    }
+
+    blocks = sidecar + index_offset;
+    for (size_t i = 0; i < count; ++i) {
+        struct ucursor block = { (unsigned char *)blocks +
+                                 i * SIDECAR_BLOCK_SIZE };
+        struct savefile_block *entry = &index.blocks[i];
+
+        entry->offset = uc_load_le32(&block);
+        entry->size = uc_load_le32(&block);
+        entry->uncompressed_size = uc_load_le32(&block);
+        entry->type = uc_load_le32(&block);
+        entry->form_id = uc_load_le32(&block);
+        entry->flags = uc_load_le32(&block);
+        entry->version = uc_load_le32(&block);
+    }
+
+    DEBUG_LOG(ctx, "Reading %" PRIu64 " indexed blocks\n", count);
+
+    err = indexed_blocks_reader(body_data, body_size, save, &index, wanted,
+                                options->flags, options->threads);
+    cegse_free(ctx, index.blocks);
+    if (err) {
+        return err;
+    }
+
+    body.pos = (unsigned char *)body_data + index.end_offset;
+    body.n = body_size - index.end_offset;
+
+    return body_end_reader(&body, save, wanted, NULL);
+}
+
+struct savegame *cengine_savefile_read_sidecar(
+    const struct cegse_ctx *ctx, const char *filename,
+    const char *sidecar_filename, const struct savefile_read_options *options)
+{
+    struct savegame *save;
+    struct stat statbuf;
+    size_t size = 0;
+    void *sidecar;
+
+    ctx = cegse_ctx_or_default(ctx);
+
+    if (stat(filename, &statbuf) == -1) {
+        LOG_ERRNO(ctx, "stat");
+        return NULL;
+    }
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        sidecar = mmap_entire_file_r(sidecar_filename, &size);
+        if (sidecar != MAP_FAILED) {
+            if (sidecar_matches(sidecar, size, &statbuf)) {
+                DEBUG_LOG(ctx, "Reading save file %s from sidecar %s\n",
+                          filename, sidecar_filename);
+
+                save = buffer_reader(ctx, sidecar, size, FILE_MAPPED, options,
+                                     sidecar_reader);
+                if (save) {
+                    return save;
+                }
+
+                break;
+            }
+
+            munmap(sidecar, size);
+        }
+
+        /* Missing or stale. */
+        if (attempt == 0 && cengine_savefile_write_sidecar(
+                                ctx, filename, sidecar_filename) == -1) {
+            break;
+        }
+    }
+
+    /* The sidecar cannot be used, but the save file may still be read. */
+    return cengine_savefile_read(ctx, filename, options);
+}
+
+static unsigned block_header_size(const struct block *block)
+{
+    struct block_change_form *cf;
+
+    switch (block->block_type) {
+    case BLOCK_SIMPLE:
+        return 4;
+    case BLOCK_GLOBAL_DATA:
+        return 8;
+    case BLOCK_CHANGE_FORM:
+        cf = (struct block_change_form *)block;
+        return 9 + (2 << ((cf->type_num >> 6) & 0x3));
+    }
+
+    return 0;
+}
+
+static cg_err_t disassembler(struct block *block, struct cursor *cursor)
+{
+    struct block_change_form *cf;
+    struct ucursor fields;
+
+    switch (block->block_type) {
+    case BLOCK_GLOBAL_DATA:
+        if (!c_reserve(cursor, &fields, 8)) {
+            return CG_EOF;
+        }
+
+        ((struct block_global_data *)block)->type_num = uc_load_le32(&fields);
+        block->size = uc_load_le32(&fields);
+        break;
+
+    case BLOCK_SIMPLE:
+        if (!c_reserve(cursor, &fields, 4)) {
+            return CG_EOF;
+        }
+
+        block->size = uc_load_le32(&fields);
+        break;
+
+    case BLOCK_CHANGE_FORM:
+        cf = (struct block_change_form *)block;
+        if (!c_reserve(cursor, &fields, 9)) {
+            return CG_EOF;
+        }
+
+        cf->form_id = uc_load_be24(&fields);
+        cf->flags = uc_load_le32(&fields);
+        cf->type_num = uc_load_u8(&fields);
+        cf->version = uc_load_u8(&fields);
+
+        /*
+         * Two upper bits of type determine the sizes of size information.
+         */
+        switch ((cf->type_num >> 6) & 0x3) {
+        case 0:
+            if (!c_reserve(cursor, &fields, 2)) {
+                return CG_EOF;
+            }
+            block->size = uc_load_u8(&fields);
+            block->uncompressed_size = uc_load_u8(&fields);
+            break;
+        case 1:
+            if (!c_reserve(cursor, &fields, 4)) {
+                return CG_EOF;
+            }
+            block->size = uc_load_le16(&fields);
+            block->uncompressed_size = uc_load_le16(&fields);
+            break;
+        case 2:
+            if (!c_reserve(cursor, &fields, 8)) {
+                return CG_EOF;
+            }
+            block->size = uc_load_le32(&fields);
+            block->uncompressed_size = uc_load_le32(&fields);
+            break;
+        default:
+            return CG_CORRUPT;
+        }
+        break;
+    }
+
+    /* Unless readed header successfully and block is completely in buffer: */
+    if (cursor->n < (long)block->size) {
+        /* Bug or corrupt. */
+        return CG_EOF;
+    }
+
+    block->buffer = cursor->pos;
+    block->buffer_size = cursor->n;
+    c_advance(cursor, block->size);
+
+    return CG_OK;
+}
+
+__attribute__((unused)) static cg_err_t decompressor(
+    struct block *block, void *buffer, size_t buffer_size,
+    enum compressor compressor_type)
+{
+    decompress_fn_t decompress;
+    ssize_t decompress_size;
+
+    switch (compressor_type) {
+    case LZ4:
+        decompress = lz4_decompress;
+        break;
+    case ZLIB:
+        decompress = zlib_decompress;
+        break;
+    default:
+        return CG_INVAL;
+    }
+
+    decompress_size =
+        decompress(as_cregion(block), make_region(buffer, buffer_size));
+    if (decompress_size == -1) {
+        /* Buffer too small? */
+        return CG_COMPRESS;
+    }
+
+    /* Update values. */
+    block->uncompressed_size = 0;
+    block->size = decompress_size;
+    block->buffer_size = buffer_size;
+    block->buffer = buffer;
+
+    return CG_OK;
+}
+
+static cg_err_t deserializer(struct block *block, struct savegame *save,
+                             enum object_type object_type)
+{
+    struct cursor *cursor = &(struct cursor){ block->buffer, block->size };
+    struct ucursor fields;
+    cg_err_t err = CG_OK;
+
+#if defined(COMPILE_WITH_UNIT_TESTS)
+    struct chunk **file_object = &save->priv->file_objects[object_type];
+
+    cegse_free(save->priv->ctx, *file_object);
+
+    /* Copy this block for unit testing. */
+    *file_object = ctx_chunk_alloc(save->priv->ctx, block->size);
+    if (!*file_object) {
+        perror("chunk_alloc");
+        exit(1);
+    }
+
+    memcpy((*file_object)->data, block->buffer, block->size);
+#endif
+
+    switch (object_type) {
+    case OBJECT_FILE_HEADER:
+        if (!c_load_le32(cursor, &save->priv->file_version)) {
+            err = CG_EOF;
+            break;
+        }
+
+        save->save_num = c_load_le32_or0(cursor);
+        err = c_load_le16_str(cursor, save, &save->player_name);
+        if (err)
+            break;
+        save->level = c_load_le32_or0(cursor);
+        err = c_load_le16_str(cursor, save, &save->player_location_name);
+        if (err)
+            break;
+        err = c_load_le16_str(cursor, save, &save->game_time);
+        if (err)
+            break;
+        err = c_load_le16_str(cursor, save, &save->race_id);
+        if (err)
+            break;
+        if (!c_reserve(cursor, &fields, HEADER_TAIL_SIZE)) {
+            err = CG_EOF;
+            break;
+        }
+
+        save->sex = uc_load_le16(&fields);
+        save->current_xp = uc_load_lef32(&fields);
+        save->target_xp = uc_load_lef32(&fields);
+        save->filetime = uc_load_le64(&fields);
+        save->snapshot_width = uc_load_le32(&fields);
+        save->snapshot_height = uc_load_le32(&fields);
+
+        if (supports_save_file_compression(save)) {
+            /*
+             * Read compression type and validate it.
+             */
+            uint16_t compression_type;
+
+            if (!c_load_le16(cursor, &compression_type)) {
+                err = CG_EOF;
+                break;
+            }
+
+            if (!(compression_type <= 2)) {
+                DEBUG_LOG(save->priv->ctx,
+                          "Read an invalid compression type: %u\n",
+                          compression_type);
+                err = CG_CORRUPT;
+                break;
+            }
+
+            save->priv->compressor = compression_type;
+
+            DEBUG_LOG(save->priv->ctx,
+                      "Save file compression algorithm = %s.\n",
+                      compression_type == LZ4    ? "lz4"
+                      : compression_type == ZLIB ? "zlib"
+                                                 : "none");
+        }
+        else {
+            DEBUG_LOG(save->priv->ctx, "No save file compression support\n");
+        }
+        break;
+
+    case OBJECT_PLUGIN_INFO:
+        /* Regular plugins. */
+        if (!c_load_u8(cursor, &save->num_plugins)) {
+            err = CG_EOF;
+            break;
+        }
+
+        save->plugins =
+            save_calloc(save, save->num_plugins, sizeof(*save->plugins));
+        if (!save->plugins) {
+            err = CG_NO_MEM;
+            break;
+        }
+
+        err = read_le16_str_array(cursor, save, save->plugins,
+                                  save->num_plugins);
+        if (err) {
+            break;
+        }
+
+        /* Light plugins. */
+        if (supports_light_plugins(save)) {
+            if (!c_load_le16(cursor, &save->num_light_plugins)) {
+                err = CG_EOF;
+                break;
+            }
+
+            save->light_plugins = save_calloc(save, save->num_light_plugins,
+                                              sizeof(*save->light_plugins));
+            if (!save->light_plugins) {
+                err = CG_NO_MEM;
+                break;
+            }
+
+            err = read_le16_str_array(cursor, save, save->light_plugins,
+                                      save->num_light_plugins);
+        }
+        break;
+
+    case OBJECT_GLDA_MISC_STATS:
+        save->num_misc_stats = c_load_le32_or0(cursor);
+        if (save->num_misc_stats == 0) {
+            break;
+        }
+
+        save->misc_stats =
+            save_calloc(save, save->num_misc_stats, sizeof(*save->misc_stats));
+        if (!save->misc_stats) {
+            err = CG_NO_MEM;
+            break;
+        }
+
+        for (uint32_t i = 0u; i < save->num_misc_stats; ++i) {
+            err = c_load_le16_str(cursor, save, &save->misc_stats[i].name);
+            if (err) {
+                break;
+            }
+
+            save->misc_stats[i].category = c_load_u8_or0(cursor);
+            save->misc_stats[i].value = c_load_le32_or0(cursor);
+        }
+        break;
+
+    case OBJECT_GLDA_PLAYER_LOCATION:
+        if (!c_reserve(cursor, &fields,
+                       PLAYER_LOCATION_SIZE + (save->game == SKYRIM))) {
+            break;
+        }
+
+        save->player_location.next_object_id = uc_load_le32(&fields);
+        save->player_location.world_space1 = uc_load_be24(&fields);
+        save->player_location.coord_x = (int32_t)uc_load_le32(&fields);
+        save->player_location.coord_y = (int32_t)uc_load_le32(&fields);
+        save->player_location.world_space2 = uc_load_be24(&fields);
+        save->player_location.pos_x = uc_load_lef32(&fields);
+        save->player_location.pos_y = uc_load_lef32(&fields);
+        save->player_location.pos_z = uc_load_lef32(&fields);
+        if (save->game == SKYRIM) {
+            save->player_location.unknown =
+                uc_load_u8(&fields); /* Skyrim only */
+        }
+        break;
+
+    case OBJECT_GLDA_GLOBAL_VARIABLES:
+        err = decode_vsval(cursor, &save->num_global_vars);
+        if (err || save->num_global_vars == 0) {
+            break;
+        }
+
+        save->global_vars = save_calloc(save, save->num_global_vars,
+                                        sizeof(*save->global_vars));
+        if (!save->global_vars) {
+            err = CG_NO_MEM;
+            break;
+        }
+
+        if (!c_reserve(cursor, &fields,
+                       GLOBAL_VARIABLE_SIZE * (size_t)save->num_global_vars)) {
+            break;
+        }
+
+        for (uint32_t i = 0u; i < save->num_global_vars; ++i) {
+            save->global_vars[i].form_id = uc_load_be24(&fields);
+            save->global_vars[i].value = uc_load_lef32(&fields);
+        }
+        break;
+
+    case OBJECT_GLDA_WEATHER:
+        if (!c_reserve(cursor, &fields, WEATHER_FIXED_SIZE)) {
+            break;
+        }
+
+        save->weather.climate = uc_load_be24(&fields);
+        save->weather.weather = uc_load_be24(&fields);
+        save->weather.prev_weather = uc_load_be24(&fields);
+        save->weather.unk_weather1 = uc_load_be24(&fields);
+        save->weather.unk_weather2 = uc_load_be24(&fields);
+        save->weather.regn_weather = uc_load_be24(&fields);
+        save->weather.current_time = uc_load_lef32(&fields);
+        save->weather.begin_time = uc_load_lef32(&fields);
+        save->weather.weather_pct = uc_load_lef32(&fields);
+        for (size_t i = 0u; i < 6; ++i)
+            save->weather.data1[i] = uc_load_le32(&fields);
+        save->weather.data2 = uc_load_lef32(&fields);
+        save->weather.data3 = uc_load_le32(&fields);
+        save->weather.flags = uc_load_u8(&fields);
+
+        /* Read the remaining bytes. Don't know what they are. */
+        if (cursor->n > 0) {
+            err = read_view(cursor, save, &save->weather.data4, cursor->n);
+        }
+        break;
+
+    case OBJECT_GLDA_MAGIC_FAVORITES:
+        err = decode_vsval(cursor, &save->num_favourites);
+        if (err) {
+            break;
+        }
+
+        save->favourites =
+            save_calloc(save, save->num_favourites, sizeof(*save->favourites));
+        if (!save->favourites) {
+            err = CG_NO_MEM;
+            break;
+        }
+
+        c_load_be24_array(cursor, save->favourites, save->num_favourites);
+
+        err = decode_vsval(cursor, &save->num_hotkeys);
+        if (err) {
+            break;
+        }
+
+        save->hotkeys =
+            save_calloc(save, save->num_hotkeys, sizeof(*save->hotkeys));
+        if (!save->hotkeys) {
+            err = CG_NO_MEM;
+            break;
+        }
+
+        c_load_be24_array(cursor, save->hotkeys, save->num_hotkeys);
+        break;
+
+    case OBJECT_GLDA_GAME:
+    case OBJECT_GLDA_CREATED_OBJECTS:
+    case OBJECT_GLDA_EFFECTS:
+    case OBJECT_GLDA_AUDIO:
+    case OBJECT_GLDA_SKY_CELLS:
+    case OBJECT_GLDA_9:
+    case OBJECT_GLDA_10:
+    case OBJECT_GLDA_11:
+    case OBJECT_GLDA_PROCESS_LISTS:
+    case OBJECT_GLDA_COMBAT:
+    case OBJECT_GLDA_INTERFACE:
+    case OBJECT_GLDA_ACTOR_CAUSES:
+    case OBJECT_GLDA_104:
+    case OBJECT_GLDA_DETECTION_MANAGER:
+    case OBJECT_GLDA_LOCATION_METADATA:
+    case OBJECT_GLDA_QUEST_STATIC_DATA:
+    case OBJECT_GLDA_STORYTELLER:
+    case OBJECT_GLDA_PLAYER_CONTROLS:
+    case OBJECT_GLDA_STORY_EVENT_MANAGER:
+    case OBJECT_GLDA_INGREDIENT_SHARED:
+    case OBJECT_GLDA_MENU_CONTROLS:
+    case OBJECT_GLDA_MENU_TOPIC_MANAGER:
+    case OBJECT_GLDA_115:
+    case OBJECT_GLDA_116:
+    case OBJECT_GLDA_117:
+    case OBJECT_GLDA_TEMP_EFFECTS:
+    case OBJECT_GLDA_PAPYRUS:
+    case OBJECT_GLDA_ANIM_OBJECTS:
+    case OBJECT_GLDA_TIMER:
+    case OBJECT_GLDA_SYNCHRONISED_ANIMS:
+    case OBJECT_GLDA_MAIN:
+    case OBJECT_GLDA_1006:
+    case OBJECT_GLDA_1007:
+        {
+            /*
+             * Read an unknown global data structure.
+             */
+            struct cregion *slot;
+
+            slot = &save->priv->globals[object_type - FIRST_OBJECT_GLDA];
+
+            if (slot->data != NULL) {
+                ERROR_LOG(save->priv->ctx,
+                          "encountered multiple global data of type %u\n",
+                          object_type);
+                err = CG_CORRUPT;
+                break;
+            }
+
+            err = read_view(cursor, save, slot, cursor->n);
+            break;
+        }
+
+    default:
+        break;
+    }
+
+    if (cursor->n < 0) {
+        /* Bug or corrupt. */
+        DEBUG_LOG(save->priv->ctx,
+                  "CG_EOF while deserializing object type %u. "
+                  "cursor->n = %lld\n",
+                  object_type, cursor->n);
+        return CG_EOF;
+    }
+
+    return err;
+}
+
+static void prepare_block(struct block *block, struct cursor *cursor)
+{
+    unsigned header_size = block_header_size(block);
+    block->buffer = cursor->pos + header_size;
+    block->buffer_size = cursor->n - header_size;
+}
+
+static cg_err_t serializer(struct block *block, const struct savegame *save,
+                           enum object_type object_type)
+{
+    struct cursor *cursor =
+        &(struct cursor){ block->buffer, block->buffer_size };
+    struct ucursor fields;
+    cg_err_t err = CG_OK;
+
+    switch (object_type) {
+    case OBJECT_FILE_HEADER:
+        c_store_le32(cursor, save->priv->file_version);
+        c_store_le32(cursor, save->save_num);
+        c_store_le16_str(cursor, save->player_name);
+        c_store_le32(cursor, save->level);
+        c_store_le16_str(cursor, save->player_location_name);
+        c_store_le16_str(cursor, save->game_time);
+        c_store_le16_str(cursor, save->race_id);
+        if (c_reserve(cursor, &fields, HEADER_TAIL_SIZE)) {
+            uc_store_le16(&fields, save->sex);
+            uc_store_lef32(&fields, save->current_xp);
+            uc_store_lef32(&fields, save->target_xp);
+            uc_store_le64(&fields, save->filetime);
+            uc_store_le32(&fields, save->snapshot_width);
+            uc_store_le32(&fields, save->snapshot_height);
+        }
+        if (supports_save_file_compression(save)) {
+            c_store_le16(cursor, save->priv->compressor);
+        }
+        break;
+
+    case OBJECT_PLUGIN_INFO:
+        c_store_u8(cursor, save->num_plugins);
+        for (uint32_t i = 0; i < save->num_plugins; ++i) {
+            c_store_le16_str(cursor, save->plugins[i]);
+        }
+
+        if (supports_light_plugins(save)) {
+            c_store_le16(cursor, save->num_light_plugins);
+            for (uint32_t i = 0; i < save->num_light_plugins; ++i) {
+                c_store_le16_str(cursor, save->light_plugins[i]);
+            }
+        }
+        break;
+
+    case OBJECT_GLDA_MISC_STATS:
+        c_store_le32(cursor, save->num_misc_stats);
+        for (uint32_t i = 0u; i < save->num_misc_stats; ++i) {
+            c_store_le16_str(cursor, save->misc_stats[i].name);
+            c_store_u8(cursor, save->misc_stats[i].category);
+            c_store_le32(cursor, save->misc_stats[i].value);
+        }
+        break;
+
+    case OBJECT_GLDA_PLAYER_LOCATION:
+        /* The last byte is present in Skyrim savefiles. */
+        if (c_reserve(cursor, &fields, PLAYER_LOCATION_SIZE + 1)) {
+            uc_store_le32(&fields, save->player_location.next_object_id);
+            uc_store_be24(&fields, save->player_location.world_space1);
+            uc_store_le32(&fields, save->player_location.coord_x);
+            uc_store_le32(&fields, save->player_location.coord_y);
+            uc_store_be24(&fields, save->player_location.world_space2);
+            uc_store_lef32(&fields, save->player_location.pos_x);
+            uc_store_lef32(&fields, save->player_location.pos_y);
+            uc_store_lef32(&fields, save->player_location.pos_z);
+            uc_store_u8(&fields, save->player_location.unknown);
+        }
+        break;
+
+    case OBJECT_GLDA_GLOBAL_VARIABLES:
+        encode_vsval(cursor, save->num_global_vars);
+        if (c_reserve(cursor, &fields,
+                      GLOBAL_VARIABLE_SIZE * (size_t)save->num_global_vars)) {
+            for (uint32_t i = 0u; i < save->num_global_vars; ++i) {
+                uc_store_be24(&fields, save->global_vars[i].form_id);
+                uc_store_lef32(&fields, save->global_vars[i].value);
+            }
+        }
+        break;
+
+    case OBJECT_GLDA_WEATHER:
+        if (c_reserve(cursor, &fields, WEATHER_FIXED_SIZE)) {
+            uc_store_be24(&fields, save->weather.climate);
+            uc_store_be24(&fields, save->weather.weather);
+            uc_store_be24(&fields, save->weather.prev_weather);
+            uc_store_be24(&fields, save->weather.unk_weather1);
+            uc_store_be24(&fields, save->weather.unk_weather2);
+            uc_store_be24(&fields, save->weather.regn_weather);
+            uc_store_lef32(&fields, save->weather.current_time);
+            uc_store_lef32(&fields, save->weather.begin_time);
+            uc_store_lef32(&fields, save->weather.weather_pct);
+            for (int i = 0; i < 6; ++i)
+                uc_store_le32(&fields, save->weather.data1[i]);
+            uc_store_lef32(&fields, save->weather.data2);
+            uc_store_le32(&fields, save->weather.data3);
+            uc_store_u8(&fields, save->weather.flags);
+        }
+        c_store_bytes(cursor, save->weather.data4.data,
+                      save->weather.data4.size);
+        break;
+
+    case OBJECT_GLDA_MAGIC_FAVORITES:
+        encode_vsval(cursor, save->num_favourites);
+        c_store_be24_array(cursor, save->favourites, save->num_favourites);
+        encode_vsval(cursor, save->num_hotkeys);
+        c_store_be24_array(cursor, save->hotkeys, save->num_hotkeys);
+        break;
+
+    case OBJECT_GLDA_GAME:
+    case OBJECT_GLDA_CREATED_OBJECTS:
+    case OBJECT_GLDA_EFFECTS:
+    case OBJECT_GLDA_AUDIO:
+    case OBJECT_GLDA_SKY_CELLS:
+    case OBJECT_GLDA_9:
+    case OBJECT_GLDA_10:
     case OBJECT_GLDA_11:
     case OBJECT_GLDA_PROCESS_LISTS:
     case OBJECT_GLDA_COMBAT:
@@ -1591,1009 +3869,2450 @@ static cg_err_t deserializer(struct block *block, struct savegame *save,
     case OBJECT_GLDA_1007:
         {
             /*
-             * Read an unknown global data structure.
+             * Unknown global data structure.
+             */
+            struct cregion data;
+
+            data = save->priv->globals[object_type - FIRST_OBJECT_GLDA];
+
+            if (data.data == NULL) {
+                err = CG_NOT_PRESENT;
+                break;
+            }
+
+            c_store_bytes(cursor, data.data, data.size);
+            break;
+        }
+    default:
+        err = CG_NOT_PRESENT;
+        break;
+    }
+
+    if (cursor->n < 0 && block->buffer != NULL) {
+        /* Buffer needs to grow by -cursor->n bytes. */
+        err = CG_EOF;
+    }
+
+    if (err) {
+        DEBUG_LOG(save->priv->ctx, "error %u at object type %u\n", err,
+                  object_type);
+        return err;
+    }
+
+    block->size = block->buffer_size - cursor->n;
+    block->uncompressed_size = 0;
+    return CG_OK;
+}
+
+__attribute__((unused)) static cg_err_t compressor(
+    struct block *block, void *buffer, size_t buffer_size,
+    enum compressor compressor_type)
+{
+    compress_fn_t compress;
+    ssize_t compress_size;
+
+    switch (compressor_type) {
+    case LZ4:
+        compress = lz4_compress;
+        break;
+    case ZLIB:
+        compress = zlib_compress;
+        break;
+    case NO_COMPRESSION:
+        return CG_INVAL;
+    }
+
+    compress_size =
+        compress(as_cregion(block), make_region(buffer, buffer_size), NULL);
+    if (compress_size == -1) {
+        /* Buffer too small? */
+        return CG_COMPRESS;
+    }
+
+    /* Update values. */
+    block->uncompressed_size = block->size;
+    block->size = compress_size;
+    block->buffer_size = buffer_size;
+    block->buffer = buffer;
+
+    return CG_OK;
+}
+
+static void assembler(const struct block *block, struct cursor *cursor)
+{
+    struct block_change_form *cf;
+    struct ucursor fields;
+
+    /* Cursor must be at the block header. */
+    assert(block->buffer - cursor->pos == block_header_size(block));
+
+    if (!c_reserve(cursor, &fields, block_header_size(block))) {
+        return;
+    }
+
+    switch (block->block_type) {
+    case BLOCK_GLOBAL_DATA:
+        uc_store_le32(&fields, ((struct block_global_data *)block)->type_num);
+        /* fallthrough */
+    case BLOCK_SIMPLE:
+        uc_store_le32(&fields, block->size);
+        break;
+
+    case BLOCK_CHANGE_FORM:
+        cf = (struct block_change_form *)block;
+        uc_store_be24(&fields, cf->form_id);
+        uc_store_le32(&fields, cf->flags);
+        uc_store_u8(&fields, cf->type_num);
+        uc_store_u8(&fields, cf->version);
+
+        /* Two upper bits of type determine the sizes of length1 and length2. */
+        switch ((cf->type_num >> 6) & 0x3) {
+        case 0:
+            uc_store_u8(&fields, block->size);
+            uc_store_u8(&fields, block->uncompressed_size);
+            break;
+        case 1:
+            uc_store_le16(&fields, block->size);
+            uc_store_le16(&fields, block->uncompressed_size);
+            break;
+        case 2:
+            uc_store_le32(&fields, block->size);
+            uc_store_le32(&fields, block->uncompressed_size);
+            break;
+        default:
+            BUG("Valid length types include uint8, uint16 and uint32.\n");
+        }
+        break;
+    }
+
+    assert(cursor->pos == block->buffer);
+
+    c_advance(cursor, block->size);
+}
+
+/*
+ * Find out the serialized size of an object without writing it anywhere.
+ * The size is stored to block->size.
+ */
+static cg_err_t measure_object(struct block *block, const struct savegame *save,
+                               enum object_type object_type)
+{
+    block->buffer = NULL;
+    block->buffer_size = 0;
+    return serializer(block, save, object_type);
+}
+
+/*
+ * Calculate the exact size of the save data (the body) that file_writer()
+ * produces before compression.
+ */
+static cg_err_t measure_body(const struct savegame *save, size_t *body_size)
+{
+    union {
+        struct block simple;
+        struct block_change_form chfo;
+        struct block_global_data glda;
+    } block_buf = { 0 };
+    struct block *block = &block_buf.simple;
+    size_t size;
+    cg_err_t err;
+
+    size = 1; /* Form version. */
+
+    if (save->game == FALLOUT4) {
+        size += 2 + strlen(save->game_version);
+    }
+
+    block->block_type = BLOCK_SIMPLE;
+    err = measure_object(block, save, OBJECT_PLUGIN_INFO);
+    if (err) {
+        return err;
+    }
+    size += block_header_size(block) + block->size;
+
+    size += LOCATION_TABLE_SIZE;
+
+    block->block_type = BLOCK_GLOBAL_DATA;
+    for (enum object_type i = FIRST_OBJECT_GLDA; i <= LAST_OBJECT_GLDA; ++i) {
+        err = measure_object(block, save, i);
+        if (err == CG_NOT_PRESENT) {
+            continue;
+        }
+        if (err) {
+            return err;
+        }
+        size += block_header_size(block) + block->size;
+    }
+
+    /* Change forms are already serialized. Only headers vary in size. */
+    block->block_type = BLOCK_CHANGE_FORM;
+    for (unsigned i = 0; i < save->priv->n_change_forms; ++i) {
+        const struct change_form *cf = &save->priv->change_forms[i];
+
+        block_buf.chfo.type_num = cf->type;
+        size += block_header_size(block) + cf->length1;
+    }
+
+    size += 4 + 4 * (size_t)save->num_form_ids;
+    size += 4 + 4 * (size_t)save->num_world_spaces;
+    size += 4 + save->priv->unknown3.size;
+
+    *body_size = size;
+    return CG_OK;
+}
+
+/*
+ * Return the largest size the body can have after compression or 0 if
+ * the body is too large for the compressor.
+ */
+static size_t compress_bound(enum compressor compressor_type, size_t size,
+                             const struct compress_options *options)
+{
+    switch (compressor_type) {
+    case LZ4:
+        return lz4_compress_bound(size);
+    case ZLIB:
+        return zlib_compress_options_bound(size, options);
+    case NO_COMPRESSION:
+        return size;
+    }
+
+    return 0;
+}
+
+/*
+ * Calculate how large a buffer file_writer() needs to write the file.
+ * The size is exact unless the body gets compressed.
+ */
+static cg_err_t measure_file(const struct savegame *save, size_t body_size,
+                             const struct savefile_write_options *options,
+                             size_t *file_size)
+{
+    struct block block = { .block_type = BLOCK_SIMPLE };
+    size_t size;
+    cg_err_t err;
+
+    size = strlen(save->game == FALLOUT4 ? FO4_SIGNATURE : TESV_SIGNATURE);
+
+    err = measure_object(&block, save, OBJECT_FILE_HEADER);
+    if (err) {
+        return err;
+    }
+    size += block_header_size(&block) + block.size;
+
+    size += save->snapshot_size;
+
+    if (supports_save_file_compression(save)) {
+        size_t bound = compress_bound(save->priv->compressor, body_size,
+                                      &options->compression);
+
+        if (bound == 0) {
+            return CG_UNSUPPORTED;
+        }
+
+        size += 8 + bound;
+    }
+    else {
+        size += body_size;
+    }
+
+    *file_size = size;
+    return CG_OK;
+}
+
+/*
+ * Copy the compressed save data that was read into dest if body is the
+ * same save data and no other compression is asked for. Return the
+ * compressed size or -1 if the body has to be compressed.
+ */
+static ssize_t reuse_compressed_body(
+    const struct savegame *save, const struct savefile_write_options *options,
+    struct cregion body, struct region dest)
+{
+    const struct compress_options *compression = &options->compression;
+    const struct chunk *compressed_body = save->priv->compressed_body;
+
+    if (!compressed_body || compression->level ||
+        compression->acceleration || compression->threads) {
+        return -1;
+    }
+
+    if (body.size != save->priv->body_size ||
+        compressed_body->size > dest.size ||
+        hash64(body.data, body.size, 0) != save->priv->body_hash) {
+        return -1;
+    }
+
+    DEBUG_LOG(save->priv->ctx,
+              "Save data is unchanged, copying it compressed\n");
+    memcpy(dest.data, compressed_body->data, compressed_body->size);
+
+    return compressed_body->size;
+}
+
+/*
+ * Write a save file to file_size_ptr bytes at file and store the written
+ * size back. body_size is the size of the save data that measure_body()
+ * gives.
+ */
+static cg_err_t file_writer(unsigned char *file, size_t *file_size_ptr,
+                            const struct savegame *save, size_t body_size,
+                            const struct savefile_write_options *options)
+{
+    const struct cegse_ctx *ctx = save->priv->ctx;
+    struct location_table locations = { 0 };
+    struct chunk *buffers[1] = { 0 }; /* Buffers for compression. */
+    struct cursor file_cursor;        /* Cursor for additions to file. */
+    struct cursor body_cursor;        /* Cursor for additions to body. */
+    struct cursor *cursor;            /* The cursor being used. */
+    intptr_t offset_var =
+        (intptr_t)file;   /* Variable for file offset calculation. */
+    size_t max_file_size; /* Size of 'file' arg for bounds checking. */
+    unsigned char *ptr_to_locations; /* Points where to write location table. */
+    unsigned char *body;             /* Points where the body begins. */
+    cg_err_t err = CG_OK;
+
+    if (save->priv->sections != SAVEFILE_ALL_SECTIONS) {
+        /* Some of the save is missing. */
+        return CG_INVAL;
+    }
+
+    max_file_size = *file_size_ptr;
+    file_cursor.pos = file;
+    file_cursor.n = max_file_size;
+    cursor = &file_cursor;
+
+/* Calculates current file offset at cursor position. */
+#define OFFSET() ((uint32_t)((intptr_t)cursor->pos - offset_var))
+
+    union {
+        struct block simple;
+        struct block_change_form chfo;
+        struct block_global_data glda;
+    } block_buf = { 0 };
+    struct block *block = &block_buf.simple;
+
+    /*
+     * Write signature.
+     */
+    {
+        const char *signature = NULL;
+
+        switch (save->game) {
+        case SKYRIM:
+            signature = TESV_SIGNATURE;
+            break;
+        case FALLOUT4:
+            signature = FO4_SIGNATURE;
+            break;
+        }
+
+        c_store_bytes(cursor, signature, strlen(signature));
+    }
+
+    /*
+     * Write the file header.
+     */
+    block->block_type = BLOCK_SIMPLE;
+    prepare_block(block, cursor);
+    err = serializer(block, save, OBJECT_FILE_HEADER);
+    if (err) {
+        goto out_error;
+    }
+    assembler(block, cursor);
+
+    /*
+     * Write snapshot.
+     */
+    c_store_bytes(cursor, save->snapshot_data, save->snapshot_size);
+
+    /* Initialize body cursor. */
+    if (supports_save_file_compression(save)) {
+        if (save->priv->compressor != NO_COMPRESSION) {
+            /*
+             * Compression required => need a buffer to write the body in.
+             * Allocate a buffer for the body and set the body cursor at
+             * the beginning of the buffer.
+             */
+            buffers[0] = ctx_chunk_alloc(ctx, body_size);
+            if (!buffers[0]) {
+                err = CG_NO_MEM;
+                goto out_error;
+            }
+
+            body_cursor.pos = buffers[0]->data;
+            body_cursor.n = buffers[0]->size;
+            offset_var = (intptr_t)body_cursor.pos - (file_cursor.pos - file);
+        }
+        else {
+            /*
+             * No compression required. We will directly write to file, but
+             * need to leave 8 bytes of space to store size information.
              */
-            struct chunk **slot;
+            c_advance2(&body_cursor, &file_cursor, 8);
+            offset_var += 8;
+        }
+    }
+    else {
+        /*
+         * Game engine doesn't support compression for the save file.
+         * We will continue writing where we left off.
+         */
+        c_advance2(&body_cursor, &file_cursor, 0);
+    }
+
+    cursor = &body_cursor;
+    body = cursor->pos;
+
+    c_store_u8(cursor, save->priv->form_version);
+
+    /*
+     * Write game version string.
+     */
+    if (save->game == FALLOUT4) {
+        c_store_le16_str(cursor, save->game_version);
+    }
+
+    /*
+     * Write plugin info.
+     */
+    block->block_type = BLOCK_SIMPLE;
+    prepare_block(block, cursor);
+    err = serializer(block, save, OBJECT_PLUGIN_INFO);
+    if (err) {
+        goto out_error;
+    }
+    assembler(block, cursor);
+
+    /*
+     * Save pointer to file location table.
+     */
+    if (cursor->n < LOCATION_TABLE_SIZE) {
+        err = CG_EOF;
+        goto out_error;
+    }
+    ptr_to_locations = cursor->pos;
+    memset(ptr_to_locations, 0, LOCATION_TABLE_SIZE);
+    c_advance(cursor, LOCATION_TABLE_SIZE);
+
+    /*
+     * Write global data table 1.
+     */
+    locations.off_globals1 = OFFSET();
+    block->block_type = BLOCK_GLOBAL_DATA;
+    for (enum object_type i = FIRST_TABLE1_OBJECT_GLDA;
+         i < FIRST_TABLE2_OBJECT_GLDA; ++i) {
+        block_buf.glda.type_num = glda_type_number(i);
+        prepare_block(block, cursor);
+        err = serializer(block, save, i);
+        if (err && err != CG_NOT_PRESENT) {
+            goto out_error;
+        }
+        if (err != CG_NOT_PRESENT) {
+            assembler(block, cursor);
+            locations.num_globals1++;
+        }
+    }
+    err = CG_OK;
+
+    /*
+     * Write global data table 2.
+     */
+    locations.off_globals2 = OFFSET();
+    for (enum object_type i = FIRST_TABLE2_OBJECT_GLDA;
+         i < FIRST_TABLE3_OBJECT_GLDA; ++i) {
+        block_buf.glda.type_num = glda_type_number(i);
+        prepare_block(block, cursor);
+        err = serializer(block, save, i);
+        if (err && err != CG_NOT_PRESENT) {
+            goto out_error;
+        }
+        if (err != CG_NOT_PRESENT) {
+            assembler(block, cursor);
+            locations.num_globals2++;
+        }
+    }
+    err = CG_OK;
+
+    /*
+     * Write change forms.
+     */
+    locations.off_change_forms = OFFSET();
+    block->block_type = BLOCK_CHANGE_FORM;
+    for (unsigned i = 0; i < save->priv->n_change_forms; ++i) {
+        struct change_form *ptr = &save->priv->change_forms[i];
+        /* Already serialized and compressed. */
+        block_buf.chfo.flags = ptr->flags;
+        block_buf.chfo.form_id = ptr->form_id;
+        block_buf.chfo.version = ptr->version;
+        block_buf.chfo.type_num = ptr->type;
+        block->size = ptr->length1;
+        block->uncompressed_size = ptr->length2;
+
+        prepare_block(block, cursor);
+        memcpy(block->buffer, ptr->data, block->size);
+        assembler(block, cursor);
+
+        locations.num_change_forms++;
+    }
+
+    /*
+     * Write global data table 3.
+     */
+    locations.off_globals3 = OFFSET();
+    block->block_type = BLOCK_GLOBAL_DATA;
+    for (enum object_type i = FIRST_TABLE3_OBJECT_GLDA; i <= LAST_OBJECT_GLDA;
+         ++i) {
+        block_buf.glda.type_num = glda_type_number(i);
+        prepare_block(block, cursor);
+        err = serializer(block, save, i);
+        if (err && err != CG_NOT_PRESENT) {
+            goto out_error;
+        }
+        if (err != CG_NOT_PRESENT) {
+            assembler(block, cursor);
+            locations.num_globals3++;
+        }
+    }
+    err = CG_OK;
+
+    /*
+     * Write form IDs.
+     */
+    locations.off_form_ids_count = OFFSET();
+    c_store_le32(cursor, save->num_form_ids);
+    c_store_le32_array(cursor, save->form_ids, save->num_form_ids);
+
+    /*
+     * Write world spaces.
+     */
+    c_store_le32(cursor, save->num_world_spaces);
+    c_store_le32_array(cursor, save->world_spaces, save->num_world_spaces);
+
+    /*
+     * Write unknown table.
+     */
+    locations.off_unknown_table = OFFSET();
+    c_store_le32(cursor, save->priv->unknown3.size);
+    c_store_bytes(cursor, save->priv->unknown3.data,
+                  save->priv->unknown3.size);
+
+    if (cursor->n < 0) {
+        err = CG_EOF;
+        goto out_error;
+    }
+
+    /*
+     * Write locations table.
+     */
+    store_le32(&ptr_to_locations[0], locations.off_form_ids_count);
+    store_le32(&ptr_to_locations[4], locations.off_unknown_table);
+    store_le32(&ptr_to_locations[8], locations.off_globals1);
+    store_le32(&ptr_to_locations[12], locations.off_globals2);
+    store_le32(&ptr_to_locations[16], locations.off_change_forms);
+    store_le32(&ptr_to_locations[20], locations.off_globals3);
+    store_le32(&ptr_to_locations[24], locations.num_globals1);
+    store_le32(&ptr_to_locations[28], locations.num_globals2);
+    /* Subtract by 1: Skyrim doesn't acknowledge the last global data. */
+    store_le32(&ptr_to_locations[32], locations.num_globals3 - 1);
+    store_le32(&ptr_to_locations[36], locations.num_change_forms);
+    print_locations_table(ctx, &locations);
+
+    /*
+     * Compress body into the file, if necessary.
+     */
+    cursor = &file_cursor;
+
+    if (supports_save_file_compression(save)) {
+        ssize_t uncompress_size = body_cursor.pos - body;
+        ssize_t compress_size = 0;
+
+        struct cregion src = make_cregion(body, uncompress_size);
+        struct region dest = make_region(cursor->pos + 8, cursor->n - 8);
+
+        switch (save->priv->compressor) {
+        case LZ4:
+            compress_size = reuse_compressed_body(save, options, src, dest);
+            if (compress_size == -1) {
+                compress_size = lz4_compress(src, dest, &options->compression);
+            }
+            break;
+        case ZLIB:
+            compress_size = reuse_compressed_body(save, options, src, dest);
+            if (compress_size == -1) {
+                compress_size =
+                    zlib_compress(src, dest, &options->compression);
+            }
+            break;
+        case NO_COMPRESSION:
+            /* Not sure about this, but needed to correctly advance cursor. */
+            compress_size = uncompress_size;
+            break;
+        }
+
+        if (compress_size == -1) {
+            err = CG_COMPRESS;
+            goto out_error;
+        }
+
+        c_store_le32(cursor, uncompress_size);
+        c_store_le32(cursor, compress_size);
+        c_advance(cursor, compress_size);
+    }
+    else {
+        c_advance2(&file_cursor, &body_cursor, 0);
+    }
+
+    /* File is now written, give the size to the caller. */
+    *file_size_ptr = max_file_size - file_cursor.n;
+
+out_error:
+    for (size_t i = 0; i < ARRAY_LEN(buffers); ++i) {
+        cegse_free(ctx, buffers[i]);
+    }
+    return err;
+#undef OFFSET
+}
+
+int cengine_savefile_write(const char *filename,
+                           const struct savegame *savegame,
+                           const struct savefile_write_options *options)
+{
+    const struct cegse_ctx *ctx;
+    size_t max_file_size;
+    size_t body_size;
+    size_t file_size;
+    cg_err_t err;
+    void *file;
+    int fd;
+
+    /* savegame should have been initialized correctly. */
+    assert(savegame->priv != NULL);
+
+    ctx = savegame->priv->ctx;
+    if (!options) {
+        options = &ctx->write_options;
+    }
+
+    if (savegame->priv->sections != SAVEFILE_ALL_SECTIONS) {
+        ERROR_LOG(ctx, "Cannot write a save of which only some sections were "
+                       "read.\n");
+        return -1;
+    }
+
+    err = measure_body(savegame, &body_size);
+    if (!err) {
+        err = measure_file(savegame, body_size, options, &max_file_size);
+    }
+    if (err) {
+        DEBUG_LOG(ctx, "Error %d occurred while measuring save file\n", err);
+        return -1;
+    }
+
+    fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd == -1) {
+        LOG_ERRNO(ctx, "open");
+        return -1;
+    }
+
+    if (ftruncate(fd, max_file_size) == -1) {
+        LOG_ERRNO(ctx, "ftruncate");
+        close(fd);
+        return -1;
+    }
+
+    file = mmap(NULL, max_file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (file == MAP_FAILED) {
+        LOG_ERRNO(ctx, "mmap");
+        close(fd);
+        return -1;
+    }
+
+    if (close(fd) == -1) {
+        LOG_ERRNO(ctx, "close");
+    }
+
+    file_size = max_file_size;
+    err = file_writer(file, &file_size, savegame, body_size, options);
+    if (err) {
+        ERROR_LOG(ctx, "Error %d occurred while writing save file\n", err);
+    }
+
+    if (munmap(file, max_file_size) == -1) {
+        LOG_ERRNO(ctx, "munmap");
+    }
+
+    if (truncate(filename, file_size) == -1) {
+        LOG_ERRNO(ctx, "truncate");
+    }
+
+    return err == CG_OK ? 0 : -1;
+}
+
+/*
+ * Write the save file to a new buffer of the size measure_file() gives.
+ * Return NULL on error.
+ */
+static unsigned char *
+buffer_writer(const struct savegame *savegame,
+              const struct savefile_write_options *options, size_t *file_size)
+{
+    const struct cegse_ctx *ctx;
+    unsigned char *file;
+    size_t body_size;
+    cg_err_t err;
+
+    assert(savegame->priv != NULL);
+
+    ctx = savegame->priv->ctx;
+    if (!options) {
+        options = &ctx->write_options;
+    }
+
+    if (savegame->priv->sections != SAVEFILE_ALL_SECTIONS) {
+        ERROR_LOG(ctx, "Cannot write a save of which only some sections were "
+                       "read.\n");
+        return NULL;
+    }
+
+    err = measure_body(savegame, &body_size);
+    if (!err) {
+        err = measure_file(savegame, body_size, options, file_size);
+    }
+    if (err) {
+        DEBUG_LOG(ctx, "Error %d occurred while measuring save file\n", err);
+        return NULL;
+    }
+
+    file = cegse_malloc(ctx, *file_size);
+    if (!file) {
+        LOG_ERRNO(ctx, "malloc");
+        return NULL;
+    }
+
+    err = file_writer(file, file_size, savegame, body_size, options);
+    if (err) {
+        ERROR_LOG(ctx, "Error %d occurred while writing save file\n", err);
+        cegse_free(ctx, file);
+        return NULL;
+    }
+
+    return file;
+}
+
+void *cengine_savefile_write_mem(const struct savegame *savegame,
+                                 const struct savefile_write_options *options,
+                                 size_t *size)
+{
+    unsigned char *file;
+    unsigned char *fitted;
+
+    file = buffer_writer(savegame, options, size);
+    if (!file) {
+        return NULL;
+    }
+
+    /* The measured size is an upper bound if the body was compressed. */
+    fitted = cegse_realloc(savegame->priv->ctx, file, *size ? *size : 1);
+
+    return fitted ? fitted : file;
+}
+
+int cengine_savefile_write_sink(const struct savefile_sink *sink,
+                                const struct savegame *savegame,
+                                const struct savefile_write_options *options)
+{
+    unsigned char *file;
+    size_t file_size;
+    int rc;
+
+    /*
+     * The sizes in the file header come before the compressed body, so the
+     * file is put together in memory before any of it is handed out.
+     */
+    file = buffer_writer(savegame, options, &file_size);
+    if (!file) {
+        return -1;
+    }
+
+    rc = sink->write(sink->opaque, file, file_size) == 0 ? 0 : -1;
+    cegse_free(savegame->priv->ctx, file);
+
+    return rc;
+}
+
+/* The opaque pointer of a sink that writes to a file descriptor. */
+struct fd_sink {
+    const struct cegse_ctx *ctx;
+    int fd;
+};
+
+static int fd_sink_write(void *opaque, const void *data, size_t size)
+{
+    const struct fd_sink *sink = opaque;
+    const unsigned char *p = data;
+    ssize_t n;
+
+    while (size > 0) {
+        n = write(sink->fd, p, size);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            LOG_ERRNO(sink->ctx, "write");
+            return -1;
+        }
+
+        p += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+int cengine_savefile_write_fd(int fd, const struct savegame *savegame,
+                              const struct savefile_write_options *options)
+{
+    struct fd_sink fd_sink = { .ctx = savegame->priv->ctx, .fd = fd };
+    struct savefile_sink sink = { .write = fd_sink_write, .opaque = &fd_sink };
+
+    return cengine_savefile_write_sink(&sink, savegame, options);
+}
+
+static struct savegame *savegame_alloc(const struct cegse_ctx *ctx,
+                                       unsigned flags)
+{
+    struct arena *arena = NULL;
+    struct savegame *save;
+    struct psavegame *priv;
+
+    if (flags & SAVEFILE_ARENA) {
+        arena = arena_create(ctx, SAVEGAME_ARENA_BLOCK_SIZE);
+        if (!arena) {
+            return NULL;
+        }
+
+        save = arena_alloc(arena, sizeof(*save));
+        priv = arena_alloc(arena, sizeof(*priv));
+
+        if (!save || !priv) {
+            arena_destroy(arena);
+            return NULL;
+        }
+
+        memset(save, 0, sizeof(*save));
+        memset(priv, 0, sizeof(*priv));
+    }
+    else {
+        save = cegse_calloc(ctx, 1, sizeof(*save));
+        priv = cegse_calloc(ctx, 1, sizeof(*priv));
+
+        if (!save || !priv) {
+            cegse_free(ctx, priv);
+            cegse_free(ctx, save);
+            return NULL;
+        }
+    }
+
+    priv->ctx = ctx;
+    priv->arena = arena;
+    priv->sections = SAVEFILE_ALL_SECTIONS;
+    priv->view_global_data = flags & SAVEFILE_VIEW_GLOBAL_DATA;
+    save->priv = priv;
+
+    return save;
+}
+
+/*
+ * Release the buffers the savegame keeps for data to point into.
+ */
+static void release_retained_buffers(struct psavegame *priv)
+{
+    cegse_free(priv->ctx, priv->body);
+
+    if (priv->file) {
+        release_file(priv->ctx, priv->file, priv->file_size,
+                     priv->file_owner);
+    }
+}
+
+void savegame_free(struct savegame *save)
+{
+    struct psavegame *private = save->priv;
+    const struct cegse_ctx *ctx = private->ctx;
+    unsigned i;
+
+    /* Never allocated from the arena. */
+    savegame_change_forms_changed(save);
+
+#if defined(COMPILE_WITH_UNIT_TESTS)
+    for (i = 0; i < ARRAY_LEN(private->file_objects); ++i) {
+        cegse_free(private->ctx, private->file_objects[i]);
+    }
+#endif
+
+    if (private->arena) {
+        /* The savegame itself lives in the arena too. */
+        release_retained_buffers(private);
+        arena_destroy(private->arena);
+        return;
+    }
+
+    save_free(save, save->player_name);
+    save_free(save, save->player_location_name);
+    save_free(save, save->game_time);
+    save_free(save, save->race_id);
+    save_free(save, save->snapshot_data);
+    save_free(save, save->game_version);
+
+    if (save->plugins) {
+        for (i = 0u; i < save->num_plugins; ++i) {
+            save_free(save, save->plugins[i]);
+        }
+
+        save_free(save, save->plugins);
+    }
+
+    if (save->light_plugins) {
+        for (i = 0u; i < save->num_light_plugins; ++i) {
+            save_free(save, save->light_plugins[i]);
+        }
+
+        save_free(save, save->light_plugins);
+    }
+
+    if (save->misc_stats) {
+        for (i = 0; i < save->num_misc_stats; ++i) {
+            save_free(save, save->misc_stats[i].name);
+        }
+
+        save_free(save, save->misc_stats);
+    }
+
+    save_free(save, save->global_vars);
+    free_view(save, save->weather.data4);
+    save_free(save, save->favourites);
+    save_free(save, save->hotkeys);
+    save_free(save, save->form_ids);
+    save_free(save, save->world_spaces);
+
+    for (i = 0; i < ARRAY_LEN(private->globals); ++i) {
+        free_view(save, private->globals[i]);
+    }
+
+    if (private->change_forms) {
+        for (i = 0; i < private->n_change_forms; ++i) {
+            if (!savegame_retains(private, private->change_forms[i].data)) {
+                save_free(save, private->change_forms[i].data);
+            }
+        }
+
+        save_free(save, private->change_forms);
+    }
+
+    free_view(save, private->unknown3);
+    save_free(save, private->compressed_body);
+    release_retained_buffers(private);
+
+    cegse_free(ctx, private);
+    cegse_free(ctx, save);
+}
+
+#if defined(COMPILE_WITH_UNIT_TESTS)
+
+#define TEST_SUITE(TEST_CASE)                                                  \
+    TEST_CASE(vsval_encoding)                                                  \
+    TEST_CASE(vsval_decoding)                                                  \
+    TEST_CASE(serialize_deserialized_objects_test)                             \
+    TEST_CASE(read_and_write_sample_files_back_identically)                    \
+    TEST_CASE(measured_sizes_match_written_sizes)                              \
+    TEST_CASE(change_form_views_write_back_identically)                        \
+    TEST_CASE(global_data_views_write_back_identically)                        \
+    TEST_CASE(arena_savegames_write_back_identically)                          \
+    TEST_CASE(header_only_read_matches_full_read)                              \
+    TEST_CASE(selected_sections_match_full_read)                               \
+    TEST_CASE(compress_options_write_equivalent_saves)                         \
+    TEST_CASE(unchanged_compressed_body_is_copied)                             \
+    TEST_CASE(streamed_bodies_write_back_identically)                          \
+    TEST_CASE(change_form_lookup_matches_scan)                                 \
+    TEST_CASE(change_form_columns_match_change_forms)                          \
+    TEST_CASE(memory_and_fd_reads_write_back_identically)                      \
+    TEST_CASE(memory_sink_and_fd_writes_match_sample_files)                    \
+    TEST_CASE(distinct_contexts_work_on_threads_at_once)                       \
+    TEST_CASE(sidecar_reads_write_back_identically)                            \
+    TEST_CASE(scan_index_matches_full_read)                                    \
+    TEST_CASE(threaded_reads_match_serial_reads)
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "unit_tests.h"
+
+/* Logs to stderr. */
+static const struct cegse_ctx test_ctx = {
+    .logger = { .log = cegse_log_to_file, .error = cegse_log_to_file },
+};
+
+/* Initialize cursor referred to by C for a new scope. */
+#define with_cursor                                                            \
+    for (struct {                                                              \
+             int i;                                                            \
+             struct cursor c;                                                  \
+    } _i = { .c = { buffer, BUF_SIZE } };                                 \
+         _i.i < 1; _i.i++)
+
+/* Reference to cursor. */
+#define C (&_i.c)
+
+/* Cursor pos offset from buffer. */
+#define OFFSET (C->pos - buffer)
+
+UNIT_TEST(vsval_encoding)
+{
+    enum {
+        BUF_SIZE = 8
+    };
+    unsigned char buffer[BUF_SIZE];
+
+    /* Encode values that result in 1 byte encoded.. */
+    with_cursor
+    {
+        ASSERT_EQ(CG_OK, encode_vsval(C, 0));
+        ASSERT_EQ(1, OFFSET);
+        ASSERT_EQ(buffer[0], 0);
+    }
+
+    with_cursor
+    {
+        ASSERT_EQ(CG_OK, encode_vsval(C, 1));
+        ASSERT_EQ(1, OFFSET);
+        ASSERT_EQ(buffer[0], 0x4);
+    }
+
+    with_cursor
+    {
+        ASSERT_EQ(CG_OK, encode_vsval(C, 0x3f));
+        ASSERT_EQ(1, OFFSET);
+        ASSERT_EQ(buffer[0], 0xfc);
+    }
+
+    /* 2 byte length result. */
+    with_cursor
+    {
+        ASSERT_EQ(CG_OK, encode_vsval(C, 0x40));
+        ASSERT_EQ(2, OFFSET);
+        ASSERT_EQ(buffer[0], 0x1);
+        ASSERT_EQ(buffer[1], 0x1);
+    }
+
+    /* 3 byte length result. */
+    with_cursor
+    {
+        ASSERT_EQ(CG_OK, encode_vsval(C, 0x4000));
+        ASSERT_EQ(3, OFFSET);
+        ASSERT_EQ(buffer[0], 0x2);
+        ASSERT_EQ(buffer[1], 0x0);
+        ASSERT_EQ(buffer[2], 0x1);
+    }
+
+    /* Maximum value */
+    with_cursor
+    {
+        ASSERT_EQ(CG_OK, encode_vsval(C, VSVAL_MAX));
+        ASSERT_EQ(3, OFFSET);
+        ASSERT_EQ(buffer[0], 0xfe);
+        ASSERT_EQ(buffer[1], 0xff);
+        ASSERT_EQ(buffer[2], 0xff);
+    }
+
+    /* One past maximum value */
+    with_cursor
+    {
+        ASSERT_EQ(CG_INVAL, encode_vsval(C, VSVAL_MAX + 1));
+        ASSERT_EQ(0, OFFSET);
+    }
+
+    /* Negative integer. */
+    with_cursor
+    {
+        ASSERT_EQ(CG_INVAL, encode_vsval(C, -1));
+        ASSERT_EQ(0, OFFSET);
+    }
+
+    /* Buffer overflow testing. */
+    with_cursor
+    {
+        c_advance(C, BUF_SIZE);
+
+        ASSERT_EQ(CG_OK, encode_vsval(C, 1));
+        ASSERT_EQ(-1, C->n);
+
+        ASSERT_EQ(CG_OK, encode_vsval(C, 0x4000));
+        ASSERT_EQ(-4, C->n);
+    }
+}
+
+UNIT_TEST(vsval_decoding)
+{
+    enum {
+        BUF_SIZE = 16
+    };
+    unsigned char buffer[BUF_SIZE] = {
+        0x0,              /* 0x0 */
+        0x4,              /* 0x1 */
+        0xfc,             /* 0x3f */
+        0x2,  0x0,  0x1,  /* 0x4000 */
+        0xfe, 0xff, 0xff, /* VSVAL_MAX */
+        0xff              /* corrupt */
+    };
+    uint32_t result;
 
-            slot = &save->priv->globals[object_type - FIRST_OBJECT_GLDA];
+    with_cursor
+    {
+        ASSERT_EQ(CG_OK, decode_vsval(C, &result));
+        ASSERT_EQ(0x0, result);
+        ASSERT_EQ(OFFSET, 1);
 
-            if (*slot != NULL) {
-                eprintf("encountered multiple global data of type %u\n",
-                        object_type);
-                err = CG_CORRUPT;
-                break;
-            }
+        ASSERT_EQ(CG_OK, decode_vsval(C, &result));
+        ASSERT_EQ(0x1, result);
+        ASSERT_EQ(OFFSET, 2);
 
-            err = alloc_and_read_chunk(cursor, slot, cursor->n);
-            break;
-        }
+        ASSERT_EQ(CG_OK, decode_vsval(C, &result));
+        ASSERT_EQ(0x3f, result);
+        ASSERT_EQ(OFFSET, 3);
 
-    default:
-        break;
-    }
+        ASSERT_EQ(CG_OK, decode_vsval(C, &result));
+        ASSERT_EQ(0x4000, result);
+        ASSERT_EQ(OFFSET, 6);
 
-    if (cursor->n < 0) {
-        /* Bug or corrupt. */
-        DEBUG_LOG("CG_EOF while deserializing object type %u. "
-                  "cursor->n = %lld\n",
-                  object_type, cursor->n);
-        return CG_EOF;
-    }
+        ASSERT_EQ(CG_OK, decode_vsval(C, &result));
+        ASSERT_EQ(VSVAL_MAX, result);
+        ASSERT_EQ(OFFSET, 9);
 
-    return err;
+        ASSERT_EQ(CG_CORRUPT, decode_vsval(C, &result));
+        ASSERT_EQ(OFFSET, 10);
+    }
 }
 
-static void prepare_block(struct block *block, struct cursor *cursor)
-{
-    unsigned header_size = block_header_size(block);
-    block->buffer = cursor->pos + header_size;
-    block->buffer_size = cursor->n - header_size;
-}
+#undef with_cursor
+#undef C
+#undef OFFSET
 
-static cg_err_t serializer(struct block *block, const struct savegame *save,
-                           enum object_type object_type)
+static void for_each_sample_file(void (*callback)(const char *filename))
 {
-    struct cursor *cursor =
-        &(struct cursor){ block->buffer, block->buffer_size };
-    cg_err_t err = CG_OK;
+    struct dirent *dirent;
+    DIR *samples;
 
-    switch (object_type) {
-    case OBJECT_FILE_HEADER:
-        c_store_le32(cursor, save->priv->file_version);
-        c_store_le32(cursor, save->save_num);
-        c_store_le16_str(cursor, save->player_name);
-        c_store_le32(cursor, save->level);
-        c_store_le16_str(cursor, save->player_location_name);
-        c_store_le16_str(cursor, save->game_time);
-        c_store_le16_str(cursor, save->race_id);
-        c_store_le16(cursor, save->sex);
-        c_store_lef32(cursor, save->current_xp);
-        c_store_lef32(cursor, save->target_xp);
-        c_store_le64(cursor, save->filetime);
-        c_store_le32(cursor, save->snapshot_width);
-        c_store_le32(cursor, save->snapshot_height);
-        if (supports_save_file_compression(save)) {
-            c_store_le16(cursor, save->priv->compressor);
-        }
-        break;
+    samples = opendir("../samples");
+    ASSERT_NOT_NULL(samples);
 
-    case OBJECT_PLUGIN_INFO:
-        c_store_u8(cursor, save->num_plugins);
-        for (uint32_t i = 0; i < save->num_plugins; ++i) {
-            c_store_le16_str(cursor, save->plugins[i]);
-        }
+    while ((dirent = readdir(samples)) != NULL) {
+        char sample_filename[512];
 
-        if (supports_light_plugins(save)) {
-            c_store_le16(cursor, save->num_light_plugins);
-            for (uint32_t i = 0; i < save->num_light_plugins; ++i) {
-                c_store_le16_str(cursor, save->light_plugins[i]);
-            }
+        if (dirent->d_type != DT_REG) {
+            continue;
         }
-        break;
 
-    case OBJECT_GLDA_MISC_STATS:
-        c_store_le32(cursor, save->num_misc_stats);
-        for (uint32_t i = 0u; i < save->num_misc_stats; ++i) {
-            c_store_le16_str(cursor, save->misc_stats[i].name);
-            c_store_u8(cursor, save->misc_stats[i].category);
-            c_store_le32(cursor, save->misc_stats[i].value);
-        }
-        break;
+        sprintf(sample_filename, "../samples/%s", dirent->d_name);
 
-    case OBJECT_GLDA_PLAYER_LOCATION:
-        c_store_le32(cursor, save->player_location.next_object_id);
-        c_store_be24(cursor, save->player_location.world_space1);
-        c_store_le32(cursor, save->player_location.coord_x);
-        c_store_le32(cursor, save->player_location.coord_y);
-        c_store_be24(cursor, save->player_location.world_space2);
-        c_store_lef32(cursor, save->player_location.pos_x);
-        c_store_lef32(cursor, save->player_location.pos_y);
-        c_store_lef32(cursor, save->player_location.pos_z);
-        /* Present in Skyrim savefiles. */
-        c_store_u8(cursor, save->player_location.unknown);
-        break;
+        eprintf("sample file: %s\n", sample_filename);
+        callback(sample_filename);
+    }
 
-    case OBJECT_GLDA_GLOBAL_VARIABLES:
-        encode_vsval(cursor, save->num_global_vars);
-        for (uint32_t i = 0u; i < save->num_global_vars; ++i) {
-            c_store_be24(cursor, save->global_vars[i].form_id);
-            c_store_lef32(cursor, save->global_vars[i].value);
-        }
-        break;
+    closedir(samples);
+}
 
-    case OBJECT_GLDA_WEATHER:
-        c_store_be24(cursor, save->weather.climate);
-        c_store_be24(cursor, save->weather.weather);
-        c_store_be24(cursor, save->weather.prev_weather);
-        c_store_be24(cursor, save->weather.unk_weather1);
-        c_store_be24(cursor, save->weather.unk_weather2);
-        c_store_be24(cursor, save->weather.regn_weather);
-        c_store_lef32(cursor, save->weather.current_time);
-        c_store_lef32(cursor, save->weather.begin_time);
-        c_store_lef32(cursor, save->weather.weather_pct);
-        for (int i = 0; i < 6; ++i)
-            c_store_le32(cursor, save->weather.data1[i]);
-        c_store_lef32(cursor, save->weather.data2);
-        c_store_le32(cursor, save->weather.data3);
-        c_store_u8(cursor, save->weather.flags);
-        if (save->weather.data4)
-            c_store_bytes(cursor, save->weather.data4->data,
-                          save->weather.data4->size);
-        break;
+static void serialize_deserialized_objects(const char *sample_filename)
+{
+    unsigned char *sample_file;
+    size_t sample_file_size;
+    struct savegame *save;
+    cg_err_t err;
 
-    case OBJECT_GLDA_MAGIC_FAVORITES:
-        encode_vsval(cursor, save->num_favourites);
-        for (uint32_t i = 0u; i < save->num_favourites; ++i) {
-            c_store_be24(cursor, save->favourites[i]);
-        }
-        encode_vsval(cursor, save->num_hotkeys);
-        for (uint32_t i = 0u; i < save->num_hotkeys; ++i) {
-            c_store_be24(cursor, save->hotkeys[i]);
-        }
-        break;
+    enum {
+        BUFFER_SIZE = 8 * 1024 * 1024
+    };
+    static unsigned char buffer[BUFFER_SIZE];
 
-    case OBJECT_GLDA_GAME:
-    case OBJECT_GLDA_CREATED_OBJECTS:
-    case OBJECT_GLDA_EFFECTS:
-    case OBJECT_GLDA_AUDIO:
-    case OBJECT_GLDA_SKY_CELLS:
-    case OBJECT_GLDA_9:
-    case OBJECT_GLDA_10:
-    case OBJECT_GLDA_11:
-    case OBJECT_GLDA_PROCESS_LISTS:
-    case OBJECT_GLDA_COMBAT:
-    case OBJECT_GLDA_INTERFACE:
-    case OBJECT_GLDA_ACTOR_CAUSES:
-    case OBJECT_GLDA_104:
-    case OBJECT_GLDA_DETECTION_MANAGER:
-    case OBJECT_GLDA_LOCATION_METADATA:
-    case OBJECT_GLDA_QUEST_STATIC_DATA:
-    case OBJECT_GLDA_STORYTELLER:
-    case OBJECT_GLDA_PLAYER_CONTROLS:
-    case OBJECT_GLDA_STORY_EVENT_MANAGER:
-    case OBJECT_GLDA_INGREDIENT_SHARED:
-    case OBJECT_GLDA_MENU_CONTROLS:
-    case OBJECT_GLDA_MENU_TOPIC_MANAGER:
-    case OBJECT_GLDA_115:
-    case OBJECT_GLDA_116:
-    case OBJECT_GLDA_117:
-    case OBJECT_GLDA_TEMP_EFFECTS:
-    case OBJECT_GLDA_PAPYRUS:
-    case OBJECT_GLDA_ANIM_OBJECTS:
-    case OBJECT_GLDA_TIMER:
-    case OBJECT_GLDA_SYNCHRONISED_ANIMS:
-    case OBJECT_GLDA_MAIN:
-    case OBJECT_GLDA_1006:
-    case OBJECT_GLDA_1007:
-        {
-            /*
-             * Unknown global data structure.
-             */
-            struct chunk *chunk;
+    struct block block = {
+        .buffer = buffer,
+        .buffer_size = BUFFER_SIZE,
+    };
 
-            chunk = save->priv->globals[object_type - FIRST_OBJECT_GLDA];
+    sample_file = mmap_entire_file_r(sample_filename, &sample_file_size);
+    ASSERT_NE_PTR(sample_file, MAP_FAILED);
+    ASSERT_NOT_NULL(save = savegame_alloc(&test_ctx, 0));
 
-            if (chunk == NULL) {
-                err = CG_NOT_PRESENT;
-                break;
-            }
+    /* Read objects and copies of their blocks. */
+    ASSERT_EQ(CG_OK, file_reader(sample_file, sample_file_size, save,
+                                     &(struct savefile_read_options){ 0 }));
+    munmap(sample_file, sample_file_size);
 
-            c_store_bytes(cursor, chunk->data, chunk->size);
-            break;
-        }
-    default:
-        err = CG_NOT_PRESENT;
-        break;
-    }
+    for (int i = 0; i < OBJECT_TYPE_COUNT; ++i) {
+        ut_info("Serializing object %d\n", i);
 
-    if (cursor->n < 0) {
-        /* Buffer needs to grow by -cursor->n bytes. */
-        err = CG_EOF;
+        err = serializer(&block, save, i);
+        if (err == CG_NOT_PRESENT) {
+            continue;
+        }
+        ASSERT_EQ(err, CG_OK);
+        ASSERT_EQ_MEM(block.buffer, block.size,
+                      save->priv->file_objects[i]->data,
+                      save->priv->file_objects[i]->size);
     }
 
-    if (err) {
-        DEBUG_LOG("error %u at object type %u\n", err, object_type);
-        return err;
-    }
+    savegame_free(save);
+}
 
-    block->size = block->buffer_size - cursor->n;
-    block->uncompressed_size = 0;
-    return CG_OK;
+UNIT_TEST(serialize_deserialized_objects_test)
+{
+    for_each_sample_file(serialize_deserialized_objects);
 }
 
-__attribute__((unused)) static cg_err_t compressor(
-    struct block *block, void *buffer, size_t buffer_size,
-    enum compressor compressor_type)
+static void check_writer_produces_identical_file(const char *sample_filename)
 {
-    compress_fn_t compress;
-    ssize_t compress_size;
+    unsigned char *rewritten_file;
+    unsigned char *sample_file;
+    size_t rewritten_file_size;
+    size_t sample_file_size;
+    size_t body_size;
+    struct savegame *save;
+    cg_err_t err;
 
-    switch (compressor_type) {
-    case LZ4:
-        compress = lz4_compress;
-        break;
-    case ZLIB:
-        compress = zlib_compress;
-        break;
-    case NO_COMPRESSION:
-        return CG_INVAL;
-    }
+    sample_file = mmap_entire_file_r(sample_filename, &sample_file_size);
+    ASSERT_NE_PTR(sample_file, MAP_FAILED);
+    ASSERT_NOT_NULL(save = savegame_alloc(&test_ctx, 0));
 
-    compress_size =
-        compress(as_cregion(block), make_region(buffer, buffer_size));
-    if (compress_size == -1) {
-        /* Buffer too small? */
-        return CG_COMPRESS;
+    err = file_reader(sample_file, sample_file_size, save,
+                      &(struct savefile_read_options){ 0 });
+    ASSERT_EQ(err, CG_OK);
+
+    rewritten_file = malloc(sample_file_size);
+    ASSERT_NOT_NULL(rewritten_file);
+
+    ASSERT_EQ(CG_OK, measure_body(save, &body_size));
+    rewritten_file_size = sample_file_size;
+    ASSERT_EQ(CG_OK, file_writer(rewritten_file, &rewritten_file_size, save,
+                                 body_size,
+                                 &(struct savefile_write_options){ 0 }));
+
+    if (rewritten_file_size != sample_file_size) {
+        char dump_filename[512] = "./dump_rewritten_file";
+
+        eprintf("Unequal file lengths.\n"
+                "Dump file: %s\n"
+                "Original file: %s\n",
+                dump_filename, sample_filename);
+
+        dump_to_file(&test_ctx, dump_filename, rewritten_file,
+                     rewritten_file_size, 0);
     }
 
-    /* Update values. */
-    block->uncompressed_size = block->size;
-    block->size = compress_size;
-    block->buffer_size = buffer_size;
-    block->buffer = buffer;
+    ASSERT_EQ_MEM(sample_file, sample_file_size, rewritten_file,
+                  rewritten_file_size);
 
-    return CG_OK;
+    munmap(sample_file, sample_file_size);
+    free(rewritten_file);
+    savegame_free(save);
+}
+
+UNIT_TEST(read_and_write_sample_files_back_identically)
+{
+    for_each_sample_file(check_writer_produces_identical_file);
 }
 
-static void assembler(const struct block *block, struct cursor *cursor)
+static void check_measured_sizes(const char *sample_filename)
 {
-    struct block_change_form *cf;
+    unsigned char *rewritten_file;
+    unsigned char *sample_file;
+    size_t rewritten_file_size;
+    size_t sample_file_size;
+    size_t max_file_size;
+    size_t body_size;
+    struct savegame *save;
 
-    /* Cursor must be at the block header. */
-    assert(block->buffer - cursor->pos == block_header_size(block));
+    sample_file = mmap_entire_file_r(sample_filename, &sample_file_size);
+    ASSERT_NE_PTR(sample_file, MAP_FAILED);
+    ASSERT_NOT_NULL(save = savegame_alloc(&test_ctx, 0));
 
-    switch (block->block_type) {
-    case BLOCK_GLOBAL_DATA:
-        c_store_le32(cursor, ((struct block_global_data *)block)->type_num);
-        /* fallthrough */
-    case BLOCK_SIMPLE:
-        c_store_le32(cursor, block->size);
-        break;
+    ASSERT_EQ(CG_OK, file_reader(sample_file, sample_file_size, save,
+                                     &(struct savefile_read_options){ 0 }));
+    munmap(sample_file, sample_file_size);
 
-    case BLOCK_CHANGE_FORM:
-        cf = (struct block_change_form *)block;
-        c_store_be24(cursor, cf->form_id);
-        c_store_le32(cursor, cf->flags);
-        c_store_u8(cursor, cf->type_num);
-        c_store_u8(cursor, cf->version);
+    ASSERT_EQ(CG_OK, measure_body(save, &body_size));
+    ASSERT_EQ(CG_OK, measure_file(save, body_size,
+                                  &(struct savefile_write_options){ 0 },
+                                  &max_file_size));
 
-        /* Two upper bits of type determine the sizes of length1 and length2. */
-        switch ((cf->type_num >> 6) & 0x3) {
-        case 0:
-            c_store_u8(cursor, block->size);
-            c_store_u8(cursor, block->uncompressed_size);
-            break;
-        case 1:
-            c_store_le16(cursor, block->size);
-            c_store_le16(cursor, block->uncompressed_size);
-            break;
-        case 2:
-            c_store_le32(cursor, block->size);
-            c_store_le32(cursor, block->uncompressed_size);
-            break;
-        default:
-            BUG("Valid length types include uint8, uint16 and uint32.\n");
-        }
-        break;
+    rewritten_file = malloc(max_file_size);
+    ASSERT_NOT_NULL(rewritten_file);
+
+    rewritten_file_size = max_file_size;
+    ASSERT_EQ(CG_OK, file_writer(rewritten_file, &rewritten_file_size, save,
+                                 body_size,
+                                 &(struct savefile_write_options){ 0 }));
+    ASSERT_EQ(rewritten_file_size, sample_file_size);
+
+    if (!supports_save_file_compression(save) ||
+        save->priv->compressor == NO_COMPRESSION) {
+        /* Measurement is exact without compression. */
+        ASSERT_EQ(max_file_size, rewritten_file_size);
+    }
+    else {
+        /* The uncompressed body size precedes the compressed body. */
+        size_t head_size =
+            max_file_size - 8 -
+            compress_bound(save->priv->compressor, body_size, NULL);
+        ASSERT_EQ(load_le32(rewritten_file + head_size), body_size);
     }
 
-    assert(cursor->pos == block->buffer);
+    free(rewritten_file);
+    savegame_free(save);
+}
 
-    c_advance(cursor, block->size);
+UNIT_TEST(measured_sizes_match_written_sizes)
+{
+    for_each_sample_file(check_measured_sizes);
 }
 
-static cg_err_t file_writer(unsigned char *file, size_t *file_size_ptr,
-                            const struct savegame *save)
+/*
+ * Write the save into memory and check that it matches the sample file.
+ */
+static void assert_writes_back_identically(const struct savegame *save,
+                                           const char *sample_filename)
 {
-    struct location_table locations = { 0 };
-    struct chunk *buffers[1] = { 0 }; /* Buffers for compression. */
-    struct cursor file_cursor;        /* Cursor for additions to file. */
-    struct cursor body_cursor;        /* Cursor for additions to body. */
-    struct cursor *cursor;            /* The cursor being used. */
-    intptr_t offset_var =
-        (intptr_t)file;   /* Variable for file offset calculation. */
-    size_t max_file_size; /* Size of 'file' arg for bounds checking. */
-    unsigned char *ptr_to_locations; /* Points where to write location table. */
-    cg_err_t err = CG_OK;
+    unsigned char *rewritten_file;
+    unsigned char *sample_file;
+    size_t rewritten_file_size;
+    size_t sample_file_size;
+    size_t body_size;
 
-    max_file_size = *file_size_ptr;
-    file_cursor.pos = file;
-    file_cursor.n = max_file_size;
-    cursor = &file_cursor;
+    sample_file = mmap_entire_file_r(sample_filename, &sample_file_size);
+    ASSERT_NE_PTR(sample_file, MAP_FAILED);
 
-/* Calculates current file offset at cursor position. */
-#define OFFSET() ((uint32_t)((intptr_t)cursor->pos - offset_var))
+    rewritten_file = malloc(sample_file_size);
+    ASSERT_NOT_NULL(rewritten_file);
 
-    union {
-        struct block simple;
-        struct block_change_form chfo;
-        struct block_global_data glda;
-    } block_buf = { 0 };
-    struct block *block = &block_buf.simple;
+    ASSERT_EQ(CG_OK, measure_body(save, &body_size));
+    rewritten_file_size = sample_file_size;
+    ASSERT_EQ(CG_OK, file_writer(rewritten_file, &rewritten_file_size, save,
+                                 body_size,
+                                 &(struct savefile_write_options){ 0 }));
+    ASSERT_EQ_MEM(sample_file, sample_file_size, rewritten_file,
+                  rewritten_file_size);
 
-    /*
-     * Write signature.
-     */
-    {
-        const char *signature = NULL;
+    munmap(sample_file, sample_file_size);
+    free(rewritten_file);
+}
 
-        switch (save->game) {
-        case SKYRIM:
-            signature = TESV_SIGNATURE;
-            break;
-        case FALLOUT4:
-            signature = FO4_SIGNATURE;
-            break;
-        }
+static void check_change_form_views(const char *sample_filename)
+{
+    struct savefile_read_options options = {
+        .flags = SAVEFILE_VIEW_CHANGE_FORMS,
+    };
+    struct savegame *save;
 
-        c_store_bytes(cursor, signature, strlen(signature));
-    }
+    save = cengine_savefile_read(&test_ctx, sample_filename, &options);
+    ASSERT_NOT_NULL(save);
 
-    /*
-     * Write the file header.
-     */
-    block->block_type = BLOCK_SIMPLE;
-    prepare_block(block, cursor);
-    err = serializer(block, save, OBJECT_FILE_HEADER);
-    if (err) {
-        goto out_error;
+    /* Exactly one buffer is retained for the change forms to point into. */
+    ASSERT_TRUE(!save->priv->body != !save->priv->file);
+
+    for (unsigned i = 0; i < save->priv->n_change_forms; ++i) {
+        ASSERT_TRUE(
+            savegame_retains(save->priv, save->priv->change_forms[i].data));
     }
-    assembler(block, cursor);
 
-    /*
-     * Write snapshot.
-     */
-    c_store_bytes(cursor, save->snapshot_data, save->snapshot_size);
+    /* A copied out change form no longer points into the buffer. */
+    if (save->priv->n_change_forms > 0) {
+        struct change_form *cf = &save->priv->change_forms[0];
+        unsigned char *view = cf->data;
 
-    /* Initialize body cursor. */
-    if (supports_save_file_compression(save)) {
-        if (save->priv->compressor != NO_COMPRESSION) {
-            /*
-             * Compression required => need a buffer to write the body in.
-             * Allocate a buffer for the body and set the body cursor at
-             * the beginning of the buffer.
-             */
-            buffers[0] = chunk_alloc(128 * 1024 * 1024);
-            if (!buffers[0]) {
-                err = CG_NO_MEM;
-                goto out_error;
-            }
+        ASSERT_EQ(savegame_change_form_own_data(save, cf), 0);
+        ASSERT_FALSE(savegame_retains(save->priv, cf->data));
+        ASSERT_EQ_MEM(cf->data, cf->length1, view, cf->length1);
 
-            body_cursor.pos = buffers[0]->data;
-            body_cursor.n = buffers[0]->size;
-            offset_var = (intptr_t)body_cursor.pos - (file_cursor.pos - file);
-        }
-        else {
-            /*
-             * No compression required. We will directly write to file, but
-             * need to leave 8 bytes of space to store size information.
-             */
-            c_advance2(&body_cursor, &file_cursor, 8);
-            offset_var += 8;
+        /* The copy can be modified even if the view was read-only. */
+        if (cf->length1 > 0) {
+            cf->data[0] = view[0];
         }
-    }
-    else {
-        /*
-         * Game engine doesn't support compression for the save file.
-         * We will continue writing where we left off.
-         */
-        c_advance2(&body_cursor, &file_cursor, 0);
+
+        /* Owned data is left alone. */
+        view = cf->data;
+        ASSERT_EQ(savegame_change_form_own_data(save, cf), 0);
+        ASSERT_EQ_PTR(cf->data, view);
     }
 
-    cursor = &body_cursor;
+    assert_writes_back_identically(save, sample_filename);
+    savegame_free(save);
+}
 
-    c_store_u8(cursor, save->priv->form_version);
+UNIT_TEST(change_form_views_write_back_identically)
+{
+    for_each_sample_file(check_change_form_views);
+}
 
-    /*
-     * Write game version string.
-     */
-    if (save->game == FALLOUT4) {
-        c_store_le16_str(cursor, save->game_version);
-    }
+static void check_global_data_views(const char *sample_filename)
+{
+    struct savefile_read_options options = {
+        .flags = SAVEFILE_VIEW_GLOBAL_DATA,
+    };
+    struct savegame *save;
+    struct cregion papyrus;
+    struct cregion data4;
+    unsigned char *copy;
 
-    /*
-     * Write plugin info.
-     */
-    block->block_type = BLOCK_SIMPLE;
-    prepare_block(block, cursor);
-    err = serializer(block, save, OBJECT_PLUGIN_INFO);
-    if (err) {
-        goto out_error;
-    }
-    assembler(block, cursor);
+    save = cengine_savefile_read(&test_ctx, sample_filename, &options);
+    ASSERT_NOT_NULL(save);
+    ASSERT_TRUE(!save->priv->body != !save->priv->file);
 
-    /*
-     * Save pointer to file location table.
-     */
-    if (cursor->n < LOCATION_TABLE_SIZE) {
-        err = CG_EOF;
-        goto out_error;
+    /* Change forms are still copied. */
+    for (unsigned i = 0; i < save->priv->n_change_forms; ++i) {
+        ASSERT_FALSE(
+            savegame_retains(save->priv, save->priv->change_forms[i].data));
     }
-    ptr_to_locations = cursor->pos;
-    memset(ptr_to_locations, 0, LOCATION_TABLE_SIZE);
-    c_advance(cursor, LOCATION_TABLE_SIZE);
 
-    /*
-     * Write global data table 1.
-     */
-    locations.off_globals1 = OFFSET();
-    block->block_type = BLOCK_GLOBAL_DATA;
-    for (enum object_type i = FIRST_TABLE1_OBJECT_GLDA;
-         i < FIRST_TABLE2_OBJECT_GLDA; ++i) {
-        block_buf.glda.type_num = glda_type_number(i);
-        prepare_block(block, cursor);
-        err = serializer(block, save, i);
-        if (err && err != CG_NOT_PRESENT) {
-            goto out_error;
-        }
-        if (err != CG_NOT_PRESENT) {
-            assembler(block, cursor);
-            locations.num_globals1++;
-        }
+    ASSERT_TRUE(savegame_retains(save->priv, save->priv->unknown3.data));
+    if (save->weather.data4.size > 0) {
+        ASSERT_TRUE(savegame_retains(save->priv, save->weather.data4.data));
     }
-    err = CG_OK;
 
-    /*
-     * Write global data table 2.
-     */
-    locations.off_globals2 = OFFSET();
-    for (enum object_type i = FIRST_TABLE2_OBJECT_GLDA;
-         i < FIRST_TABLE3_OBJECT_GLDA; ++i) {
-        block_buf.glda.type_num = glda_type_number(i);
-        prepare_block(block, cursor);
-        err = serializer(block, save, i);
-        if (err && err != CG_NOT_PRESENT) {
-            goto out_error;
-        }
-        if (err != CG_NOT_PRESENT) {
-            assembler(block, cursor);
-            locations.num_globals2++;
-        }
+    papyrus = savegame_global_data(save, SECTION_GLDA_PAPYRUS);
+    ASSERT_NOT_NULL(papyrus.data);
+    ASSERT_TRUE(savegame_retains(save->priv, papyrus.data));
+    ASSERT_EQ_PTR(savegame_global_data(save, SECTION_GLDA_WEATHER).data,
+                  NULL);
+
+    /* Replacing a view copies the new data and leaves the old in place. */
+    ASSERT_NOT_NULL(copy = malloc(papyrus.size));
+    memcpy(copy, papyrus.data, papyrus.size);
+    ASSERT_EQ(savegame_replace_global_data(save, SECTION_GLDA_PAPYRUS, copy,
+                                           papyrus.size),
+              0);
+    ASSERT_FALSE(savegame_retains(
+        save->priv, savegame_global_data(save, SECTION_GLDA_PAPYRUS).data));
+    ASSERT_EQ_MEM(papyrus.data, papyrus.size, copy, papyrus.size);
+    ASSERT_EQ(savegame_replace_global_data(save, SECTION_GLDA_WEATHER, copy,
+                                           papyrus.size),
+              -1);
+    free(copy);
+
+    /* So does replacing weather.data4. */
+    data4 = save->weather.data4;
+    ASSERT_NOT_NULL(copy = malloc(data4.size ? data4.size : 1));
+    memcpy(copy, data4.data, data4.size);
+    ASSERT_EQ(savegame_replace_weather_data4(save, copy, data4.size), 0);
+    ASSERT_FALSE(savegame_retains(save->priv, save->weather.data4.data));
+    ASSERT_EQ_MEM(save->weather.data4.data, save->weather.data4.size, copy,
+                  data4.size);
+    free(copy);
+
+    assert_writes_back_identically(save, sample_filename);
+    savegame_free(save);
+}
+
+UNIT_TEST(global_data_views_write_back_identically)
+{
+    for_each_sample_file(check_global_data_views);
+}
+
+static void check_arena_savegame(const char *sample_filename)
+{
+    static const unsigned flag_sets[] = {
+        SAVEFILE_ARENA,
+        SAVEFILE_ARENA | SAVEFILE_VIEW_CHANGE_FORMS,
+        SAVEFILE_ARENA | SAVEFILE_VIEW_GLOBAL_DATA,
+    };
+
+    for (size_t i = 0; i < ARRAY_LEN(flag_sets); ++i) {
+        struct savefile_read_options options = { .flags = flag_sets[i] };
+        struct savegame *save;
+
+        save = cengine_savefile_read(&test_ctx, sample_filename, &options);
+        ASSERT_NOT_NULL(save);
+        ASSERT_NOT_NULL(save->priv->arena);
+
+        assert_writes_back_identically(save, sample_filename);
+        savegame_free(save);
     }
-    err = CG_OK;
+}
 
-    /*
-     * Write change forms.
-     */
-    locations.off_change_forms = OFFSET();
-    block->block_type = BLOCK_CHANGE_FORM;
-    for (unsigned i = 0; i < save->priv->n_change_forms; ++i) {
-        struct change_form *ptr = &save->priv->change_forms[i];
-        /* Already serialized and compressed. */
-        block_buf.chfo.flags = ptr->flags;
-        block_buf.chfo.form_id = ptr->form_id;
-        block_buf.chfo.version = ptr->version;
-        block_buf.chfo.type_num = ptr->type;
-        block->size = ptr->length1;
-        block->uncompressed_size = ptr->length2;
+UNIT_TEST(arena_savegames_write_back_identically)
+{
+    for_each_sample_file(check_arena_savegame);
+}
 
-        prepare_block(block, cursor);
-        memcpy(block->buffer, ptr->data, block->size);
-        assembler(block, cursor);
+static void check_header_only_read(const char *sample_filename)
+{
+    unsigned char *sample_file;
+    size_t sample_file_size;
+    struct savegame *header;
+    struct savegame *save;
+    size_t file_size = 0;
+
+    save = cengine_savefile_read(&test_ctx, sample_filename, NULL);
+    ASSERT_NOT_NULL(save);
 
-        locations.num_change_forms++;
-    }
+    sample_file = mmap_entire_file_r(sample_filename, &sample_file_size);
+    ASSERT_NE_PTR(sample_file, MAP_FAILED);
 
-    /*
-     * Write global data table 3.
-     */
-    locations.off_globals3 = OFFSET();
-    block->block_type = BLOCK_GLOBAL_DATA;
-    for (enum object_type i = FIRST_TABLE3_OBJECT_GLDA; i <= LAST_OBJECT_GLDA;
-         ++i) {
-        block_buf.glda.type_num = glda_type_number(i);
-        prepare_block(block, cursor);
-        err = serializer(block, save, i);
-        if (err && err != CG_NOT_PRESENT) {
-            goto out_error;
+    for (int with_plugins = 0; with_plugins <= 1; ++with_plugins) {
+        header = cengine_savefile_read_header(&test_ctx, sample_filename,
+                                              with_plugins);
+        ASSERT_NOT_NULL(header);
+
+        ASSERT_EQ(header->game, save->game);
+        ASSERT_EQ(header->save_num, save->save_num);
+        ASSERT_EQ(strcmp(header->player_name, save->player_name), 0);
+        ASSERT_EQ(header->level, save->level);
+        ASSERT_EQ(
+            strcmp(header->player_location_name, save->player_location_name),
+            0);
+        ASSERT_EQ(strcmp(header->game_time, save->game_time), 0);
+        ASSERT_EQ(header->filetime, save->filetime);
+        ASSERT_EQ(header->snapshot_size, save->snapshot_size);
+        ASSERT_EQ_PTR(header->snapshot_data, NULL);
+        ASSERT_EQ_PTR(header->priv->unknown3.data, NULL);
+
+        /* The snapshot is found in the file without reading it. */
+        ASSERT_EQ(savegame_snapshot_offset(header),
+                  savegame_snapshot_offset(save));
+        ASSERT_LE(savegame_snapshot_offset(header) + header->snapshot_size,
+                  sample_file_size);
+        ASSERT_EQ(memcmp(sample_file + savegame_snapshot_offset(header),
+                         save->snapshot_data, save->snapshot_size),
+                  0);
+
+        if (with_plugins) {
+            ASSERT_EQ(header->num_plugins, save->num_plugins);
+            for (unsigned i = 0; i < save->num_plugins; ++i) {
+                ASSERT_EQ(strcmp(header->plugins[i], save->plugins[i]), 0);
+            }
+
+            ASSERT_EQ(header->num_light_plugins, save->num_light_plugins);
+            for (unsigned i = 0; i < save->num_light_plugins; ++i) {
+                ASSERT_EQ(
+                    strcmp(header->light_plugins[i], save->light_plugins[i]),
+                    0);
+            }
         }
-        if (err != CG_NOT_PRESENT) {
-            assembler(block, cursor);
-            locations.num_globals3++;
+        else {
+            ASSERT_EQ_PTR(header->plugins, NULL);
         }
+
+        /* Writing what was not read must fail. */
+        ASSERT_EQ(CG_INVAL,
+                  file_writer(NULL, &file_size, header, 0,
+                              &(struct savefile_write_options){ 0 }));
+
+        savegame_free(header);
     }
-    err = CG_OK;
 
-    /*
-     * Write form IDs.
-     */
-    locations.off_form_ids_count = OFFSET();
-    c_store_le32(cursor, save->num_form_ids);
-    for (uint32_t i = 0; i < save->num_form_ids; ++i) {
-        c_store_le32(cursor, save->form_ids[i]);
+    munmap(sample_file, sample_file_size);
+    savegame_free(save);
+}
+
+UNIT_TEST(header_only_read_matches_full_read)
+{
+    for_each_sample_file(check_header_only_read);
+}
+
+static void check_selected_sections(const char *sample_filename)
+{
+    struct savefile_read_options options = {
+        .sections = SAVEFILE_SECTION(SECTION_GLDA_MISC_STATS) |
+                    SAVEFILE_SECTION(SECTION_GLDA_GLOBAL_VARIABLES),
+    };
+    struct savegame *partial;
+    struct savegame *save;
+    size_t file_size = 0;
+
+    save = cengine_savefile_read(&test_ctx, sample_filename, NULL);
+    ASSERT_NOT_NULL(save);
+    partial = cengine_savefile_read(&test_ctx, sample_filename, &options);
+    ASSERT_NOT_NULL(partial);
+
+    ASSERT_EQ(partial->save_num, save->save_num);
+    ASSERT_EQ(partial->num_misc_stats, save->num_misc_stats);
+    for (unsigned i = 0; i < save->num_misc_stats; ++i) {
+        ASSERT_EQ(strcmp(partial->misc_stats[i].name, save->misc_stats[i].name),
+                  0);
+        ASSERT_EQ(partial->misc_stats[i].value, save->misc_stats[i].value);
     }
 
-    /*
-     * Write world spaces.
-     */
-    c_store_le32(cursor, save->num_world_spaces);
-    for (uint32_t i = 0; i < save->num_world_spaces; ++i) {
-        c_store_le32(cursor, save->world_spaces[i]);
+    ASSERT_EQ(partial->num_global_vars, save->num_global_vars);
+    ASSERT_EQ_MEM(partial->global_vars,
+                  partial->num_global_vars * sizeof(*partial->global_vars),
+                  save->global_vars,
+                  save->num_global_vars * sizeof(*save->global_vars));
+
+    /* Nothing else is loaded. */
+    ASSERT_EQ_PTR(partial->snapshot_data, NULL);
+    ASSERT_EQ_PTR(partial->plugins, NULL);
+    ASSERT_EQ(partial->weather.data4.size, 0);
+    ASSERT_EQ(savegame_replace_weather_data4(partial, "", 0), -1);
+    ASSERT_EQ_PTR(partial->priv->change_forms, NULL);
+    ASSERT_EQ(partial->priv->n_change_forms, 0);
+    ASSERT_EQ_PTR(partial->form_ids, NULL);
+    ASSERT_EQ_PTR(partial->priv->unknown3.data, NULL);
+    for (unsigned i = 0; i < OBJECT_GLDA_TYPE_COUNT; ++i) {
+        ASSERT_EQ_PTR(partial->priv->globals[i].data, NULL);
     }
 
-    /*
-     * Write unknown table.
-     */
-    locations.off_unknown_table = OFFSET();
-    c_store_le32(cursor, save->priv->unknown3->size);
-    c_store_bytes(cursor, save->priv->unknown3->data,
-                  save->priv->unknown3->size);
+    ASSERT_EQ(CG_INVAL, file_writer(NULL, &file_size, partial, 0,
+                                    &(struct savefile_write_options){ 0 }));
 
-    if (cursor->n < 0) {
-        err = CG_EOF;
-        goto out_error;
-    }
+    savegame_free(partial);
+    savegame_free(save);
+}
 
-    /*
-     * Write locations table.
-     */
-    store_le32(&ptr_to_locations[0], locations.off_form_ids_count);
-    store_le32(&ptr_to_locations[4], locations.off_unknown_table);
-    store_le32(&ptr_to_locations[8], locations.off_globals1);
-    store_le32(&ptr_to_locations[12], locations.off_globals2);
-    store_le32(&ptr_to_locations[16], locations.off_change_forms);
-    store_le32(&ptr_to_locations[20], locations.off_globals3);
-    store_le32(&ptr_to_locations[24], locations.num_globals1);
-    store_le32(&ptr_to_locations[28], locations.num_globals2);
-    /* Subtract by 1: Skyrim doesn't acknowledge the last global data. */
-    store_le32(&ptr_to_locations[32], locations.num_globals3 - 1);
-    store_le32(&ptr_to_locations[36], locations.num_change_forms);
-    print_locations_table(&locations);
+UNIT_TEST(selected_sections_match_full_read)
+{
+    for_each_sample_file(check_selected_sections);
+}
 
-    /*
-     * Compress body into the file, if necessary.
-     */
-    cursor = &file_cursor;
+static void check_compress_options(const char *sample_filename)
+{
+    static const struct savefile_write_options option_sets[] = {
+        { .compression = { .acceleration = 4 } },
+        { .compression = { .level = 9 } },
+        { .compression = { .level = 1, .threads = 2 } },
+    };
+    struct savegame *save;
 
-    if (supports_save_file_compression(save)) {
-        ssize_t uncompress_size = buffers[0]->size - body_cursor.n;
-        ssize_t compress_size = 0;
+    save = cengine_savefile_read(&test_ctx, sample_filename, NULL);
+    ASSERT_NOT_NULL(save);
 
-        struct cregion src = make_cregion(buffers[0]->data, uncompress_size);
-        struct region dest = make_region(cursor->pos + 8, cursor->n - 8);
+    for (size_t i = 0; i < ARRAY_LEN(option_sets); ++i) {
+        const struct savefile_write_options *options = &option_sets[i];
+        unsigned char *file;
+        struct savegame *reread;
+        size_t max_file_size;
+        size_t body_size;
+        size_t file_size;
 
-        switch (save->priv->compressor) {
-        case LZ4:
-            compress_size = lz4_compress(src, dest);
-            break;
-        case ZLIB:
-            compress_size = zlib_compress(src, dest);
-            break;
-        case NO_COMPRESSION:
-            /* Not sure about this, but needed to correctly advance cursor. */
-            compress_size = uncompress_size;
-            break;
+        if (save->priv->compressor == LZ4 && options->compression.threads) {
+            /* Only zlib compresses on threads. */
+            continue;
         }
 
-        if (compress_size == -1) {
-            err = CG_COMPRESS;
-            goto out_error;
-        }
+        ASSERT_EQ(CG_OK, measure_body(save, &body_size));
+        ASSERT_EQ(CG_OK,
+                  measure_file(save, body_size, options, &max_file_size));
+        ASSERT_NOT_NULL(file = malloc(max_file_size));
 
-        c_store_le32(cursor, uncompress_size);
-        c_store_le32(cursor, compress_size);
-        c_advance(cursor, compress_size);
-    }
-    else {
-        c_advance2(&file_cursor, &body_cursor, 0);
+        file_size = max_file_size;
+        ASSERT_EQ(CG_OK,
+                  file_writer(file, &file_size, save, body_size, options));
+
+        /* Compressed differently, the save is still the same. */
+        ASSERT_NOT_NULL(reread = savegame_alloc(&test_ctx, 0));
+        ASSERT_EQ(CG_OK, file_reader(file, file_size, reread,
+                                     &(struct savefile_read_options){ 0 }));
+        assert_writes_back_identically(reread, sample_filename);
+
+        savegame_free(reread);
+        free(file);
     }
 
-    /* File is now written, give the size to the caller. */
-    *file_size_ptr = max_file_size - file_cursor.n;
+    savegame_free(save);
+}
 
-out_error:
-    for (size_t i = 0; i < ARRAY_LEN(buffers); ++i) {
-        free(buffers[i]);
+UNIT_TEST(compress_options_write_equivalent_saves)
+{
+    for_each_sample_file(check_compress_options);
+}
+
+/*
+ * Write the save into a new buffer with the given options.
+ */
+static unsigned char *
+write_to_memory(const struct savegame *save,
+                const struct savefile_write_options *options, size_t *file_size)
+{
+    unsigned char *file;
+    size_t body_size;
+
+    ASSERT_EQ(CG_OK, measure_body(save, &body_size));
+    ASSERT_EQ(CG_OK, measure_file(save, body_size, options, file_size));
+    ASSERT_NOT_NULL(file = malloc(*file_size));
+    ASSERT_EQ(CG_OK, file_writer(file, file_size, save, body_size, options));
+
+    return file;
+}
+
+static void check_compressed_body_reuse(const char *sample_filename)
+{
+    struct savefile_write_options options = { .compression.level = 9 };
+    struct savefile_read_options read_options = {
+        .flags = SAVEFILE_KEEP_COMPRESSED_BODY,
+    };
+    unsigned char *original;
+    unsigned char *rewritten;
+    size_t original_size;
+    size_t rewritten_size;
+    struct savegame *save;
+    float value;
+
+    save = cengine_savefile_read(&test_ctx, sample_filename, NULL);
+    ASSERT_NOT_NULL(save);
+    if (!supports_save_file_compression(save) ||
+        save->priv->compressor == NO_COMPRESSION) {
+        savegame_free(save);
+        return;
     }
-    return err;
-#undef OFFSET
+
+    /* Compress unlike the default so that a copy can be told apart. */
+    original = write_to_memory(save, &options, &original_size);
+    savegame_free(save);
+
+    ASSERT_NOT_NULL(save = savegame_alloc(&test_ctx, 0));
+    ASSERT_EQ(CG_OK,
+              file_reader(original, original_size, save, &read_options));
+    ASSERT_NOT_NULL(save->priv->compressed_body);
+
+    /* Unchanged, the compressed save data is copied as it was. */
+    rewritten = write_to_memory(save, &(struct savefile_write_options){ 0 },
+                                &rewritten_size);
+    ASSERT_EQ_MEM(rewritten, rewritten_size, original, original_size);
+    free(rewritten);
+
+    /* So it is after a file header edit. */
+    save->save_num += 1;
+    rewritten = write_to_memory(save, &(struct savefile_write_options){ 0 },
+                                &rewritten_size);
+    ASSERT_EQ(rewritten_size, original_size);
+    ASSERT_EQ(load_le32(rewritten + strlen(TESV_SIGNATURE) + 8),
+              save->save_num);
+    ASSERT_EQ_MEM(rewritten + original_size / 2, original_size / 2,
+                  original + original_size / 2, original_size / 2);
+    free(rewritten);
+
+    /* An edit of the save data has it compressed again. */
+    ASSERT_TRUE(save->num_global_vars > 0);
+    save->global_vars[0].value += 1.0f;
+    value = save->global_vars[0].value;
+    rewritten = write_to_memory(save, &(struct savefile_write_options){ 0 },
+                                &rewritten_size);
+    savegame_free(save);
+
+    ASSERT_NOT_NULL(save = savegame_alloc(&test_ctx, 0));
+    ASSERT_EQ(CG_OK,
+              file_reader(rewritten, rewritten_size, save, &read_options));
+    ASSERT_TRUE(save->global_vars[0].value == value);
+    free(rewritten);
+    savegame_free(save);
+    free(original);
 }
 
-int cengine_savefile_write(const char *filename,
-                           const struct savegame *savegame)
+UNIT_TEST(unchanged_compressed_body_is_copied)
 {
-    size_t max_file_size;
-    size_t file_size;
-    cg_err_t err;
-    void *file;
-    int fd;
+    for_each_sample_file(check_compressed_body_reuse);
+}
 
-    /* savegame should have been initialized correctly. */
-    assert(savegame->priv != NULL);
+static void check_streamed_body(const char *sample_filename)
+{
+    static const unsigned flag_sets[] = {
+        SAVEFILE_STREAM_BODY,
+        SAVEFILE_STREAM_BODY | SAVEFILE_VIEW_CHANGE_FORMS,
+        SAVEFILE_STREAM_BODY | SAVEFILE_ARENA,
+        SAVEFILE_STREAM_BODY | SAVEFILE_KEEP_COMPRESSED_BODY,
+    };
+    struct savefile_read_options options = {
+        .flags = SAVEFILE_KEEP_COMPRESSED_BODY,
+    };
+    struct savegame *partial;
+    struct savegame *save;
 
-    fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, 0644);
-    if (fd == -1) {
-        perror("open");
-        return -1;
+    save = cengine_savefile_read(&test_ctx, sample_filename, &options);
+    ASSERT_NOT_NULL(save);
+
+    for (size_t i = 0; i < ARRAY_LEN(flag_sets); ++i) {
+        struct savegame *streamed;
+
+        options.flags = flag_sets[i];
+        streamed = cengine_savefile_read(&test_ctx, sample_filename, &options);
+        ASSERT_NOT_NULL(streamed);
+
+        if (streamed->priv->compressed_body) {
+            ASSERT_EQ(streamed->priv->body_size, save->priv->body_size);
+            ASSERT_EQ(streamed->priv->body_hash, save->priv->body_hash);
+        }
+
+        assert_writes_back_identically(streamed, sample_filename);
+        savegame_free(streamed);
     }
 
-    max_file_size = 128 * 1024 * 1024; /* 128 MiB limit. */
-    if (ftruncate(fd, max_file_size) == -1) {
-        perror("ftruncate");
-        close(fd);
-        return -1;
+    /* Reading may stop before all of the body is decompressed. */
+    options.flags = SAVEFILE_STREAM_BODY;
+    options.sections = SAVEFILE_SECTION(SECTION_GLDA_MISC_STATS);
+    partial = cengine_savefile_read(&test_ctx, sample_filename, &options);
+    ASSERT_NOT_NULL(partial);
+    ASSERT_EQ(partial->num_misc_stats, save->num_misc_stats);
+    ASSERT_EQ_PTR(partial->priv->change_forms, NULL);
+
+    savegame_free(partial);
+    savegame_free(save);
+}
+
+UNIT_TEST(streamed_bodies_write_back_identically)
+{
+    for_each_sample_file(check_streamed_body);
+}
+
+static struct change_form *scan_change_forms(struct savegame *save,
+                                             ref_t form_id, int type)
+{
+    for (unsigned i = 0; i < save->priv->n_change_forms; ++i) {
+        struct change_form *cf = &save->priv->change_forms[i];
+
+        if (cf->form_id == form_id &&
+            (type == -1 || (int)(cf->type & 0x3f) == type)) {
+            return cf;
+        }
     }
 
-    file = mmap(NULL, max_file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (file == MAP_FAILED) {
-        perror("mmap");
-        close(fd);
-        return -1;
+    return NULL;
+}
+
+static void check_change_form_lookup(const char *sample_filename)
+{
+    struct change_form *cf;
+    struct savegame *save;
+    ref_t unused = 0xffffff;
+
+    save = cengine_savefile_read(&test_ctx, sample_filename, NULL);
+    ASSERT_NOT_NULL(save);
+
+    for (unsigned i = 0; i < save->priv->n_change_forms; ++i) {
+        cf = &save->priv->change_forms[i];
+
+        ASSERT_EQ_PTR(savegame_find_change_form(save, cf->form_id),
+                      scan_change_forms(save, cf->form_id, -1));
+        ASSERT_EQ_PTR(
+            savegame_find_change_form_of_type(save, cf->type, cf->form_id),
+            scan_change_forms(save, cf->form_id, cf->type & 0x3f));
+        ASSERT_EQ_PTR(savegame_find_change_form_of_type(
+                          save, (cf->type + 1) & 0x3f, cf->form_id),
+                      scan_change_forms(save, cf->form_id,
+                                        (cf->type + 1) & 0x3f));
     }
 
-    if (close(fd) == -1) {
-        perror("close");
+    while (scan_change_forms(save, unused, -1)) {
+        unused--;
     }
 
-    file_size = max_file_size;
-    err = file_writer(file, &file_size, savegame);
+    ASSERT_EQ_PTR(savegame_find_change_form(save, unused), NULL);
 
-    if (munmap(file, max_file_size) == -1) {
-        perror("munmap");
+    /* A modified form ID is found after telling about it. */
+    if (save->priv->n_change_forms > 0) {
+        cf = &save->priv->change_forms[save->priv->n_change_forms - 1];
+        cf->form_id = unused;
+        savegame_change_forms_changed(save);
+        ASSERT_EQ_PTR(savegame_find_change_form(save, unused), cf);
     }
 
-    if (truncate(filename, file_size) == -1) {
-        perror("truncate");
-    }
+    savegame_free(save);
+}
 
-    return err == CG_OK ? 0 : -1;
+UNIT_TEST(change_form_lookup_matches_scan)
+{
+    for_each_sample_file(check_change_form_lookup);
 }
 
-static struct savegame *savegame_alloc(void)
+static void check_change_form_columns(const char *sample_filename)
 {
+    const struct change_form_columns *columns;
+    struct change_form_query query;
+    uint32_t counts[64];
+    uint32_t *indices;
+    uint32_t *matches;
+    uint32_t flags = 0;
+    uint32_t total = 0;
     struct savegame *save;
-    struct psavegame *priv;
+    ssize_t n;
+    ssize_t m;
+
+    save = cengine_savefile_read(&test_ctx, sample_filename, NULL);
+    ASSERT_NOT_NULL(save);
+    ASSERT_NOT_NULL(columns = savegame_change_form_columns(save));
+    ASSERT_EQ(columns->count, save->priv->n_change_forms);
+    ASSERT_NOT_NULL(indices = malloc((columns->count + 1) * sizeof(*indices)));
+    ASSERT_NOT_NULL(matches = malloc((columns->count + 1) * sizeof(*matches)));
+
+    for (uint32_t i = 0; i < columns->count; ++i) {
+        const struct change_form *cf = savegame_change_form(save, i);
+
+        ASSERT_EQ(columns->form_id[i], cf->form_id);
+        ASSERT_EQ(columns->flags[i], cf->flags);
+        ASSERT_EQ(columns->type[i], cf->type & 0x3f);
+        ASSERT_EQ(columns->version[i], cf->version);
+        ASSERT_EQ(columns->length1[i], cf->length1);
+        ASSERT_EQ(columns->length2[i], cf->length2);
+    }
 
-    save = calloc(1, sizeof(*save));
-    priv = calloc(1, sizeof(*priv));
+    ASSERT_EQ_PTR(savegame_change_form(save, columns->count), NULL);
 
-    if (!save || !priv) {
-        free(priv);
-        free(save);
-        return NULL;
+    if (columns->count > 0) {
+        flags = columns->flags[0] & 0x0000ffff;
     }
 
-    save->priv = priv;
+    ASSERT_EQ(0, savegame_count_change_form_types(save, counts));
+    for (unsigned type = 0; type < 64; ++type) {
+        n = savegame_change_forms_of_type(save, type, indices);
+        ASSERT_EQ(n, counts[type]);
+        total += counts[type];
 
-    return save;
+        for (ssize_t i = 0; i < n; ++i) {
+            ASSERT_EQ(columns->type[indices[i]], type);
+            ASSERT_TRUE(i == 0 || indices[i - 1] < indices[i]);
+        }
+
+        /* Narrowing down by flags matches filtering by both. */
+        m = savegame_keep_change_forms_with_flags(save, flags, indices, n);
+        ASSERT_TRUE(m >= 0 && m <= n);
+        for (uint32_t i = 0, j = 0; i < columns->count; ++i) {
+            if (columns->type[i] == type &&
+                (columns->flags[i] & flags) == flags) {
+                ASSERT_TRUE(j < (uint32_t)m);
+                ASSERT_EQ(indices[j++], i);
+            }
+        }
+
+        /* So does a query. */
+        query.types = CHANGE_FORM_TYPE(type);
+        query.flags_mask = flags;
+        query.flags_value = flags;
+        ASSERT_EQ(m, savegame_query_change_form_indices(save, &query,
+                                                        matches));
+        ASSERT_EQ_MEM(indices, m * sizeof(*indices), matches,
+                      m * sizeof(*matches));
+    }
+
+    ASSERT_EQ(total, columns->count);
+
+    /*
+     * Indices that are not of change forms are refused, and the indices are
+     * left as they were.
+     */
+    if (columns->count >= 2) {
+        uint32_t bad[] = { 1, 0, columns->count };
+
+        ASSERT_EQ(savegame_keep_change_forms_with_flags(save, UINT32_MAX, bad,
+                                                        ARRAY_LEN(bad)),
+                  -1);
+        ASSERT_EQ(bad[0], 1);
+        ASSERT_EQ(bad[1], 0);
+        ASSERT_EQ(bad[2], columns->count);
+    }
+
+    n = savegame_change_forms_with_flags(save, flags, indices);
+    for (ssize_t i = 0; i < n; ++i) {
+        ASSERT_EQ(columns->flags[indices[i]] & flags, flags);
+    }
+
+    /* Actors whose life state changed. */
+    query = (struct change_form_query){
+        .types = CHANGE_FORM_TYPE(CHANGE_ACHR),
+        .flags_mask = CHANGE_ACTOR_LIFESTATE,
+        .flags_value = CHANGE_ACTOR_LIFESTATE,
+    };
+    n = savegame_query_change_form_indices(save, &query, matches);
+    ASSERT_TRUE(n >= 0);
+    for (ssize_t i = 0; i < n; ++i) {
+        ASSERT_EQ(columns->type[matches[i]], CHANGE_ACHR);
+        ASSERT_NE(columns->flags[matches[i]] & CHANGE_ACTOR_LIFESTATE, 0);
+    }
+
+    /* The columns are rebuilt after a change. */
+    if (columns->count > 0) {
+        save->priv->change_forms[0].type ^= 1;
+        savegame_change_forms_changed(save);
+        ASSERT_NOT_NULL(columns = savegame_change_form_columns(save));
+        ASSERT_EQ(columns->type[0], save->priv->change_forms[0].type & 0x3f);
+    }
+
+    free(matches);
+    free(indices);
+    savegame_free(save);
 }
 
-void savegame_free(struct savegame *save)
+UNIT_TEST(change_form_columns_match_change_forms)
 {
-    struct psavegame *private = save->priv;
-    unsigned i;
+    for_each_sample_file(check_change_form_columns);
+}
 
-    free(save->player_name);
-    free(save->player_location_name);
-    free(save->game_time);
-    free(save->race_id);
-    free(save->snapshot_data);
-    free(save->game_version);
+/* Write a sample file to a pipe from a child process. */
+static pid_t pipe_sample_file(const void *sample_file, size_t size, int *fd)
+{
+    int fds[2];
+    pid_t pid;
 
-    if (save->plugins) {
-        for (i = 0u; i < save->num_plugins; ++i) {
-            free(save->plugins[i]);
-        }
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_NE(pid = fork(), -1);
 
-        free(save->plugins);
-    }
+    if (pid == 0) {
+        const unsigned char *p = sample_file;
+        ssize_t n;
 
-    if (save->light_plugins) {
-        for (i = 0u; i < save->num_light_plugins; ++i) {
-            free(save->light_plugins[i]);
+        close(fds[0]);
+        while (size > 0 && (n = write(fds[1], p, size)) > 0) {
+            p += n;
+            size -= n;
         }
+        _exit(size == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    *fd = fds[0];
+    return pid;
+}
+
+/* Junk before the save file in the file read from an offset. */
+#define TEST_FD_OFFSET 5000
+
+static void check_memory_and_fd_reads(const char *sample_filename)
+{
+    struct savefile_read_options options = {
+        .flags = SAVEFILE_VIEW_CHANGE_FORMS | SAVEFILE_VIEW_GLOBAL_DATA,
+    };
+    struct savegame *save;
+    FILE *tmp;
+    unsigned char *sample_file;
+    size_t sample_file_size;
+    int status;
+    pid_t pid;
+    int fd;
+
+    sample_file = mmap_entire_file_r(sample_filename, &sample_file_size);
+    ASSERT_NE_PTR(sample_file, MAP_FAILED);
 
-        free(save->light_plugins);
+    /* Memory */
+    save = cengine_savefile_read_mem(&test_ctx, sample_file,
+                                     sample_file_size, &options);
+    ASSERT_NOT_NULL(save);
+    if (save->priv->file) {
+        ASSERT_EQ_PTR(save->priv->file, sample_file);
+        ASSERT_EQ(save->priv->file_owner, FILE_BORROWED);
     }
+    assert_writes_back_identically(save, sample_filename);
+    savegame_free(save);
 
-    if (save->misc_stats) {
-        for (i = 0; i < save->num_misc_stats; ++i) {
-            free(save->misc_stats[i].name);
-        }
+    /* Regular file */
+    ASSERT_NE(fd = open(sample_filename, O_RDONLY), -1);
+    ASSERT_NOT_NULL(save = cengine_savefile_read_fd(&test_ctx, fd, &options));
+    close(fd);
+    assert_writes_back_identically(save, sample_filename);
+    savegame_free(save);
 
-        free(save->misc_stats);
+    /* Regular file read from an offset that is not at a page boundary */
+    ASSERT_NOT_NULL(tmp = tmpfile());
+    fd = fileno(tmp);
+    ASSERT_EQ(ftruncate(fd, TEST_FD_OFFSET), 0);
+    ASSERT_EQ(pwrite(fd, sample_file, sample_file_size, TEST_FD_OFFSET),
+              (ssize_t)sample_file_size);
+    ASSERT_EQ(lseek(fd, TEST_FD_OFFSET, SEEK_SET), TEST_FD_OFFSET);
+    ASSERT_NOT_NULL(save = cengine_savefile_read_fd(&test_ctx, fd, &options));
+    ASSERT_EQ(lseek(fd, 0, SEEK_CUR),
+              (off_t)(TEST_FD_OFFSET + sample_file_size));
+    fclose(tmp);
+    assert_writes_back_identically(save, sample_filename);
+    savegame_free(save);
+
+    /* Pipe */
+    pid = pipe_sample_file(sample_file, sample_file_size, &fd);
+    ASSERT_NOT_NULL(save = cengine_savefile_read_fd(&test_ctx, fd, &options));
+    close(fd);
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    if (save->priv->file) {
+        ASSERT_EQ(save->priv->file_owner, FILE_ALLOCATED);
     }
+    assert_writes_back_identically(save, sample_filename);
+    savegame_free(save);
 
-    free(save->global_vars);
-    free(save->weather.data4);
-    free(save->favourites);
-    free(save->hotkeys);
-    free(save->form_ids);
-    free(save->world_spaces);
+    munmap(sample_file, sample_file_size);
+}
+
+UNIT_TEST(memory_and_fd_reads_write_back_identically)
+{
+    for_each_sample_file(check_memory_and_fd_reads);
+}
 
-    for (i = 0; i < ARRAY_LEN(private->globals); ++i) {
-        free(private->globals[i]);
-    }
+/* A sink that appends to a buffer, or fails if the buffer is NULL. */
+struct buffer_sink {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+};
 
-    if (private->change_forms) {
-        for (i = 0; i < private->n_change_forms; ++i) {
-            free(private->change_forms[i].data);
-        }
+static int buffer_sink_write(void *opaque, const void *data, size_t size)
+{
+    struct buffer_sink *buffer = opaque;
 
-        free(private->change_forms);
+    if (!buffer->data || buffer->capacity - buffer->size < size) {
+        return -1;
     }
 
-    free(private->unknown3);
-    free(private);
-    free(save);
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return 0;
 }
 
-#if defined(COMPILE_WITH_UNIT_TESTS)
-
-#define TEST_SUITE(TEST_CASE)                                                  \
-    TEST_CASE(vsval_encoding)                                                  \
-    TEST_CASE(vsval_decoding)                                                  \
-    TEST_CASE(serialize_deserialized_objects_test)                             \
-    TEST_CASE(read_and_write_sample_files_back_identically)
+static void check_memory_sink_and_fd_writes(const char *sample_filename)
+{
+    struct buffer_sink buffer = { 0 };
+    struct savefile_sink sink = { buffer_sink_write, &buffer };
+    unsigned char *sample_file;
+    size_t sample_file_size;
+    struct savegame *save;
+    unsigned char *file;
+    size_t file_size;
+    FILE *tmp;
 
-#include <dirent.h>
-#include "unit_tests.h"
+    sample_file = mmap_entire_file_r(sample_filename, &sample_file_size);
+    ASSERT_NE_PTR(sample_file, MAP_FAILED);
+    save = cengine_savefile_read(&test_ctx, sample_filename, NULL);
+    ASSERT_NOT_NULL(save);
+
+    /* Memory */
+    ASSERT_NOT_NULL(file = cengine_savefile_write_mem(save, NULL, &file_size));
+    ASSERT_EQ_MEM(file, file_size, sample_file, sample_file_size);
+    free(file);
+
+    /* Sink */
+    ASSERT_EQ(cengine_savefile_write_sink(&sink, save, NULL), -1);
+    buffer.capacity = sample_file_size;
+    ASSERT_NOT_NULL(buffer.data = malloc(buffer.capacity));
+    ASSERT_EQ(cengine_savefile_write_sink(&sink, save, NULL), 0);
+    ASSERT_EQ_MEM(buffer.data, buffer.size, sample_file, sample_file_size);
+    free(buffer.data);
+
+    /* File descriptor */
+    ASSERT_NOT_NULL(tmp = tmpfile());
+    ASSERT_EQ(cengine_savefile_write_fd(fileno(tmp), save, NULL), 0);
+    ASSERT_EQ(lseek(fileno(tmp), 0, SEEK_CUR), (off_t)sample_file_size);
+    ASSERT_NOT_NULL(file = malloc(sample_file_size));
+    ASSERT_EQ(pread(fileno(tmp), file, sample_file_size, 0),
+              (ssize_t)sample_file_size);
+    ASSERT_EQ_MEM(file, sample_file_size, sample_file, sample_file_size);
+    free(file);
+    fclose(tmp);
 
-/* Initialize cursor referred to by C for a new scope. */
-#define with_cursor                                                            \
-    for (struct {                                                              \
-             int i;                                                            \
-             struct cursor c;                                                  \
-    } _i = { .c = { buffer, BUF_SIZE } };                                 \
-         _i.i < 1; _i.i++)
+    savegame_free(save);
+    munmap(sample_file, sample_file_size);
+}
 
-/* Reference to cursor. */
-#define C (&_i.c)
+UNIT_TEST(memory_sink_and_fd_writes_match_sample_files)
+{
+    for_each_sample_file(check_memory_sink_and_fd_writes);
+}
 
-/* Cursor pos offset from buffer. */
-#define OFFSET (C->pos - buffer)
+/* Context of a thread that counts what it is used for. */
+struct counting_ctx {
+    struct cegse_ctx ctx;
+    const char *sample_filename;
+    unsigned long allocations;
+    long live_allocations;
+    unsigned long log_messages;
+};
 
-UNIT_TEST(vsval_encoding)
+static void *counting_malloc(void *opaque, size_t size)
 {
-    enum {
-        BUF_SIZE = 8
-    };
-    unsigned char buffer[BUF_SIZE];
+    struct counting_ctx *counting = opaque;
+    void *ptr = malloc(size);
 
-    /* Encode values that result in 1 byte encoded.. */
-    with_cursor
-    {
-        ASSERT_EQ(CG_OK, encode_vsval(C, 0));
-        ASSERT_EQ(1, OFFSET);
-        ASSERT_EQ(buffer[0], 0);
+    if (ptr) {
+        counting->allocations++;
+        counting->live_allocations++;
     }
 
-    with_cursor
-    {
-        ASSERT_EQ(CG_OK, encode_vsval(C, 1));
-        ASSERT_EQ(1, OFFSET);
-        ASSERT_EQ(buffer[0], 0x4);
-    }
+    return ptr;
+}
 
-    with_cursor
-    {
-        ASSERT_EQ(CG_OK, encode_vsval(C, 0x3f));
-        ASSERT_EQ(1, OFFSET);
-        ASSERT_EQ(buffer[0], 0xfc);
-    }
+static void *counting_realloc(void *opaque, void *ptr, size_t size)
+{
+    struct counting_ctx *counting = opaque;
+    void *new_ptr = realloc(ptr, size);
 
-    /* 2 byte length result. */
-    with_cursor
-    {
-        ASSERT_EQ(CG_OK, encode_vsval(C, 0x40));
-        ASSERT_EQ(2, OFFSET);
-        ASSERT_EQ(buffer[0], 0x1);
-        ASSERT_EQ(buffer[1], 0x1);
+    if (new_ptr && !ptr) {
+        counting->allocations++;
+        counting->live_allocations++;
     }
 
-    /* 3 byte length result. */
-    with_cursor
-    {
-        ASSERT_EQ(CG_OK, encode_vsval(C, 0x4000));
-        ASSERT_EQ(3, OFFSET);
-        ASSERT_EQ(buffer[0], 0x2);
-        ASSERT_EQ(buffer[1], 0x0);
-        ASSERT_EQ(buffer[2], 0x1);
-    }
+    return new_ptr;
+}
 
-    /* Maximum value */
-    with_cursor
-    {
-        ASSERT_EQ(CG_OK, encode_vsval(C, VSVAL_MAX));
-        ASSERT_EQ(3, OFFSET);
-        ASSERT_EQ(buffer[0], 0xfe);
-        ASSERT_EQ(buffer[1], 0xff);
-        ASSERT_EQ(buffer[2], 0xff);
-    }
+static void counting_free(void *opaque, void *ptr)
+{
+    struct counting_ctx *counting = opaque;
 
-    /* One past maximum value */
-    with_cursor
-    {
-        ASSERT_EQ(CG_INVAL, encode_vsval(C, VSVAL_MAX + 1));
-        ASSERT_EQ(0, OFFSET);
+    if (ptr) {
+        counting->live_allocations--;
     }
 
-    /* Negative integer. */
-    with_cursor
-    {
-        ASSERT_EQ(CG_INVAL, encode_vsval(C, -1));
-        ASSERT_EQ(0, OFFSET);
-    }
+    free(ptr);
+}
 
-    /* Buffer overflow testing. */
-    with_cursor
-    {
-        c_advance(C, BUF_SIZE);
+static void counting_log(void *opaque, const char *message)
+{
+    struct counting_ctx *counting = opaque;
 
-        ASSERT_EQ(CG_OK, encode_vsval(C, 1));
-        ASSERT_EQ(-1, C->n);
+    (void)message;
+    counting->log_messages++;
+}
 
-        ASSERT_EQ(CG_OK, encode_vsval(C, 0x4000));
-        ASSERT_EQ(-4, C->n);
+static void *read_and_write_with_ctx(void *arg)
+{
+    struct counting_ctx *counting = arg;
+    struct savegame *save;
+    void *file;
+    size_t file_size;
+
+    save = cengine_savefile_read(&counting->ctx, counting->sample_filename,
+                                 NULL);
+    if (save) {
+        file = cengine_savefile_write_mem(save, NULL, &file_size);
+        cegse_free(&counting->ctx, file);
+        savegame_free(save);
     }
+
+    return save ? counting : NULL;
 }
 
-UNIT_TEST(vsval_decoding)
+static void check_distinct_contexts(const char *sample_filename)
 {
-    enum {
-        BUF_SIZE = 16
+    static const unsigned flag_sets[] = {
+        0,
+        SAVEFILE_VIEW_GLOBAL_DATA | SAVEFILE_STREAM_BODY,
+        SAVEFILE_ARENA,
+        SAVEFILE_ARENA | SAVEFILE_VIEW_CHANGE_FORMS,
     };
-    unsigned char buffer[BUF_SIZE] = {
-        0x0,              /* 0x0 */
-        0x4,              /* 0x1 */
-        0xfc,             /* 0x3f */
-        0x2,  0x0,  0x1,  /* 0x4000 */
-        0xfe, 0xff, 0xff, /* VSVAL_MAX */
-        0xff              /* corrupt */
+    enum {
+        THREADS = ARRAY_LEN(flag_sets)
     };
-    uint32_t result;
-
-    with_cursor
-    {
-        ASSERT_EQ(CG_OK, decode_vsval(C, &result));
-        ASSERT_EQ(0x0, result);
-        ASSERT_EQ(OFFSET, 1);
-
-        ASSERT_EQ(CG_OK, decode_vsval(C, &result));
-        ASSERT_EQ(0x1, result);
-        ASSERT_EQ(OFFSET, 2);
-
-        ASSERT_EQ(CG_OK, decode_vsval(C, &result));
-        ASSERT_EQ(0x3f, result);
-        ASSERT_EQ(OFFSET, 3);
-
-        ASSERT_EQ(CG_OK, decode_vsval(C, &result));
-        ASSERT_EQ(0x4000, result);
-        ASSERT_EQ(OFFSET, 6);
+    struct counting_ctx contexts[THREADS];
+    pthread_t threads[THREADS];
+    void *result;
+
+    for (int i = 0; i < THREADS; ++i) {
+        contexts[i] = (struct counting_ctx){
+            .ctx = {
+                .logger = { .log = counting_log,
+                            .error = counting_log,
+                            .opaque = &contexts[i] },
+                .allocator = { counting_malloc, counting_realloc,
+                               counting_free, &contexts[i] },
+                .read_options.flags = flag_sets[i],
+            },
+            .sample_filename = sample_filename,
+        };
+
+        ASSERT_EQ(pthread_create(&threads[i], NULL, read_and_write_with_ctx,
+                                 &contexts[i]),
+                  0);
+    }
 
-        ASSERT_EQ(CG_OK, decode_vsval(C, &result));
-        ASSERT_EQ(VSVAL_MAX, result);
-        ASSERT_EQ(OFFSET, 9);
+    for (int i = 0; i < THREADS; ++i) {
+        ASSERT_EQ(pthread_join(threads[i], &result), 0);
+        ASSERT_NOT_NULL(result);
 
-        ASSERT_EQ(CG_CORRUPT, decode_vsval(C, &result));
-        ASSERT_EQ(OFFSET, 10);
+        /* Everything was logged and allocated through the context. */
+        ASSERT_NE(contexts[i].log_messages, 0);
+        ASSERT_NE(contexts[i].allocations, 0);
+        ASSERT_EQ(contexts[i].live_allocations, 0);
     }
 }
 
-#undef with_cursor
-#undef C
-#undef OFFSET
-
-static void for_each_sample_file(void (*callback)(const char *filename))
+UNIT_TEST(distinct_contexts_work_on_threads_at_once)
 {
-    struct dirent *dirent;
-    DIR *samples;
+    for_each_sample_file(check_distinct_contexts);
+}
 
-    samples = opendir("../samples");
-    ASSERT_NOT_NULL(samples);
+#define TEST_SIDECAR_FILENAME "test_sidecar"
 
-    while ((dirent = readdir(samples)) != NULL) {
-        char sample_filename[512];
+static void check_sidecar_reads(const char *sample_filename)
+{
+    struct savefile_read_options view_options = {
+        .flags = SAVEFILE_VIEW_CHANGE_FORMS | SAVEFILE_VIEW_GLOBAL_DATA,
+    };
+    struct savefile_read_options copy_options = { 0 };
+    struct stat written;
+    struct stat statbuf;
+    struct savegame *save;
 
-        if (dirent->d_type != DT_REG) {
-            continue;
+    /*
+     * The sidecar left by the previous sample file is stale, so the first
+     * read writes it again and the reads after it only map it.
+     */
+    for (int i = 0; i < 3; ++i) {
+        save = cengine_savefile_read_sidecar(&test_ctx, sample_filename,
+                                             TEST_SIDECAR_FILENAME,
+                                             i < 2 ? &view_options
+                                                   : &copy_options);
+        ASSERT_NOT_NULL(save);
+
+        ASSERT_EQ(stat(TEST_SIDECAR_FILENAME, &statbuf), 0);
+        if (i == 0) {
+            written = statbuf;
+        }
+        ASSERT_EQ(statbuf.st_ino, written.st_ino);
+        ASSERT_EQ(statbuf.st_mtim.tv_nsec, written.st_mtim.tv_nsec);
+
+        /* Views point into the mapped sidecar. */
+        ASSERT_EQ_PTR(save->priv->body, NULL);
+        for (unsigned j = 0; j < save->priv->n_change_forms; ++j) {
+            ASSERT_EQ(savegame_retains(save->priv,
+                                       save->priv->change_forms[j].data),
+                      i < 2);
         }
 
-        sprintf(sample_filename, "../samples/%s", dirent->d_name);
-
-        eprintf("sample file: %s\n", sample_filename);
-        callback(sample_filename);
+        assert_writes_back_identically(save, sample_filename);
+        savegame_free(save);
     }
+}
 
-    closedir(samples);
+UNIT_TEST(sidecar_reads_write_back_identically)
+{
+    for_each_sample_file(check_sidecar_reads);
+    remove(TEST_SIDECAR_FILENAME);
 }
 
-static void serialize_deserialized_objects(const char *sample_filename)
+static void check_scan_index(const char *sample_filename)
 {
-    unsigned char *sample_file;
-    size_t sample_file_size;
+    const struct savefile_block_index *index;
+    const struct savefile_block *blocks;
+    struct savefile_scan scan;
     struct savegame *save;
-    cg_err_t err;
-
-    enum {
-        BUFFER_SIZE = 8 * 1024 * 1024
-    };
-    static unsigned char buffer[BUFFER_SIZE];
-
-    struct block block = {
-        .buffer = buffer,
-        .buffer_size = BUFFER_SIZE,
-    };
+    size_t sample_file_size;
+    void *sample_file;
+    uint32_t count;
 
+    save = cengine_savefile_read(&test_ctx, sample_filename, NULL);
+    ASSERT_NOT_NULL(save);
     sample_file = mmap_entire_file_r(sample_filename, &sample_file_size);
     ASSERT_NE_PTR(sample_file, MAP_FAILED);
-    ASSERT_NOT_NULL(save = savegame_alloc());
 
-    /* Read objects into unit_test_file_objects. */
-    ASSERT_EQ(CG_OK, file_reader(sample_file, sample_file_size, save));
-    munmap(sample_file, sample_file_size);
+    ASSERT_EQ(cengine_savefile_scan(&test_ctx, sample_file, sample_file_size,
+                                    &scan),
+              0);
 
-    for (int i = 0; i < OBJECT_TYPE_COUNT; ++i) {
-        ut_info("Serializing object %d\n", i);
+    index = &scan.index;
+    blocks = index->blocks + index->num_globals12;
+    count = index->num_globals12 + index->num_change_forms +
+            index->num_globals3;
+    ASSERT_LE(index->end_offset, scan.body_size);
+    ASSERT_EQ(index->num_change_forms, save->priv->n_change_forms);
 
-        err = serializer(&block, save, i);
-        if (err == CG_NOT_PRESENT) {
-            continue;
-        }
-        ASSERT_EQ(err, CG_OK);
-        ASSERT_EQ_MEM(block.buffer, block.size, unit_test_file_objects[i]->data,
-                      unit_test_file_objects[i]->size);
+    for (uint32_t i = 0; i < count; ++i) {
+        ASSERT_LE(index->blocks[i].offset + index->blocks[i].size,
+                  index->end_offset);
     }
 
-    for (int i = 0; i < OBJECT_TYPE_COUNT; ++i) {
-        free(unit_test_file_objects[i]);
-        unit_test_file_objects[i] = NULL;
+    for (uint32_t i = 0; i < index->num_change_forms; ++i) {
+        const struct change_form *cf = &save->priv->change_forms[i];
+
+        ASSERT_EQ(blocks[i].form_id, cf->form_id);
+        ASSERT_EQ(blocks[i].flags, cf->flags);
+        ASSERT_EQ(blocks[i].type, cf->type);
+        ASSERT_EQ(blocks[i].version, cf->version);
+        ASSERT_EQ(blocks[i].size, cf->length1);
+        ASSERT_EQ(blocks[i].uncompressed_size, cf->length2);
+        ASSERT_EQ_MEM(scan.body + blocks[i].offset, blocks[i].size, cf->data,
+                      cf->length1);
+    }
+
+    /* Global data blocks are all of known types. */
+    for (uint32_t i = 0; i < count; ++i) {
+        if (i - index->num_globals12 >= index->num_change_forms) {
+            ASSERT_NE(object_type_from_glda_type_number(index->blocks[i].type),
+                      -1);
+        }
     }
 
+    savefile_scan_free(&scan);
+    ASSERT_EQ_PTR(scan.index.blocks, NULL);
     savegame_free(save);
+    munmap(sample_file, sample_file_size);
 }
 
-UNIT_TEST(serialize_deserialized_objects_test)
+UNIT_TEST(scan_index_matches_full_read)
 {
-    debug_log_file = stderr;
-    for_each_sample_file(serialize_deserialized_objects);
+    for_each_sample_file(check_scan_index);
 }
 
-static void check_writer_produces_identical_file(const char *sample_filename)
+static void assert_same_blocks(const struct savegame *a,
+                               const struct savegame *b)
 {
-    unsigned char *rewritten_file;
-    unsigned char *sample_file;
-    size_t rewritten_file_size;
-    size_t sample_file_size;
-    struct savegame *save;
-    cg_err_t err;
-
-    sample_file = mmap_entire_file_r(sample_filename, &sample_file_size);
-    ASSERT_NE_PTR(sample_file, MAP_FAILED);
-    ASSERT_NOT_NULL(save = savegame_alloc());
-
-    err = file_reader(sample_file, sample_file_size, save);
-    ASSERT_EQ(err, CG_OK);
+    ASSERT_EQ(a->priv->n_change_forms, b->priv->n_change_forms);
+    for (unsigned i = 0; i < a->priv->n_change_forms; ++i) {
+        const struct change_form *x = &a->priv->change_forms[i];
+        const struct change_form *y = &b->priv->change_forms[i];
+
+        ASSERT_EQ(x->form_id, y->form_id);
+        ASSERT_EQ(x->flags, y->flags);
+        ASSERT_EQ(x->type, y->type);
+        ASSERT_EQ(x->version, y->version);
+        ASSERT_EQ(x->length2, y->length2);
+        ASSERT_EQ_MEM(x->data, x->length1, y->data, y->length1);
+    }
 
-    rewritten_file = malloc(sample_file_size);
-    ASSERT_NOT_NULL(rewritten_file);
+    for (int section = SECTION_GLDA_MISC_STATS; section <= SECTION_GLDA_1007;
+         ++section) {
+        struct cregion x = savegame_global_data(a, section);
+        struct cregion y = savegame_global_data(b, section);
 
-    rewritten_file_size = sample_file_size;
-    ASSERT_EQ(CG_OK, file_writer(rewritten_file, &rewritten_file_size, save));
+        ASSERT_EQ(x.data == NULL, y.data == NULL);
+        ASSERT_EQ_MEM(x.data, x.size, y.data, y.size);
+    }
 
-    if (rewritten_file_size != sample_file_size) {
-        char dump_filename[512] = "./dump_rewritten_file";
+    ASSERT_EQ(a->num_misc_stats, b->num_misc_stats);
+    ASSERT_EQ(a->num_global_vars, b->num_global_vars);
+    ASSERT_EQ(a->num_favourites, b->num_favourites);
+    ASSERT_EQ(a->weather.climate, b->weather.climate);
+    ASSERT_EQ(a->player_location.world_space1,
+              b->player_location.world_space1);
+}
 
-        eprintf("Unequal file lengths.\n"
-                "Dump file: %s\n"
-                "Original file: %s\n",
-                dump_filename, sample_filename);
+static void check_threaded_reads(const char *sample_filename)
+{
+    static const unsigned flag_sets[] = {
+        0,
+        SAVEFILE_VIEW_CHANGE_FORMS | SAVEFILE_VIEW_GLOBAL_DATA,
+        SAVEFILE_KEEP_COMPRESSED_BODY,
+        SAVEFILE_ARENA,
+    };
+    struct savegame *serial;
+    struct savegame *save;
 
-        dump_to_file(dump_filename, rewritten_file, rewritten_file_size, 0);
+    serial = cengine_savefile_read(&test_ctx, sample_filename, NULL);
+    ASSERT_NOT_NULL(serial);
+
+    for (size_t i = 0; i < ARRAY_LEN(flag_sets); ++i) {
+        /* More threads than tasks are fine too. */
+        for (unsigned threads = 2; threads <= 1024; threads *= 8) {
+            struct savefile_read_options options = {
+                .flags = flag_sets[i],
+                .threads = threads,
+            };
+
+            save = cengine_savefile_read(&test_ctx, sample_filename,
+                                         &options);
+            ASSERT_NOT_NULL(save);
+            ASSERT_EQ(save->priv->sections, SAVEFILE_ALL_SECTIONS);
+            assert_same_blocks(save, serial);
+            assert_writes_back_identically(save, sample_filename);
+            savegame_free(save);
+        }
     }
 
-    ASSERT_EQ_MEM(sample_file, sample_file_size, rewritten_file,
-                  rewritten_file_size);
-
-    munmap(sample_file, sample_file_size);
-    free(rewritten_file);
-    savegame_free(save);
+    savegame_free(serial);
 }
 
-UNIT_TEST(read_and_write_sample_files_back_identically)
+UNIT_TEST(threaded_reads_match_serial_reads)
 {
-    debug_log_file = stderr;
-    for_each_sample_file(check_writer_produces_identical_file);
+    for_each_sample_file(check_threaded_reads);
 }
 
 #endif /* defined(COMPILE_WITH_UNIT_TESTS) */
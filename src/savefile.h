@@ -18,9 +18,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #ifndef CEGSE_CENGINE_SAVEFILE_H
 #define CEGSE_CENGINE_SAVEFILE_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
 
-struct chunk;
+#include "change_form_query.h"
+#include "compression.h"
+
+struct cegse_ctx;
 
 typedef uint32_t ref_t;
 
@@ -100,8 +105,12 @@ struct weather {
      *     ...
      *     uint32 (the very last one, always = 0x1)
      * }
+     *
+     * data4.size is 0 if there is no data4. When read with
+     * SAVEFILE_VIEW_GLOBAL_DATA, data4 may point into the save data. Change
+     * it only with savegame_replace_weather_data4().
      */
-    struct chunk *data4;
+    struct cregion data4;
 };
 
 struct player_location {
@@ -139,6 +148,167 @@ struct global_variable {
     float value;
 };
 
+struct change_form {
+    ref_t form_id;
+    uint32_t flags;
+
+    /*
+     * The lower six bits are the form type. The upper two bits tell how
+     * wide the lengths are in the file.
+     */
+    uint32_t type;
+    uint32_t version;
+    uint32_t length1; /* Length of data */
+    uint32_t length2; /* Non-zero value means data is compressed */
+    unsigned char *data;
+};
+
+/*
+ * Form types of change forms, the lower six bits of change_form.type. Use
+ * them with CHANGE_FORM_TYPE() in a change_form_query.
+ */
+enum change_form_type {
+    CHANGE_REFR,
+    CHANGE_ACHR,
+    CHANGE_PMIS,
+    CHANGE_PGRE,
+    CHANGE_PBEA,
+    CHANGE_PFLA,
+    CHANGE_CELL,
+    CHANGE_INFO,
+    CHANGE_QUST,
+    CHANGE_NPC_,
+    CHANGE_ACTI,
+    CHANGE_TACT,
+    CHANGE_ARMO,
+    CHANGE_BOOK,
+    CHANGE_CONT,
+    CHANGE_DOOR,
+    CHANGE_INGR,
+    CHANGE_LIGH,
+    CHANGE_MISC,
+    CHANGE_APPA,
+    CHANGE_STAT,
+    CHANGE_MSTT,
+    CHANGE_FURN,
+    CHANGE_WEAP,
+    CHANGE_AMMO,
+    CHANGE_KEYM,
+    CHANGE_ALCH,
+    CHANGE_IDLM,
+    CHANGE_NOTE,
+    CHANGE_ECZN,
+    CHANGE_CLAS,
+    CHANGE_FACT,
+    CHANGE_PACK,
+    CHANGE_NAVM,
+    CHANGE_WOOP,
+    CHANGE_MGEF,
+    CHANGE_SMQN,
+    CHANGE_SCEN,
+    CHANGE_LCTN,
+    CHANGE_RELA,
+    CHANGE_PHZD,
+    CHANGE_PBAR,
+    CHANGE_PCON,
+    CHANGE_FLST,
+    CHANGE_LVLN,
+    CHANGE_LVLI,
+    CHANGE_LVSP,
+    CHANGE_PARW,
+    CHANGE_ENCH
+};
+
+/*
+ * Bits of change_form.flags. What a bit means depends on the form type, so
+ * the names of different form types share values.
+ */
+enum change_flags {
+    CHANGE_FORM_FLAGS = 0x00000001,
+    CHANGE_CLASS_TAG_SKILLS = 0x00000002,
+    CHANGE_FACTION_FLAGS = 0x00000002,
+    CHANGE_FACTION_REACTIONS = 0x00000004,
+    CHANGE_FACTION_CRIME_COUNTS = 0x80000000,
+    CHANGE_TALKING_ACTIVATOR_SPEAKER = 0x00800000,
+    CHANGE_BOOK_TEACHES = 0x00000020,
+    CHANGE_BOOK_READ = 0x00000040,
+    CHANGE_DOOR_EXTRA_TELEPORT = 0x00020000,
+    CHANGE_INGREDIENT_USE = 0x80000000,
+    CHANGE_ACTOR_BASE_DATA = 0x00000002,
+    CHANGE_ACTOR_BASE_ATTRIBUTES = 0x00000004,
+    CHANGE_ACTOR_BASE_AIDATA = 0x00000008,
+    CHANGE_ACTOR_BASE_SPELLLIST = 0x00000010,
+    CHANGE_ACTOR_BASE_FULLNAME = 0x00000020,
+    CHANGE_ACTOR_BASE_FACTIONS = 0x00000040,
+    CHANGE_NPC_SKILLS = 0x00000200,
+    CHANGE_NPC_CLASS = 0x00000400,
+    CHANGE_NPC_FACE = 0x00000800,
+    CHANGE_NPC_DEFAULT_OUTFIT = 0x00001000,
+    CHANGE_NPC_SLEEP_OUTFIT = 0x00002000,
+    CHANGE_NPC_GENDER = 0x01000000,
+    CHANGE_NPC_RACE = 0x02000000,
+    CHANGE_LEVELED_LIST_ADDED_OBJECT = 0x80000000,
+    CHANGE_NOTE_READ = 0x80000000,
+    CHANGE_CELL_FLAGS = 0x00000002,
+    CHANGE_CELL_FULLNAME = 0x00000004,
+    CHANGE_CELL_OWNERSHIP = 0x00000008,
+    CHANGE_CELL_EXTERIOR_SHORT = 0x10000000,
+    CHANGE_CELL_EXTERIOR_CHAR = 0x20000000,
+    CHANGE_CELL_DETACHTIME = 0x40000000,
+    CHANGE_CELL_SEENDATA = 0x80000000,
+    CHANGE_REFR_MOVE = 0x00000002,
+    CHANGE_REFR_HAVOK_MOVE = 0x00000004,
+    CHANGE_REFR_CELL_CHANGED = 0x00000008,
+    CHANGE_REFR_SCALE = 0x00000010,
+    CHANGE_REFR_INVENTORY = 0x00000020,
+    CHANGE_REFR_EXTRA_OWNERSHIP = 0x00000040,
+    CHANGE_REFR_BASEOBJECT = 0x00000080,
+    CHANGE_REFR_PROMOTED = 0x02000000,
+    CHANGE_REFR_EXTRA_ACTIVATING_CHILDREN = 0x04000000,
+    CHANGE_REFR_LEVELED_INVENTORY = 0x08000000,
+    CHANGE_REFR_ANIMATION = 0x10000000,
+    CHANGE_REFR_EXTRA_ENCOUNTER_ZONE = 0x20000000,
+    CHANGE_REFR_EXTRA_CREATED_ONLY = 0x40000000,
+    CHANGE_REFR_EXTRA_GAME_ONLY = 0x80000000,
+    CHANGE_ACTOR_LIFESTATE = 0x00000400,
+    CHANGE_ACTOR_EXTRA_PACKAGE_DATA = 0x00000800,
+    CHANGE_ACTOR_EXTRA_MERCHANT_CONTAINER = 0x00001000,
+    CHANGE_ACTOR_EXTRA_DISMEMBERED_LIMBS = 0x00020000,
+    CHANGE_ACTOR_LEVELED_ACTOR = 0x00040000,
+    CHANGE_ACTOR_DISPOSITION_MODIFIERS = 0x00080000,
+    CHANGE_ACTOR_TEMP_MODIFIERS = 0x00100000,
+    CHANGE_ACTOR_DAMAGE_MODIFIERS = 0x00200000,
+    CHANGE_ACTOR_OVERRIDE_MODIFIERS = 0x00400000,
+    CHANGE_ACTOR_PERMANENT_MODIFIERS = 0x00800000,
+    CHANGE_OBJECT_EXTRA_ITEM_DATA = 0x00000400,
+    CHANGE_OBJECT_EXTRA_AMMO = 0x00000800,
+    CHANGE_OBJECT_EXTRA_LOCK = 0x00001000,
+    CHANGE_OBJECT_EMPTY = 0x00200000,
+    CHANGE_OBJECT_OPEN_DEFAULT_STATE = 0x00400000,
+    CHANGE_OBJECT_OPEN_STATE = 0x00800000,
+    CHANGE_TOPIC_SAIDONCE = 0x80000000,
+    CHANGE_QUEST_FLAGS = 0x00000002,
+    CHANGE_QUEST_SCRIPT_DELAY = 0x00000004,
+    CHANGE_QUEST_ALREADY_RUN = 0x04000000,
+    CHANGE_QUEST_INSTANCES = 0x08000000,
+    CHANGE_QUEST_RUNDATA = 0x10000000,
+    CHANGE_QUEST_OBJECTIVES = 0x20000000,
+    CHANGE_QUEST_SCRIPT = 0x40000000,
+    CHANGE_QUEST_STAGES = 0x80000000,
+    CHANGE_PACKAGE_WAITING = 0x40000000,
+    CHANGE_PACKAGE_NEVER_RUN = 0x80000000,
+    CHANGE_FORM_LIST_ADDED_FORM = 0x80000000,
+    CHANGE_ENCOUNTER_ZONE_FLAGS = 0x00000002,
+    CHANGE_ENCOUNTER_ZONE_GAME_DATA = 0x80000000,
+    CHANGE_LOCATION_KEYWORDDATA = 0x40000000,
+    CHANGE_LOCATION_CLEARED = 0x80000000,
+    CHANGE_QUEST_NODE_TIME_RUN = 0x80000000,
+    CHANGE_RELATIONSHIP_DATA = 0x00000002,
+    CHANGE_SCENE_ACTIVE = 0x80000000,
+    CHANGE_BASE_OBJECT_VALUE = 0x00000002,
+    CHANGE_BASE_OBJECT_FULLNAME = 0x00000004
+};
+
 struct psavegame;
 struct savegame {
     enum game game;
@@ -197,14 +367,418 @@ struct savegame {
     struct psavegame *priv;
 };
 
+/*
+ * Sections of a save file, in the order of enum object_type for the file
+ * header, the plugin information and global data.
+ */
+enum savefile_section {
+    SECTION_FILE_HEADER,
+    SECTION_PLUGIN_INFO,
+    SECTION_GLDA_MISC_STATS,
+    SECTION_GLDA_PLAYER_LOCATION,
+    SECTION_GLDA_GAME,
+    SECTION_GLDA_GLOBAL_VARIABLES,
+    SECTION_GLDA_CREATED_OBJECTS,
+    SECTION_GLDA_EFFECTS,
+    SECTION_GLDA_WEATHER,
+    SECTION_GLDA_AUDIO,
+    SECTION_GLDA_SKY_CELLS,
+    SECTION_GLDA_9,
+    SECTION_GLDA_10,
+    SECTION_GLDA_11,
+    SECTION_GLDA_PROCESS_LISTS,
+    SECTION_GLDA_COMBAT,
+    SECTION_GLDA_INTERFACE,
+    SECTION_GLDA_ACTOR_CAUSES,
+    SECTION_GLDA_104,
+    SECTION_GLDA_DETECTION_MANAGER,
+    SECTION_GLDA_LOCATION_METADATA,
+    SECTION_GLDA_QUEST_STATIC_DATA,
+    SECTION_GLDA_STORYTELLER,
+    SECTION_GLDA_MAGIC_FAVORITES,
+    SECTION_GLDA_PLAYER_CONTROLS,
+    SECTION_GLDA_STORY_EVENT_MANAGER,
+    SECTION_GLDA_INGREDIENT_SHARED,
+    SECTION_GLDA_MENU_CONTROLS,
+    SECTION_GLDA_MENU_TOPIC_MANAGER,
+    SECTION_GLDA_115,
+    SECTION_GLDA_116,
+    SECTION_GLDA_117,
+    SECTION_GLDA_TEMP_EFFECTS,
+    SECTION_GLDA_PAPYRUS,
+    SECTION_GLDA_ANIM_OBJECTS,
+    SECTION_GLDA_TIMER,
+    SECTION_GLDA_SYNCHRONISED_ANIMS,
+    SECTION_GLDA_MAIN,
+    SECTION_GLDA_1006,
+    SECTION_GLDA_1007,
+    SECTION_CHANGE_FORMS,
+    SECTION_FORM_IDS,
+    SECTION_WORLD_SPACES,
+    SECTION_UNKNOWN3,
+    SECTION_SNAPSHOT,
+    SECTION_COUNT
+};
+
+#define SAVEFILE_SECTION(section) ((uint64_t)1 << (section))
+#define SAVEFILE_ALL_SECTIONS     (SAVEFILE_SECTION(SECTION_COUNT) - 1)
+
+/* Flags for struct savefile_read_options. */
+enum savefile_read_flags {
+    /*
+     * Let change form data point into the save data instead of copying
+     * every change form separately. The savegame keeps the decompressed
+     * save data, or the mapped file if the save is not compressed,
+     * until it is freed.
+     *
+     * The mapped file is read-only. Call savegame_change_form_own_data()
+     * on a change form before modifying its data.
+     */
+    SAVEFILE_VIEW_CHANGE_FORMS = 1 << 0,
+
+    /*
+     * Allocate everything read from the file from a few large blocks
+     * that savegame_free() releases at once. The caller must not free
+     * fields nor replace them with separately allocated memory.
+     */
+    SAVEFILE_ARENA = 1 << 1,
+
+    /*
+     * Keep a copy of the compressed save data. If the save data is
+     * unchanged when the savegame is written with default compression,
+     * the copy is written instead of compressing the save data again.
+     * Edits of the file header or the snapshot then cost no compression.
+     */
+    SAVEFILE_KEEP_COMPRESSED_BODY = 1 << 2,
+
+    /*
+     * Decompress the save data on another thread while it is being read
+     * instead of decompressing all of it before reading starts.
+     */
+    SAVEFILE_STREAM_BODY = 1 << 3,
+
+    /*
+     * Like SAVEFILE_VIEW_CHANGE_FORMS but for the global data that is not
+     * interpreted, the unknown data at the end of the save data and
+     * weather.data4. The save data is never written through the views, so
+     * replacing one copies nothing but the new data.
+     */
+    SAVEFILE_VIEW_GLOBAL_DATA = 1 << 4,
+};
+
+struct savefile_read_options {
+    unsigned flags; /* Bitwise OR of enum savefile_read_flags. */
+
+    /*
+     * Bitwise OR of SAVEFILE_SECTION() of the sections to load, or 0 to
+     * load every section. Other sections are skipped without being
+     * deserialized or copied, and reading stops after the last wanted
+     * section. The file header is always loaded. A savegame that is
+     * missing sections cannot be written.
+     */
+    uint64_t sections;
+
+    /*
+     * If greater than 1, the blocks of the save data are indexed first and
+     * the global data and the change forms are then read on this many
+     * threads. The logger and the allocator of the context are called on
+     * all of them. Savegames in an arena and streamed save data are read
+     * on the calling thread only.
+     */
+    unsigned threads;
+};
+
 /*
  * Deallocate save game memory.
  */
 void savegame_free(struct savegame *save);
 
+struct savefile_write_options {
+    /* Tuning of the compressor that the save file is compressed with. */
+    struct compress_options compression;
+};
+
+/*
+ * Write a save file. Pass NULL options to write with the default options
+ * of the context the savegame was read with.
+ */
 int cengine_savefile_write(const char *filename,
-                           const struct savegame *savegame);
+                           const struct savegame *savegame,
+                           const struct savefile_write_options *options);
+
+/*
+ * Write a save file to a new buffer of exactly the size of the file, which
+ * is stored to size. The buffer comes from the allocator of the context of
+ * the savegame. Return NULL on error.
+ */
+void *cengine_savefile_write_mem(const struct savegame *savegame,
+                                 const struct savefile_write_options *options,
+                                 size_t *size);
+
+/* Destination of a save file being written. */
+struct savefile_sink {
+    /*
+     * Write all size bytes of data. Return 0 on success and nonzero on
+     * error, which fails the write.
+     */
+    int (*write)(void *opaque, const void *data, size_t size);
+    void *opaque;
+};
+
+/*
+ * Write a save file to a sink or to a file descriptor, such as a socket or
+ * a pipe. The descriptor is not closed. Return 0 on success or -1 on error.
+ */
+int cengine_savefile_write_sink(const struct savefile_sink *sink,
+                                const struct savegame *savegame,
+                                const struct savefile_write_options *options);
+int cengine_savefile_write_fd(int fd, const struct savegame *savegame,
+                              const struct savefile_write_options *options);
+
+/*
+ * Return the offset of the snapshot in the file the savegame was read
+ * from, which holds snapshot_size bytes of snapshot data.
+ */
+size_t savegame_snapshot_offset(const struct savegame *save);
+
+/*
+ * Return the data of a global data section that is not interpreted, such
+ * as SECTION_GLDA_PAPYRUS. The data is NULL if the section is interpreted
+ * or was not loaded. Valid until the section is replaced or the savegame
+ * is freed.
+ */
+struct cregion savegame_global_data(const struct savegame *save,
+                                    enum savefile_section section);
+
+/*
+ * Replace the data of a global data section that is not interpreted with a
+ * copy of size bytes of data. Return 0 on success or -1 if the section is
+ * interpreted, was not loaded or if out of memory.
+ */
+int savegame_replace_global_data(struct savegame *save,
+                                 enum savefile_section section,
+                                 const void *data, size_t size);
 
-struct savegame *cengine_savefile_read(const char *filename);
+/*
+ * Replace weather.data4 with a copy of size bytes of data. Return 0 on
+ * success or -1 if the weather was not loaded or if out of memory.
+ */
+int savegame_replace_weather_data4(struct savegame *save, const void *data,
+                                   size_t size);
+
+/*
+ * Find the first change form with the form ID, or with both the form ID and
+ * the form type (the lower six bits of change_form.type). Return NULL if
+ * there is none. The first lookup builds an index of the change forms.
+ */
+struct change_form *savegame_find_change_form(struct savegame *save,
+                                              ref_t form_id);
+struct change_form *savegame_find_change_form_of_type(struct savegame *save,
+                                                      uint32_t type,
+                                                      ref_t form_id);
+
+/*
+ * Give a change form its own copy of its data if the data points into the
+ * save data that the savegame keeps (see SAVEFILE_VIEW_CHANGE_FORMS), so
+ * that the data can be modified. Return 0 on success or -1 if out of
+ * memory.
+ */
+int savegame_change_form_own_data(struct savegame *save,
+                                  struct change_form *cf);
+
+/*
+ * Change form metadata as parallel arrays. Row i describes the change form
+ * at index i. type holds only the form type, without the length bits.
+ */
+struct change_form_columns {
+    uint32_t count;
+    const ref_t *form_id;
+    const uint32_t *flags;
+    const uint8_t *type;
+    const uint32_t *version;
+    const uint32_t *length1;
+    const uint32_t *length2;
+};
+
+/*
+ * Return the change form metadata as columns, built on first use, or NULL
+ * if out of memory. Valid until the change forms are modified.
+ */
+const struct change_form_columns *
+savegame_change_form_columns(struct savegame *save);
+
+/*
+ * Return the change form at index, or NULL if there is none.
+ */
+struct change_form *savegame_change_form(struct savegame *save,
+                                         uint32_t index);
+
+/*
+ * Store to indices the indices of the change forms of the form type, or
+ * with all bits of flags set, in file order. indices must have room for
+ * every change form. Return the number of indices stored or -1 if out of
+ * memory.
+ */
+ssize_t savegame_change_forms_of_type(struct savegame *save, unsigned type,
+                                      uint32_t *indices);
+ssize_t savegame_change_forms_with_flags(struct savegame *save,
+                                         uint32_t flags, uint32_t *indices);
+
+/*
+ * Keep the first count indices of change forms that have all bits of flags
+ * set and drop the rest, e.g. to narrow down change forms of a type.
+ * Return the number of indices kept, or -1 if an index is not of a change
+ * form or if out of memory. On failure the indices are left unchanged.
+ */
+ssize_t savegame_keep_change_forms_with_flags(struct savegame *save,
+                                              uint32_t flags,
+                                              uint32_t *indices, size_t count);
+
+/*
+ * Evaluate a query on the change forms. Either set bit i % 64 of
+ * bitmap[i / 64] for each matching change form i, or store the indices of
+ * the matching change forms in file order. The bitmap must have room for
+ * a bit and indices for an index of every change form. Return the number
+ * of matches or -1 if out of memory.
+ */
+ssize_t savegame_query_change_forms(struct savegame *save,
+                                    const struct change_form_query *query,
+                                    uint64_t *bitmap);
+ssize_t savegame_query_change_form_indices(
+    struct savegame *save, const struct change_form_query *query,
+    uint32_t *indices);
+
+/*
+ * Count the change forms of each form type. Return -1 if out of memory.
+ */
+int savegame_count_change_form_types(struct savegame *save,
+                                     uint32_t counts[64]);
+
+/*
+ * Tell that the metadata of change forms was modified, so that the index
+ * and the columns are rebuilt on the next use.
+ */
+void savegame_change_forms_changed(struct savegame *save);
+
+/*
+ * Read a save file. Pass a NULL context to use the default context (see
+ * context.h) and NULL options to read with the default options of the
+ * context.
+ */
+struct savegame *cengine_savefile_read(
+    const struct cegse_ctx *ctx, const char *filename,
+    const struct savefile_read_options *options);
+
+/*
+ * Read a save file from size bytes of memory. If change forms or global
+ * data are viewed, they may point into data, which must then stay valid
+ * and unchanged until the savegame is freed.
+ */
+struct savegame *cengine_savefile_read_mem(
+    const struct cegse_ctx *ctx, const void *data, size_t size,
+    const struct savefile_read_options *options);
+
+/*
+ * Read a save file from a file descriptor, which is read from its current
+ * offset to the end but not closed. Regular files are mapped, anything
+ * else such as a pipe or a socket is read to a buffer.
+ */
+struct savegame *cengine_savefile_read_fd(
+    const struct cegse_ctx *ctx, int fd,
+    const struct savefile_read_options *options);
+
+/*
+ * Write a sidecar of a save file: a file that holds the decompressed save
+ * data and an index of its global data blocks and change forms. Return 0
+ * on success or -1 on error.
+ */
+int cengine_savefile_write_sidecar(const struct cegse_ctx *ctx,
+                                   const char *filename,
+                                   const char *sidecar_filename);
+
+/*
+ * Read a save file from its sidecar, which is first written if it is
+ * missing or if the size or the modification time of the save file has
+ * changed since. The sidecar is mapped, and nothing is decompressed and no
+ * blocks are walked: the change forms are set up from the index and only
+ * the global data is deserialized, straight from where the index says it
+ * is. Viewed change forms and global data point into the sidecar. If the
+ * sidecar cannot be written, the save file is read as by
+ * cengine_savefile_read().
+ */
+struct savegame *cengine_savefile_read_sidecar(
+    const struct cegse_ctx *ctx, const char *filename,
+    const char *sidecar_filename, const struct savefile_read_options *options);
+
+/*
+ * A global data block or a change form in the save data. offset and size
+ * locate the data of the block, without its header, from the start of the
+ * save data. The rest is from the header: type is the global data type or
+ * the change form type with the length bits. Only change forms have
+ * uncompressed_size, form_id, flags and version.
+ */
+struct savefile_block {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t uncompressed_size;
+    uint32_t type;
+    ref_t form_id;
+    uint32_t flags;
+    uint32_t version;
+};
+
+/*
+ * The blocks of the save data in file order: global data tables 1 and 2,
+ * the change forms and global data table 3. end_offset is where the form
+ * IDs that follow the blocks start.
+ */
+struct savefile_block_index {
+    uint32_t num_globals12;
+    uint32_t num_change_forms;
+    uint32_t num_globals3;
+    uint32_t end_offset;
+    struct savefile_block *blocks;
+};
+
+struct savefile_scan {
+    const unsigned char *body; /* Decompressed save data */
+    size_t body_size;
+    size_t prefix_size; /* Bytes of the file before the save data */
+    bool compressed;    /* True if the save data was compressed */
+    struct savefile_block_index index;
+
+    /* Private */
+    const struct cegse_ctx *ctx;
+    void *buffer;
+};
+
+/*
+ * Scan size bytes of save file at data into an index of its blocks. The
+ * save data is decompressed if need be, and the blocks are only walked:
+ * nothing is deserialized and nothing is allocated per block. The save
+ * data of an uncompressed file points into data, which must stay valid
+ * while the scan is used. Return 0 on success or -1 on error. Free the
+ * scan with savefile_scan_free().
+ */
+int cengine_savefile_scan(const struct cegse_ctx *ctx, const void *data,
+                          size_t size, struct savefile_scan *scan);
+void savefile_scan_free(struct savefile_scan *scan);
+
+/*
+ * Read only the file header of a save file and, if with_plugins is true,
+ * the plugin lists. Nothing else is read and only as much of the save data
+ * is decompressed as the plugin lists need. The savegame cannot be written.
+ */
+struct savegame *cengine_savefile_read_header(const struct cegse_ctx *ctx,
+                                              const char *filename,
+                                              bool with_plugins);
+
+/*
+ * Like cengine_savefile_read_header() but read from size bytes of memory,
+ * which need to stay valid only during the call.
+ */
+struct savegame *cengine_savefile_read_header_mem(const struct cegse_ctx *ctx,
+                                                  const void *data, size_t size,
+                                                  bool with_plugins);
 
 #endif /* CEGSE_CENGINE_SAVEFILE_H */